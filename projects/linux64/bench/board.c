@@ -0,0 +1,8 @@
+#include <canopus/types.h>
+#include <canopus/subsystem/subsystem.h>
+
+bool
+board_enabled_subsystem_id(ss_id_e id)
+{
+	return true;
+}
@@ -0,0 +1,222 @@
+#include "algebra_fixed.h"
+
+#include <math.h>
+
+/* Block floating point algebra, an accuracy experiment. Bench only: the
+ * flight controllers run on algebra.c.
+ *
+ * This is not a Q format controller: state stays in float between calls.
+ * Each call converts every vector or matrix operand to int32_t with a block
+ * exponent of its own, picked so its largest component takes ALGEBRA_Q_BITS
+ * bits, accumulates products in int64_t and converts the result back to
+ * float. It tells whether the controllers still work with 30 bit mantissas
+ * and integer arithmetic (see bench_algebra.c), it doesn't make them
+ * faster: the conversions cost more than the float operations they wrap.
+ * A single Q format wouldn't fit anyway: B x w is ~1e5 mG*dps while
+ * epsilon^2*kp in lovera_prefeedback() is ~1e-8.
+ *
+ * Components that don't fit in ALGEBRA_Q_MIN (inf, NaN, or above 2^61)
+ * saturate to +-2^ALGEBRA_Q_BITS, or 0 for NaN, and are counted in
+ * algebra_fixed_saturations. Those below 2^-ALGEBRA_Q_MAX flush to 0.
+ */
+#define ALGEBRA_Q_BITS  30      /* one bit left for sums */
+#define ALGEBRA_Q_MIN   (-31)
+#define ALGEBRA_Q_MAX   62
+#define ALGEBRA_Q_SAT   ((int32_t)1 << ALGEBRA_Q_BITS)
+
+uint32_t algebra_fixed_saturations = 0;
+
+/* fractional bits for the block of n values at x */
+static int q_format(const float *x, int n)
+{
+    float max = 0, a;
+    int i, e, q;
+
+    for (i=0;i<n;i++) {
+        a = fabsf(x[i]);
+        if (a > max) max = a;
+    }
+    if (0 == max) return ALGEBRA_Q_MAX;
+    if (isinf(max)) return ALGEBRA_Q_MIN;
+
+    (void)frexpf(max, &e);  /* max = m * 2^e, .5 <= m < 1 */
+    q = ALGEBRA_Q_BITS - e;
+    if (q < ALGEBRA_Q_MIN) q = ALGEBRA_Q_MIN;
+    if (q > ALGEBRA_Q_MAX) q = ALGEBRA_Q_MAX;
+    return q;
+}
+
+/* 2^q, once per block rather than an ldexpf() per value */
+static float q_scale(int q)
+{
+    return ldexpf(1.f, q);
+}
+
+static int32_t q_from_float(float x, float scale)
+{
+    float y;
+
+    if (isnan(x)) {
+        algebra_fixed_saturations++;
+        return 0;
+    }
+    y = x * scale;
+    if (y > ALGEBRA_Q_SAT) {
+        algebra_fixed_saturations++;
+        return ALGEBRA_Q_SAT;
+    }
+    if (y < -ALGEBRA_Q_SAT) {
+        algebra_fixed_saturations++;
+        return -ALGEBRA_Q_SAT;
+    }
+    return (int32_t)(y >= 0 ? y + .5f : y - .5f);
+}
+
+static void vq_from_float(int32_t *r, const float *x, int n, int q)
+{
+    float scale = q_scale(q);
+    int i;
+    for(i=0;i<n;i++) r[i] = q_from_float(x[i], scale);
+}
+
+/* floor(sqrt(x)), for x < 2^62 */
+static uint32_t isqrt64(uint64_t x)
+{
+    uint64_t r = 0, bit = (uint64_t)1 << 62;
+
+    while (bit > x) bit >>= 2;
+    while (bit) {
+        if (x >= r + bit) {
+            x -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)r;
+}
+
+static int64_t sqsum_q(const int32_t *v)
+{
+    return (int64_t)v[0]*v[0] + (int64_t)v[1]*v[1] + (int64_t)v[2]*v[2];
+}
+
+void smult_q(float s, vectorf_t v) {
+    int32_t sq, vq[3];
+    int qs, qv, i;
+    float out;
+
+    qs = q_format(&s, 1);
+    qv = q_format(v, 3);
+    vq_from_float(&sq, &s, 1, qs);
+    vq_from_float(vq, v, 3, qv);
+
+    out = q_scale(-(qv + qs));
+    for(i=0;i<3;i++) v[i] = (float)((int64_t)vq[i] * sq) * out;
+}
+
+void vsubst_q(vectorf_t l, const vectorf_t r) {
+    float both[6] = {l[0], l[1], l[2], r[0], r[1], r[2]};
+    int32_t lq[3], rq[3];
+    int q, i;
+    float out;
+
+    /* one format for both, less a bit so the difference fits */
+    q = q_format(both, 6) - 1;
+    vq_from_float(lq, l, 3, q);
+    vq_from_float(rq, r, 3, q);
+
+    out = q_scale(-q);
+    for(i=0;i<3;i++) l[i] = (float)(lq[i] - rq[i]) * out;
+}
+
+void deadzone_q(vectorf_t v, float deadzone_limit) {
+    float both[4] = {v[0], v[1], v[2], deadzone_limit};
+    int32_t vq[4];
+    int q, i;
+    float out;
+
+    q = q_format(both, 4);
+    vq_from_float(vq, both, 4, q);
+
+    out = q_scale(-q);
+    for(i=0;i<3;i++)
+        v[i] = (vq[i] > vq[3] || vq[i] < -vq[3]) ? (float)vq[i] * out : 0.;
+}
+
+void applym_q(const matrixf_t m, vectorf_t v) {
+    int32_t mq[3][3], vq[3];
+    int qm, qv, i;
+    float out;
+
+    qm = q_format(&m[0][0], 9);
+    qv = q_format(v, 3);
+    vq_from_float(&mq[0][0], &m[0][0], 9, qm);
+    vq_from_float(vq, v, 3, qv);
+
+    out = q_scale(-(qv + qm));
+    for(i=0;i<3;i++) {
+        v[i] = (float)((int64_t)vq[0]*mq[i][0] + (int64_t)vq[1]*mq[i][1] + (int64_t)vq[2]*mq[i][2]) * out;
+    }
+}
+
+void mprod_q(matrixf_t a, matrixf_t b, matrixf_t res)
+{
+	int32_t aq[3][3], bq[3][3];
+	int qa, qb, j, k, l;
+	int64_t sum;
+	float out;
+
+	qa = q_format(&a[0][0], 9);
+	qb = q_format(&b[0][0], 9);
+	vq_from_float(&aq[0][0], &a[0][0], 9, qa);
+	vq_from_float(&bq[0][0], &b[0][0], 9, qb);
+
+	out = q_scale(-(qa + qb));
+	for (j = 0; j < 3; j++) for (k = 0; k < 3; k++)
+	{
+		sum = 0;
+		for (l = 0; l < 3; l++)
+		{
+			sum += (int64_t)aq[j][l] * bq[l][k];
+		}
+		res[j][k] = (float)sum * out;
+	}
+}
+
+void cross_q(vectorf_t res, const vectorf_t a, const vectorf_t b) {
+    int32_t aq[3], bq[3];
+    int qa, qb;
+    float out;
+
+    qa = q_format(a, 3);
+    qb = q_format(b, 3);
+    vq_from_float(aq, a, 3, qa);
+    vq_from_float(bq, b, 3, qb);
+
+    out = q_scale(-(qa + qb));
+    res[0] = (float)((int64_t)aq[1]*bq[2] - (int64_t)aq[2]*bq[1]) * out;
+    res[1] = (float)(-((int64_t)aq[0]*bq[2] - (int64_t)aq[2]*bq[0])) * out;
+    res[2] = (float)((int64_t)aq[0]*bq[1] - (int64_t)aq[1]*bq[0]) * out;
+}
+
+float norm_q(const vectorf_t v) {
+    int32_t vq[3];
+    int q;
+
+    q = q_format(v, 3);
+    vq_from_float(vq, v, 3, q);
+
+    return (float)isqrt64(sqsum_q(vq)) * q_scale(-q);
+}
+
+float sqnorm_q(const vectorf_t v) {
+    int32_t vq[3];
+    int q;
+
+    q = q_format(v, 3);
+    vq_from_float(vq, v, 3, q);
+
+    return (float)sqsum_q(vq) * q_scale(-2 * q);
+}
@@ -0,0 +1,28 @@
+#ifndef _BENCH_ALGEBRA_FIXED_H_
+#define _BENCH_ALGEBRA_FIXED_H_
+
+#include <canopus/types.h>
+#include <canopus/subsystem/aocs/algebra.h>
+
+/* Block floating point versions of the algebra.c primitives, and of the
+ * controllers built on them. Bench only, see algebra_fixed.c.
+ */
+
+extern uint32_t algebra_fixed_saturations;
+
+void smult_q(float, vectorf_t);
+void vsubst_q(vectorf_t, const vectorf_t);
+void deadzone_q(vectorf_t, float);
+void applym_q(const matrixf_t, vectorf_t);
+void mprod_q(matrixf_t, matrixf_t, matrixf_t);
+void cross_q(vectorf_t, const vectorf_t, const vectorf_t);
+float norm_q(const vectorf_t);
+float sqnorm_q(const vectorf_t);
+
+/* detumbling.c and pointing_lovera_prefeed.c on the functions above */
+void Bxw_mtq_dipole_q(const vectorf_t B, const vectorf_t W, vectorf_t);
+retval_t lovera_mtq_dipole_q(const vectorf_t q, const vectorf_t w, const vectorf_t b, vectorf_t dipole);
+retval_t rotmat2quat_q(matrixf_t mat, vectorf_t quatv, float *quats);
+retval_t triad_q(const vectorf_t W_1, const vectorf_t W_2, const vectorf_t V_1, const vectorf_t V_2, matrixf_t A);
+
+#endif /* _BENCH_ALGEBRA_FIXED_H_ */
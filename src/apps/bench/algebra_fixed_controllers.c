@@ -0,0 +1,28 @@
+#include "algebra_fixed.h"
+
+/* The flight controllers, built a second time on the block floating point
+ * primitives, so the bench compares the very same code on both. Everything
+ * they define gets a _q name too, so they link next to the originals.
+ */
+#define smult							smult_q
+#define vsubst							vsubst_q
+#define deadzone						deadzone_q
+#define applym							applym_q
+#define mprod							mprod_q
+#define cross							cross_q
+#define norm							norm_q
+#define sqnorm							sqnorm_q
+
+#define Bxw_mtq_dipole					Bxw_mtq_dipole_q
+#define MTQ_DIPOLE_MAX_ALLOWED			MTQ_DIPOLE_MAX_ALLOWED_q
+#define MTQ_DIPOLE_SURVIVAL_PERCENT		MTQ_DIPOLE_SURVIVAL_PERCENT_q
+#define preliminary_feedback			preliminary_feedback_q
+#define lovera_prefeedback				lovera_prefeedback_q
+#define lovera_mtq_dipole				lovera_mtq_dipole_q
+#define triad							triad_q
+#define rotmat2quat						rotmat2quat_q
+#define SIGN							SIGN_q
+#define NORM							NORM_q
+
+#include "../../lib/canopus/subsystem/aocs/detumbling.c"
+#include "../../lib/canopus/subsystem/aocs/pointing_lovera_prefeed.c"
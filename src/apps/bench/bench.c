@@ -0,0 +1,32 @@
+#include "bench.h"
+
+#include <time.h>
+
+static const struct {
+	const char *name;
+	bench_t *run;
+} benchmarks[] = {
+	{ "frame codec", &bench_frame_codec },
+	{ "md5", &bench_md5 },
+	{ "aocs algebra", &bench_algebra },
+};
+
+uint64_t bench_now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Run as ./projects/linux64/bench/Release/bench_linux64, the exit code is
+ * the number of failed checks */
+int app_main(void) {
+	int i, failures = 0;
+
+	for (i = 0; i < ARRAY_COUNT(benchmarks); i++) {
+		printf("%s:\n", benchmarks[i].name);
+		failures += benchmarks[i].run();
+	}
+	printf("%d failed checks\n", failures);
+	return failures;
+}
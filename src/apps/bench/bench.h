@@ -0,0 +1,31 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <canopus/types.h>
+
+#include <stdio.h>
+
+/* POSIX only microbenchmarks of library code. They run for seconds and
+ * time with clock_gettime(), so they don't belong in the TEST subsystem
+ * table, which also runs on the flight computer.
+ *
+ * Each benchmark checks that the code it times gives the right results,
+ * prints its numbers and returns the number of failed checks.
+ */
+
+typedef int bench_t(void);
+
+uint64_t bench_now_ns(void);
+
+#define BENCH_CHECK(__failures, __cond)	do {							\
+	if (!(__cond)) {													\
+		printf("  FAILED %s at %s:%d\n", #__cond, __FILE__, __LINE__);	\
+		(__failures)++;													\
+	}																	\
+} while (0)
+
+int bench_frame_codec(void);
+int bench_md5(void);
+int bench_algebra(void);
+
+#endif /* _BENCH_H_ */
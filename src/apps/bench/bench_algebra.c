@@ -0,0 +1,181 @@
+#include "bench.h"
+#include "algebra_fixed.h"
+
+#include <canopus/subsystem/aocs/algebra.h>
+#include <canopus/subsystem/aocs/detumbling.h>
+#include <canopus/subsystem/aocs/pointing.h>
+#include <canopus/nvram.h>
+
+#include <math.h>
+#include <string.h>
+
+#define ALGEBRA_BENCH_STEPS	20000
+
+/* Block floating point against float, for the controllers' inputs:
+ * B in mG from the IMU, w in dps, unit sun vectors.
+ */
+#define ALGEBRA_CHECK_STEPS	500
+#define DETUMBLING_EPS		1e-6	/* Am2, of MTQ_DIPOLE_MAX_ALLOWED */
+#define ATTITUDE_EPS		1e-5	/* rotation matrix */
+#define QUATERNION_EPS		1e-4	/* rotmat2quat() sqrt()s values near 0 */
+#define POINTING_REL_EPS	1e-5	/* of the dipole norm */
+
+extern const nvram_t nvram_default;
+
+static const vectorf_t Sb = { 0.267261f, 0.534522f, 0.801784f };
+static const vectorf_t Si = { 0.707107f, 0.f, 0.707107f };
+static const vectorf_t Bb = { 212.f, -347.f, 105.f };
+static const vectorf_t Bi = { -130.f, 220.f, 401.f };
+static const vectorf_t W  = { 1.5f, -0.75f, 2.25f };
+
+static uint32_t algebra_bench_seed;
+
+static float algebra_bench_rand(float range) {
+	algebra_bench_seed = algebra_bench_seed * 1103515245 + 12345;
+	return range * ((float)(algebra_bench_seed >> 8) / (1 << 23) - 1.f);
+}
+
+static void algebra_bench_vector(vectorf_t v, float range) {
+	v[0] = algebra_bench_rand(range);
+	v[1] = algebra_bench_rand(range);
+	v[2] = algebra_bench_rand(range);
+}
+
+static float algebra_bench_norm(const vectorf_t v) {
+	return sqrtf(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+}
+
+static void algebra_bench_unit(vectorf_t v) {
+	float n;
+
+	algebra_bench_vector(v, 1.f);
+	n = algebra_bench_norm(v);
+	v[0] /= n;
+	v[1] /= n;
+	v[2] /= n;
+}
+
+static float algebra_bench_max(float worst, float a, float b) {
+	float d = fabsf(a - b);
+	return d > worst ? d : worst;
+}
+
+typedef struct pointing_bench_out_t {
+	matrixf_t A;
+	vectorf_t Qv;
+	float Qs;
+	vectorf_t dipole;
+} pointing_bench_out_t;
+
+static void pointing_step(const vectorf_t sb, const vectorf_t si, const vectorf_t bb, const vectorf_t bi, const vectorf_t w, pointing_bench_out_t *out) {
+	triad(sb, si, bb, bi, out->A);
+	rotmat2quat(out->A, out->Qv, &out->Qs);
+	lovera_mtq_dipole(out->Qv, w, bb, out->dipole);
+}
+
+static void pointing_step_q(const vectorf_t sb, const vectorf_t si, const vectorf_t bb, const vectorf_t bi, const vectorf_t w, pointing_bench_out_t *out) {
+	triad_q(sb, si, bb, bi, out->A);
+	rotmat2quat_q(out->A, out->Qv, &out->Qs);
+	lovera_mtq_dipole_q(out->Qv, w, bb, out->dipole);
+}
+
+/* ns per detumbling (B x w) and pointing (triad, quaternion, lovera) step */
+static void algebra_bench_time(void) {
+	pointing_bench_out_t out;
+	vectorf_t dipole;
+	uint64_t start, detumbling_f, detumbling_q, pointing_f, pointing_q;
+	int step;
+
+	start = bench_now_ns();
+	for (step = 0; step < ALGEBRA_BENCH_STEPS; step++) Bxw_mtq_dipole(Bb, W, dipole);
+	detumbling_f = (bench_now_ns() - start) / ALGEBRA_BENCH_STEPS;
+
+	start = bench_now_ns();
+	for (step = 0; step < ALGEBRA_BENCH_STEPS; step++) Bxw_mtq_dipole_q(Bb, W, dipole);
+	detumbling_q = (bench_now_ns() - start) / ALGEBRA_BENCH_STEPS;
+
+	start = bench_now_ns();
+	for (step = 0; step < ALGEBRA_BENCH_STEPS; step++) pointing_step(Sb, Si, Bb, Bi, W, &out);
+	pointing_f = (bench_now_ns() - start) / ALGEBRA_BENCH_STEPS;
+
+	start = bench_now_ns();
+	for (step = 0; step < ALGEBRA_BENCH_STEPS; step++) pointing_step_q(Sb, Si, Bb, Bi, W, &out);
+	pointing_q = (bench_now_ns() - start) / ALGEBRA_BENCH_STEPS;
+
+	printf("  ns per step: detumbling %llu float, %llu fixed; pointing %llu float, %llu fixed\n",
+			(unsigned long long)detumbling_f, (unsigned long long)detumbling_q,
+			(unsigned long long)pointing_f, (unsigned long long)pointing_q);
+}
+
+static int algebra_bench_detumbling(void) {
+	vectorf_t B, Wr, dipole_f, dipole_q;
+	float worst = 0;
+	int failures = 0, step, i;
+
+	algebra_bench_seed = 1;
+	for (step = 0; step < ALGEBRA_CHECK_STEPS; step++) {
+		algebra_bench_vector(B, 600.f);
+		algebra_bench_vector(Wr, step % 2 ? 30.f : 1.f);
+
+		Bxw_mtq_dipole(B, Wr, dipole_f);
+		Bxw_mtq_dipole_q(B, Wr, dipole_q);
+
+		for (i = 0; i < 3; i++) worst = algebra_bench_max(worst, dipole_f[i], dipole_q[i]);
+	}
+	printf("  detumbling: worst dipole error %g Am2\n", worst);
+	BENCH_CHECK(failures, worst <= DETUMBLING_EPS);
+	return failures;
+}
+
+static int algebra_bench_pointing(void) {
+	vectorf_t sb, si, bb, bi, w, d;
+	pointing_bench_out_t f, q;
+	float attitude = 0, quaternion = 0, dipole = 0, rel;
+	int failures = 0, step, i, j;
+
+	algebra_bench_seed = 2;
+	for (step = 0; step < ALGEBRA_CHECK_STEPS; step++) {
+		algebra_bench_unit(sb);
+		algebra_bench_unit(si);
+		algebra_bench_vector(bb, 600.f);
+		algebra_bench_vector(bi, 600.f);
+		algebra_bench_vector(w, 5.f);
+
+		pointing_step(sb, si, bb, bi, w, &f);
+		pointing_step_q(sb, si, bb, bi, w, &q);
+
+		for (i = 0; i < 3; i++) {
+			for (j = 0; j < 3; j++) attitude = algebra_bench_max(attitude, f.A[i][j], q.A[i][j]);
+			quaternion = algebra_bench_max(quaternion, f.Qv[i], q.Qv[i]);
+		}
+		quaternion = algebra_bench_max(quaternion, f.Qs, q.Qs);
+
+		for (i = 0; i < 3; i++) d[i] = f.dipole[i] - q.dipole[i];
+		rel = algebra_bench_norm(d) / algebra_bench_norm(f.dipole);
+		if (rel > dipole) dipole = rel;
+	}
+	printf("  pointing: worst attitude error %g, quaternion %g, dipole %g relative\n",
+			attitude, quaternion, dipole);
+	BENCH_CHECK(failures, attitude <= ATTITUDE_EPS);
+	BENCH_CHECK(failures, quaternion <= QUATERNION_EPS);
+	BENCH_CHECK(failures, dipole <= POINTING_REL_EPS);
+	return failures;
+}
+
+/* The flight controllers on algebra.c against the same controllers on the
+ * block floating point primitives in algebra_fixed.c: speed, and whether
+ * the results stay within float precision over random inputs */
+int bench_algebra(void) {
+	uint32_t saturations = algebra_fixed_saturations;
+	int failures = 0;
+
+	/* the controller gains, nothing loads them here */
+	memcpy(&nvram, &nvram_default, sizeof(nvram));
+
+	algebra_bench_time();
+	failures += algebra_bench_detumbling();
+	failures += algebra_bench_pointing();
+
+	BENCH_CHECK(failures, saturations == algebra_fixed_saturations);
+	return failures;
+}
@@ -0,0 +1,59 @@
+#include "bench.h"
+
+#include <canopus/frame.h>
+
+#include <string.h>
+
+#define CODEC_BENCH_VALUES	128
+#define CODEC_BENCH_ROUNDS	200000
+
+static void codec_bench_put_u16_bytewise(frame_t *frame, const uint16_t *data, size_t count) {
+	size_t i;
+
+	/* the way frame_put_u16() used to be */
+	for (i=0; i<count; i++) {
+		frame->buf[frame->position++] = data[i] >> 8;
+		frame->buf[frame->position++] = data[i];
+	}
+}
+
+/* ns per u16 put, bytewise, with frame_put_u16() and with frame_put_u16_array() */
+int bench_frame_codec(void) {
+	frame_t ref = DECLARE_FRAME_SPACE(CODEC_BENCH_VALUES * 2);
+	frame_t frame = DECLARE_FRAME_SPACE(CODEC_BENCH_VALUES * 2);
+	uint16_t data[CODEC_BENCH_VALUES];
+	uint64_t start, bytewise, single, array;
+	int i, round, failures = 0;
+
+	for (i=0; i<CODEC_BENCH_VALUES; i++) data[i] = i * 0x0101 + 0x1234;
+
+	start = bench_now_ns();
+	for (round=0; round<CODEC_BENCH_ROUNDS; round++) {
+		frame_reset(&ref);
+		codec_bench_put_u16_bytewise(&ref, data, CODEC_BENCH_VALUES);
+	}
+	bytewise = bench_now_ns() - start;
+
+	start = bench_now_ns();
+	for (round=0; round<CODEC_BENCH_ROUNDS; round++) {
+		frame_reset(&frame);
+		for (i=0; i<CODEC_BENCH_VALUES; i++) frame_put_u16(&frame, data[i]);
+	}
+	single = bench_now_ns() - start;
+	BENCH_CHECK(failures, 0 == memcmp(ref.buf, frame.buf, CODEC_BENCH_VALUES * 2));
+
+	start = bench_now_ns();
+	for (round=0; round<CODEC_BENCH_ROUNDS; round++) {
+		frame_reset(&frame);
+		frame_put_u16_array(&frame, data, CODEC_BENCH_VALUES);
+	}
+	array = bench_now_ns() - start;
+	BENCH_CHECK(failures, 0 == memcmp(ref.buf, frame.buf, CODEC_BENCH_VALUES * 2));
+
+	printf("  %d x %d u16, ns per value: bytewise %.2f, frame_put_u16 %.2f, frame_put_u16_array %.2f\n",
+			CODEC_BENCH_ROUNDS, CODEC_BENCH_VALUES,
+			(double)bytewise / (CODEC_BENCH_ROUNDS * CODEC_BENCH_VALUES),
+			(double)single / (CODEC_BENCH_ROUNDS * CODEC_BENCH_VALUES),
+			(double)array / (CODEC_BENCH_ROUNDS * CODEC_BENCH_VALUES));
+	return failures;
+}
@@ -0,0 +1,12 @@
+#ifndef _BENCH_MD5_REFERENCE_H_
+#define _BENCH_MD5_REFERENCE_H_
+
+#include <canopus/types.h>
+#include <canopus/md5.h>
+
+/* The RSA reference MD5 that md5.c started from, see md5_reference.c */
+void MD5Init_ref(MD5_CTX *mdContext);
+void MD5Update_ref(MD5_CTX *mdContext, const unsigned char *inBuf, unsigned int inLen);
+void MD5Final_ref(MD5_CTX *mdContext);
+
+#endif /* _BENCH_MD5_REFERENCE_H_ */
@@ -2,6 +2,7 @@
 #include <task.h>
 
 #include <canopus/board.h> /* board_init_scheduler_not_running() */
+#include <canopus/drivers/console_lowlevel.h>
 #include <canopus/logging.h>
 #include <canopus/subsystem/platform.h>
 
@@ -48,6 +49,8 @@ int app_main( void )
 
     harakiri(0x08);
 
+    lowlevel_console_rtos_enable(true);
+
     xTaskCreate(
 			SUBSYSTEM_PLATFORM.api->main_task,
 			(signed char *) SUBSYSTEM_PLATFORM.config->name,
@@ -1,6 +1,7 @@
 #include <canopus/types.h>
 #include <canopus/board.h>
 #include <canopus/drivers/channel.h>
+#include <canopus/drivers/console_lowlevel.h>
 #include <canopus/drivers/tms570/uart.h>
 #include <canopus/drivers/tms570/spi.h>
 #include <canopus/drivers/tms570/i2c.h>
@@ -54,6 +55,9 @@ board_init_scheduler_not_running(void)
 	spi1Init();
 	spi3Init();
 
+	/* nobody waits on the debug UART in flight */
+	lowlevel_console_set_policy(CONSOLE_POLICY_DROP_OLDEST, 0);
+
 	// san: cosas bajo nivel necesarias antes del scheduler
 
 	//send_identification_string_on_all_uarts_at_default_baudrate();
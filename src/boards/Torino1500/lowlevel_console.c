@@ -5,11 +5,16 @@
 
 #define CONSOLE_REG sciREG
 
+/* polling, sciSend() would keep `buf` in interrupt mode */
 void
-lowlevel_console_putchar(char c)
+lowlevel_console_write(const void *buf, size_t count)
 {
+	const uint8 *c = (const uint8 *)buf;
+
 	// FIXME disable IRQ?
-	sciSendByte(CONSOLE_REG, c);
+	while (count--) {
+		sciSendByte(CONSOLE_REG, *c++);
+	}
 	// FIXME enable IRQ?
 }
 
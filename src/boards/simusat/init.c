@@ -7,8 +7,10 @@
 #include <canopus/drivers/channel.h>
 #include <canopus/drivers/simusat/channel_posix.h>
 #include <canopus/drivers/simusat/remote.h>
+#include <canopus/drivers/simusat/channel_shm.h>
 #include <canopus/drivers/memory/channel_link_driver.h>
 #include <canopus/drivers/flash.h>
+#include <canopus/drivers/console_lowlevel.h>
 
 #include <canopus/drivers/simusat/gyroscope.h>
 #include <canopus/board/channels.h>
@@ -31,7 +33,13 @@ const channel_t *const ch_fpga_hub = &datadiscard_channel;
 const channel_t *const ch_fpga_slave = &datadiscard_channel;
 
 const channel_t *const ch_startracker = &datadiscard_channel;
+/* Build with SIMUSAT_SHM_DEVICES to talk to the device simulators over shared
+ * memory rings instead of loopback TCP */
+#ifdef SIMUSAT_SHM_DEVICES
+const channel_t *const ch_nanowheel = &DECLARE_CHANNEL_SHM("/canopus-nanowheel", 0);
+#else
 const channel_t *const ch_nanowheel = &DECLARE_CHANNEL_TCP_CLIENT("127.0.0.1", PORT_NRW);
+#endif
 
 /* Standalone Gyroscope */
 static posix_gyroscope_state_t gyroscope_0_state;
@@ -144,6 +152,9 @@ retval_t board_init_scheduler_running(void) {
     rv = channel_driver_initialize(&unix_socket_server_channel_driver);
     success &= (rv != RV_SUCCESS);
 
+    rv = channel_driver_initialize(&shm_channel_driver);
+    success &= (rv != RV_SUCCESS);
+
     rv = channel_driver_initialize(&remote_channel_driver);
     success &= (rv != RV_SUCCESS);
 
@@ -176,5 +187,6 @@ retval_t board_init_scheduler_running(void) {
 
 /* no scheduler */
 void board_init_scheduler_not_running() {
-
+	/* stdout keeps up, better wait a bit than lose what the tests print */
+	lowlevel_console_set_policy(CONSOLE_POLICY_BLOCK, 100);
 }
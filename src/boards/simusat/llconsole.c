@@ -6,9 +6,9 @@
 #include <stdio.h>
 
 void
-lowlevel_console_putchar(char c)
+lowlevel_console_write(const void *buf, size_t count)
 {
-    putchar(c);
+    fwrite(buf, 1, count, stdout);
 }
 
 #endif /* DEBUG_CONSOLE_ENABLED */
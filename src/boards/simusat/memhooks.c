@@ -23,11 +23,22 @@ uint16_t __stage_0_config__[0x4000];
 uint16_t _nvram0_addr[8*1024];
 uint16_t _nvram1_addr[8*1024];
 uint16_t _cdh_sample_addr[8*1024];
+uint16_t _cdh_delayed_cmds_addr[8*1024];
 #endif
 
 /* DRAM */
 #define UPLOAD_MEMORY_AREA_SIZE (1*1024*1024)
-char upload_memory_area_start[UPLOAD_MEMORY_AREA_SIZE], upload_memory_area_stop[UPLOAD_MEMORY_AREA_SIZE];
+
+/* One object, the stop symbol right at its end as the linkscripts put it:
+ * separate arrays can be laid out in any order */
+#define MEMHOOKS_STR_(x) #x
+#define MEMHOOKS_STR(x) MEMHOOKS_STR_(x)
+#define MEMHOOKS_SYMBOL(name) MEMHOOKS_STR(__USER_LABEL_PREFIX__) #name
+
+char upload_memory_area_start[UPLOAD_MEMORY_AREA_SIZE];
+__asm__(".globl " MEMHOOKS_SYMBOL(upload_memory_area_stop) "\n"
+        ".set " MEMHOOKS_SYMBOL(upload_memory_area_stop) ", "
+        MEMHOOKS_SYMBOL(upload_memory_area_start) " + " MEMHOOKS_STR(UPLOAD_MEMORY_AREA_SIZE));
 
 static bool
 mmap_ram_init(uintptr_t addr, size_t size, const char *type, void **ptr)
@@ -1,11 +1,20 @@
 #include <canopus/drivers/simusat/memhooks.h>
 
+#include <string.h>
+
 extern int app_main( void );
 
 int
 main(int argc, char **argv)
 {
+	int i;
+
 	memhooks_init(MEMHOOKS_TMS570LS3137);
+	for (i = 1; i < argc; i++) {
+		if (0 == strcmp(argv[i], "--flash-write-behind")) {
+			memhooks_flash_write_behind(true);
+		}
+	}
 
 	return app_main();
 }
@@ -10,6 +10,9 @@
 typedef struct channel_t channel_t;
 typedef /*TODO const*/ struct channel_driver_t channel_driver_t;
 typedef const struct channel_driver_config_t channel_driver_config_t;
+typedef struct channel_request_t channel_request_t;
+typedef struct channel_stats_t channel_stats_t;
+typedef struct channel_transaction_t channel_transaction_t;
 
 /* Channels public API:
  *  This are the functions used to communicate via a channel,
@@ -22,12 +25,59 @@ typedef const struct channel_driver_config_t channel_driver_config_t;
 retval_t channel_open(const channel_t *const chan);
 retval_t channel_close(const channel_t *const chan);
 retval_t channel_send(const channel_t *const chan, frame_t *const send_frame);
+retval_t channel_send_chain(const channel_t *const chan, frame_chain_t *const send_chain);
 retval_t channel_recv(const channel_t *const chan, frame_t *const recv_frame);
 retval_t channel_transact(const channel_t *const chan, frame_t *const send_frame,
                           uint32_t delay_ms, frame_t *const recv_frame);
 retval_t channel_lock(const channel_t *const chan, portTickType xBlockTime);
 retval_t channel_unlock(const channel_t *const chan);
 
+/* Asynchronous API:
+ *  Same operations as above, but the calling task doesn't wait. The request
+ *  is queued and `complete` is called once it's finished, from the task that
+ *  finished it (a driver task or a channel worker), never from an ISR.
+ *  The request and its frames belong to the channel until then.
+ *
+ * @return RV_SUCCESS if queued, RV_ILLEGAL, RV_BUSY if the request is in use,
+ *  RV_NOSPACE if the worker tasks can't be created.
+ */
+retval_t channel_send_async(const channel_t *const chan, channel_request_t *const request,
+                            frame_t *const send_frame);
+retval_t channel_recv_async(const channel_t *const chan, channel_request_t *const request,
+                            frame_t *const recv_frame);
+retval_t channel_transact_async(const channel_t *const chan, channel_request_t *const request,
+                                frame_t *const send_frame, uint32_t delay_ms, frame_t *const recv_frame);
+/**
+ * Cancel a request that didn't start yet, `complete` is called with RV_ERROR.
+ * @return RV_SUCCESS, RV_BUSY if it's already running, RV_ILLEGAL if it's not queued.
+ */
+retval_t channel_request_cancel(channel_request_t *const request);
+/** For drivers implementing `submit`, to signal the end of a request */
+void channel_request_complete(channel_request_t *const request, retval_t rv);
+
+/* Batched API:
+ *  Runs `count` transactions back to back under a single lock of the channel,
+ *  each one with its own result and completion time. Drivers implementing
+ *  `transact_batch` may have all of them in flight at once, for the rest
+ *  it's one channel_transact() after the other.
+ *
+ * @return RV_SUCCESS if all of them succeeded, the first failure otherwise
+ */
+retval_t channel_transact_batch(const channel_t *const chan,
+                                channel_transaction_t *const transactions, size_t count);
+
+/* Statistics:
+ *  Every channel opened at least once gets an index, in opening order,
+ *  used to fetch its counters from the ground.
+ */
+uint8_t channel_stats_count(void);
+/**
+ * @return RV_SUCCESS, RV_NOENT if there's no channel with that index
+ */
+retval_t channel_stats_get(uint8_t index, const channel_t **chan, channel_stats_t *stats);
+void channel_stats_reset(const channel_t *const chan);
+void channel_stats_reset_all(void);
+
 // FIXME used? lead to error on TMS570
 #define DECLARE_CHANNEL(__driver, __config, __state_type)	\
 	(channel_t){											\
@@ -61,10 +111,102 @@ typedef const struct channel_config_t {
 	uint32_t transaction_timeout_ms;
 } channel_config_t;
 
+/**
+ * Asynchronous channel request.
+ *
+ * Owned by the caller, must stay valid until `complete` is called. Only
+ * `complete`, `context` and `timeout_ms` are to be set by the caller, the
+ * rest is filled by the channel_*_async() calls.
+ */
+typedef void channel_complete_t(channel_request_t *request, retval_t rv);
+
+typedef enum {
+	CHANNEL_OP_SEND = 0,
+	CHANNEL_OP_RECV,
+	CHANNEL_OP_TRANSACT,
+} channel_op_t;
+
+typedef enum {
+	CHANNEL_REQUEST_IDLE = 0,
+	CHANNEL_REQUEST_QUEUED,
+	CHANNEL_REQUEST_RUNNING,
+} channel_request_status_t;
+
+#define DECLARE_CHANNEL_REQUEST(__complete, __context, __timeout_ms)	\
+	{														\
+		.complete = (__complete),							\
+		.context = (__context),								\
+		.timeout_ms = (__timeout_ms),						\
+	}
+
+struct channel_request_t {
+	channel_complete_t *complete;
+	void *context;
+	uint32_t timeout_ms;	/* while queued, 0 for transaction_timeout_ms */
+
+	const channel_t *channel;
+	channel_op_t op;
+	frame_t *send_frame;
+	frame_t *recv_frame;
+	uint32_t delay_ms;
+	portTickType deadline;
+	volatile channel_request_status_t status;
+	retval_t rv;
+	channel_request_t *next;
+};
+
+/**
+ * Batched transaction.
+ *
+ * Same arguments as channel_transact(), `rv` and `ticks` (tick count when
+ * it completed) are filled by channel_transact_batch().
+ */
+#define DECLARE_CHANNEL_TRANSACTION(__send_frame, __delay_ms, __recv_frame)	\
+	{														\
+		.send_frame = (__send_frame),						\
+		.recv_frame = (__recv_frame),						\
+		.delay_ms = (__delay_ms),							\
+	}
+
+struct channel_transaction_t {
+	frame_t *send_frame;
+	frame_t *recv_frame;
+	uint32_t delay_ms;
+	retval_t rv;
+	portTickType ticks;
+};
+
+/**
+ * Channel statistics.
+ *
+ * Counters kept by the generic channel layer for every channel, whatever the
+ * driver. Errors are counted by retval_t, transact latencies in a histogram
+ * where bucket 0 is < 1ms, bucket i (i > 0) is [2^(i-1), 2^i) ms and the
+ * last one takes everything longer.
+ */
+#define CHANNEL_STATS_MAX_CHANNELS		32
+#define CHANNEL_STATS_RV_COUNT			(RV_NOTIMPLEMENTED + 1)
+#define CHANNEL_STATS_LATENCY_BUCKETS	10
+
+struct channel_stats_t {
+	uint32_t bytes_out;
+	uint32_t bytes_in;
+	uint32_t sends;
+	uint32_t recvs;
+	uint32_t transacts;
+	uint16_t errors[CHANNEL_STATS_RV_COUNT];
+	uint32_t lock_wait_total_ms;
+	uint32_t lock_wait_max_ms;
+	uint32_t transact_max_ms;
+	uint16_t transact_latency[CHANNEL_STATS_LATENCY_BUCKETS];
+};
+
 typedef struct channel_state_t  {
 	bool is_open;
 	xSemaphoreHandle send_mutex;
 	xSemaphoreHandle recv_mutex;
+	bool async_busy;	/* a channel worker is running a request for it */
+	channel_stats_t stats;
 } channel_state_t;
 
 struct channel_t {
@@ -121,6 +263,34 @@ typedef retval_t channel_transact_t(
         const size_t send_bytes,
         const size_t recv_bytes);
 
+/* IO: Send all the segments of `send_chain` to `channel`, as a single write
+ * when the hardware allows it (optional, channel_send_chain() falls back to
+ * one `send` per segment) */
+typedef retval_t channel_send_chain_t(
+		const channel_t * const channel,
+		frame_chain_t * const send_chain);
+
+/* IO: Start `request` and return without waiting, the driver calls
+ * channel_request_complete() when it's done (optional, the generic
+ * implementation runs send/recv/transact from a pool of worker tasks) */
+typedef retval_t channel_submit_t(
+		const channel_t * const channel,
+		channel_request_t * const request);
+
+/* IO: Abort a request previously accepted by `submit`. Return RV_SUCCESS
+ * only if `complete` will not be called by the driver anymore */
+typedef retval_t channel_cancel_t(
+		const channel_t * const channel,
+		channel_request_t * const request);
+
+/* IO: Run all of `transactions`, filling their `rv` and `ticks` (optional,
+ * channel_transact_batch() falls back to one `transact` after the other).
+ * Called with the channel locked */
+typedef retval_t channel_transact_batch_t(
+		const channel_t * const channel,
+		channel_transaction_t * const transactions,
+		const size_t count);
+
 /* Channel Drivers:
  * 	The channel driver implements all necessary to operate a channel.
  * 	There may be a single channel driver for many channels of the same type,
@@ -163,6 +333,10 @@ struct channel_driver_api_t {
 	channel_send_t *send;
 	channel_recv_t *recv;
 	channel_transact_t *transact;
+	channel_send_chain_t *send_chain;
+	channel_submit_t *submit;
+	channel_cancel_t *cancel;
+	channel_transact_batch_t *transact_batch;
 };
 
 retval_t channel_driver_initialize(
@@ -29,6 +29,33 @@ typedef enum {
     HEXDUMP_GROUP4_32   = 1<<2
 } hexdump_flag_e;
 
+typedef enum {
+    CONSOLE_POLICY_DROP_OLDEST,     /* never wait, lose the oldest output */
+    CONSOLE_POLICY_BLOCK            /* wait up to block_ms for room first */
+} console_policy_e;
+
+/* board provided, synchronous */
+void lowlevel_console_write(const void *buf, size_t count);
+
+/* where the output goes, lowlevel_console_write() unless set (NULL sets
+ * it back), for the tests */
+typedef void lowlevel_console_write_t(const void *buf, size_t count);
+void lowlevel_console_set_write(lowlevel_console_write_t *write);
+
+/* queue the output and drain it from a task (see console_debug.c) */
+void lowlevel_console_rtos_enable(bool state);
+
+/* what to do when the queue is full, boards set it from
+ * board_init_scheduler_not_running(), CONSOLE_POLICY_DROP_OLDEST if not */
+void lowlevel_console_set_policy(console_policy_e policy, uint32_t block_ms);
+
+console_policy_e lowlevel_console_get_policy(uint32_t *block_ms);
+
+uint32_t lowlevel_console_dropped(void);
+
+/* from fault handlers: flush what's queued, then write synchronously */
+void lowlevel_console_emergency(void);
+
 void lowlevel_console_putchar(char c) ATTR_NAKED;
 
 char lowlevel_console_getchar(void) ATTR_NAKED;
@@ -49,6 +76,11 @@ void lowlevel_console_hexdump_ex(const void *ptr, size_t size, const char *desc,
 
 #else
 
+#define lowlevel_console_rtos_enable(s) (void)(s)
+#define lowlevel_console_set_write(w) (void)(w)
+#define lowlevel_console_set_policy(p, ms)
+#define lowlevel_console_dropped() 0
+#define lowlevel_console_emergency()
 #define lowlevel_console_putchar(c)
 #define lowlevel_console_getchar() 0
 #define lowlevel_console_putnewline()
@@ -41,6 +41,10 @@ flash_err_t flash_patch(const void *dst, const void *src, size_t size);
 flash_err_t flash_patch_force(const void *dst, const void *src, size_t size);
 flash_err_t flash_patch_ex(const void *dst, const void *src, size_t size, flashpatch_mode_e mode);
 
+/* patches between these two share the sector cache, written back at the end */
+void flash_cache_begin(void);
+flash_err_t flash_cache_end(void);
+
 #ifdef FLASH_DEBUG
 const char *dev_flash_errmsg(flash_err_t err);
 #endif
@@ -5,6 +5,9 @@
 #include <canopus/types.h>
 #include <canopus/nvram.h> /* nvram_t */
 
+#include <FreeRTOS.h>
+#include <semphr.h>
+
 #if 1
 # include <canopus/logging.h>
 # define NVRAM_REPORT(args...) log_report_fmt(LOG_NVRAM, args)
@@ -18,4 +21,46 @@ retval_t nvram_format_blocking(uint32_t format_key);
 retval_t nvram_read_blocking(void *addr, size_t size);
 retval_t nvram_write_blocking(const void *addr, size_t size);
 
+/* Journal area next to the nvram image, for small updates (see nvram.c).
+ * nvram_journal_size() is 0 where there's none, the rest RV_NOTIMPLEMENTED.
+ * Appends only program erased space, nvram_journal_erase() erases it all */
+size_t nvram_journal_size(void);
+retval_t nvram_journal_read(uint32_t offset, void *addr, size_t size);
+retval_t nvram_journal_append(uint32_t offset, const void *addr, size_t size);
+retval_t nvram_journal_erase(void);
+
+/* The functions above as a table. nvram.c works on a store made of one,
+ * the board's for nvram_reload() and friends, so the tests can give it a
+ * flash of their own */
+typedef struct nvram_storage_t {
+    retval_t (*read)(void *addr, size_t size);
+    retval_t (*write)(const void *addr, size_t size);
+    size_t (*journal_size)(void);
+    retval_t (*journal_read)(uint32_t offset, void *addr, size_t size);
+    retval_t (*journal_append)(uint32_t offset, const void *addr, size_t size);
+    retval_t (*journal_erase)(void);
+} nvram_storage_t;
+
+/* An image in RAM and where it's saved. `scratch` is as big as the image,
+ * a compaction puts the new one together there: nvram_t is too big for the
+ * callers' stacks. Zero the rest before the first use */
+typedef struct nvram_store_t {
+    const nvram_storage_t *storage;
+    nvram_t *ram;
+    nvram_t *scratch;
+    xSemaphoreHandle lock;
+    bool flushing_disabled;
+    uint16_t flash_access_count; /* valid since last reboot */
+    struct {
+        bool open;      /* head is where the next record goes */
+        uint32_t head;  /* 0 when a new journal must be started */
+        unsigned char digest[MD5_DIGEST_SIZE]; /* of the image in flash */
+    } journal;
+} nvram_store_t;
+
+/* nvram_reload(), nvram_flush() and nvram_flush_partial() on any store */
+void nvram_store_reload(nvram_store_t *store);
+retval_t nvram_store_flush(nvram_store_t *store);
+retval_t nvram_store_flush_partial(nvram_store_t *store, uint16_t offset, int16_t size);
+
 #endif
@@ -18,6 +18,9 @@
 
 #define EPS_API_VERSION	1
 
+#include <canopus/types.h>
+#include <FreeRTOS.h>
+
 /* note: GetStatus() retrieves the status from the EPS, the result   */
 /* could be expressed in a struct with bitfields, with enums or with */
 /* defines. Bitfields seem a good option, however, there are groups  */
@@ -126,6 +129,14 @@ typedef enum eps_charger_activity_e {
 	EPS_CHARGER_NEITHER_CHARGING_NOR_DISCHARGING,
 } eps_charger_activity_t;
 
+/* One ADC read of eps_GetADCRawBatch() */
+typedef struct eps_adc_sample_t {
+	eps_adc_channel_t channel;	/* set by the caller */
+	uint16_t raw;				/* ADC_ERROR_VALUE unless rv is RV_SUCCESS */
+	retval_t rv;
+	portTickType ticks;			/* when the answer came */
+} eps_adc_sample_t;
+
 /* ADC channels High level */
 retval_t eps_GetArrayCurrent(eps_array_t array_id, float *current);         /* only on X+,X-,Z+,Z-,Y+,Y- */
 retval_t eps_GetArrayTemperature(eps_array_t array_id, float *temperature); /* only on X+,X-,Z+,Z-,Y+,Y- */
@@ -139,6 +150,7 @@ retval_t eps_GetChargerActivity(uint8_t battery_id, eps_charger_activity_t *acti
  /* Low level message interface */
 retval_t eps_GetADCRaw(eps_adc_channel_t channel_id, uint16_t *value);
 retval_t eps_GetADC(eps_adc_channel_t channel_id, float *value);
+retval_t eps_GetADCRawBatch(eps_adc_sample_t *samples, size_t count);
 retval_t eps_GetStatus(uint16_t *status);
 retval_t eps_GetFirmwareVersion(uint16_t *version);
 retval_t eps_ResetPowerLines(eps_bus_t line_id);
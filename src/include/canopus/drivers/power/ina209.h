@@ -131,12 +131,22 @@ typedef struct ina209_outputPinCfg_t {
 	uint16_t				SMBusMask;
 }ina209_outputPinCfg_t;
 
+// One register read of ina209_readRegisterBatch()
+typedef struct ina209_sample_t {
+	uint8_t			reg;		// set by the caller
+	uint16_t		value;		// raw register
+	retval_t		rv;
+	portTickType	ticks;		// when the answer came
+} ina209_sample_t;
+
 // Defines
 #define INA209_CONFIGURATION_DEFAULT	0x399F
+#define INA209_BATCH_SIZE				8
 
 // Low level function
 retval_t ina209_init(const channel_t *const channel);
 retval_t ina209_readRegister(const channel_t *const channel, uint8_t regAdress, uint16_t * buffer);
+retval_t ina209_readRegisterBatch(const channel_t *const channel, ina209_sample_t *samples, size_t count);
 retval_t ina209_writeRegister(const channel_t *const channel, uint8_t regAdress, uint16_t buffer);
 retval_t ina209_setBitsOnRegister(const channel_t *const channel, uint8_t regAddress, uint16_t bitmask);
 retval_t ina209_clearBitsOnRegister(const channel_t *const channel, uint8_t regAddress, uint16_t bitmask);
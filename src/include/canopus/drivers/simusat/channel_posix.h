@@ -2,6 +2,7 @@
 #define _FILE_CHANNEL_DRIVER_H_
 
 #include <canopus/drivers/channel.h>
+#include <canopus/drivers/simusat/posix_reactor.h>
 
 #define CHANNEL_POSIX_DEFAULT_TIMEOUT_ms	100
 extern const channel_driver_t fd_channel_driver;
@@ -37,6 +38,7 @@ typedef struct fd_channel_state_t {
 	channel_state_t common;
     int  fd;
     int  master_fd;
+    posix_reactor_fd_t reactor;
 } fd_channel_state_t;
 
 /**
@@ -0,0 +1,43 @@
+#ifndef _SHM_CHANNEL_DRIVER_H_
+#define _SHM_CHANNEL_DRIVER_H_
+
+#include <canopus/drivers/channel.h>
+#include <canopus/drivers/simusat/channel_posix.h>
+#include <canopus/drivers/simusat/shm_ring.h>
+
+/* Channel over a shared memory ring pair (see shm_ring.h), a drop-in
+ * replacement for a tcp_client channel talking to a device simulator on
+ * the same machine. The simulator links shm_ring.c and opens the same
+ * name with SHM_RING_SIDE_DEVICE.
+ *
+ * Copies in and out of the rings cost no syscall. FreeRTOS tasks can't
+ * sleep on a futex under the POSIX port, so a recv() with nothing to read
+ * checks the ring once per tick, up to transaction_timeout_ms.
+ */
+
+extern const channel_driver_t shm_channel_driver;
+extern const channel_driver_api_t shm_channel_driver_api;
+
+typedef struct shm_channel_config_t {
+	channel_config_t common;
+	const char *name;		/* shm_open(3) name, "/something" */
+	uint32_t size;			/* bytes per direction, 0 for SHM_RING_DEFAULT_SIZE */
+} shm_channel_config_t;
+
+typedef struct shm_channel_state_t {
+	channel_state_t common;
+	shm_ring_pair_t ring;
+} shm_channel_state_t;
+
+#define DECLARE_CHANNEL_SHM(_name, _size)										\
+	(channel_t){																\
+		.config = (const channel_config_t *)&(shm_channel_config_t){			\
+			.common = DECLARE_CHANNEL_CONFIG(0, CHANNEL_FLAG_NO_AUTO_LOCK, CHANNEL_POSIX_DEFAULT_TIMEOUT_ms),	\
+			.name   = _name,													\
+			.size   = _size,													\
+		},																		\
+		.state  = (channel_state_t *)&(shm_channel_state_t){},					\
+		.driver = &shm_channel_driver,											\
+	}
+
+#endif /* _SHM_CHANNEL_DRIVER_H_ */
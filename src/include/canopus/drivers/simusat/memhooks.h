@@ -11,4 +11,9 @@ typedef enum memhooks_e {
 void memhooks_init(memhooks_t type);
 bool memhooks_flash_init(memhooks_t type);
 
+/* Simulated flash is synced sector by sector as it's erased or written.
+ * With write-behind, only on memhooks_flash_sync() and at exit */
+void memhooks_flash_write_behind(bool enable);
+bool memhooks_flash_sync(void);
+
 #endif
@@ -0,0 +1,44 @@
+#ifndef _POSIX_REACTOR_H_
+#define _POSIX_REACTOR_H_
+
+#include <canopus/types.h>
+
+#include <FreeRTOS.h>
+#include <semphr.h>
+
+/* Reactor for the POSIX channels.
+ *
+ * Instead of blocking a task (and its pthread) inside read(2), accept(2) and
+ * friends, drivers wait for the file descriptor to be ready with
+ * posix_reactor_wait(). The waiting task sleeps on a semaphore, and a single
+ * reactor task, built on epoll, wakes it up when the descriptor is ready or
+ * lets it time out at the given tick. On systems without epoll the wait
+ * returns immediately, and the following call blocks as it used to.
+ */
+
+#define POSIX_REACTOR_READ		(1<<0)
+#define POSIX_REACTOR_WRITE		(1<<1)
+
+/* One per file descriptor, zero initialized, kept in the channel state */
+typedef struct posix_reactor_fd_t {
+	int fd;
+	bool registered;
+	bool not_pollable;		/* regular files, always ready */
+	uint8_t armed;			/* POSIX_REACTOR_READ | POSIX_REACTOR_WRITE */
+	xSemaphoreHandle ready[2];
+} posix_reactor_fd_t;
+
+/**
+ * Wait until `fd` is ready for `event` (POSIX_REACTOR_READ or _WRITE)
+ * or until the tick count reaches `deadline`. portMAX_DELAY for ever.
+ * @retval RV_SUCCESS, RV_TIMEOUT, RV_ERROR, RV_NOSPACE
+ */
+retval_t posix_reactor_wait(posix_reactor_fd_t *entry, int fd, uint8_t event, portTickType deadline);
+
+/** Stop watching the file descriptor, before closing it */
+void posix_reactor_forget(posix_reactor_fd_t *entry);
+
+/** Deadline for a call starting now, 0 means for ever */
+portTickType posix_reactor_deadline(uint32_t timeout_ms);
+
+#endif /* _POSIX_REACTOR_H_ */
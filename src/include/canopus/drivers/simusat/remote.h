@@ -10,8 +10,31 @@
  * The transport, on which the requests are forwarded is another channel,
  * it could be of any type, but since this channels will be primarly used
  * for simulation we expect to have a tcp_channel as transport.
+ *
+ * Two protocols are spoken over the transport. The original one makes a
+ * full round trip per operation. The tagged one, used when the portmapper
+ * answers the ping with "PONG2" and the device accepts it on open, prefixes
+ * every request with a 16 bits id, and every answer carries it back:
+ *
+ *   request:  cmd:u8 id:u16 args... data...
+ *             SEND     len:u32 data[len]
+ *             RECV     max:u32
+ *             TRANSACT len:u32 delay_ms:u32 max:u32 data[len]
+ *   answer:   id:u16 rv:u8 written:u32 len:u32 data[len]
+ *
+ * Several requests may be outstanding on the same connection, sends don't
+ * wait for their answer (a failure is reported by the next call), and
+ * requests may be written back to back in a single batch. The server answers
+ * them in order. channel_transact_batch() writes all its transactions that
+ * way, and only then collects the answers.
  */
 
+#define REMOTE_PROTOCOL_LEGACY		0
+#define REMOTE_PROTOCOL_TAGGED		1
+
+#define REMOTE_MAX_OUTSTANDING		8
+#define REMOTE_BATCH_SIZE			512
+
 extern const channel_driver_t remote_channel_driver;
 extern const channel_driver_api_t remote_channel_driver_api;
 
@@ -24,6 +47,7 @@ typedef struct remote_channel_driver_config_t {
 
 typedef struct remote_channel_driver_state_t {
 	channel_driver_state_t common;
+	uint8_t protocol;			/* offered by the portmapper */
 } remote_channel_driver_state_t;
 
 typedef struct remote_channel_config_t {
@@ -38,11 +62,39 @@ typedef struct remote_channel_config_t {
     };
 } remote_channel_config_t;
 
+typedef struct remote_pending_t {
+	uint16_t id;
+	bool used;
+	bool forgotten;		/* its caller is gone, the answer is just read out */
+	frame_t *recv_frame;	/* where the answer data goes, NULL to discard */
+	channel_transaction_t *transaction;	/* of a batch, gets rv and ticks */
+} remote_pending_t;
+
 typedef struct remote_channel_state_t {
 	channel_state_t common;
 	channel_t * const transport;
+	uint8_t protocol;			/* in use on this connection */
+	const char *config_string;	/* to open it again */
+	bool out_of_step;			/* lost in an answer, reopened by the next request */
+	xSemaphoreHandle lock;
+	uint16_t next_id;
+	remote_pending_t pending[REMOTE_MAX_OUTSTANDING];
+	retval_t deferred_rv;		/* failure of a send nobody waited for */
+	bool batching;
+	frame_t batch;
+	uint8_t batch_buf[REMOTE_BATCH_SIZE];
 } remote_channel_state_t;
 
+/**
+ * Requests on `chan` between these two calls are written to the device
+ * in as few writes as possible. A recv or transact in between still
+ * waits for its answer, flushing what's pending. No-op with the legacy
+ * protocol.
+ * @retval RV_SUCCESS, RV_ILLEGAL
+ */
+retval_t remote_batch_begin(const channel_t *const chan);
+retval_t remote_batch_end(const channel_t *const chan);
+
 typedef struct remote_portmapped_channel_driver_config_t {
 	channel_driver_config_t common;
 	channel_t *ch_portmapper;
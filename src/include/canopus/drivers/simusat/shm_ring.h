@@ -0,0 +1,112 @@
+#ifndef _SHM_RING_H_
+#define _SHM_RING_H_
+
+/* Shared memory ring pair, between the simulated satellite and the external
+ * device simulators.
+ *
+ * A POSIX shared memory object (shm_open(3)) holds a header and two single
+ * producer, single consumer byte rings, one per direction. Data is copied in
+ * and out of the rings with no syscall involved, the only syscalls are futex
+ * wakeups, and only when the other side is sleeping on the ring.
+ *
+ * This file and shm_ring.c don't depend on FreeRTOS nor on the rest of
+ * canopus, device simulators can just compile them in:
+ *
+ *     shm_ring_pair_t ring;
+ *     uint8_t buf[64];
+ *     ssize_t n;
+ *
+ *     if (0 != shm_ring_open(&ring, "/canopus-nanowheel", 0, SHM_RING_SIDE_DEVICE)) exit(1);
+ *     for (;;) {
+ *         n = shm_ring_recv(&ring, buf, sizeof(buf), -1);
+ *         if (n > 0) shm_ring_send(&ring, answer, answer_len, 1000);
+ *     }
+ *
+ * Blocking calls (shm_ring_recv/send/wait_*) sleep on a futex. They're meant
+ * for the simulators, the firmware side uses the non blocking ones.
+ */
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SHM_RING_MAGIC			0x52484343	/* "CCHR" */
+#define SHM_RING_VERSION		1
+#define SHM_RING_DEFAULT_SIZE	4096		/* bytes per direction, power of 2 */
+#define SHM_RING_CACHELINE		64
+
+#define SHM_RING_SIDE_HOST		0			/* the simulated satellite */
+#define SHM_RING_SIDE_DEVICE	1			/* the device simulator */
+
+/* Ring 0 goes from the host to the device, ring 1 the other way */
+#define SHM_RING_TO_DEVICE		0
+#define SHM_RING_TO_HOST		1
+
+/* Producer and consumer indexes live in their own cache lines. Indexes are
+ * free running, the position in the data area is index & (size - 1) */
+typedef struct shm_ring_t {
+	volatile uint32_t head;				/* written by the producer */
+	volatile uint32_t data_seq;			/* futex, bumped on every write */
+	volatile uint32_t data_waiters;		/* consumers sleeping on data_seq */
+	uint8_t _pad0[SHM_RING_CACHELINE - 3 * sizeof(uint32_t)];
+	volatile uint32_t tail;				/* written by the consumer */
+	volatile uint32_t space_seq;		/* futex, bumped on every read */
+	volatile uint32_t space_waiters;	/* producers sleeping on space_seq */
+	uint8_t _pad1[SHM_RING_CACHELINE - 3 * sizeof(uint32_t)];
+} shm_ring_t;
+
+typedef struct shm_ring_header_t {
+	volatile uint32_t magic;			/* set last, once initialized */
+	volatile uint32_t initializing;
+	uint32_t version;
+	uint32_t size;
+	uint8_t _pad[SHM_RING_CACHELINE - 4 * sizeof(uint32_t)];
+	shm_ring_t rings[2];
+	/* followed by the data of rings[0] and rings[1], size bytes each */
+} shm_ring_header_t;
+
+/* One side's view of the mapping */
+typedef struct shm_ring_pair_t {
+	shm_ring_header_t *header;
+	size_t map_size;
+	uint32_t size;
+	shm_ring_t *tx;
+	shm_ring_t *rx;
+	uint8_t *tx_data;
+	uint8_t *rx_data;
+} shm_ring_pair_t;
+
+/**
+ * Map the shared memory object `name`, creating and initializing it if needed.
+ * The host side always resets it, dropping what a previous run left in the
+ * rings, so device simulators see a fresh session when the satellite starts.
+ * `size` is the size of each ring, a power of 2, 0 for SHM_RING_DEFAULT_SIZE.
+ * Both sides must agree on it.
+ * @return 0, or -errno
+ */
+int shm_ring_open(shm_ring_pair_t *pair, const char *name, uint32_t size, int side);
+void shm_ring_close(shm_ring_pair_t *pair);
+/** Remove the shared memory object, mappings already open keep working */
+int shm_ring_unlink(const char *name);
+
+/** Bytes that can be read/written right now */
+size_t shm_ring_readable(const shm_ring_pair_t *pair);
+size_t shm_ring_writable(const shm_ring_pair_t *pair);
+
+/** Non blocking, copy as much as possible and return the amount copied */
+size_t shm_ring_write(shm_ring_pair_t *pair, const void *buf, size_t count);
+size_t shm_ring_read(shm_ring_pair_t *pair, void *buf, size_t count);
+
+/**
+ * Sleep until there's something to read, or room to write.
+ * timeout_ms < 0 waits for ever.
+ * @return 0, or -ETIMEDOUT
+ */
+int shm_ring_wait_readable(shm_ring_pair_t *pair, int timeout_ms);
+int shm_ring_wait_writable(shm_ring_pair_t *pair, int timeout_ms);
+
+/** Blocking, write all of buf. @return count, or the amount written before timing out */
+ssize_t shm_ring_send(shm_ring_pair_t *pair, const void *buf, size_t count, int timeout_ms);
+/** Blocking, read at least one byte. @return amount read, or -ETIMEDOUT */
+ssize_t shm_ring_recv(shm_ring_pair_t *pair, void *buf, size_t count, int timeout_ms);
+
+#endif /* _SHM_RING_H_ */
@@ -142,32 +142,115 @@ retval_t frame_put_bits_by_4(frame_t *frame, uint32_t data, size_t bits);
 
 void frame_put_u8_nocheck(frame_t *frame, uint8_t data);
 
-/** Frame pools **/
+/** Bulk array codecs, same output as putting/getting one element at a time.
+ * Elements that fit are processed even when not all of them do.
+ * @retval RV_SUCCESS, RV_NOSPACE
+ */
+retval_t frame_put_u16_array(frame_t *frame, const uint16_t *data, size_t count);
+retval_t frame_put_u16_le_array(frame_t *frame, const uint16_t *data, size_t count);
+retval_t frame_put_u32_array(frame_t *frame, const uint32_t *data, size_t count);
+retval_t frame_put_u32_le_array(frame_t *frame, const uint32_t *data, size_t count);
+retval_t frame_get_u16_array(frame_t *frame, uint16_t *data, size_t count);
+retval_t frame_get_u16_le_array(frame_t *frame, uint16_t *data, size_t count);
+retval_t frame_get_u32_array(frame_t *frame, uint32_t *data, size_t count);
+retval_t frame_get_u32_le_array(frame_t *frame, uint32_t *data, size_t count);
+
+/** Frame chains
+ *
+ * A chain is a short list of segments which together form a single message,
+ * so headers and trailers can be put in front or behind a payload (and
+ * stripped again) without copying it. Segments are views (frame_t copies)
+ * spanning from the position of the original frame up to its size.
+ * Frames whose ownership is given to the chain with frame_chain_own() are
+ * disposed with it.
+ */
+#define FRAME_CHAIN_MAX_SEGMENTS	4
+
+typedef struct frame_chain_t {
+	frame_t segments[FRAME_CHAIN_MAX_SEGMENTS];
+	frame_t *owned[FRAME_CHAIN_MAX_SEGMENTS];
+	uint8_t count;
+	uint8_t owned_count;
+} frame_chain_t;
+
+void frame_chain_init(frame_chain_t *chain);
+/**
+ * @retval RV_SUCCESS, RV_NOSPACE
+ */
+retval_t frame_chain_append(frame_chain_t *chain, const frame_t *segment);
+retval_t frame_chain_prepend(frame_chain_t *chain, const frame_t *segment);
+retval_t frame_chain_own(frame_chain_t *chain, frame_t *frame);
+size_t frame_chain_available_data(const frame_chain_t *chain);
+void frame_chain_reset(frame_chain_t *chain);
+retval_t frame_chain_advance(frame_chain_t *chain, size_t count);
+retval_t frame_chain_transfer(frame_t *dst_frame, frame_chain_t *chain);
+void frame_chain_dispose(frame_chain_t *chain);
+
+/** Frame pools
+ *
+ * Frames are allocated from a small set of pools, one per size class. Each
+ * pool keeps a stack of its free frames, so allocating and disposing are O(1)
+ * and only hold the critical section for a couple of pointer moves.
+ * frame_dispose() finds the owning pool from the frame address, so any frame
+ * can be disposed without knowing where it came from (non pool frames are
+ * just marked as not in use).
+ **/
 typedef struct frame_pool_t {
 	size_t count;
 	size_t buffer_size;
 	frame_t *frames;
 	uint8_t *big_buffer;
+	frame_t **free_list;
+	size_t free_count;
+	size_t high_water;			/* most frames in use at the same time */
+	uint32_t failures;			/* allocations refused for lack of frames */
 } frame_pool_t;
 
 #define DECLARE_FRAME_POOL(__name, __count, __each_buffer_size)			\
 	frame_t __name##_frames[__count];							\
 	uint8_t __name##_big_buffer[__count * __each_buffer_size];	\
+	frame_t *__name##_free_list[__count];						\
 	frame_pool_t __name  = {									\
 		.count = __count,										\
 		.buffer_size = __each_buffer_size,						\
 		.frames = __name##_frames,								\
-		.big_buffer = __name##_big_buffer}
+		.big_buffer = __name##_big_buffer,						\
+		.free_list = __name##_free_list}
 
 #define MAX_FRAME_SIZE			300
+#define SMALL_FRAME_SIZE		64
+
+typedef struct frame_pool_stats_t {
+	uint16_t buffer_size;
+	uint16_t count;
+	uint16_t free;
+	uint16_t high_water;
+	uint32_t failures;
+} frame_pool_stats_t;
 
 retval_t frame_pool_initialize();
+/* Free frames of the class frame_allocate() takes from (MAX_FRAME_SIZE),
+ * the others are in frame_pool_get_stats() */
 int frame_free_count();
 retval_t frame_recycle(frame_t *frame);
 retval_t frame_allocate(frame_t **frame);
+retval_t frame_allocate_size(frame_t **frame, size_t size);
 retval_t frame_allocate_retry(frame_t **frame, portTickType delay);
 void frame_dispose(frame_t *frame);
 
+/** Per size class statistics, classes are sorted by buffer size
+ * @retval RV_SUCCESS, RV_NOENT
+ */
+size_t frame_pool_class_count();
+retval_t frame_pool_get_stats(size_t class_index, frame_pool_stats_t *stats);
+
+/* Same as above, but working on an explicit pool */
+retval_t _frame_pool_initialize(frame_pool_t *pool);
+int _frame_free_count(const frame_pool_t *pool);
+retval_t _frame_allocate(frame_pool_t *pool, frame_t **frame);
+void _frame_pool_dispose(frame_pool_t *pool, frame_t *frame);
+bool _frame_pool_owns(const frame_pool_t *pool, const frame_t *frame);
+bool frame_is_pooled(const frame_t *frame);
 
 typedef uint32_t frame_mac_t;
 
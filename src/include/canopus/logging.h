@@ -78,9 +78,35 @@ logmask_t log_setmask(logmask_t mask, bool dump);
 void dumpmask(logmask_t mask);
 #define dumpmasks() dumpmask(LOGMASK_MAX)
 
+/* Loggers get every message whose bit was enabled when it was logged, they
+ * don't check the mask again */
 typedef void log_report_nb_t(portTickType xBlockTime, logbit_t bit, const char *msg);
 void log_register(int index, log_report_nb_t *logger);
 
+typedef struct log_stats_t {
+    uint32_t recorded;
+    uint32_t dropped;       /**< the ring was full, the message is lost */
+    uint32_t truncated;     /**< arguments didn't fit in a record */
+    uint32_t high_water;    /**< bytes of the ring ever used */
+} log_stats_t;
+
+void log_deferred_start(void);
+log_stats_t log_get_stats(void);
+
+#ifdef VARARGS_SUPPORTED
+/* The deferred logging ring alone, for the tests: messages recorded in a
+ * ring of the caller's as log_report() and log_report_fmt() do, and read
+ * back formatted as the LOG task would. log_test_report() is false if the
+ * message doesn't fit in a record */
+typedef struct log_ring_t log_ring_t;
+log_ring_t *log_test_ring_new(void);
+void log_test_ring_free(log_ring_t *ring);
+bool log_test_report(log_ring_t *ring, const char *msg);
+void log_test_report_fmt(log_ring_t *ring, const char *fmt, ...);
+bool log_test_read(log_ring_t *ring, char *buf, size_t size);
+log_stats_t log_test_stats(log_ring_t *ring);
+#endif /* VARARGS_SUPPORTED */
+
 void log_report(logbit_t bit, const char *msg);
 #ifdef VARARGS_SUPPORTED
 void log_report_fmt(logbit_t bit, const char *fmt, ...);
@@ -11,7 +11,7 @@
 #include <canopus/subsystem/payload.h>
 #include <canopus/subsystem/thermal.h>
 
-#define NVRAM_VERSION_CURRENT 11
+#define NVRAM_VERSION_CURRENT 12
 
 typedef struct nvram_t {
     nvram_header_t hdr;
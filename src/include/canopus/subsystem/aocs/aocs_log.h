@@ -0,0 +1,59 @@
+#ifndef _CANOPUS_SUBSYSTEM_AOCS_LOG_H_
+#define _CANOPUS_SUBSYSTEM_AOCS_LOG_H_
+
+#include <canopus/types.h>
+
+/* AOCS log, see aocs_log.c for the format */
+
+#define AOCS_LOG_SIZE			(32*1024)
+#define AOCS_LOG_BLOCK_SIZE		512
+#define AOCS_LOG_BLOCK_HEADER_SIZE	12
+#define AOCS_LOG_MAX_FIELDS		12
+
+typedef enum {
+	AOCS_LOG_IMU = 0,	/* the 12 raw words of the burst */
+	AOCS_LOG_CSS,		/* sun_vector_bits x, y, z */
+	AOCS_LOG_MTQ,		/* duty x, y, z in 1/100 % */
+	AOCS_LOG_STATE,		/* mode, dipole x, y, z in uAm2, Qs, Qv x, y, z in 1/16384 */
+	AOCS_LOG_TYPES,
+} aocs_log_type_e;
+
+#define AOCS_LOG_TYPE_BIT(__type)	(1 << (__type))
+
+typedef struct aocs_log_cursor_t {
+	uint32_t seq;		/* block */
+	uint16_t offset;	/* in the block */
+} aocs_log_cursor_t;
+
+#define AOCS_LOG_BLOCKS		(AOCS_LOG_SIZE / AOCS_LOG_BLOCK_SIZE)
+
+typedef struct aocs_log_block_t {
+	uint32_t seq;
+	uint32_t first_s;
+	uint32_t last_s;
+	uint16_t used;		/* 0 if never written */
+} aocs_log_block_t;
+
+typedef struct aocs_log_t {
+	uint8_t buf[AOCS_LOG_SIZE];
+	aocs_log_block_t blocks[AOCS_LOG_BLOCKS];
+	uint8_t current;
+	bool started;
+	uint32_t next_seq;
+	uint64_t last_ms;
+	int32_t last[AOCS_LOG_TYPES][AOCS_LOG_MAX_FIELDS];
+} aocs_log_t;
+
+/* types logged, by AOCS_LOG_TYPE_BIT() */
+extern uint8_t aocs_log_mask;
+
+/* The AOCS log, records of the types in aocs_log_mask */
+void aocs_log_record(aocs_log_type_e type, const int32_t *fields);
+retval_t aocs_log_read(uint32_t from_s, uint32_t to_s, aocs_log_cursor_t *at, aocs_log_cursor_t *next, uint8_t *buf, size_t *size);
+
+/* Any other log, empty after aocs_log_init(), records of every type */
+void aocs_log_init(aocs_log_t *log);
+void aocs_log_record_to(aocs_log_t *log, aocs_log_type_e type, const int32_t *fields);
+retval_t aocs_log_read_from(aocs_log_t *log, uint32_t from_s, uint32_t to_s, aocs_log_cursor_t *at, aocs_log_cursor_t *next, uint8_t *buf, size_t *size);
+
+#endif /* _CANOPUS_SUBSYSTEM_AOCS_LOG_H_ */
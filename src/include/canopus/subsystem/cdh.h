@@ -89,13 +89,38 @@ void CDH_command_watchdog_kick(void);
 retval_t CDH_process_hard_commands(frame_t *cmd_frame);
 bool CDH_antenna_is_deployment_enabled();
 
-/* cdh/sampler.c (used by AOCS) */
+/* cdh/sampler.c (used by AOCS)
+ *
+ * CDH_SAMPLE_STREAMS streams sample at once, each one from the beacon, a
+ * memory range or the answer of a command, every `interval` seconds, into
+ * its own ring in the upload area. Every `decimation` samples passing the
+ * trigger one is kept, or their average. Streams with CDH_SAMPLE_FLASH
+ * spill what they keep to a log at _cdh_sample_addr. The old sampler
+ * commands drive stream 0.
+ */
+#define CDH_SAMPLE_STREAMS		4
+#define CDH_SAMPLE_MAX_SIZE		64		/* bytes per sample */
+#define CDH_SAMPLE_MAX_ARGS		8		/* of a command source */
+#define CDH_SAMPLE_FOREVER		0xffff	/* samples wanted */
+#define CDH_SAMPLE_FLASH_SIZE	(8*1024)
+
 void cdh_sample_init(void);
 retval_t cdh_sample_beacon_tick(frame_t *beacon);
-retval_t cdh_sample_memory_tick(void);
+retval_t cdh_sample_tick(void);
+
+/* Where the streams' intervals are measured, xTaskGetTickCount() unless
+ * set (NULL sets it back) */
+typedef portTickType cdh_sample_clock_t(void);
+void cdh_sample_set_clock(cdh_sample_clock_t *clock);
+
 retval_t cmd_sample_beacon(const subsystem_t *self, frame_t * iframe, frame_t * oframe);
 retval_t cmd_sample_memory(const subsystem_t *self, frame_t * iframe, frame_t * oframe);
 retval_t cmd_sample_flash_when_done(const subsystem_t *self, frame_t * iframe, frame_t * oframe);
 retval_t cmd_sample_retrieve(const subsystem_t *self, frame_t * iframe, frame_t * oframe);
+retval_t cmd_sample_stream(const subsystem_t *self, frame_t * iframe, frame_t * oframe);
+retval_t cmd_sample_trigger(const subsystem_t *self, frame_t * iframe, frame_t * oframe);
+retval_t cmd_sample_stop(const subsystem_t *self, frame_t * iframe, frame_t * oframe);
+retval_t cmd_sample_read(const subsystem_t *self, frame_t * iframe, frame_t * oframe);
+retval_t cmd_sample_status(const subsystem_t *self, frame_t * iframe, frame_t * oframe);
 
 #endif
@@ -32,6 +32,10 @@ enum ss_cmd_platform_e {
     SS_CMD_PM_SET_ON_BOARD_TIME,
     SS_CMD_PM_GET_FPGA_TICKS,
     SS_CMD_PM_UART_DISCONNECT,
+    SS_CMD_PM_CHANNEL_STATS,
+    SS_CMD_PM_CHANNEL_STATS_RESET,
+    SS_CMD_PM_COMMAND_LIST,
+    SS_CMD_PM_MODE_CHANGE_REPORT,
 };
 
 enum ss_cmd_memory_e {
@@ -70,6 +74,12 @@ enum ss_cmd_memory_e {
     SS_CMD_MM_NVRAM_FORMAT,
     SS_CMD_MM_MEMORY_COMPRESS_BCL_LZ77,
     SS_CMD_MM_MEMORY_DECOMPRESS_BCL_LZ77,
+    SS_CMD_MM_FRAME_POOL_STATS,
+    SS_CMD_MM_BULK_READ,
+    SS_CMD_MM_BULK_ACK,
+    SS_CMD_MM_BULK_RESUME,
+    SS_CMD_MM_BULK_ABORT,
+    SS_CMD_MM_BULK_READ_LZ,
 };
 
 enum ss_cmd_cdh_e {
@@ -112,6 +122,15 @@ enum ss_cmd_cdh_e {
 	SS_CMD_CDH_DELAYED_COMMAND_DISCARD,
 
 	SS_CMD_GET_SEEN_AX25_CALLS,
+
+	SS_CMD_CDH_DELAYED_COMMAND_AT,
+	SS_CMD_CDH_DELAYED_COMMAND_DISCARD_ALL,
+
+	SS_CMD_CDH_SAMPLE_STREAM,
+	SS_CMD_CDH_SAMPLE_TRIGGER,
+	SS_CMD_CDH_SAMPLE_STOP,
+	SS_CMD_CDH_SAMPLE_READ,
+	SS_CMD_CDH_SAMPLE_STATUS,
 };
 
 enum ss_cmd_aocs_e {
@@ -198,11 +217,46 @@ retval_t ss_get_telemetry_beacon_short(const struct subsystem_t *self, frame_t *
 retval_t ss_get_telemetry_beacon_ascii(const struct subsystem_t *self, frame_t * oframe, uint32_t seqnum);
 retval_t ss_cmd_run_test(const struct subsystem_t *self, frame_t * iframe, frame_t * oframe);
 
+/* Command metadata.
+ *
+ * Unless COMMAND_METADATA_DISABLED is defined, every command table entry
+ * keeps, next to the handler, its name and formats packed in a single string:
+ *
+ *   "name\0args\0answer\0description"
+ *
+ * so it costs one pointer per command plus the text. PLATFORM's
+ * commandList sends it to the ground (see platform.c).
+ */
+#ifndef COMMAND_METADATA_DISABLED
+typedef struct ss_command_t {
+	ss_command_handler_t handler;
+	const char *metadata;
+} ss_command_t;
+
+#define SS_COMMAND_HANDLER(_cmd_)		((_cmd_).handler)
+#define SS_COMMAND_METADATA(_cmd_)		((_cmd_).metadata)
+#define SS_COMMAND_METADATA_FIELDS		4
+
+#define DECLARE_COMMAND(cmd_id, cmd_handler, cmd_name, cmd_description, cmd_args_format, cmd_ans_format)\
+   [cmd_id] = { (ss_command_handler_t)&cmd_handler, cmd_name "\0" cmd_args_format "\0" cmd_ans_format "\0" cmd_description }
+
+#define SS_COMMANDS_INITIALIZE_DEFAULT_VALUE(arraycount)	\
+    [0 ... (arraycount - 1)] = { (ss_command_handler_t)INVALID_PTR, NULL }
+#else
+typedef ss_command_handler_t ss_command_t;
+
+#define SS_COMMAND_HANDLER(_cmd_)		(_cmd_)
+#define SS_COMMAND_METADATA(_cmd_)		((const char *)NULL)
+
 #define DECLARE_COMMAND(cmd_id, cmd_handler, cmd_name, cmd_description, cmd_args_format, cmd_ans_format)\
    [cmd_id] = (ss_command_handler_t)&cmd_handler
 
+#define SS_COMMANDS_INITIALIZE_DEFAULT_VALUE(arraycount)	\
+    ARRAY_INITIALIZE_DEFAULT_VALUE(arraycount, ss_command_handler_t)
+#endif
+
 #define DECLARE_BASIC_COMMANDS(telemetryFormat, shortTelemetryFormat)	\
-	ARRAY_INITIALIZE_DEFAULT_VALUE(SS_CMD_SS_START, ss_command_handler_t), \
+	SS_COMMANDS_INITIALIZE_DEFAULT_VALUE(SS_CMD_SS_START), \
 	DECLARE_COMMAND(SS_CMD_GET_NAME, ss_cmd_get_name, "name", "Get subsystem name", "", "name:str"),	\
 	DECLARE_COMMAND(SS_CMD_GET_TELEMETRY_BEACON, cmd_get_telemetry_beacon, "telemetry", "Retrieves a telemetry report from the sybsystem", "", telemetryFormat),	\
 	DECLARE_COMMAND(SS_CMD_GET_TELEMETRY_BEACON_SHORT, cmd_get_telemetry_beacon_short, "shortRelemetry", "Retrieves a very short telemetry report from the sybsystem", "", shortTelemetryFormat),	\
@@ -11,10 +11,13 @@
 
 extern subsystem_t SUBSYSTEM_MEMORY;
 
+#define NVRAM_SECTION_COUNT 8 /* of nvram_t, after the header */
+
 typedef struct nvram_header_t {
     unsigned char digest[MD5_DIGEST_SIZE];
     uint16_t version;
     uint16_t flash_access_count;
+    uint16_t section_sum[NVRAM_SECTION_COUNT]; /* Fletcher-16 of each one */
 } nvram_header_t;
 
 typedef struct nvram_mm_t {
@@ -11,6 +11,26 @@ extern subsystem_t SUBSYSTEM_PLATFORM;
 #define PM_SS_MODE_CHANGE_TIMEOUT_MS		15000
 #define SYSTEM_WATCHDOG_INTERVAL_s			(4*60)
 
+/* Mode changes are given to all subsystems at once, PLATFORM then waits
+ * until each one is ready again or its own timeout expires (config
+ * mode_change_timeout_ms, PM_SS_MODE_CHANGE_TIMEOUT_MS when 0). Result:
+ *
+ *   RV_SUCCESS	all acknowledged
+ *   RV_TIMEOUT	some didn't, the new mode stays (drops to SURVIVAL and
+ *   			LOW_POWER are never undone, late subsystems catch up)
+ *   RV_NACK	some didn't, going to MISSION: rolled back to the old mode
+ *   RV_BUSY	a new mode was requested meanwhile, which takes over
+ */
+#define PM_MODE_ACK_NONE					0xffff
+
+typedef struct pm_mode_change_report_t {
+	uint8_t from;
+	uint8_t to;
+	uint8_t result;
+	uint16_t total_ms;
+	uint16_t ack_ms[SS_MAX];	/**< PM_MODE_ACK_NONE if not acknowledged */
+} pm_mode_change_report_t;
+
 typedef struct nvram_platform_t {
 	uint16_t reset_count;
 	void *last_boot_reason;
@@ -30,4 +50,11 @@ __attribute__((noreturn)) void PLATFORM_safe_reset(const char *reason);
 uint16_t PLATFORM_get_reset_count();
 uint32_t PLATFORM_get_cpu_uptime_ms();
 uint32_t PLATFORM_get_cpu_uptime_s();
+
+/* The barrier of mode changes, on `count` subsystems of `list` (NULL ones
+ * skipped) with `ack` given by their acknowledges. ack_ms as `list` */
+retval_t _PLATFORM_mode_change_barrier(subsystem_t *const *list, size_t count, xSemaphoreHandle ack, uint16_t *ack_ms);
+
+/* PLATFORM_ss_is_ready() giving `ack` */
+void _PLATFORM_ss_is_ready(subsystem_t *ss, xSemaphoreHandle ack);
 #endif
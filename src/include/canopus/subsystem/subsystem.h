@@ -86,6 +86,23 @@ struct subsystem_api_t;
 struct subsystem_config_t;
 struct subsystem_state_t;
 
+/** ss_telemetry_t
+ * Latest beacon telemetry of a subsystem, taken by its own task with
+ * ss_telemetry_publish() so the beacon doesn't wait for its hardware.
+ * Written to the buffer not in use, then switched.
+ **/
+#define SS_TELEMETRY_SNAPSHOT_SIZE	96
+#define SS_TELEMETRY_PERIOD_ms		5000	/* between snapshots, at least */
+#define SS_TELEMETRY_STALE_ms		60000
+
+typedef struct ss_telemetry_t {
+    portTickType ticks;
+    bool taken;
+    uint8_t current;
+    uint8_t size[2];
+    uint8_t data[2][SS_TELEMETRY_SNAPSHOT_SIZE];
+} ss_telemetry_t;
+
 /** subsystem_state_t
  * Mutable structure holding the current state for a subsystem
  **/
@@ -97,6 +114,7 @@ typedef struct subsystem_state_t {
     uint8_t expected_heartbeats;
     void *status_arg_p;
     uint32_t status_arg_u32;
+    ss_telemetry_t telemetry;
 } subsystem_state_t;
 
 #define HEARTBEAT_MAIN_TASK		(1 << 0)
@@ -128,8 +146,9 @@ typedef const struct subsystem_config {
     const ss_id_e id;         
     const char * name;
     const ss_tests_t *tests;
-    const ss_command_handler_t *command_handlers;
+    const ss_command_t *command_handlers;
     size_t command_handlers_count;
+    uint16_t mode_change_timeout_ms;   /**< 0 for PM_SS_MODE_CHANGE_TIMEOUT_MS */
 } subsystem_config_t;
 
 #define DECLARE_COMMAND_HANDLERS(__command_handlers)	\
@@ -150,6 +169,8 @@ typedef enum { SS_CRITICAL_ERR, SS_FATAL_ERR } ss_error_e;
 extern const subsystem_t *const subsystems[SS_MAX];
 
 retval_t ss_command_execute(const struct subsystem_t * self, frame_t * iframe, frame_t * oframe, uint32_t sequence_number);
+void ss_telemetry_publish(const struct subsystem_t *ss);
+retval_t ss_telemetry_snapshot(const struct subsystem_t *ss, frame_t *oframe, uint32_t *age_ms);
 void ss_report_error(const struct subsystem_t *ss, ss_error_e error, char *filename, uint32_t line);
 
 bool board_enabled_subsystem_id(ss_id_e id);
@@ -23,6 +23,7 @@ canopus_assert(const char *expression, const char *filename, const char *funcnam
     debug_area->assert.line = line;
 #endif
 
+    lowlevel_console_emergency();
     lowlevel_console_putnewline();
     lowlevel_console_putstring("assertion failed [");
     lowlevel_console_putstring(filename);
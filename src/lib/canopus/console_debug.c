@@ -1,21 +1,237 @@
 #include <canopus/types.h>
+#include <canopus/assert.h>
 #include <canopus/drivers/console_lowlevel.h>
 
 #include <string.h>
 
 #include <FreeRTOS.h>
 #include <semphr.h>
+#include <task.h>
 
 #ifdef DEBUG_CONSOLE_ENABLED
 
+/* Console output.
+ *
+ * Once lowlevel_console_rtos_enable(true) is called, the lowlevel_console_*
+ * writers don't wait on the UART: they copy into a ring of
+ * CONSOLE_RING_SIZE bytes, in a critical section, and a task at
+ * CONSOLE_TASK_PRIORITY drains it CONSOLE_DRAIN_CHUNK bytes at a time with
+ * the board's lowlevel_console_write(). When the ring is full the policy
+ * says what to do (see lowlevel_console_set_policy()): drop the oldest
+ * output, or block the writer for a while and drop if it's still full.
+ * Dropped bytes are counted and reported by the task.
+ *
+ * Before that, or while the scheduler isn't started, nothing would drain
+ * it: as after lowlevel_console_emergency(), which a fault handler calls
+ * with the interrupts disabled, everything is written synchronously,
+ * without locks, what was still queued first. *
+ * CONSOLE_TASK_PRIORITY is above every periodic subsystem task, platform
+ * included, so none of them can starve the drain and make every writer
+ * drop or block. A polling lowlevel_console_write() keeps the CPU while
+ * the UART sends what was queued, as it did when the writers called it
+ * themselves; only the watchdog and the simulator's reactor are above it.
+ */
+#define CONSOLE_RING_SIZE       2048    /* power of 2 */
+#define CONSOLE_DRAIN_CHUNK     128
+#define CONSOLE_TASK_PRIORITY   (tskIDLE_PRIORITY + 5)  /* TASK_PRIORITY_SUBSYSTEM_PLATFORM + 1 */
+#define CONSOLE_TASK_STACK_DEPTH (configMINIMAL_STACK_SIZE + CONSOLE_DRAIN_CHUNK)
+
+static struct {
+    uint8_t buf[CONSOLE_RING_SIZE];
+    size_t head, tail;          /* free running, used = head - tail */
+    console_policy_e policy;
+    portTickType block_ticks;
+    lowlevel_console_write_t *write;
+    volatile bool emergency;
+    uint32_t dropped, dropped_reported;
+    xSemaphoreHandle kick;      /* something to drain */
+    xSemaphoreHandle space;     /* something drained */
+    xTaskHandle task;
+} console = {
+    .policy = CONSOLE_POLICY_DROP_OLDEST,
+};
+
 static xSemaphoreHandle xMutex = NULL;
 static const portTickType xBlockTime = 5 / portTICK_RATE_MS;
 
+static void
+console_write(const void *buf, size_t count)
+{
+    lowlevel_console_write_t *write = console.write;
+
+    if (NULL != write) {
+        write(buf, count);
+    } else {
+        lowlevel_console_write(buf, count);
+    }
+}
+
+/* copies what fits, or all of it dropping the oldest, returns how much */
+static size_t
+console_ring_put(const uint8_t *buf, size_t count, bool drop_oldest)
+{
+    size_t room, n, at;
+
+    portENTER_CRITICAL();
+    room = CONSOLE_RING_SIZE - (console.head - console.tail);
+    if (count > room && drop_oldest) {
+        if (count > CONSOLE_RING_SIZE) {
+            /* only the end of it would survive anyway */
+            console.dropped += count - CONSOLE_RING_SIZE;
+            buf += count - CONSOLE_RING_SIZE;
+            count = CONSOLE_RING_SIZE;
+        }
+        console.dropped += count - room;
+        console.tail += count - room;
+        room = count;
+    }
+    n = count < room ? count : room;
+    at = console.head & (CONSOLE_RING_SIZE - 1);
+    if (at + n > CONSOLE_RING_SIZE) {
+        memcpy(&console.buf[at], buf, CONSOLE_RING_SIZE - at);
+        memcpy(console.buf, buf + CONSOLE_RING_SIZE - at, n - (CONSOLE_RING_SIZE - at));
+    } else {
+        memcpy(&console.buf[at], buf, n);
+    }
+    console.head += n;
+    portEXIT_CRITICAL();
+
+    return n;
+}
+
+/* no locking, console_ring_get() or with the interrupts already disabled */
+static size_t
+console_ring_copy_out(uint8_t *buf, size_t size)
+{
+    size_t n, at;
+
+    n = console.head - console.tail;
+    if (n > size) {
+        n = size;
+    }
+    at = console.tail & (CONSOLE_RING_SIZE - 1);
+    if (at + n > CONSOLE_RING_SIZE) {
+        memcpy(buf, &console.buf[at], CONSOLE_RING_SIZE - at);
+        memcpy(buf + CONSOLE_RING_SIZE - at, console.buf, n - (CONSOLE_RING_SIZE - at));
+    } else {
+        memcpy(buf, &console.buf[at], n);
+    }
+    console.tail += n;
+
+    return n;
+}
+
+static size_t
+console_ring_get(uint8_t *buf, size_t size)
+{
+    size_t n;
+
+    portENTER_CRITICAL();
+    n = console_ring_copy_out(buf, size);
+    portEXIT_CRITICAL();
+
+    return n;
+}
+
+static char ascii(uint8_t c) {
+    if (c <= 9) {
+        return c + '0';
+    } else if (c >= 0xa && c <= 0xf) {
+        return c + 'a' - 10;
+    } else {
+        return '?';
+    }
+}
+
+static void
+hex8(char *p, uint8_t val8)
+{
+    p[0] = ascii(val8 >> 4);
+    p[1] = ascii(val8 & 0xf);
+}
+
+static void
+hex32(char *p, uint32_t val32)
+{
+    register int i;
+
+    for (i = 0; i < 4; i++) {
+        hex8(&p[i * 2], val32 >> ((3 - i) * 8));
+    }
+}
+
+static bool
+console_may_block()
+{
+    return CONSOLE_POLICY_BLOCK == console.policy
+        && taskSCHEDULER_RUNNING == xTaskGetSchedulerState();
+}
+
+/* every writer ends up here */
+static void
+console_emit(const void *buf, size_t count)
+{
+    const uint8_t *c = (const uint8_t *)buf;
+    size_t n;
+
+    if (console.emergency || NULL == console.task
+            || taskSCHEDULER_NOT_STARTED == xTaskGetSchedulerState()) {
+        console_write(buf, count);
+        return;
+    }
+    while (count > 0) {
+        n = console_ring_put(c, count, !console_may_block());
+        c += n;
+        count -= n;
+        (void)xSemaphoreGive(console.kick);
+        if (count > 0 && pdFALSE == xSemaphoreTake(console.space, console.block_ticks)) {
+            /* drain too slow, don't wait anymore */
+            (void)console_ring_put(c, count, true);
+            break;
+        }
+    }
+}
+
+static void
+console_task(void *pvParameters)
+{
+    char msg[] = "\r\nconsole: bytes dropped 0x________\r\n";
+    uint8_t chunk[CONSOLE_DRAIN_CHUNK];
+    uint32_t dropped;
+    size_t n;
+
+    while (1) {
+        (void)xSemaphoreTake(console.kick, portMAX_DELAY);
+
+        while (!console.emergency && 0 != (n = console_ring_get(chunk, sizeof(chunk)))) {
+            (void)xSemaphoreGive(console.space);
+            console_write(chunk, n);
+        }
+
+        dropped = console.dropped;
+        if (dropped != console.dropped_reported && !console.emergency) {
+            hex32(&msg[sizeof(msg) - 11], dropped - console.dropped_reported);
+            console.dropped_reported = dropped;
+            console_write(msg, sizeof(msg) - 1);
+        }
+    }
+}
+
 void
 lowlevel_console_rtos_enable(bool state)
 {
     if (true == state) {
         xMutex = xSemaphoreCreateRecursiveMutex();
+        if (NULL != console.task) {
+            return;
+        }
+        vSemaphoreCreateBinary(console.kick);
+        vSemaphoreCreateBinary(console.space);
+        assert(NULL != console.kick);
+        assert(NULL != console.space);
+        (void)xSemaphoreTake(console.kick, 0);
+        (void)xSemaphoreTake(console.space, 0);
+        xTaskCreate(console_task, (signed char *)"CONSOLE", CONSOLE_TASK_STACK_DEPTH, NULL, CONSOLE_TASK_PRIORITY, &console.task);
     } else if (NULL != xMutex) {
 		#ifndef portUSING_MPU_WRAPPERS /* FIXME broken FreeRTOS_MPU port on TMS570... */
         vSemaphoreDelete(xMutex);
@@ -23,10 +239,50 @@ lowlevel_console_rtos_enable(bool state)
     }
 }
 
+void
+lowlevel_console_set_policy(console_policy_e policy, uint32_t block_ms)
+{
+    console.block_ticks = block_ms / portTICK_RATE_MS;
+    console.policy = policy;
+}
+
+console_policy_e
+lowlevel_console_get_policy(uint32_t *block_ms)
+{
+    if (NULL != block_ms) {
+        *block_ms = console.block_ticks * portTICK_RATE_MS;
+    }
+    return console.policy;
+}
+
+void
+lowlevel_console_set_write(lowlevel_console_write_t *write)
+{
+    console.write = write;
+}
+
+uint32_t
+lowlevel_console_dropped(void)
+{
+    return console.dropped;
+}
+
+void
+lowlevel_console_emergency(void)
+{
+    uint8_t chunk[CONSOLE_DRAIN_CHUNK];
+    size_t n;
+
+    console.emergency = true;
+    while (0 != (n = console_ring_copy_out(chunk, sizeof(chunk)))) {
+        console_write(chunk, n);
+    }
+}
+
 static bool
 console_lock()
 {
-    if (NULL == xMutex) {
+    if (NULL == xMutex || console.emergency) {
         return true;
     }
     if (pdFALSE == xSemaphoreTakeRecursive(xMutex, xBlockTime)) {
@@ -38,7 +294,7 @@ console_lock()
 static void
 console_unlock()
 {
-    if (NULL == xMutex) {
+    if (NULL == xMutex || console.emergency) {
         return;
     }
     xSemaphoreGiveRecursive(xMutex);
@@ -52,17 +308,21 @@ console_unlock()
     console_unlock();
 
 void
-lowlevel_console_putbuf(const void *buf, size_t count)
+lowlevel_console_putchar(char c)
 {
-    uint8_t *c = (uint8_t *)buf;
+    LOCK();
+    console_emit(&c, 1);
+    UNLOCK();
+}
 
+void
+lowlevel_console_putbuf(const void *buf, size_t count)
+{
     if (NULL == buf || 0 == count) {
         return;
     }
     LOCK();
-    while (count--) {
-        lowlevel_console_putchar(*c++);
-    }
+    console_emit(buf, count);
     UNLOCK();
 }
 
@@ -70,8 +330,7 @@ void
 lowlevel_console_putnewline()
 {
     LOCK();
-    lowlevel_console_putchar('\r');
-    lowlevel_console_putchar('\n');
+    console_emit("\r\n", 2);
     UNLOCK();
 }
 
@@ -82,40 +341,29 @@ lowlevel_console_putstring(const char *string)
         return;
     }
     LOCK();
-    while (*string != '\0') {
-        lowlevel_console_putchar(*string++);
-    }
+    console_emit(string, strlen(string));
     UNLOCK();
 }
 
-static char ascii(uint8_t c) {
-    if (c <= 9) {
-        return c + '0';
-    } else if (c >= 0xa && c <= 0xf) {
-        return c + 'a' - 10;
-    } else {
-        return '?';
-    }
-}
-
 void
 lowlevel_console_puthex8(uint8_t val8)
 {
+    char p[2];
+
+    hex8(p, val8);
     LOCK();
-    lowlevel_console_putchar(ascii(val8 >> 4));
-    lowlevel_console_putchar(ascii(val8 & 0xf));
+    console_emit(p, sizeof(p));
     UNLOCK();
 }
 
 void
 lowlevel_console_puthex32(uint32_t val32)
 {
-    register int i;
+    char p[8];
 
+    hex32(p, val32);
     LOCK();
-    for (i = 0; i < 4; i++) {
-        lowlevel_console_puthex8(val32 >> ((3 - i) * 8));
-    }
+    console_emit(p, sizeof(p));
     UNLOCK();
 }
 
@@ -155,6 +403,8 @@ void lowlevel_console_hexdump_ex(const void *ptr, size_t size, const char *desc,
 {
     register int i;
     register uint8_t *buf = (uint8_t *)ptr;
+    char line[80];
+    size_t n = 0;
 
     LOCK();
     if (desc != NULL) {
@@ -169,21 +419,27 @@ void lowlevel_console_hexdump_ex(const void *ptr, size_t size, const char *desc,
     if (desc != NULL || (flags & HEXDUMP_ADDRESS)) {
         lowlevel_console_putnewline();
     }
+    /* a line at a time, at most 5 chars per byte */
     for (i = 0; i < size; i++) {
-        lowlevel_console_puthex8(buf[i]);
+        hex8(&line[n], buf[i]);
+        n += 2;
         if (flags & HEXDUMP_GROUP4_32) {
-            if (!i) {
-                continue;
+            if (i && !((i + 1) % 4)) {
+                line[n++] = ' ';
             }
-            if (!((i + 1) % 4)) {
-                lowlevel_console_putchar(' ');
-            }
-            if (!((i + 1) % 32)) {
-                lowlevel_console_putnewline();
+            if (i && !((i + 1) % 32)) {
+                line[n++] = '\r';
+                line[n++] = '\n';
             }
         }
+        if (n > sizeof(line) - 5) {
+            console_emit(line, n);
+            n = 0;
+        }
     }
-    lowlevel_console_putnewline();
+    line[n++] = '\r';
+    line[n++] = '\n';
+    console_emit(line, n);
     UNLOCK();
 }
 
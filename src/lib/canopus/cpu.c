@@ -12,6 +12,7 @@ cpu_reset(const char *reason)
     portDISABLE_INTERRUPTS();
     FUTURE_HOOK_1(cpu_reset_1, reason);
 
+    lowlevel_console_emergency();
     if (reason != NULL) {
         lowlevel_console_putnewline();
         lowlevel_console_putstring("CPU RESET: ");
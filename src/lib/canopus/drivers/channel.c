@@ -2,8 +2,62 @@
 #include <canopus/drivers/channel.h>
 #include <FreeRTOS.h>
 #include <task.h>
+#include <string.h>
+
+static const channel_t *channel_registry[CHANNEL_STATS_MAX_CHANNELS];
+static uint8_t channel_registry_count;
+
+static void _channel_register(const channel_t *const channel) {
+	uint8_t i;
+
+	taskENTER_CRITICAL();
+	for (i = 0; i < channel_registry_count; i++) {
+		if (channel_registry[i] == channel) break;
+	}
+	if ((i == channel_registry_count) && (i < CHANNEL_STATS_MAX_CHANNELS)) {
+		channel_registry[channel_registry_count++] = channel;
+	}
+	taskEXIT_CRITICAL();
+}
+
+static inline uint32_t _ticks_to_ms(portTickType ticks) {
+	return ticks * portTICK_RATE_MS;
+}
+
+static void _channel_stats_lock_wait(channel_state_t *c_state, portTickType since) {
+	uint32_t wait_ms = _ticks_to_ms(xTaskGetTickCount() - since);
+
+	taskENTER_CRITICAL();
+	c_state->stats.lock_wait_total_ms += wait_ms;
+	if (wait_ms > c_state->stats.lock_wait_max_ms) c_state->stats.lock_wait_max_ms = wait_ms;
+	taskEXIT_CRITICAL();
+}
+
+static void _channel_stats_error(channel_state_t *c_state, retval_t rv) {
+	if ((RV_SUCCESS == rv) || ((unsigned)rv >= CHANNEL_STATS_RV_COUNT)) return;
+
+	taskENTER_CRITICAL();
+	c_state->stats.errors[rv]++;
+	taskEXIT_CRITICAL();
+}
+
+static void _channel_stats_latency(channel_state_t *c_state, portTickType since) {
+	uint32_t ms = _ticks_to_ms(xTaskGetTickCount() - since);
+	uint32_t bucket = 0;
+
+	if (ms) {
+		for (bucket = 1; (bucket < CHANNEL_STATS_LATENCY_BUCKETS - 1) && (ms >> bucket); bucket++);
+	}
+
+	taskENTER_CRITICAL();
+	c_state->stats.transact_latency[bucket]++;
+	if (ms > c_state->stats.transact_max_ms) c_state->stats.transact_max_ms = ms;
+	taskEXIT_CRITICAL();
+}
+
+static retval_t _channel_state_send_lock(channel_state_t *c_state, channel_config_t const* c_config, portTickType xBlockTime_ms) {
+	portTickType since;
 
-static retval_t _channel_state_send_lock(const channel_state_t *c_state, channel_config_t const* c_config, portTickType xBlockTime_ms) {
 	if (false == c_state->is_open) return RV_ILLEGAL;
 	if (NULL == c_state->send_mutex) return RV_NACK;
 
@@ -13,13 +67,18 @@ static retval_t _channel_state_send_lock(const channel_state_t *c_state, channel
 
 	if (0 == xBlockTime_ms) xBlockTime_ms = c_config->lock_timeout_ms;
 
+	since = xTaskGetTickCount();
     if (pdFALSE == xSemaphoreTakeRecursive(c_state->send_mutex, xBlockTime_ms / portTICK_RATE_MS)) {
+    	_channel_stats_lock_wait(c_state, since);
         return RV_TIMEOUT;
     }
+	_channel_stats_lock_wait(c_state, since);
     return RV_SUCCESS;
 }
 
-static retval_t _channel_state_recv_lock(const channel_state_t *c_state, const channel_config_t *c_config, portTickType xBlockTime_ms) {
+static retval_t _channel_state_recv_lock(channel_state_t *c_state, const channel_config_t *c_config, portTickType xBlockTime_ms) {
+	portTickType since;
+
 	if (false == c_state->is_open) return RV_ILLEGAL;
 	if (NULL == c_state->recv_mutex) return RV_NACK;
 
@@ -29,9 +88,12 @@ static retval_t _channel_state_recv_lock(const channel_state_t *c_state, const c
 
 	if (0 == xBlockTime_ms) xBlockTime_ms = c_config->lock_timeout_ms;
 
+	since = xTaskGetTickCount();
     if (pdFALSE == xSemaphoreTakeRecursive(c_state->recv_mutex, xBlockTime_ms / portTICK_RATE_MS)) {
+    	_channel_stats_lock_wait(c_state, since);
         return RV_TIMEOUT;
     }
+	_channel_stats_lock_wait(c_state, since);
     return RV_SUCCESS;
 }
 
@@ -98,6 +160,7 @@ retval_t channel_open(const channel_t *const channel)
 
 	if (RV_SUCCESS == rv) {
 		c_state->is_open = true;
+		_channel_register(channel);
 	}
 
 	return rv;
@@ -179,6 +242,7 @@ retval_t channel_send(const channel_t *const channel,
 	channel_state_t *c_state;
 	channel_send_t *_send;
 	channel_transact_t *_transact;
+	size_t position;
 	retval_t rv;
 
 	assert(channel);
@@ -194,9 +258,13 @@ retval_t channel_send(const channel_t *const channel,
 	// If driver or driver->api are corrupted... why should they be corrupted with NULL?
 
 	rv = _channel_state_send_lock(c_state, channel->config, 0);
-	if ((RV_SUCCESS != rv) && (RV_NACK != rv)) return rv;
+	if ((RV_SUCCESS != rv) && (RV_NACK != rv)) {
+		_channel_stats_error(c_state, rv);
+		return rv;
+	}
 
 	rv = RV_SUCCESS;
+	position = send_frame->position;
 
 	_send = channel->driver->api->send;
 	if (IS_PTR_VALID(_send)) {
@@ -210,6 +278,57 @@ retval_t channel_send(const channel_t *const channel,
 		}
 	}
 
+	c_state->stats.sends++;
+	c_state->stats.bytes_out += send_frame->position - position;
+	_channel_stats_error(c_state, rv);
+
+	_channel_state_send_unlock(c_state);
+	return rv;
+}
+
+retval_t channel_send_chain(const channel_t *const channel,
+                            frame_chain_t *const send_chain)
+{
+	channel_state_t *c_state;
+	channel_send_chain_t *_send_chain;
+	frame_t *segment;
+	size_t i, available;
+	retval_t rv;
+
+	assert(channel);
+	c_state = channel->state;
+	assert(c_state);
+	assert(channel->config);
+
+	if (NULL == send_chain) return RV_ILLEGAL;
+	if (!frame_chain_available_data(send_chain)) return RV_SUCCESS;
+
+	rv = _channel_state_send_lock(c_state, channel->config, 0);
+	if ((RV_SUCCESS != rv) && (RV_NACK != rv)) {
+		_channel_stats_error(c_state, rv);
+		return rv;
+	}
+
+	rv = RV_SUCCESS;
+
+	_send_chain = channel->driver->api->send_chain;
+	if (IS_PTR_VALID(_send_chain)) {
+		available = frame_chain_available_data(send_chain);
+		rv = _send_chain(channel, send_chain);
+		c_state->stats.sends++;
+		c_state->stats.bytes_out += available - frame_chain_available_data(send_chain);
+		_channel_stats_error(c_state, rv);
+	} else {
+		/* accounted by channel_send() */
+		/* Generic fallback, one send per segment, all under the same lock */
+		for (i = 0; i < send_chain->count; i++) {
+			segment = &send_chain->segments[i];
+			if (!_frame_available_data(segment)) continue;
+			rv = channel_send(channel, segment);
+			if (RV_SUCCESS != rv) break;
+		}
+	}
+
 	_channel_state_send_unlock(c_state);
 	return rv;
 }
@@ -220,6 +339,7 @@ retval_t channel_recv(const channel_t *const channel,
 	channel_state_t *c_state;
 	channel_recv_t *_recv;
 	channel_transact_t *_transact;
+	size_t position;
 	retval_t rv;
 
 	assert(channel);
@@ -235,9 +355,13 @@ retval_t channel_recv(const channel_t *const channel,
 	// If driver or driver->api are corrupted... why should they be corrupted with NULL?
 
 	rv = _channel_state_recv_lock(c_state, channel->config, 0);
-	if ((RV_SUCCESS != rv) && (RV_NACK != rv)) return rv;
+	if ((RV_SUCCESS != rv) && (RV_NACK != rv)) {
+		_channel_stats_error(c_state, rv);
+		return rv;
+	}
 
 	rv = RV_SUCCESS;
+	position = recv_frame->position;
 
 	_recv = channel->driver->api->recv;
 	if (IS_PTR_VALID(_recv)) {
@@ -252,6 +376,10 @@ retval_t channel_recv(const channel_t *const channel,
 		}
 	}
 
+	c_state->stats.recvs++;
+	c_state->stats.bytes_in += recv_frame->position - position;
+	_channel_stats_error(c_state, rv);
+
 	_channel_state_recv_unlock(c_state);
 	return rv;
 }
@@ -263,7 +391,8 @@ retval_t channel_transact(const channel_t *const channel, frame_t *const send_fr
 	channel_send_t *_send;
 	channel_recv_t *_recv;
 	channel_transact_t *_transact;
-	size_t send_count, recv_count;
+	size_t send_count, recv_count, send_position, recv_position;
+	portTickType since;
 	retval_t rv;
 
 	assert(channel);
@@ -286,18 +415,25 @@ retval_t channel_transact(const channel_t *const channel, frame_t *const send_fr
 
     if (send_count > 0) {
     	rv = _channel_state_send_lock(c_state, channel->config, 0);
-    	if ((RV_SUCCESS != rv) && (RV_NACK != rv)) return rv;
+    	if ((RV_SUCCESS != rv) && (RV_NACK != rv)) {
+    		_channel_stats_error(c_state, rv);
+    		return rv;
+    	}
     }
 
     if (recv_count > 0) {
     	rv = _channel_state_recv_lock(c_state, channel->config, 0);
     	if ((RV_SUCCESS != rv) && (RV_NACK != rv)) {
     		if (send_count > 0) _channel_state_send_unlock(c_state);
+    		_channel_stats_error(c_state, rv);
     		return rv;
     	}
     }
 
 	rv = RV_SUCCESS;
+	send_position = (NULL != send_frame) ? send_frame->position : 0;
+	recv_position = (NULL != recv_frame) ? recv_frame->position : 0;
+	since = xTaskGetTickCount();
 
 	_transact = channel->driver->api->transact;
 	if (IS_PTR_VALID(_transact)) {
@@ -322,11 +458,107 @@ retval_t channel_transact(const channel_t *const channel, frame_t *const send_fr
 		}
 	}
 
+	_channel_stats_latency(c_state, since);
+	c_state->stats.transacts++;
+	if (NULL != send_frame) c_state->stats.bytes_out += send_frame->position - send_position;
+	if (NULL != recv_frame) c_state->stats.bytes_in += recv_frame->position - recv_position;
+	_channel_stats_error(c_state, rv);
+
 	if (send_count > 0) _channel_state_send_unlock(c_state);
 	if (recv_count > 0) _channel_state_recv_unlock(c_state);
 	return rv;
 }
 
+/* Data still to send, and received so far, in all the frames of a batch */
+static size_t _batch_bytes_out(const channel_transaction_t *transactions, size_t count) {
+	size_t i, bytes = 0;
+
+	for (i = 0; i < count; i++) {
+		if (NULL != transactions[i].send_frame) bytes += _frame_available_data(transactions[i].send_frame);
+	}
+	return bytes;
+}
+
+static size_t _batch_bytes_in(const channel_transaction_t *transactions, size_t count) {
+	size_t i, bytes = 0;
+
+	for (i = 0; i < count; i++) {
+		if (NULL != transactions[i].recv_frame) bytes += transactions[i].recv_frame->position;
+	}
+	return bytes;
+}
+
+retval_t channel_transact_batch(const channel_t *const channel,
+                                channel_transaction_t *const transactions, size_t count)
+{
+	channel_state_t *c_state;
+	channel_transact_batch_t *_transact_batch;
+	channel_transaction_t *t;
+	size_t bytes_out, bytes_in, i;
+	portTickType since;
+	retval_t rv;
+
+	assert(channel);
+	c_state = channel->state;
+	assert(c_state);
+	assert(channel->config);
+
+	if (false == c_state->is_open) return RV_ILLEGAL;
+	if ((NULL == transactions) && (count > 0)) return RV_ILLEGAL;
+	if (0 == count) return RV_SUCCESS;
+
+	rv = _channel_state_send_lock(c_state, channel->config, 0);
+	if ((RV_SUCCESS != rv) && (RV_NACK != rv)) {
+		_channel_stats_error(c_state, rv);
+		return rv;
+	}
+	rv = _channel_state_recv_lock(c_state, channel->config, 0);
+	if ((RV_SUCCESS != rv) && (RV_NACK != rv)) {
+		_channel_state_send_unlock(c_state);
+		_channel_stats_error(c_state, rv);
+		return rv;
+	}
+
+	_transact_batch = channel->driver->api->transact_batch;
+	if (IS_PTR_VALID(_transact_batch)) {
+		for (i = 0; i < count; i++) {
+			transactions[i].rv = RV_SUCCESS;
+			transactions[i].ticks = 0;
+		}
+		bytes_out = _batch_bytes_out(transactions, count);
+		bytes_in = _batch_bytes_in(transactions, count);
+		since = xTaskGetTickCount();
+
+		rv = _transact_batch(channel, transactions, count);
+
+		/* a batch is a single latency sample */
+		_channel_stats_latency(c_state, since);
+		c_state->stats.transacts += count;
+		c_state->stats.bytes_out += bytes_out - _batch_bytes_out(transactions, count);
+		c_state->stats.bytes_in += _batch_bytes_in(transactions, count) - bytes_in;
+		for (i = 0; i < count; i++) {
+			_channel_stats_error(c_state, transactions[i].rv);
+		}
+	} else {
+		/* accounted by channel_transact() */
+		for (i = 0; i < count; i++) {
+			t = &transactions[i];
+			t->rv = channel_transact(channel, t->send_frame, t->delay_ms, t->recv_frame);
+			t->ticks = xTaskGetTickCount();
+		}
+		rv = RV_SUCCESS;
+	}
+
+	/* the first failure */
+	for (i = 0; (i < count) && (RV_SUCCESS == rv); i++) {
+		rv = transactions[i].rv;
+	}
+
+	_channel_state_send_unlock(c_state);
+	_channel_state_recv_unlock(c_state);
+	return rv;
+}
+
 retval_t channel_driver_initialize(
         const channel_driver_t        * const driver)
 {
@@ -369,3 +601,39 @@ retval_t channel_driver_deinitialize(const channel_driver_t * const driver)
     	return driver->api->deinitialize(driver);
    	return RV_SUCCESS;
 }
+
+uint8_t channel_stats_count(void) {
+	return channel_registry_count;
+}
+
+retval_t channel_stats_get(uint8_t index, const channel_t **channel, channel_stats_t *stats) {
+	if (index >= channel_registry_count) return RV_NOENT;
+
+	if (NULL != channel) *channel = channel_registry[index];
+	if (NULL != stats) {
+		taskENTER_CRITICAL();
+		*stats = channel_registry[index]->state->stats;
+		taskEXIT_CRITICAL();
+	}
+	return RV_SUCCESS;
+}
+
+void channel_stats_reset(const channel_t *const channel) {
+	channel_stats_t *stats;
+
+	assert(channel);
+	assert(channel->state);
+
+	stats = &channel->state->stats;
+	taskENTER_CRITICAL();
+	memset(stats, 0, sizeof(*stats));
+	taskEXIT_CRITICAL();
+}
+
+void channel_stats_reset_all(void) {
+	uint8_t i;
+
+	for (i = 0; i < channel_registry_count; i++) {
+		channel_stats_reset(channel_registry[i]);
+	}
+}
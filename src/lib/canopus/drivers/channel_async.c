@@ -0,0 +1,289 @@
+#include <canopus/assert.h>
+#include <canopus/drivers/channel.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <semphr.h>
+
+/*
+ * Asynchronous channel requests.
+ *
+ * Drivers implementing `submit` get the requests directly. For the rest,
+ * requests are queued here in submission order and run by a small pool of
+ * worker tasks calling the synchronous channel_send/recv/transact(). A worker
+ * never takes a request for a channel another worker is busy with, so
+ * requests on the same channel complete in order, while a slow device only
+ * holds one worker.
+ */
+
+#ifndef CHANNEL_ASYNC_WORKERS
+#define CHANNEL_ASYNC_WORKERS		2
+#endif
+#define CHANNEL_ASYNC_STACKSIZE		(configMINIMAL_STACK_SIZE + 256)
+#define CHANNEL_ASYNC_PRIORITY		(tskIDLE_PRIORITY + 2)
+/* How often idle workers look for queued requests that timed out */
+#define CHANNEL_ASYNC_POLL_MS		100
+
+static struct {
+	channel_request_t *head;
+	channel_request_t *tail;
+	xSemaphoreHandle kick;
+	xTaskHandle workers[CHANNEL_ASYNC_WORKERS];
+} async;
+
+static inline bool request_expired(const channel_request_t *request, portTickType now) {
+	return (portTickType)(now - request->deadline) < ((portTickType)~0 >> 1);
+}
+
+/* Must be called inside a critical section */
+static void async_unlink(channel_request_t *request, channel_request_t *prev) {
+	if (NULL == prev) async.head = request->next;
+	else prev->next = request->next;
+	if (async.tail == request) async.tail = prev;
+	request->next = NULL;
+}
+
+void channel_request_complete(channel_request_t *const request, retval_t rv) {
+	assert(request);
+
+	request->rv = rv;
+	request->status = CHANNEL_REQUEST_IDLE;
+	if (IS_PTR_VALID(request->complete)) {
+		request->complete(request, rv);
+	}
+}
+
+/* Complete with RV_TIMEOUT every queued request past its deadline */
+static void async_expire(void) {
+	channel_request_t *request, *prev;
+	portTickType now;
+
+	do {
+		now = xTaskGetTickCount();
+		taskENTER_CRITICAL();
+		for (prev = NULL, request = async.head; NULL != request; prev = request, request = request->next) {
+			if (request_expired(request, now)) {
+				async_unlink(request, prev);
+				break;
+			}
+		}
+		taskEXIT_CRITICAL();
+
+		if (NULL != request) channel_request_complete(request, RV_TIMEOUT);
+	} while (NULL != request);
+}
+
+/* First queued request whose channel is not being served, NULL if none */
+static channel_request_t *async_take(void) {
+	channel_request_t *request, *prev;
+	bool more = false;
+
+	taskENTER_CRITICAL();
+	for (prev = NULL, request = async.head; NULL != request; prev = request, request = request->next) {
+		if (!request->channel->state->async_busy) {
+			async_unlink(request, prev);
+			request->channel->state->async_busy = true;
+			request->status = CHANNEL_REQUEST_RUNNING;
+			more = (NULL != async.head);
+			break;
+		}
+	}
+	taskEXIT_CRITICAL();
+
+	/* let another worker look at what's left */
+	if (more) xSemaphoreGive(async.kick);
+	return request;
+}
+
+static void async_run(channel_request_t *request) {
+	const channel_t *channel = request->channel;
+	retval_t rv;
+
+	switch (request->op) {
+	case CHANNEL_OP_SEND:
+		rv = channel_send(channel, request->send_frame);
+		break;
+	case CHANNEL_OP_RECV:
+		rv = channel_recv(channel, request->recv_frame);
+		break;
+	case CHANNEL_OP_TRANSACT:
+		rv = channel_transact(channel, request->send_frame, request->delay_ms, request->recv_frame);
+		break;
+	default:
+		rv = RV_ILLEGAL;
+		break;
+	}
+
+	taskENTER_CRITICAL();
+	channel->state->async_busy = false;
+	taskEXIT_CRITICAL();
+
+	/* requests for this channel may be waiting for it to be free */
+	if (NULL != async.head) xSemaphoreGive(async.kick);
+
+	channel_request_complete(request, rv);
+}
+
+static void async_worker_task(void *params) {
+	channel_request_t *request;
+
+	for (;;) {
+		xSemaphoreTake(async.kick, CHANNEL_ASYNC_POLL_MS / portTICK_RATE_MS);
+		async_expire();
+		while (NULL != (request = async_take())) {
+			async_run(request);
+			async_expire();
+		}
+	}
+}
+
+/* Started once a worker is: if none could be created, the next request
+ * tries again */
+static retval_t async_initialize(void) {
+	retval_t rv = RV_SUCCESS;
+	int i;
+
+	if (NULL != async.workers[0]) return RV_SUCCESS;
+
+	/* one caller at a time, and no worker runs before it's all set up */
+	vTaskSuspendAll();
+	if (NULL == async.workers[0]) {
+		if (NULL == async.kick) vSemaphoreCreateBinary(async.kick);
+		if (NULL == async.kick) rv = RV_NOSPACE;
+
+		for (i = 0; (RV_SUCCESS == rv) && (i < CHANNEL_ASYNC_WORKERS); i++) {
+			if (pdPASS != xTaskCreate(
+					async_worker_task,
+					(signed char *)"Channel/async",
+					CHANNEL_ASYNC_STACKSIZE,
+					NULL,
+					CHANNEL_ASYNC_PRIORITY,
+					&async.workers[i])) {
+				async.workers[i] = NULL;
+				if (0 == i) rv = RV_NOSPACE;
+				break;
+			}
+		}
+	}
+	xTaskResumeAll();
+
+	return rv;
+}
+
+static retval_t channel_submit(const channel_t *const channel, channel_request_t *const request) {
+	channel_submit_t *_submit;
+	uint32_t timeout_ms;
+	retval_t rv;
+
+	assert(channel);
+	assert(channel->state);
+	assert(channel->config);
+
+	if (NULL == request) return RV_ILLEGAL;
+	if (false == channel->state->is_open) return RV_ILLEGAL;
+	if (CHANNEL_REQUEST_IDLE != request->status) return RV_BUSY;
+
+	timeout_ms = request->timeout_ms;
+	if (0 == timeout_ms) timeout_ms = channel->config->transaction_timeout_ms;
+
+	request->channel = channel;
+	request->rv = RV_SUCCESS;
+	request->next = NULL;
+	request->deadline = xTaskGetTickCount() + timeout_ms / portTICK_RATE_MS;
+
+	_submit = channel->driver->api->submit;
+	if (IS_PTR_VALID(_submit)) {
+		request->status = CHANNEL_REQUEST_RUNNING;
+		rv = _submit(channel, request);
+		if (RV_SUCCESS != rv) request->status = CHANNEL_REQUEST_IDLE;
+		return rv;
+	}
+
+	rv = async_initialize();
+	if (RV_SUCCESS != rv) return rv;
+
+	taskENTER_CRITICAL();
+	request->status = CHANNEL_REQUEST_QUEUED;
+	if (NULL == async.tail) async.head = request;
+	else async.tail->next = request;
+	async.tail = request;
+	taskEXIT_CRITICAL();
+
+	xSemaphoreGive(async.kick);
+	return RV_SUCCESS;
+}
+
+retval_t channel_send_async(const channel_t *const channel, channel_request_t *const request,
+                            frame_t *const send_frame) {
+	if ((NULL == request) || (NULL == send_frame)) return RV_ILLEGAL;
+	if (CHANNEL_REQUEST_IDLE != request->status) return RV_BUSY;
+
+	request->op = CHANNEL_OP_SEND;
+	request->send_frame = send_frame;
+	request->recv_frame = NULL;
+	request->delay_ms = 0;
+	return channel_submit(channel, request);
+}
+
+retval_t channel_recv_async(const channel_t *const channel, channel_request_t *const request,
+                            frame_t *const recv_frame) {
+	if ((NULL == request) || (NULL == recv_frame)) return RV_ILLEGAL;
+	if (CHANNEL_REQUEST_IDLE != request->status) return RV_BUSY;
+
+	request->op = CHANNEL_OP_RECV;
+	request->send_frame = NULL;
+	request->recv_frame = recv_frame;
+	request->delay_ms = 0;
+	return channel_submit(channel, request);
+}
+
+retval_t channel_transact_async(const channel_t *const channel, channel_request_t *const request,
+                                frame_t *const send_frame, uint32_t delay_ms, frame_t *const recv_frame) {
+	if (NULL == request) return RV_ILLEGAL;
+	if ((NULL == send_frame) && (NULL == recv_frame)) return RV_ILLEGAL;
+	if (CHANNEL_REQUEST_IDLE != request->status) return RV_BUSY;
+
+	request->op = CHANNEL_OP_TRANSACT;
+	request->send_frame = send_frame;
+	request->recv_frame = recv_frame;
+	request->delay_ms = delay_ms;
+	return channel_submit(channel, request);
+}
+
+retval_t channel_request_cancel(channel_request_t *const request) {
+	channel_request_t *it, *prev;
+	channel_cancel_t *_cancel;
+	retval_t rv;
+
+	if (NULL == request) return RV_ILLEGAL;
+
+	switch (request->status) {
+	case CHANNEL_REQUEST_QUEUED:
+		taskENTER_CRITICAL();
+		for (prev = NULL, it = async.head; NULL != it; prev = it, it = it->next) {
+			if (it == request) {
+				async_unlink(it, prev);
+				break;
+			}
+		}
+		taskEXIT_CRITICAL();
+
+		/* a worker took it in the meantime */
+		if (NULL == it) return RV_BUSY;
+		break;
+
+	case CHANNEL_REQUEST_RUNNING:
+		_cancel = request->channel->driver->api->cancel;
+		if (!IS_PTR_VALID(request->channel->driver->api->submit) || !IS_PTR_VALID(_cancel)) {
+			return RV_BUSY;
+		}
+		rv = _cancel(request->channel, request);
+		if (RV_SUCCESS != rv) return rv;
+		break;
+
+	default:
+		return RV_ILLEGAL;
+	}
+
+	channel_request_complete(request, RV_ERROR);
+	return RV_SUCCESS;
+}
@@ -3,6 +3,10 @@
 #include <canopus/drivers/flash.h>
 #include <string.h>
 
+#include <FreeRTOS.h>
+#include <task.h>
+#include <semphr.h>
+
 #ifdef FLASH_DEBUG
 const char *
 dev_flash_errmsg(flash_err_t err) {
@@ -44,25 +48,6 @@ dev_flash_errmsg(flash_err_t err) {
 /* Definition of "Sector":
  * a contiguous region of Flash memory which must be erased simultaneously. */
 
-#define FLASH_SECTOR_MAXSIZE (1*1024) /* FIXME nano:64K,8K tms: 128K,32K,16K */
-
-// TODO arch-dep: TMS570 poweron dedicated SRAM bank, use it, power it off
-static char *
-flash_alloc(size_t size) /* may come from HEAP, BSS or another free sector */
-{
-    static char bss_buf[FLASH_SECTOR_MAXSIZE]; /* XXX not reentrant */
-
-    assert(size <= FLASH_SECTOR_MAXSIZE);
-
-    return bss_buf;
-}
-
-static void
-flash_free(const char *ptr)
-{
-    /* nothing */
-}
-
 #define FLASH_WORD_WRITABLE(current, new) (((current) & (new)) == new)
 
 static enum { NO, YES }
@@ -94,90 +79,214 @@ sector_needs_erase(const void *dst, const void *src, size_t size)
 
 #define FLASH_SECTOR_MASK(addr) (flash_sector_size(addr) - 1) /* expect PAGE aligned sector_size */
 
+/* Sector cache.
+ *
+ * When a patch needs an erase, the sector is copied to a static buffer and
+ * patched there. The buffer takes sectors up to FLASH_SECTOR_MAXSIZE, set by
+ * the board. The 32K default covers the TMS570's EEPROM bank (16K sectors)
+ * and its small program sectors (32K, the first 128K of bank 0), and the
+ * AT49BV320DT's 8K sectors. A patch needing an erase of a bigger sector
+ * fails with FLASH_ERR_INVALID: the TMS570's 128K program sectors and the
+ * AT49BV320DT's 64K ones (it's never taken from the heap). It's only
+ * written back when a patch goes to another sector, at the end of
+ * flash_patch_ex() or, between flash_cache_begin() and flash_cache_end(),
+ * at the end of the batch: nearby patches to one sector cost one erase.
+ * On write back the sector is only erased if sector_needs_erase() says so,
+ * otherwise just the changed words are written. Patches that need no erase
+ * to a sector that's not cached go straight to flash. A recursive mutex
+ * serializes callers.
+ */
+#ifndef FLASH_SECTOR_MAXSIZE
+#define FLASH_SECTOR_MAXSIZE (32*1024)
+#endif
+
+typedef struct flash_cache_t {
+    xSemaphoreHandle mutex;
+    uintptr_t base;     /* of the cached sector, if buf != NULL */
+    size_t size;
+    size_t lo, hi;      /* changed bytes [lo, hi) */
+    char *buf;
+    int batch;
+} flash_cache_t;
+
+static flash_cache_t cache;
+static char sector_buf[FLASH_SECTOR_MAXSIZE];
+
+static void
+flash_cache_lock(void)
+{
+    if (NULL == cache.mutex) {
+        vTaskSuspendAll();
+        if (NULL == cache.mutex) {
+            cache.mutex = xSemaphoreCreateRecursiveMutex();
+        }
+        (void)xTaskResumeAll();
+    }
+    assert(NULL != cache.mutex);
+    (void)xSemaphoreTakeRecursive(cache.mutex, portMAX_DELAY);
+}
+
+static void
+flash_cache_unlock(void)
+{
+    (void)xSemaphoreGiveRecursive(cache.mutex);
+}
+
+static flash_err_t
+flash_cache_flush(void)
+{
+    const void *dst;
+    size_t wordsize, lo, hi;
+    flash_err_t err = FLASH_ERR_OK;
+
+    if (NULL == cache.buf) return FLASH_ERR_OK;
+
+    if (cache.hi > cache.lo) {
+        wordsize = flash_sector_wordsize((const void *)cache.base);
+        lo = cache.lo - cache.lo % wordsize;
+        hi = cache.hi + (wordsize - cache.hi % wordsize) % wordsize;
+        dst = (const void *)(cache.base + lo);
+        if (sector_needs_erase(dst, cache.buf + lo, hi - lo) == YES) {
+            err = flash_erase((const void *)cache.base, cache.size);
+            if (FLASH_ERR_OK == err) {
+                err = flash_write((const void *)cache.base, cache.buf, cache.size);
+            }
+        } else {
+            err = flash_write(dst, cache.buf + lo, hi - lo);
+        }
+    }
+
+    cache.buf = NULL;
+    return err;
+}
+
+static flash_err_t
+flash_cache_load(uintptr_t base, size_t size)
+{
+    flash_err_t err;
+
+    if ((NULL != cache.buf) && (cache.base == base)) return FLASH_ERR_OK;
+
+    err = flash_cache_flush();
+    if (FLASH_ERR_OK != err) return err;
+
+    if (size > sizeof(sector_buf)) {
+        return FLASH_ERR_INVALID;
+    }
+    cache.buf = sector_buf;
+    memcpy(cache.buf, (const void *)base, size);
+    cache.base = base;
+    cache.size = size;
+    cache.lo = size;
+    cache.hi = 0;
+    return FLASH_ERR_OK;
+}
+
+static bool
+flash_cache_holds(const void *dst)
+{
+    return (NULL != cache.buf) && (cache.base <= (uintptr_t)dst) && ((uintptr_t)dst < cache.base + cache.size);
+}
+
+/* dst..dst+size must be inside one sector */
 static flash_err_t
 flash_patch_sector(const void *dst, const void *src, size_t size, flashpatch_mode_e mode)
 {
     const size_t sector_size = flash_sector_size(dst);
-    char *buf = (char *)src;
+    uintptr_t sector_baseaddr;
+    off_t sector_offset;
     flash_err_t err;
 
     /* verify internal library calls correctness (must not happen) */
     assert(size > 0);
     assert(size <= sector_size);
 
-    if (mode != FLASHPATCH_FORCE && !memcmp(dst, src, size)) {
-        /* no need to write the flash if the data is already here
-         * except if we "force" the write */
-        return FLASH_ERR_OK;
-    }
-
-    /* if there is enough bits high we might avoid an Erase */
-    if (sector_needs_erase(dst, src, size) == YES) {
-        uintptr_t sector_baseaddr, sector_mask;
-        off_t sector_offset;
-
-        if (mode == FLASHPATCH_NOERASE) {
-            return FLASH_ERR_ERASE;
-        }
-        sector_mask = FLASH_SECTOR_MASK(dst);
-        sector_baseaddr = ((uintptr_t)dst) & ~sector_mask;
-        sector_offset = ((uintptr_t)dst) & sector_mask;
-        if ((buf = flash_alloc(sector_size)) == NULL) {
-            return FLASH_ERR_PROTOCOL;
+    if (!flash_cache_holds(dst)) {
+        if (mode != FLASHPATCH_FORCE && !memcmp(dst, src, size)) {
+            /* no need to write the flash if the data is already here
+             * except if we "force" the write */
+            return FLASH_ERR_OK;
         }
 
-        if (sector_offset + size > sector_size) {
-            size = sector_size - sector_offset; /* avoid buffer overflow */
-        }
-        /* copy original flash data, then insert our data */
-        memcpy(buf, (const void *)sector_baseaddr, sector_size);
-        memcpy(buf + sector_offset, src, size);
-
-        dst = (void *)sector_baseaddr;
-        size = sector_size;
-        err = flash_erase(dst, size);
-        if (FLASH_ERR_OK != err) {
-            flash_free(buf);
-            return err;
+        /* if there is enough bits high we might avoid an Erase */
+        if (sector_needs_erase(dst, src, size) == NO) {
+            return flash_write(dst, src, size);
         }
     }
-    err = flash_write(dst, buf, size);
 
-    if (buf != (char *)src) {
-        flash_free(buf);
+    if (mode == FLASHPATCH_NOERASE && sector_needs_erase(dst, src, size) == YES) {
+        return FLASH_ERR_ERASE;
     }
 
+    sector_baseaddr = ((uintptr_t)dst) & ~FLASH_SECTOR_MASK(dst);
+    sector_offset = ((uintptr_t)dst) - sector_baseaddr;
+    err = flash_cache_load(sector_baseaddr, sector_size);
+    if (FLASH_ERR_OK != err) return err;
+
+    memcpy(cache.buf + sector_offset, src, size);
+    if (sector_offset < cache.lo) cache.lo = sector_offset;
+    if (sector_offset + size > cache.hi) cache.hi = sector_offset + size;
+
+    return FLASH_ERR_OK;
+}
+
+void
+flash_cache_begin(void)
+{
+    flash_cache_lock();
+    cache.batch++;
+}
+
+flash_err_t
+flash_cache_end(void)
+{
+    flash_err_t err = FLASH_ERR_OK;
+
+    assert(cache.batch > 0);
+    if (0 == --cache.batch) {
+        err = flash_cache_flush();
+    }
+    flash_cache_unlock();
     return err;
 }
 
 flash_err_t
 flash_patch_ex(const void *dst, const void *src, size_t size, flashpatch_mode_e mode) {
     uintptr_t dst_addr, src_addr;
-    flash_err_t err;
+    flash_err_t err = FLASH_ERR_OK;
 
     dst_addr = (uintptr_t)dst;
     src_addr = (uintptr_t)src;
+
+    flash_cache_begin();
     while (size) { /* for each sector */
         size_t wr_size, sector_size;
 
         sector_size = flash_sector_size((void*)dst_addr);
-        if (size > sector_size) {
-            wr_size = sector_size;
-        } else {
+        if (0 == sector_size) {
+            err = FLASH_ERR_INVALID;
+            break;
+        }
+        wr_size = sector_size - (dst_addr & (sector_size - 1)); /* up to the end of the sector */
+        if (size < wr_size) {
             wr_size = size;
         }
         err =  flash_patch_sector((void*)dst_addr, (void*)src_addr, wr_size, mode);
         if (FLASH_ERR_OK != err) {
-            return err;
+            break;
         }
         size -= wr_size;
         dst_addr += wr_size;
         src_addr += wr_size;
     }
+    if (FLASH_ERR_OK == err) {
+        err = flash_cache_end();
+    } else {
+        (void)flash_cache_end();
+    }
 
-    return FLASH_ERR_OK;
+    return err;
 }
-
 flash_err_t
 flash_patch(const void *dst, const void *src, size_t size)
 {
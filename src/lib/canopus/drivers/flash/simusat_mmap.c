@@ -9,6 +9,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <stdlib.h>
 #include <string.h>
 
 #if 0
@@ -35,30 +36,89 @@ struct flash_cfg {
     int prot;
 };
 
+/* Erases and writes only unprotect and msync() the sector they touch. With
+ * write-behind the sector is just marked dirty, in chunks of
+ * FLASH_DIRTY_CHUNK (the smallest sector), until memhooks_flash_sync():
+ * the mapping is MAP_SHARED, so the page cache has the data anyway and a
+ * crash of the simulator loses nothing, only a crash of the host may. */
+#define FLASH_DIRTY_CHUNK	(8*1024)
+#define FLASH_DIRTY_CHUNKS	(4*1024*1024 / FLASH_DIRTY_CHUNK)
+
 struct flash_ctx {
     const flash_cfg_t *cfg;
     int fd;
     off_t size;
     void *m;
+    uintptr_t base;    /* where the flash starts, m may be above it */
+    uint8_t dirty[FLASH_DIRTY_CHUNKS / 8];
 };
 
 #define FLASH_MAX 4
 
+static bool write_behind;
+
 /* ==================== mmio dumb impl ==================== */
 
+/* [*start, *start + *len) are the sectors [addr, addr + size) falls in,
+ * as far as they're mapped */
+static void
+flash_mmio_sector_range(flash_ctx_t *f, const void *addr, size_t size, uintptr_t *start, size_t *len)
+{
+    const void *last = (const char *)addr + (size ? size - 1 : 0);
+    uintptr_t end, m = (uintptr_t)f->m;
+
+    *start = (uintptr_t)f->cfg->sector_base_addr(f, addr);
+    end = (uintptr_t)f->cfg->sector_base_addr(f, last) + f->cfg->sector_size(f, last);
+    if (*start < m) *start = m;
+    if (end > m + f->size) end = m + f->size;
+    *len = end - *start;
+}
+
 static bool
-flash_mmio_enable_write(flash_ctx_t *f)
+flash_mmio_enable_write(flash_ctx_t *f, uintptr_t start, size_t len)
 {
-    return !mprotect(f->m, f->size, f->cfg->prot | PROT_WRITE);
+    return !mprotect((void *)start, len, f->cfg->prot | PROT_WRITE);
 }
 
 static bool
-flash_mmio_disable_write(flash_ctx_t *f)
+flash_mmio_disable_write(flash_ctx_t *f, uintptr_t start, size_t len)
 {
-    if (mprotect(f->m, f->size, f->cfg->prot & ~PROT_WRITE)) {
+    size_t chunk, last;
+
+    if (mprotect((void *)start, len, f->cfg->prot & ~PROT_WRITE)) {
         return false;
     }
-    return !msync(f->m, f->size, MS_SYNC);
+    if (!write_behind) {
+        return !msync((void *)start, len, MS_SYNC);
+    }
+    last = (start + len - 1 - (uintptr_t)f->m) / FLASH_DIRTY_CHUNK;
+    for (chunk = (start - (uintptr_t)f->m) / FLASH_DIRTY_CHUNK; chunk <= last; chunk++) {
+        f->dirty[chunk / 8] |= 1 << (chunk % 8);
+    }
+    return true;
+}
+
+/* msync()s the dirty chunks, as few calls as contiguous runs */
+static bool
+flash_mmio_sync(flash_ctx_t *f)
+{
+    size_t chunk, first, chunks = (f->size + FLASH_DIRTY_CHUNK - 1) / FLASH_DIRTY_CHUNK;
+    uintptr_t start;
+    size_t len;
+    bool ok = true;
+
+    for (chunk = 0; chunk < chunks; chunk++) {
+        if (!(f->dirty[chunk / 8] & (1 << (chunk % 8)))) continue;
+
+        for (first = chunk; (chunk < chunks) && (f->dirty[chunk / 8] & (1 << (chunk % 8))); chunk++) {
+            f->dirty[chunk / 8] &= ~(1 << (chunk % 8));
+        }
+        start = (uintptr_t)f->m + first * FLASH_DIRTY_CHUNK;
+        len = (chunk - first) * FLASH_DIRTY_CHUNK;
+        if (start + len > (uintptr_t)f->m + f->size) len = (uintptr_t)f->m + f->size - start;
+        ok &= !msync((void *)start, len, MS_SYNC);
+    }
+    return ok;
 }
 
 flash_err_t
@@ -70,11 +130,15 @@ flash_mmio_dumb_init(flash_ctx_t *ctx)
 flash_err_t
 flash_mmio_dumb_sector_erase(flash_ctx_t *ctx, const void *addr, unsigned int size)
 {
+    uintptr_t start;
+    size_t len;
+
     assert(size <= ctx->cfg->sector_size(ctx, ctx->cfg->sector_base_addr(ctx, addr)));
 
-    flash_mmio_enable_write(ctx);
+    flash_mmio_sector_range(ctx, addr, size, &start, &len);
+    flash_mmio_enable_write(ctx, start, len);
     memset((void *)addr, 0xff, size);
-    flash_mmio_disable_write(ctx);
+    flash_mmio_disable_write(ctx, start, len);
 
     return FLASH_ERR_OK;
 }
@@ -82,11 +146,15 @@ flash_mmio_dumb_sector_erase(flash_ctx_t *ctx, const void *addr, unsigned int si
 flash_err_t
 flash_mmio_dumb_sector_write(flash_ctx_t *ctx, const void *addr, const void *ptr, int size)
 {
+    uintptr_t start;
+    size_t len;
+
     assert(size <= ctx->cfg->sector_size(ctx, ctx->cfg->sector_base_addr(ctx, addr)));
 
-    flash_mmio_enable_write(ctx);
+    flash_mmio_sector_range(ctx, addr, size, &start, &len);
+    flash_mmio_enable_write(ctx, start, len);
     memcpy((void *)addr, ptr, size);
-    flash_mmio_disable_write(ctx);
+    flash_mmio_disable_write(ctx, start, len);
 
     return FLASH_ERR_OK;
 }
@@ -137,7 +205,8 @@ mmap_flash_init(uintptr_t addr, const char *pathname, const flash_cfg_t *cfg)
 
     flash_ctx_t *f = empty_flash_ctx();
     assert(NULL != f);
-    f->fd = open(pathname, O_RDWR|O_CREAT|O_SYNC, 0644);
+    assert(cfg->size <= FLASH_DIRTY_CHUNKS * FLASH_DIRTY_CHUNK);
+    f->fd = open(pathname, O_RDWR|O_CREAT, 0644);
     if (-1 == f->fd) return false;
     if (-1 == fstat(f->fd, &st)) return false;
     if (st.st_size < cfg->size) {
@@ -172,6 +241,7 @@ mmap_flash_init(uintptr_t addr, const char *pathname, const flash_cfg_t *cfg)
 
     f->cfg = cfg;
     f->size = length;
+    f->base = addr - offset;
     FLASH_REPORT("0x%08lx (size:0x%06x) initialized as %s using %s\n", addr, length, cfg->name, pathname);
 
     return true;
@@ -179,6 +249,40 @@ mmap_flash_init(uintptr_t addr, const char *pathname, const flash_cfg_t *cfg)
 
 /* ==================== external impl ==================== */
 
+bool
+memhooks_flash_sync(void)
+{
+    int i;
+    bool ok = true;
+
+    for (i = 0; i < ARRAY_COUNT(flash); i++) {
+        if (NULL != flash[i].cfg) {
+            ok &= flash_mmio_sync(&flash[i]);
+        }
+    }
+    return ok;
+}
+
+static void
+memhooks_flash_sync_atexit(void)
+{
+    (void)memhooks_flash_sync();
+}
+
+void
+memhooks_flash_write_behind(bool enable)
+{
+    static bool atexit_registered;
+
+    if (enable && !atexit_registered) {
+        atexit_registered = !atexit(memhooks_flash_sync_atexit);
+    }
+    if (!enable) {
+        (void)memhooks_flash_sync();
+    }
+    write_behind = enable;
+}
+
 size_t
 flash_sector_wordsize(const void *addr)
 {
@@ -222,6 +326,8 @@ _flash_erase(const void *addr, unsigned int size)
 {
     flash_ctx_t *f = flash_ctx(addr);
 
+    if (NULL == f) return FLASH_ERR_INVALID;
+
     /* word aligned */
     if (size % 1) size += 1;
 
@@ -236,6 +342,8 @@ _flash_write(const void *addr, const void *ptr, int size)
 {
     flash_ctx_t *f = flash_ctx(addr);
 
+    if (NULL == f) return FLASH_ERR_INVALID;
+
     /* word aligned */
     if (size % 1) size += 1;
 
@@ -245,10 +353,15 @@ _flash_write(const void *addr, const void *ptr, int size)
     return f->cfg->sector_write(f, addr, ptr, size);
 }
 
+/* sectors are aligned to their size, counting from where the flash starts */
 static const void *
-TODO_sector_base_addr(flash_ctx_t *ctx, const void *addr)
+aligned_sector_base_addr(flash_ctx_t *ctx, const void *addr)
 {
-    return addr; // XXX TODO
+    size_t size = ctx->cfg->sector_size(ctx, addr);
+    uintptr_t offset = (uintptr_t)addr - ctx->base;
+
+    assert(0 != size);
+    return (const void *)(ctx->base + offset - offset % size);
 }
 
 /* ==================== nanomind simulation ==================== */
@@ -273,7 +386,7 @@ static const flash_cfg_t at49bv320dt_cfg = {
     "AT49BV320DT",
     sizeof(uint16_t),
     4*1024*1024,
-    TODO_sector_base_addr,
+    aligned_sector_base_addr,
     at49bv320dt_sector_size,
     flash_mmio_dumb_init,
     flash_mmio_dumb_sector_erase,
@@ -295,7 +408,7 @@ memhooks_nanomind_flash_init(void)
 static size_t
 tms570ls3137_sector_size(flash_ctx_t *ctx, const void *addr)
 {
-	uintptr_t baddr = (uintptr_t)ctx->m;
+	uintptr_t baddr = (uintptr_t)addr;
 
 	if (baddr >= 0xf0200000UL) {
 		return 16*1024;
@@ -311,7 +424,7 @@ static const flash_cfg_t f021_cfg[] = {
         "F021 bank#0",
         sizeof(uint16_t), // FIXME
         12*128*1024,
-        TODO_sector_base_addr, // XXX
+        aligned_sector_base_addr,
         tms570ls3137_sector_size,
         flash_mmio_dumb_init,
         flash_mmio_dumb_sector_erase,
@@ -322,7 +435,7 @@ static const flash_cfg_t f021_cfg[] = {
         "F021 bank#1",
         sizeof(uint16_t), // FIXME
         12*128*1024,
-        TODO_sector_base_addr, // XXX
+        aligned_sector_base_addr,
         tms570ls3137_sector_size,
         flash_mmio_dumb_init,
         flash_mmio_dumb_sector_erase,
@@ -333,7 +446,7 @@ static const flash_cfg_t f021_cfg[] = {
         "F021 bank#7",
         sizeof(uint16_t), // FIXME
         4*16*1024,
-        TODO_sector_base_addr, // XXX
+        aligned_sector_base_addr,
         tms570ls3137_sector_size,
         flash_mmio_dumb_init,
         flash_mmio_dumb_sector_erase,
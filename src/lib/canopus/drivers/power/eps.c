@@ -105,6 +105,12 @@ adc_name(eps_adc_channel_t chan)
 #define EPS_CMD_SET_BUS_RESET_TIMEOUT	8
 #define EPS_CMD_WATCHDOG				128
 
+#define EPS_ADC_DELAY_MS				2
+/* the EPS wants this much between an ADC read and the next command */
+#define EPS_ADC_PAUSE_MS				10
+/* ADC reads per channel_transact_batch(), bounded for the stack */
+#define EPS_ADC_BATCH_SIZE				8
+
 float eps_ADC_convertion(uint8_t channel, uint16_t rawValue) {
 	EPS_ADC_convertionValue_t convert;
 
@@ -274,12 +280,12 @@ retval_t eps_GetADCRaw(eps_adc_channel_t channel_id, uint16_t *value) {
 	retval_t rv;
     *value = ADC_ERROR_VALUE;
 
-	rv = channel_transact(ch_eps, &cmd, 2, &answer); // TODO document '2' with define
+	rv = channel_transact(ch_eps, &cmd, EPS_ADC_DELAY_MS, &answer);
     if (RV_SUCCESS != rv) {
         log_report_fmt(LOG_EPS, "eps_GetADCRaw(%d:%s) rv=%s\r\n", channel_id, adc_name(channel_id), retval_s(rv));
         return rv;
     }
-	vTaskDelay(10 / portTICK_RATE_MS);
+	vTaskDelay(EPS_ADC_PAUSE_MS / portTICK_RATE_MS);
 	frame_reset_for_reading(&answer);
 	rv = frame_get_u16(&answer, value);
     log_report_fmt(LOG_EPS, "eps_GetADCRaw(%d:%s) u16=0x%04x\r\n", channel_id, adc_name(channel_id), *value);
@@ -301,6 +307,60 @@ retval_t eps_GetADC(eps_adc_channel_t channel_id, float *value) {
 	return rv;
 }
 
+/* Reads samples[i].channel for every sample, EPS_ADC_BATCH_SIZE at a time,
+ * all the commands of a batch sent before waiting for the answers when the
+ * channel can. eps_GetADCRaw()'s pause after each read goes in delay_ms:
+ * it's waited before the answer instead of after it, but the commands still
+ * reach the EPS at least EPS_ADC_DELAY_MS + EPS_ADC_PAUSE_MS apart.
+ * @return RV_SUCCESS if all of them were read, the first failure otherwise
+ */
+retval_t eps_GetADCRawBatch(eps_adc_sample_t *samples, size_t count) {
+	channel_transaction_t transactions[EPS_ADC_BATCH_SIZE];
+	frame_t cmd[EPS_ADC_BATCH_SIZE], answer[EPS_ADC_BATCH_SIZE];
+	uint8_t cmd_buf[EPS_ADC_BATCH_SIZE][2], answer_buf[EPS_ADC_BATCH_SIZE][2];
+	eps_adc_sample_t *sample;
+	size_t done, n, i;
+	retval_t rv, first_rv = RV_SUCCESS;
+
+	for (i = 0; i < count; i++) {
+		if (samples[i].channel >= EPS_ADC_CHANNEL_COUNT) return RV_ILLEGAL;
+	}
+
+	for (done = 0; done < count; done += n) {
+		n = count - done;
+		if (n > EPS_ADC_BATCH_SIZE) n = EPS_ADC_BATCH_SIZE;
+
+		for (i = 0; i < n; i++) {
+			cmd_buf[i][0] = EPS_CMD_ADC;
+			cmd_buf[i][1] = samples[done + i].channel;
+			cmd[i] = (frame_t)DECLARE_FRAME(cmd_buf[i]);
+			answer[i] = (frame_t)DECLARE_FRAME(answer_buf[i]);
+			transactions[i] = (channel_transaction_t)DECLARE_CHANNEL_TRANSACTION(&cmd[i],
+					EPS_ADC_DELAY_MS + EPS_ADC_PAUSE_MS, &answer[i]);
+		}
+
+		(void)channel_transact_batch(ch_eps, transactions, n);
+
+		for (i = 0; i < n; i++) {
+			sample = &samples[done + i];
+			sample->raw = ADC_ERROR_VALUE;
+			sample->ticks = transactions[i].ticks;
+			rv = transactions[i].rv;
+			if (RV_SUCCESS == rv) {
+				frame_reset_for_reading(&answer[i]);
+				rv = frame_get_u16(&answer[i], &sample->raw);
+			}
+			sample->rv = rv;
+			if (RV_SUCCESS != rv) {
+				sample->raw = ADC_ERROR_VALUE;
+				log_report_fmt(LOG_EPS, "eps_GetADCRawBatch(%d:%s) rv=%s\r\n", sample->channel, adc_name(sample->channel), retval_s(rv));
+				if (RV_SUCCESS == first_rv) first_rv = rv;
+			}
+		}
+	}
+	return first_rv;
+}
+
 retval_t eps_GetStatus(uint16_t *status) {
 	static const uint8_t cmd_data[] = {EPS_CMD_STATUS, 0};
 	frame_t cmd = DECLARE_FRAME(cmd_data);
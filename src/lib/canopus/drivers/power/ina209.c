@@ -314,6 +314,43 @@ retval_t ina209_readRegister(const channel_t *const channel, uint8_t address, ui
 	return frame_get_u16(&answer, value);
 }
 
+// All the reads go in a single channel_transact_batch(), INA209_BATCH_SIZE at a time.
+// Returns the first failure, each sample has its own.
+retval_t ina209_readRegisterBatch(const channel_t *const channel, ina209_sample_t *samples, size_t count) {
+	channel_transaction_t transactions[INA209_BATCH_SIZE];
+	frame_t cmd[INA209_BATCH_SIZE], answer[INA209_BATCH_SIZE];
+	uint8_t answer_buf[INA209_BATCH_SIZE][2];
+	ina209_sample_t *sample;
+	size_t done, n, i;
+	retval_t rv, first_rv = RV_SUCCESS;
+
+	for (done = 0; done < count; done += n) {
+		n = count - done;
+		if (n > INA209_BATCH_SIZE) n = INA209_BATCH_SIZE;
+
+		for (i = 0; i < n; i++) {
+			cmd[i] = (frame_t)DECLARE_FRAME_SIZE(&samples[done + i].reg, 1);
+			answer[i] = (frame_t)DECLARE_FRAME(answer_buf[i]);
+			transactions[i] = (channel_transaction_t)DECLARE_CHANNEL_TRANSACTION(&cmd[i], 0, &answer[i]);
+		}
+
+		(void)channel_transact_batch(channel, transactions, n);
+
+		for (i = 0; i < n; i++) {
+			sample = &samples[done + i];
+			sample->ticks = transactions[i].ticks;
+			rv = transactions[i].rv;
+			if (RV_SUCCESS == rv) {
+				frame_reset_for_reading(&answer[i]);
+				rv = frame_get_u16(&answer[i], &sample->value);
+			}
+			sample->rv = rv;
+			if ((RV_SUCCESS != rv) && (RV_SUCCESS == first_rv)) first_rv = rv;
+		}
+	}
+	return first_rv;
+}
+
 retval_t ina209_writeRegister(const channel_t *const channel, uint8_t address, uint16_t value) {
 	frame_t cmd    = DECLARE_FRAME_SPACE(3);
 
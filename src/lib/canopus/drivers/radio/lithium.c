@@ -45,16 +45,9 @@ lithium_cmd_t get_li1cmd_from_frame_nocheck(frame_t *frame) {
 	return (lithium_cmd_t)frame_get_u8_nocheck(frame);
 }
 
-retval_t create_command_frame(lithium_cmd_t command, frame_t *payload_frame, frame_t *frame) {
+static
+uint16_t put_command_header(lithium_cmd_t command, uint16_t payload_size, frame_t *frame) {
     uint16_t chksum;
-    retval_t rv;
-    uint16_t payload_size;
-
-    assert(frame != NULL);
-
-    if (payload_frame != NULL && payload_frame->size > FRAME_PAYLOAD_MAXSIZE) {
-        return RV_ILLEGAL;
-    }
 
     /* sync header */
     frame_put_u8(frame, LITHIUM_SYNC_CHAR_1);
@@ -63,26 +56,84 @@ retval_t create_command_frame(lithium_cmd_t command, frame_t *payload_frame, fra
     frame_put_u8(frame, LITHIUM_DIRECTION_INPUT); /* command 'direction'. we will always send 'input' (0x10) commands to the radio */
     frame_put_u8(frame, command);                 /* command id */
 
-    payload_size = payload_frame == NULL ? 0 : _frame_available_data(payload_frame);
     frame_put_u16(frame, payload_size);  /* payload size */
 
     /* calculate and insert checksum for header */
     chksum = fletcher_chksum16(&(frame->buf[2]), 4, 0);
     frame_put_u16(frame, chksum);
+    return chksum;
+}
+
+/**
+ * Builds the command as a chain: [header][payload][checksum].
+ * Pool frames are chained as they are and disposed after being sent, any
+ * other payload (static or in the stack) is copied next to the header
+ * because it may be gone by the time the TX task gets to it.
+ * The payload is always consumed (chained or disposed).
+ */
+static
+retval_t create_command_chain(lithium_cmd_t command, frame_t *payload_frame, frame_chain_t *chain) {
+    frame_t *hdr_frame, trailer;
+    uint16_t chksum;
+    uint16_t payload_size;
+    bool zero_copy;
+    retval_t rv;
+
+    assert(chain != NULL);
+
+    if (payload_frame != NULL && payload_frame->size > FRAME_PAYLOAD_MAXSIZE) {
+        frame_dispose(payload_frame);
+        return RV_ILLEGAL;
+    }
+
+    payload_size = payload_frame == NULL ? 0 : _frame_available_data(payload_frame);
+    zero_copy = (payload_size > 0) && frame_is_pooled(payload_frame);
+
+    rv = frame_allocate_size(&hdr_frame, FRAME_HEADER_SIZE + CHECKSUM_SIZE + (zero_copy ? 0 : payload_size));
+    if (RV_SUCCESS != rv) {
+    	if (payload_frame != NULL) frame_dispose(payload_frame);
+    	return rv;
+    }
+
+    frame_chain_init(chain);
+    frame_chain_own(chain, hdr_frame);
+
+    chksum = put_command_header(command, payload_size, hdr_frame);
 
     /* if no payload, we're done */
     if (payload_size == 0) {
-        return RV_SUCCESS;
+        if (payload_frame != NULL) frame_dispose(payload_frame);
+        frame_reset_for_reading(hdr_frame);
+        return frame_chain_append(chain, hdr_frame);
     }
 
-    rv = frame_transfer(frame, payload_frame);
-    if (RV_SUCCESS != rv) return RV_NOSPACE;
+    /* calculate checksum for whole command, including the header checksum */
+    chksum = fletcher_chksum16(&(hdr_frame->buf[6]), CHECKSUM_SIZE, chksum);
+    chksum = fletcher_chksum16(frame_get_data_pointer_nocheck(payload_frame, payload_size), payload_size, chksum);
 
-    /* calculate ans insert checksum for whole command */
-    chksum = fletcher_chksum16(&(frame->buf[6]), payload_size + CHECKSUM_SIZE, chksum);
-    frame_put_u16(frame, chksum);
+    if (zero_copy) {
+    	frame_chain_own(chain, payload_frame);
 
-    return RV_SUCCESS;
+    	trailer = (frame_t)DECLARE_FRAME_SIZE(&hdr_frame->buf[FRAME_HEADER_SIZE], CHECKSUM_SIZE);
+    	frame_put_u16(&trailer, chksum);
+    	frame_reset(&trailer);
+
+    	frame_reset_for_reading(hdr_frame);
+    	frame_chain_append(chain, hdr_frame);
+    	frame_chain_append(chain, payload_frame);
+    	return frame_chain_append(chain, &trailer);
+    }
+
+    rv = frame_transfer(hdr_frame, payload_frame);
+    frame_dispose(payload_frame);
+    if (RV_SUCCESS != rv) {
+    	frame_chain_dispose(chain);
+    	return RV_NOSPACE;
+    }
+
+    frame_put_u16(hdr_frame, chksum);
+    frame_reset_for_reading(hdr_frame);
+    return frame_chain_append(chain, hdr_frame);
 }
 
 retval_t lithium_parse_command_frame(frame_t *frame, lithium_cmd_t *command, bool *is_ack) {
@@ -225,13 +276,13 @@ retval_t lithium_recv_cmd_expect(frame_t **pFrame, lithium_cmd_t cmd_code) {
 }
 
 static inline
-portBASE_TYPE lithium_send_cmd(frame_t *frame) {
-    return xQueueSendToBack(LITHIUM_STATE.queue_tx, &frame, portMAX_DELAY);
+portBASE_TYPE lithium_send_cmd(frame_chain_t *chain) {
+    return xQueueSendToBack(LITHIUM_STATE.queue_tx, chain, portMAX_DELAY);
     /* FIXME retval */
 }
 
-void lithium_pop_outgoing(frame_t **pFrame) {
-    (void)xQueueReceive(LITHIUM_STATE.queue_tx, pFrame, portMAX_DELAY);
+void lithium_pop_outgoing(frame_chain_t *chain) {
+    (void)xQueueReceive(LITHIUM_STATE.queue_tx, chain, portMAX_DELAY);
 }
 
 retval_t lithium_basic_init_and_check() {
@@ -268,18 +319,21 @@ retval_t lithium_basic_init_and_check() {
     return RV_ERROR;
 }
 
-static retval_t lithium_transact(frame_t *send_frame, uint32_t delay_ms, frame_t **recv_frame) {
-    frame_t *response;
+static retval_t lithium_transact(frame_chain_t *send_chain, uint32_t delay_ms, frame_t **recv_frame) {
+    frame_t *response, header;
     uint8_t command;
 	retval_t rv;
 
-	if (!frame_hasEnoughData(send_frame, MINIMUM_FRAME_SIZE)) return RV_NOSPACE;
-	frame_advance(send_frame, 3);
-	command = get_li1cmd_from_frame_nocheck(send_frame);
-	frame_reset(send_frame);
+	frame_copy(&header, &send_chain->segments[0]);
+	if (!frame_hasEnoughData(&header, MINIMUM_FRAME_SIZE)) {
+		frame_chain_dispose(send_chain);
+		return RV_NOSPACE;
+	}
+	frame_advance(&header, 3);
+	command = get_li1cmd_from_frame_nocheck(&header);
 
 	xSemaphoreTake(LITHIUM_STATE.mutex_command_send, portMAX_DELAY);
-    lithium_send_cmd(send_frame);
+    lithium_send_cmd(send_chain);
 
     rv = lithium_recv_cmd_expect(&response, command);
     if (RV_SUCCESS == rv) {
@@ -301,32 +355,22 @@ static
 retval_t lithium_send_frame(lithium_cmd_t command, frame_t *command_payload_or_NULL, frame_t **pResponse)
 {
     retval_t rv;
-    frame_t *command_frame;
+    frame_chain_t command_chain;
 
     if(command_payload_or_NULL != NULL && frame_hasEnoughData(command_payload_or_NULL, FRAME_PAYLOAD_MAXSIZE+1)) {
         frame_dispose(command_payload_or_NULL);
         return RV_NOSPACE;
     }
 
-    rv = frame_allocate(&command_frame);
-    if (RV_SUCCESS != rv) {
-    	if (command_payload_or_NULL != NULL) frame_dispose(command_payload_or_NULL);
-    	return rv;
-    }
-
-    rv = create_command_frame(command, command_payload_or_NULL, command_frame);
-    if (command_payload_or_NULL != NULL) frame_dispose(command_payload_or_NULL);
-
+    /* `create_command_chain()` takes care of disposing the payload */
+    rv = create_command_chain(command, command_payload_or_NULL, &command_chain);
     if (rv != RV_SUCCESS) {
-    	frame_dispose(command_frame);
     	return rv;
     }
 
-    /* `create_command_frame()` resets and puts data into `frame`, at this point `position` will be the data size */
-    frame_reset_for_reading(command_frame);
-    log_report_fmt(LOG_RADIO_VERBOSE, "lithium_send_frame: pushed cmd 0x%02x (framelen: %d) to TX queue\n", command, command_frame->size);
+    log_report_fmt(LOG_RADIO_VERBOSE, "lithium_send_frame: pushed cmd 0x%02x (framelen: %d) to TX queue\n", command, frame_chain_available_data(&command_chain));
 
-    return lithium_transact(command_frame, 0, pResponse);
+    return lithium_transact(&command_chain, 0, pResponse);
 }
 
 retval_t lithium_get_configuration(lithium_configuration_t * const config)
@@ -430,7 +474,7 @@ retval_t lithium_set_configuration(const lithium_configuration_t *config)
     frame_t *cmd_data;
     retval_t rv;
 
-    rv = frame_allocate(&cmd_data);
+    rv = frame_allocate_size(&cmd_data, sizeof(lithium_configuration_t));
     if (RV_SUCCESS != rv) return rv;
 
     configuration_to_command_frame(config, cmd_data);
@@ -446,7 +490,7 @@ retval_t lithium_set_rf_configuration(const lithium_rf_configuration_t *rf_confi
     frame_t *cmd_data;
     retval_t rv;
 
-    rv = frame_allocate(&cmd_data);
+    rv = frame_allocate_size(&cmd_data, sizeof(lithium_rf_configuration_t));
     if (RV_SUCCESS != rv) return rv;
 
     frame_put_data(cmd_data, rf_config, sizeof(lithium_rf_configuration_t));	/* Proper serializing using _le */
@@ -208,30 +208,30 @@ void lithium_rx_task(void *pvParameters) {
 static
 void lithium_tx_task(void *pvParameters) {
 	channel_t *ch_output = (channel_t*)pvParameters;
-    frame_t * frame;
+    frame_chain_t chain;
     retval_t rv;
     size_t last_available;
 
     log_report(LOG_RADIO, "TASK: lithium_tx_task started\n");
     while (1) {
-        lithium_pop_outgoing(&frame); /* blocks here */
-        log_report_fmt(LOG_RADIO, "LITHIUM: tx - got a frame to send (%d) bytes\n", _frame_available_data(frame));
+        lithium_pop_outgoing(&chain); /* blocks here */
+        log_report_fmt(LOG_RADIO, "LITHIUM: tx - got a frame to send (%d) bytes\n", frame_chain_available_data(&chain));
 
         /* ToDo: Loop until all data is sent.
          * a few tries? while no RV_TIMEOUT?
          */
         while (1) {
-        	last_available = _frame_available_data(frame);
-        	rv = channel_send(ch_output, frame);
-        	if (last_available == _frame_available_data(frame)) break;
+        	last_available = frame_chain_available_data(&chain);
+        	rv = channel_send_chain(ch_output, &chain);
+        	if (last_available == frame_chain_available_data(&chain)) break;
         	if (RV_PARTIAL != rv) break;
         }
 
         /* replicate the same output in the console/umbilical */
-        frame_reset(frame);
-        (void)channel_send(ch_umbilical_out, frame);
+        frame_chain_reset(&chain);
+        (void)channel_send_chain(ch_umbilical_out, &chain);
 
-        frame_dispose(frame);
+        frame_chain_dispose(&chain);
     }
 }
 
@@ -249,7 +249,7 @@ retval_t lithium_initialize(const channel_t *radio_channel) {
         return RV_NOSPACE;
     }
 
-    LITHIUM_STATE.queue_tx = xQueueCreate(LITHIUM_QUEUE_TX_SIZE, sizeof(frame_t *));
+    LITHIUM_STATE.queue_tx = xQueueCreate(LITHIUM_QUEUE_TX_SIZE, sizeof(frame_chain_t));
     if (NULL == LITHIUM_STATE.queue_tx) {
         return RV_NOSPACE;
     }
@@ -26,6 +26,6 @@ retval_t lithium_recv_cmd_response(frame_t **pFrame);
 retval_t lithium_push_incoming_data(const frame_t *frame);
 retval_t lithium_push_incoming_command_response(const frame_t *frame);
 
-void lithium_pop_outgoing(frame_t **pFrame);
+void lithium_pop_outgoing(frame_chain_t *chain);
 
 #endif
@@ -9,6 +9,7 @@
 #include <sys/select.h>
 #include <netinet/in.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 #include <netdb.h>
 #endif /* __USE_POSIX */
 #include <string.h>
@@ -17,6 +18,11 @@
 #include <task.h>
 
 #define EINTR_DELAY 1
+#ifdef MSG_DONTWAIT
+# define SOCK_DONTWAIT_FLAG	MSG_DONTWAIT
+#else
+# define SOCK_DONTWAIT_FLAG	0
+#endif
 #define CONNECT_TIMEOUT_SEC 3
 #define USE_MASTER_FD_FROM_STATE -1
 #define NO_INCOMING_CONNETION_YET -1
@@ -102,8 +108,7 @@ static retval_t tcp_client_open(
 
 static retval_t wait_connection(const channel_t * const link, int master_fd, uint32_t timeout_s) {
 	fd_channel_state_t *l_state = (fd_channel_state_t*)link->state;
-    struct timeval timeout;
-    fd_set rdfds;
+    portTickType deadline;
     int rv;
 
     if (master_fd == USE_MASTER_FD_FROM_STATE) {
@@ -118,21 +123,8 @@ static retval_t wait_connection(const channel_t * const link, int master_fd, uin
 		}
     }
 
-    timeout.tv_sec = timeout_s;
-    timeout.tv_usec = 0;
-    FD_ZERO(&rdfds);
-    FD_SET(master_fd, &rdfds);
-
-    while (1) {
-    	rv = select(master_fd + 1, &rdfds, NULL, NULL, &timeout);
-        if (rv == -1 && EINTR == errno) {
-            vTaskDelay(EINTR_DELAY);
-        } else {
-        	break;
-        }
-    };
-
-    if (!FD_ISSET(master_fd, &rdfds)) {
+    deadline = xTaskGetTickCount() + (timeout_s * 1000) / portTICK_RATE_MS;
+    if (RV_SUCCESS != posix_reactor_wait(&l_state->reactor, master_fd, POSIX_REACTOR_READ, deadline)) {
         SET_CHANNEL_STATE_FD(link, NO_INCOMING_CONNETION_YET);
         return RV_TIMEOUT;
     }
@@ -147,6 +139,7 @@ static retval_t wait_connection(const channel_t * const link, int master_fd, uin
     };
 
     if (-1 == rv) return RV_ERROR;
+    posix_reactor_forget(&l_state->reactor);
 	close(master_fd);
 
     SET_CHANNEL_STATE_FD(link, rv);
@@ -259,6 +252,7 @@ static retval_t fd_close(
     fd_channel_state_t * const c_state =
         (fd_channel_state_t * const) link->state;
 
+    posix_reactor_forget(&c_state->reactor);
     close(c_state->fd);
     return RV_SUCCESS;
 }
@@ -270,13 +264,15 @@ static retval_t _write_or_send(
         const channel_t * const link,
         frame_t * const send_frame,
         const size_t count,
-        write_t *_write)
+        write_t *_write,
+        int flags)
 {
 	fd_channel_state_t * const l_state = (fd_channel_state_t * const) link->state;
 
 	void *buf;
 	retval_t rv;
 	ssize_t actual_count;
+	portTickType deadline;
 
     if (l_state->fd == NO_INCOMING_CONNETION_YET) {
     	 rv = wait_connection(link, USE_MASTER_FD_FROM_STATE, 0);
@@ -288,12 +284,17 @@ static retval_t _write_or_send(
     rv = frame_get_data_pointer(send_frame, &buf, count);
     if (RV_SUCCESS != rv) return rv;
 
+    deadline = posix_reactor_deadline(link->config->transaction_timeout_ms);
+
     /* when running under FreeRTOS POSIX simulator, send(3) might be interrupted by a signal,
-       returning -1 and errno == EINTR. We want this recv() function to be blocking, thus this loop here */
+       returning -1 and errno == EINTR. A full socket buffer is waited for in the reactor */
     while (1) {
-        actual_count = _write(l_state->fd, buf, count, 0); // TODO catch SIGPIPE -> reconnect
+        actual_count = _write(l_state->fd, buf, count, flags); // TODO catch SIGPIPE -> reconnect
         if (actual_count == -1 && EINTR == errno) {
             vTaskDelay(EINTR_DELAY);
+        } else if (actual_count == -1 && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+            rv = posix_reactor_wait(&l_state->reactor, l_state->fd, POSIX_REACTOR_WRITE, deadline);
+            if (RV_SUCCESS != rv) return rv;
         } else {
         	break;
         }
@@ -313,15 +314,75 @@ static retval_t fd_send(
         const channel_t * const link,
         frame_t * const send_frame,
         const size_t count) {
-	return _write_or_send(link, send_frame, count, (void*)write);
+	return _write_or_send(link, send_frame, count, (void*)write, 0);
 }
 
 static retval_t sock_send(
         const channel_t * const link,
         frame_t * const send_frame,
         const size_t count) {
-	return _write_or_send(link, send_frame, count, send);
+	return _write_or_send(link, send_frame, count, send, SOCK_DONTWAIT_FLAG);
+}
+
+#ifdef __USE_POSIX
+/* Gathers all the segments in a single writev(2), no copying involved */
+static retval_t fd_send_chain(
+        const channel_t * const link,
+        frame_chain_t * const send_chain)
+{
+	fd_channel_state_t * const l_state = (fd_channel_state_t * const) link->state;
+
+	struct iovec iov[FRAME_CHAIN_MAX_SEGMENTS];
+	frame_t *segment;
+	size_t i, total_count;
+	int iov_count;
+	retval_t rv;
+	ssize_t actual_count;
+
+    if (l_state->fd == NO_INCOMING_CONNETION_YET) {
+    	 rv = wait_connection(link, USE_MASTER_FD_FROM_STATE, 0);
+    	 if (rv != RV_SUCCESS) return rv;
+    }
+
+    iov_count = 0;
+    total_count = 0;
+    for (i = 0; i < send_chain->count; i++) {
+    	segment = &send_chain->segments[i];
+    	if (!_frame_available_data(segment)) continue;
+    	iov[iov_count].iov_len  = _frame_available_data(segment);
+    	iov[iov_count].iov_base = frame_get_data_pointer_nocheck(segment, iov[iov_count].iov_len);
+    	total_count += iov[iov_count].iov_len;
+    	iov_count++;
+    }
+
+    if (0 == total_count) return RV_SUCCESS;
+
+    rv = posix_reactor_wait(&l_state->reactor, l_state->fd, POSIX_REACTOR_WRITE,
+    		posix_reactor_deadline(link->config->transaction_timeout_ms));
+    if (rv != RV_SUCCESS) return rv;
+
+    while (1) {
+        actual_count = writev(l_state->fd, iov, iov_count);
+        if (actual_count == -1 && EINTR == errno) {
+            vTaskDelay(EINTR_DELAY);
+        } else {
+        	break;
+        }
+    };
+
+    if (actual_count < 0 || actual_count > total_count) {
+    	if (EPIPE == errno) l_state->common.is_open = false;
+    	return RV_ERROR;
+    }
+
+    frame_chain_advance(send_chain, actual_count);
+    if (actual_count < total_count) return RV_PARTIAL;
+    return RV_SUCCESS;
 }
+# define FD_SEND_CHAIN	&fd_send_chain
+#else
+# define FD_SEND_CHAIN	INVALID_PTR
+#endif /* __USE_POSIX */
 
 static retval_t _read_or_recv(
         const channel_t * const link,
@@ -345,6 +406,11 @@ static retval_t _read_or_recv(
     rv = frame_get_data_pointer(recv_frame, &buf, count);
     if (rv != RV_SUCCESS) return rv;
 
+    /* sleep in the reactor, not in read(2), up to transaction_timeout_ms */
+    rv = posix_reactor_wait(&l_state->reactor, l_state->fd, POSIX_REACTOR_READ,
+    		posix_reactor_deadline(link->config->transaction_timeout_ms));
+    if (rv != RV_SUCCESS) return rv;
+
     /* when running under FreeRTOS POSIX simulator, read(3) might be interrupted by a signal,
        returning -1 and errno == EINTR. We want this recv() function to be blocking, thus this loop here */
     while (1) {
@@ -387,7 +453,8 @@ const channel_driver_api_t fd_channel_driver_api = {
 	.close    = &fd_close,
 	.send     = &fd_send,
 	.recv     = &fd_recv,
-    .transact = INVALID_PTR
+    .transact = INVALID_PTR,
+    .send_chain = FD_SEND_CHAIN
 };
 
 const channel_driver_api_t file_channel_driver_api = {
@@ -397,7 +464,8 @@ const channel_driver_api_t file_channel_driver_api = {
 	.close    = &fd_close,
 	.send     = &fd_send,
 	.recv     = &fd_recv,
-    .transact = INVALID_PTR
+    .transact = INVALID_PTR,
+    .send_chain = FD_SEND_CHAIN
 };
 
 const channel_driver_api_t tcp_client_channel_driver_api = {
@@ -407,7 +475,8 @@ const channel_driver_api_t tcp_client_channel_driver_api = {
 	.close    = &fd_close,
 	.send     = &sock_send,
 	.recv     = &sock_recv,
-    .transact = INVALID_PTR
+    .transact = INVALID_PTR,
+    .send_chain = FD_SEND_CHAIN
 };
 
 const channel_driver_api_t tcp_server_channel_driver_api = {
@@ -417,7 +486,8 @@ const channel_driver_api_t tcp_server_channel_driver_api = {
 	.close    = &fd_close,
 	.send     = &sock_send,
 	.recv     = &sock_recv,
-    .transact = INVALID_PTR
+    .transact = INVALID_PTR,
+    .send_chain = FD_SEND_CHAIN
 };
 
 #ifdef __USE_POSIX
@@ -428,7 +498,8 @@ const channel_driver_api_t unix_socket_client_channel_driver_api = {
 	.close    = &fd_close,
 	.send     = &sock_send,
 	.recv     = &sock_recv,
-    .transact = INVALID_PTR
+    .transact = INVALID_PTR,
+    .send_chain = FD_SEND_CHAIN
 };
 
 const channel_driver_api_t unix_socket_server_channel_driver_api = {
@@ -438,7 +509,8 @@ const channel_driver_api_t unix_socket_server_channel_driver_api = {
 	.close    = &fd_close,
 	.send     = &sock_send,
 	.recv     = &sock_recv,
-    .transact = INVALID_PTR
+    .transact = INVALID_PTR,
+    .send_chain = FD_SEND_CHAIN
 };
 #endif /* __USE_POSIX */
 
@@ -0,0 +1,109 @@
+#include <canopus/drivers/simusat/channel_shm.h>
+#include <canopus/logging.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+static retval_t shm_open_channel(const channel_t * const channel) {
+	const shm_channel_config_t *config = (const shm_channel_config_t *)channel->config;
+	shm_channel_state_t *state = (shm_channel_state_t *)channel->state;
+	int err;
+
+	err = shm_ring_open(&state->ring, config->name, config->size, SHM_RING_SIDE_HOST);
+	if (0 != err) {
+		log_report_fmt(LOG_SOCKET, "shm_ring_open(%s) failed: %d\n", config->name, err);
+		return RV_ERROR;
+	}
+	return RV_SUCCESS;
+}
+
+static retval_t shm_close_channel(const channel_t * const channel) {
+	shm_channel_state_t *state = (shm_channel_state_t *)channel->state;
+
+	shm_ring_close(&state->ring);
+	return RV_SUCCESS;
+}
+
+/* Deadline passed? Sleeps a tick otherwise */
+static bool shm_wait_tick(portTickType deadline) {
+	if ((portTickType)(xTaskGetTickCount() - deadline) < ((portTickType)~0 >> 1)) return true;
+	vTaskDelay(1);
+	return false;
+}
+
+static retval_t shm_send(const channel_t * const channel, frame_t * const send_frame, const size_t count) {
+	shm_channel_state_t *state = (shm_channel_state_t *)channel->state;
+	portTickType deadline;
+	size_t done, written;
+	void *buf;
+	retval_t rv;
+
+	if (0 == count) return RV_SUCCESS;
+
+	rv = frame_get_data_pointer(send_frame, &buf, count);
+	if (RV_SUCCESS != rv) return rv;
+
+	deadline = xTaskGetTickCount() + channel->config->transaction_timeout_ms / portTICK_RATE_MS;
+	done = 0;
+	for (;;) {
+		written = shm_ring_write(&state->ring, (uint8_t *)buf + done, count - done);
+		done += written;
+		if (done == count) break;
+		if (!written && shm_wait_tick(deadline)) break;
+	}
+
+	frame_advance(send_frame, done);
+	if (0 == done) return RV_TIMEOUT;
+	if (done < count) return RV_PARTIAL;
+	return RV_SUCCESS;
+}
+
+static retval_t shm_send_chain(const channel_t * const channel, frame_chain_t * const send_chain) {
+	frame_t *segment;
+	size_t i;
+	retval_t rv;
+
+	for (i = 0; i < send_chain->count; i++) {
+		segment = &send_chain->segments[i];
+		rv = shm_send(channel, segment, _frame_available_data(segment));
+		if (RV_SUCCESS != rv) return rv;
+	}
+	return RV_SUCCESS;
+}
+
+/* Like read(2), returns what's there as soon as there's something */
+static retval_t shm_recv(const channel_t * const channel, frame_t * const recv_frame, const size_t count) {
+	shm_channel_state_t *state = (shm_channel_state_t *)channel->state;
+	portTickType deadline;
+	size_t actual_count;
+	void *buf;
+	retval_t rv;
+
+	if (0 == count) return RV_SUCCESS;
+
+	rv = frame_get_data_pointer(recv_frame, &buf, count);
+	if (RV_SUCCESS != rv) return rv;
+
+	deadline = xTaskGetTickCount() + channel->config->transaction_timeout_ms / portTICK_RATE_MS;
+	while (0 == shm_ring_readable(&state->ring)) {
+		if (shm_wait_tick(deadline)) return RV_TIMEOUT;
+	}
+
+	actual_count = shm_ring_read(&state->ring, buf, count);
+	frame_advance(recv_frame, actual_count);
+	if (actual_count < count) return RV_PARTIAL;
+	return RV_SUCCESS;
+}
+
+const channel_driver_api_t shm_channel_driver_api = {
+	.initialize   = INVALID_PTR,
+	.deinitialize = INVALID_PTR,
+	.open     = &shm_open_channel,
+	.close    = &shm_close_channel,
+	.send     = &shm_send,
+	.recv     = &shm_recv,
+	.transact = INVALID_PTR,
+	.send_chain = &shm_send_chain,
+};
+
+const channel_driver_t shm_channel_driver = DECLARE_CHANNEL_DRIVER(&shm_channel_driver_api, NULL, channel_driver_state_t);
@@ -0,0 +1,242 @@
+#include <canopus/drivers/simusat/posix_reactor.h>
+#include <canopus/logging.h>
+
+#include <errno.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/epoll.h>
+#endif
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#ifdef __linux__
+
+#define REACTOR_STACKSIZE		(configMINIMAL_STACK_SIZE + 256)
+#define REACTOR_PRIORITY		(configMAX_PRIORITIES - 2)
+#define REACTOR_MAX_EVENTS		16
+
+/* The reactor never sleeps inside epoll_wait(2): under the POSIX port a task
+ * stuck in a syscall still owns the CPU. It polls once per tick while there
+ * is someone waiting, and sleeps on `kick` otherwise. */
+static struct {
+	int epfd;
+	unsigned armed_count;
+	xSemaphoreHandle kick;
+	xTaskHandle task;
+} reactor = { .epfd = -1 };
+
+static inline int event_index(uint8_t event) {
+	return (POSIX_REACTOR_READ == event) ? 0 : 1;
+}
+
+static uint32_t epoll_events(uint8_t armed) {
+	uint32_t events = 0;
+
+	if (armed & POSIX_REACTOR_READ) events |= EPOLLIN;
+	if (armed & POSIX_REACTOR_WRITE) events |= EPOLLOUT;
+	if (events) events |= EPOLLONESHOT;
+	return events;
+}
+
+/* Must be called inside a critical section. Updates the kernel side after
+ * `entry->armed` changed from `was_armed` */
+static void rearm(posix_reactor_fd_t *entry, uint8_t was_armed) {
+	struct epoll_event ev;
+
+	ev.events = epoll_events(entry->armed);
+	ev.data.ptr = entry;
+	(void)epoll_ctl(reactor.epfd, EPOLL_CTL_MOD, entry->fd, &ev);
+
+	if (was_armed && !entry->armed) reactor.armed_count--;
+	if (!was_armed && entry->armed) reactor.armed_count++;
+}
+
+static void reactor_task(void *params) {
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+	posix_reactor_fd_t *entry;
+	uint8_t fired, was_armed;
+	int i, n;
+
+	for (;;) {
+		if (0 == reactor.armed_count) {
+			xSemaphoreTake(reactor.kick, portMAX_DELAY);
+		}
+
+		n = epoll_wait(reactor.epfd, events, REACTOR_MAX_EVENTS, 0);
+		for (i = 0; i < n; i++) {
+			entry = (posix_reactor_fd_t *)events[i].data.ptr;
+
+			fired = 0;
+			if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) fired |= POSIX_REACTOR_READ;
+			if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) fired |= POSIX_REACTOR_WRITE;
+
+			taskENTER_CRITICAL();
+			was_armed = entry->armed;
+			fired &= was_armed;
+			entry->armed &= ~fired;
+			/* one shot, the other direction has to be armed again */
+			rearm(entry, was_armed);
+			taskEXIT_CRITICAL();
+
+			if (fired & POSIX_REACTOR_READ) xSemaphoreGive(entry->ready[0]);
+			if (fired & POSIX_REACTOR_WRITE) xSemaphoreGive(entry->ready[1]);
+		}
+
+		vTaskDelay(1);
+	}
+}
+
+static retval_t reactor_initialize(void) {
+	xSemaphoreHandle kick;
+	int epfd;
+
+	if (NULL != reactor.task) return RV_SUCCESS;
+
+	epfd = epoll_create(REACTOR_MAX_EVENTS);
+	if (-1 == epfd) return RV_ERROR;
+
+	vSemaphoreCreateBinary(kick);
+	if (NULL == kick) {
+		close(epfd);
+		return RV_NOSPACE;
+	}
+	xSemaphoreTake(kick, 0);
+
+	taskENTER_CRITICAL();
+	if (-1 == reactor.epfd) {
+		reactor.epfd = epfd;
+		reactor.kick = kick;
+		epfd = -1;
+	}
+	taskEXIT_CRITICAL();
+
+	/* someone else got here first */
+	if (-1 != epfd) {
+		close(epfd);
+		vSemaphoreDelete(kick);
+		return RV_SUCCESS;
+	}
+
+	if (pdPASS != xTaskCreate(reactor_task, (signed char *)"POSIX/reactor",
+			REACTOR_STACKSIZE, NULL, REACTOR_PRIORITY, &reactor.task)) {
+		log_report(LOG_SOCKET, "Can't create POSIX reactor task\n");
+		return RV_NOSPACE;
+	}
+	return RV_SUCCESS;
+}
+
+static retval_t reactor_register(posix_reactor_fd_t *entry, int fd) {
+	struct epoll_event ev;
+	int i;
+
+	if (entry->registered && (entry->fd == fd)) return RV_SUCCESS;
+	posix_reactor_forget(entry);
+
+	for (i = 0; i < 2; i++) {
+		if (NULL == entry->ready[i]) {
+			vSemaphoreCreateBinary(entry->ready[i]);
+			if (NULL == entry->ready[i]) return RV_NOSPACE;
+		}
+	}
+
+	entry->fd = fd;
+	entry->armed = 0;
+	entry->not_pollable = false;
+
+	ev.events = 0;
+	ev.data.ptr = entry;
+	if (-1 == epoll_ctl(reactor.epfd, EPOLL_CTL_ADD, fd, &ev)) {
+		if (EPERM != errno) return RV_ERROR;
+		entry->not_pollable = true;
+	}
+	entry->registered = true;
+	return RV_SUCCESS;
+}
+
+portTickType posix_reactor_deadline(uint32_t timeout_ms) {
+	if (0 == timeout_ms) return portMAX_DELAY;
+	return xTaskGetTickCount() + timeout_ms / portTICK_RATE_MS;
+}
+
+retval_t posix_reactor_wait(posix_reactor_fd_t *entry, int fd, uint8_t event, portTickType deadline) {
+	xSemaphoreHandle ready;
+	struct pollfd pfd;
+	portTickType now, wait;
+	uint8_t was_armed;
+	bool fired;
+	int rv;
+
+	/* fast path, already ready */
+	pfd.fd = fd;
+	pfd.events = (POSIX_REACTOR_READ == event) ? POLLIN : POLLOUT;
+	do {
+		rv = poll(&pfd, 1, 0);
+	} while ((-1 == rv) && (EINTR == errno));
+	if (0 != rv) return RV_SUCCESS;		/* ready, or let the caller get the error */
+
+	rv = reactor_initialize();
+	if (RV_SUCCESS != rv) return rv;
+	rv = reactor_register(entry, fd);
+	if (RV_SUCCESS != rv) return rv;
+	if (entry->not_pollable) return RV_SUCCESS;
+
+	ready = entry->ready[event_index(event)];
+	xSemaphoreTake(ready, 0);	/* forget about old wake ups */
+
+	taskENTER_CRITICAL();
+	was_armed = entry->armed;
+	entry->armed |= event;
+	rearm(entry, was_armed);
+	taskEXIT_CRITICAL();
+	xSemaphoreGive(reactor.kick);
+
+	if (portMAX_DELAY == deadline) {
+		wait = portMAX_DELAY;
+	} else {
+		now = xTaskGetTickCount();
+		wait = (portTickType)(deadline - now) < ((portTickType)~0 >> 1) ? deadline - now : 0;
+	}
+
+	fired = (pdTRUE == xSemaphoreTake(ready, wait));
+	if (!fired) {
+		taskENTER_CRITICAL();
+		was_armed = entry->armed;
+		entry->armed &= ~event;
+		if (was_armed != entry->armed) rearm(entry, was_armed);
+		else fired = true;	/* the reactor got it while we were timing out */
+		taskEXIT_CRITICAL();
+	}
+	return fired ? RV_SUCCESS : RV_TIMEOUT;
+}
+
+void posix_reactor_forget(posix_reactor_fd_t *entry) {
+	struct epoll_event ev;
+
+	if (!entry->registered) return;
+
+	taskENTER_CRITICAL();
+	if (entry->armed) reactor.armed_count--;
+	entry->armed = 0;
+	entry->registered = false;
+	if (!entry->not_pollable) {
+		(void)epoll_ctl(reactor.epfd, EPOLL_CTL_DEL, entry->fd, &ev);
+	}
+	taskEXIT_CRITICAL();
+}
+
+#else /* !__linux__ */
+
+portTickType posix_reactor_deadline(uint32_t timeout_ms) {
+	return portMAX_DELAY;
+}
+
+retval_t posix_reactor_wait(posix_reactor_fd_t *entry, int fd, uint8_t event, portTickType deadline) {
+	return RV_SUCCESS;
+}
+
+void posix_reactor_forget(posix_reactor_fd_t *entry) {
+}
+
+#endif /* __linux__ */
@@ -18,8 +18,15 @@ enum {
 	REMOTE_COMMAND_SEND,
 	REMOTE_COMMAND_RECV,
 	REMOTE_COMMAND_TRANSACT,
+	REMOTE_COMMAND_OPEN_TAGGED,
+	REMOTE_COMMAND_TAGGED_SEND = 0x40,
+	REMOTE_COMMAND_TAGGED_RECV,
+	REMOTE_COMMAND_TAGGED_TRANSACT,
 };
 
+#define TAGGED_REQUEST_HEADER_SIZE	(1 + 2 + 3 * 4)
+#define TAGGED_ANSWER_HEADER_SIZE	(2 + 1 + 4 + 4)
+
 static retval_t remote_portmapped_initialize(const channel_driver_t * const driver) {
 	retval_t rv;
 	frame_t cmd_ping = DECLARE_FRAME_BYTES(PORTMAPPER_COMMAND_PING);
@@ -46,8 +53,15 @@ static retval_t remote_portmapped_initialize(const channel_driver_t * const driv
 	rv = frame_get_data_pointer(&answer, (void**)&pong, len);
 	if (RV_SUCCESS != rv) return rv;
 
+	/* PONG2: the portmapper and its devices also speak the tagged protocol */
 	rv = RV_SUCCESS;
-	if (0 != memcmp(pong, "PONG1", 5)) rv = RV_ERROR;
+	if ((5 == len) && (0 == memcmp(pong, "PONG2", 5))) {
+		((remote_channel_driver_state_t *)driver->state)->protocol = REMOTE_PROTOCOL_TAGGED;
+	} else if ((5 == len) && (0 == memcmp(pong, "PONG1", 5))) {
+		((remote_channel_driver_state_t *)driver->state)->protocol = REMOTE_PROTOCOL_LEGACY;
+	} else {
+		rv = RV_ERROR;
+	}
 	return rv;
 }
 
@@ -62,26 +76,18 @@ static retval_t remote_portmapped_deinitialize(const channel_driver_t * const dr
 	return channel_close(simusat);
 }
 
-static retval_t _remote_open(const channel_t * const channel, char *address, uint16_t tcp_port, const char * const config_string) {
-	remote_channel_state_t *c_state;
+static retval_t _remote_open_command(remote_channel_state_t *c_state, uint8_t command, const char * const config_string) {
 	frame_t cmd_size = DECLARE_FRAME_SPACE(301);
 	frame_t answer = DECLARE_FRAME_SPACE(1);
-	tcp_channel_config_t *transport_config;
 	size_t config_len;
 	retval_t rv;
 	uint8_t _remote_rv;
 
-	c_state  = (remote_channel_state_t*)channel->state;
-
-	transport_config = (tcp_channel_config_t*)c_state->transport->config;
-	transport_config->address = address;
-	transport_config->port    = tcp_port;
-
 	rv =  channel_open(c_state->transport);
 	if (RV_SUCCESS != rv) return rv;
 
 	config_len = strlen(config_string);
-	frame_put_u8(&cmd_size, REMOTE_COMMAND_OPEN);
+	frame_put_u8(&cmd_size, command);
 	frame_put_u8(&cmd_size, config_len);
 	frame_put_data(&cmd_size, config_string, config_len);
 	frame_reset_for_reading(&cmd_size);
@@ -99,12 +105,51 @@ static retval_t _remote_open(const channel_t * const channel, char *address, uin
 	return (retval_t)_remote_rv;
 }
 
+static retval_t _remote_open(const channel_t * const channel, char *address, uint16_t tcp_port, const char * const config_string, uint8_t protocol) {
+	remote_channel_state_t *c_state;
+	tcp_channel_config_t *transport_config;
+	retval_t rv;
+
+	c_state  = (remote_channel_state_t*)channel->state;
+
+	transport_config = (tcp_channel_config_t*)c_state->transport->config;
+	transport_config->address = address;
+	transport_config->port    = tcp_port;
+
+	if (NULL == c_state->lock) {
+		c_state->lock = xSemaphoreCreateRecursiveMutex();
+		if (NULL == c_state->lock) return RV_NOSPACE;
+	}
+
+	c_state->protocol = REMOTE_PROTOCOL_LEGACY;
+	c_state->config_string = config_string;
+	c_state->out_of_step = false;
+	c_state->next_id = 0;
+	c_state->deferred_rv = RV_SUCCESS;
+	c_state->batching = false;
+	c_state->batch = (frame_t)DECLARE_FRAME(c_state->batch_buf);
+	memset(c_state->pending, 0, sizeof(c_state->pending));
+
+	if (REMOTE_PROTOCOL_TAGGED == protocol) {
+		rv = _remote_open_command(c_state, REMOTE_COMMAND_OPEN_TAGGED, config_string);
+		if (RV_SUCCESS == rv) {
+			c_state->protocol = REMOTE_PROTOCOL_TAGGED;
+			return rv;
+		}
+		/* the device doesn't know about it, start over the old way */
+		log_report_fmt(LOG_SOCKET, "remote: %s: no tagged protocol (%d), falling back\n", config_string, rv);
+		(void)channel_close(c_state->transport);
+	}
+
+	return _remote_open_command(c_state, REMOTE_COMMAND_OPEN, config_string);
+}
+
 static retval_t remote_open(const channel_t * const channel) {
 	remote_channel_config_t *c_config;
 
 	c_config = (remote_channel_config_t*)channel->config;
 
-	return _remote_open(channel, c_config->address, c_config->port, c_config->config_string);
+	return _remote_open(channel, c_config->address, c_config->port, c_config->config_string, REMOTE_PROTOCOL_LEGACY);
 }
 
 retval_t portmapper_get_status(const channel_t * const ch_portmapper, const char *device_name, uint16_t *tcp_port, bool *running) {
@@ -140,6 +185,7 @@ static retval_t remote_portmapped_open(const channel_t * const channel) {
 	remote_portmapped_channel_driver_config_t *d_config;
 	remote_channel_config_t *c_config;
 	remote_channel_config_t *portmapper_config;
+	remote_channel_driver_state_t *d_state;
 	uint16_t tcp_port;
 	bool running;
 	retval_t rv;
@@ -147,16 +193,407 @@ static retval_t remote_portmapped_open(const channel_t * const channel) {
 	c_config = (remote_channel_config_t*)channel->config;
 
 	d_config = (remote_portmapped_channel_driver_config_t*)channel->driver->config;
+	d_state = (remote_channel_driver_state_t*)channel->driver->state;
 	portmapper_get_status(d_config->ch_portmapper, c_config->endpoint_name, &tcp_port, &running);
 	if (running) {
 		portmapper_config = (remote_channel_config_t*)d_config->ch_portmapper->config;
-		rv = _remote_open(channel, portmapper_config->address, tcp_port, c_config->config_string);
+		rv = _remote_open(channel, portmapper_config->address, tcp_port, c_config->config_string, d_state->protocol);
 	} else {
 		rv = RV_ERROR;
 	}
 	return rv;
 }
 
+/* Tagged protocol */
+
+/* Read exactly `count` bytes from the transport into `dst`. On failure
+ * `dst` still keeps what came, to tell how far it got */
+static retval_t transport_recv_exact(const channel_t * const transport, frame_t *dst, size_t count) {
+	frame_t view;
+	size_t before;
+	retval_t rv = RV_SUCCESS;
+
+	if (count > _frame_available_space(dst)) return RV_NOSPACE;
+
+	frame_copy(&view, dst);
+	view.size = dst->position + count;
+	while ((RV_SUCCESS == rv) && _frame_available_space(&view)) {
+		before = view.position;
+		rv = channel_recv(transport, &view);
+		if (RV_PARTIAL == rv) rv = RV_SUCCESS;
+		if ((RV_SUCCESS == rv) && (before == view.position)) rv = RV_ERROR;	/* connection closed */
+	}
+	dst->position = view.position;
+	return rv;
+}
+
+static retval_t transport_discard(const channel_t * const transport, size_t count) {
+	frame_t trash = DECLARE_FRAME_SPACE(32);
+	size_t chunk;
+	retval_t rv;
+
+	while (count) {
+		chunk = count < trash.size ? count : trash.size;
+		frame_reset(&trash);
+		rv = transport_recv_exact(transport, &trash, chunk);
+		if (RV_SUCCESS != rv) return rv;
+		count -= chunk;
+	}
+	return RV_SUCCESS;
+}
+
+static int tagged_outstanding(const remote_channel_state_t *c_state) {
+	int i, count = 0;
+
+	for (i = 0; i < REMOTE_MAX_OUTSTANDING; i++) {
+		if (c_state->pending[i].used) count++;
+	}
+	return count;
+}
+
+static remote_pending_t *tagged_pending_find(remote_channel_state_t *c_state, uint16_t id) {
+	int i;
+
+	for (i = 0; i < REMOTE_MAX_OUTSTANDING; i++) {
+		if (c_state->pending[i].used && (c_state->pending[i].id == id)) return &c_state->pending[i];
+	}
+	return NULL;
+}
+
+static retval_t tagged_flush(remote_channel_state_t *c_state) {
+	frame_t out;
+	retval_t rv;
+
+	if (0 == c_state->batch.position) return RV_SUCCESS;
+
+	frame_copy_for_reading(&out, &c_state->batch);
+	frame_reset(&c_state->batch);
+	c_state->batch.size = sizeof(c_state->batch_buf);
+
+	rv = channel_send(c_state->transport, &out);
+	if (RV_PARTIAL == rv) rv = RV_ERROR;
+	return rv;
+}
+
+/* Part of an answer was read and the rest didn't come: where the next one
+ * starts can't be told anymore. Drop the connection with everything
+ * outstanding on it, the next request opens it again */
+static void tagged_lose_step(remote_channel_state_t *c_state) {
+	log_report(LOG_SOCKET, "remote: lost in the middle of an answer, reconnecting\n");
+
+	memset(c_state->pending, 0, sizeof(c_state->pending));
+	frame_reset(&c_state->batch);
+	c_state->batch.size = sizeof(c_state->batch_buf);
+	c_state->deferred_rv = RV_SUCCESS;
+	(void)channel_close(c_state->transport);
+	c_state->out_of_step = true;
+}
+
+static retval_t tagged_reopen(remote_channel_state_t *c_state) {
+	retval_t rv;
+
+	rv = _remote_open_command(c_state, REMOTE_COMMAND_OPEN_TAGGED, c_state->config_string);
+	if (RV_SUCCESS != rv) {
+		(void)channel_close(c_state->transport);
+		return rv;
+	}
+	c_state->out_of_step = false;
+	return RV_SUCCESS;
+}
+
+/* Read the next answer and hand it to its request */
+static retval_t tagged_collect_one(remote_channel_state_t *c_state, uint16_t *id, retval_t *remote_rv) {
+	frame_t header = DECLARE_FRAME_SPACE(TAGGED_ANSWER_HEADER_SIZE);
+	remote_pending_t *pending;
+	uint32_t written, len, fit;
+	uint8_t _remote_rv;
+	retval_t rv;
+
+	rv = transport_recv_exact(c_state->transport, &header, TAGGED_ANSWER_HEADER_SIZE);
+	if (RV_SUCCESS != rv) {
+		/* with nothing read the answer may still come whole */
+		if (0 != header.position) tagged_lose_step(c_state);
+		return rv;
+	}
+
+	frame_reset(&header);
+	*id = frame_get_u16_nocheck(&header);
+	_remote_rv = frame_get_u8_nocheck(&header);
+	written = frame_get_u32_nocheck(&header);
+	len = frame_get_u32_nocheck(&header);
+	(void)written;
+
+	pending = tagged_pending_find(c_state, *id);
+	if (NULL == pending) {
+		log_report_fmt(LOG_SOCKET, "remote: answer for unknown request %d\n", *id);
+		tagged_lose_step(c_state);
+		return RV_ERROR;
+	}
+
+	fit = 0;
+	if (NULL != pending->recv_frame) {
+		fit = _frame_available_space(pending->recv_frame);
+		if (fit > len) fit = len;
+		rv = transport_recv_exact(c_state->transport, pending->recv_frame, fit);
+	}
+	if (RV_SUCCESS == rv) rv = transport_discard(c_state->transport, len - fit);
+
+	if (NULL != pending->transaction) {
+		pending->transaction->rv = (RV_SUCCESS != rv) ? rv : (retval_t)_remote_rv;
+		pending->transaction->ticks = xTaskGetTickCount();
+	} else if (!pending->forgotten && (NULL == pending->recv_frame) && (RV_SUCCESS != (retval_t)_remote_rv)) {
+		/* nobody is waiting for a send, keep its failure for the next call */
+		c_state->deferred_rv = (retval_t)_remote_rv;
+	}
+	pending->used = false;
+	if (RV_SUCCESS != rv) tagged_lose_step(c_state);
+
+	*remote_rv = (retval_t)_remote_rv;
+	return rv;
+}
+
+/* Flush the batch and read answers until the one for `id` */
+static retval_t tagged_wait(remote_channel_state_t *c_state, uint16_t id) {
+	retval_t rv, remote_rv;
+	uint16_t answered;
+
+	rv = tagged_flush(c_state);
+	if (RV_SUCCESS != rv) return rv;
+
+	do {
+		rv = tagged_collect_one(c_state, &answered, &remote_rv);
+		if (RV_SUCCESS != rv) return rv;
+	} while (answered != id);
+
+	return remote_rv;
+}
+
+static retval_t tagged_new_request(remote_channel_state_t *c_state, frame_t *recv_frame, uint16_t *id) {
+	uint16_t answered;
+	retval_t rv, remote_rv;
+	int i;
+
+	if (REMOTE_MAX_OUTSTANDING == tagged_outstanding(c_state)) {
+		rv = tagged_flush(c_state);
+		if (RV_SUCCESS != rv) return rv;
+		rv = tagged_collect_one(c_state, &answered, &remote_rv);
+		if (RV_SUCCESS != rv) return rv;
+	}
+
+	for (i = 0; i < REMOTE_MAX_OUTSTANDING; i++) {
+		if (!c_state->pending[i].used) break;
+	}
+
+	c_state->pending[i].used = true;
+	c_state->pending[i].forgotten = false;
+	c_state->pending[i].id = c_state->next_id++;
+	c_state->pending[i].recv_frame = recv_frame;
+	c_state->pending[i].transaction = NULL;
+	*id = c_state->pending[i].id;
+	return RV_SUCCESS;
+}
+
+/* Header and payload go out together, in the batch or as a single write */
+static retval_t tagged_write(remote_channel_state_t *c_state, frame_t *header, frame_t *payload, size_t payload_count) {
+	frame_chain_t chain;
+	frame_t view;
+	size_t count;
+	retval_t rv;
+
+	count = _frame_available_data(header) + payload_count;
+
+	if (c_state->batching) {
+		if (count > _frame_available_space(&c_state->batch)) {
+			rv = tagged_flush(c_state);
+			if (RV_SUCCESS != rv) return rv;
+		}
+		if (count <= _frame_available_space(&c_state->batch)) {
+			frame_transfer(&c_state->batch, header);
+			if (payload_count) {
+				frame_put_data(&c_state->batch, frame_get_data_pointer_nocheck(payload, payload_count), payload_count);
+			}
+			return RV_SUCCESS;
+		}
+	}
+
+	frame_chain_init(&chain);
+	frame_chain_append(&chain, header);
+	if (payload_count) {
+		frame_copy(&view, payload);
+		view.size = payload->position + payload_count;
+		frame_chain_append(&chain, &view);
+	}
+
+	rv = channel_send_chain(c_state->transport, &chain);
+	if (RV_PARTIAL == rv) rv = RV_ERROR;
+	return rv;
+}
+
+static retval_t tagged_deferred(remote_channel_state_t *c_state, retval_t rv) {
+	if ((RV_SUCCESS == rv) && (RV_SUCCESS != c_state->deferred_rv)) rv = c_state->deferred_rv;
+	c_state->deferred_rv = RV_SUCCESS;
+	return rv;
+}
+
+/* Write a request, without waiting for its answer */
+static retval_t tagged_request(remote_channel_state_t *c_state, uint8_t command,
+		frame_t * const send_frame, size_t send_count, uint32_t delay_ms, frame_t * const recv_frame, uint16_t *id) {
+	frame_t header = DECLARE_FRAME_SPACE(TAGGED_REQUEST_HEADER_SIZE);
+	retval_t rv;
+
+	if (c_state->out_of_step) {
+		rv = tagged_reopen(c_state);
+		if (RV_SUCCESS != rv) return rv;
+	}
+
+	rv = tagged_new_request(c_state, recv_frame, id);
+	if (RV_SUCCESS != rv) return rv;
+
+	frame_put_u8(&header, command);
+	frame_put_u16(&header, *id);
+	if (REMOTE_COMMAND_TAGGED_RECV != command) {
+		frame_put_u32(&header, send_count);
+	}
+	if (REMOTE_COMMAND_TAGGED_TRANSACT == command) {
+		frame_put_u32(&header, delay_ms);
+	}
+	if (REMOTE_COMMAND_TAGGED_SEND != command) {
+		frame_put_u32(&header, (NULL != recv_frame) ? _frame_available_space(recv_frame) : 0);
+	}
+	frame_reset_for_reading(&header);
+
+	rv = tagged_write(c_state, &header, send_frame, send_count);
+	if (RV_SUCCESS != rv) {
+		tagged_pending_find(c_state, *id)->used = false;
+		return rv;
+	}
+	if (send_count) frame_advance(send_frame, send_count);
+	return RV_SUCCESS;
+}
+
+/* Answers that won't be waited for anymore must not land in the caller's
+ * frames: still read them out when they come, to keep the stream in step */
+static void tagged_forget(remote_pending_t *pending) {
+	pending->recv_frame = NULL;
+	pending->transaction = NULL;
+	pending->forgotten = true;
+}
+
+static retval_t tagged_transact(const channel_t * const channel, uint8_t command,
+		frame_t * const send_frame, size_t send_count, uint32_t delay_ms, frame_t * const recv_frame) {
+	remote_channel_state_t *c_state;
+	remote_pending_t *pending;
+	uint16_t id;
+	retval_t rv;
+
+	c_state  = (remote_channel_state_t*)channel->state;
+
+	xSemaphoreTakeRecursive(c_state->lock, portMAX_DELAY);
+
+	rv = tagged_request(c_state, command, send_frame, send_count, delay_ms, recv_frame, &id);
+	if (RV_SUCCESS != rv) goto out;
+
+	/* sends are not waited for */
+	if (REMOTE_COMMAND_TAGGED_SEND != command) {
+		rv = tagged_wait(c_state, id);
+		pending = tagged_pending_find(c_state, id);
+		if (NULL != pending) tagged_forget(pending);
+	}
+	rv = tagged_deferred(c_state, rv);
+
+out:
+	xSemaphoreGiveRecursive(c_state->lock);
+	return rv;
+}
+
+/* Wait for all outstanding answers */
+static retval_t tagged_drain(remote_channel_state_t *c_state) {
+	retval_t rv, remote_rv;
+	uint16_t answered;
+
+	rv = tagged_flush(c_state);
+	while ((RV_SUCCESS == rv) && tagged_outstanding(c_state)) {
+		rv = tagged_collect_one(c_state, &answered, &remote_rv);
+	}
+	return tagged_deferred(c_state, rv);
+}
+
+static void tagged_forget_batch(remote_channel_state_t *c_state) {
+	int i;
+
+	for (i = 0; i < REMOTE_MAX_OUTSTANDING; i++) {
+		if (c_state->pending[i].used && (NULL != c_state->pending[i].transaction)) {
+			tagged_forget(&c_state->pending[i]);
+		}
+	}
+}
+
+static retval_t tagged_transact_batch(remote_channel_state_t *c_state,
+		channel_transaction_t * const transactions, const size_t count) {
+	channel_transaction_t *t;
+	size_t i, send_count;
+	bool batching;
+	uint16_t id;
+	retval_t rv = RV_SUCCESS;
+
+	xSemaphoreTakeRecursive(c_state->lock, portMAX_DELAY);
+	batching = c_state->batching;
+	c_state->batching = true;
+
+	for (i = 0; i < count; i++) {
+		t = &transactions[i];
+		t->rv = RV_ERROR;	/* until answered */
+		t->ticks = xTaskGetTickCount();
+		if (RV_SUCCESS != rv) {
+			t->rv = rv;
+			continue;
+		}
+
+		send_count = (NULL != t->send_frame) ? _frame_available_data(t->send_frame) : 0;
+		rv = tagged_request(c_state, REMOTE_COMMAND_TAGGED_TRANSACT,
+				t->send_frame, send_count, t->delay_ms, t->recv_frame, &id);
+		if (RV_SUCCESS != rv) {
+			t->rv = rv;
+			continue;
+		}
+		tagged_pending_find(c_state, id)->transaction = t;
+	}
+
+	c_state->batching = batching;
+	if (RV_SUCCESS == rv) rv = tagged_drain(c_state);
+	else (void)tagged_drain(c_state);
+	if (RV_SUCCESS != rv) tagged_forget_batch(c_state);
+
+	xSemaphoreGiveRecursive(c_state->lock);
+	return rv;
+}
+
+retval_t remote_batch_begin(const channel_t *const channel) {
+	remote_channel_state_t *c_state = (remote_channel_state_t*)channel->state;
+
+	if (!c_state->common.is_open) return RV_ILLEGAL;
+	if (REMOTE_PROTOCOL_TAGGED != c_state->protocol) return RV_SUCCESS;
+
+	xSemaphoreTakeRecursive(c_state->lock, portMAX_DELAY);
+	c_state->batching = true;
+	xSemaphoreGiveRecursive(c_state->lock);
+	return RV_SUCCESS;
+}
+
+retval_t remote_batch_end(const channel_t *const channel) {
+	remote_channel_state_t *c_state = (remote_channel_state_t*)channel->state;
+	retval_t rv;
+
+	if (!c_state->common.is_open) return RV_ILLEGAL;
+	if (REMOTE_PROTOCOL_TAGGED != c_state->protocol) return RV_SUCCESS;
+
+	xSemaphoreTakeRecursive(c_state->lock, portMAX_DELAY);
+	c_state->batching = false;
+	rv = tagged_flush(c_state);
+	xSemaphoreGiveRecursive(c_state->lock);
+	return rv;
+}
+
 static retval_t remote_close(const channel_t * const channel) {
 	frame_t cmd = DECLARE_FRAME_SPACE(1);
 	frame_t answer = DECLARE_FRAME_SPACE(1);
@@ -166,6 +603,20 @@ static retval_t remote_close(const channel_t * const channel) {
 
 	c_state  = (remote_channel_state_t*)channel->state;
 
+	/* open and close keep the legacy format */
+	if (REMOTE_PROTOCOL_TAGGED == c_state->protocol) {
+		xSemaphoreTakeRecursive(c_state->lock, portMAX_DELAY);
+		c_state->batching = false;
+		if (!c_state->out_of_step) (void)tagged_drain(c_state);
+		xSemaphoreGiveRecursive(c_state->lock);
+
+		/* the connection is already gone */
+		if (c_state->out_of_step) {
+			c_state->out_of_step = false;
+			return RV_SUCCESS;
+		}
+	}
+
 	frame_put_u8(&cmd, REMOTE_COMMAND_CLOSE);
 	frame_reset_for_reading(&cmd);
 
@@ -184,6 +635,22 @@ static retval_t remote_close(const channel_t * const channel) {
 	return channel_close(c_state->transport);
 }
 
+/* Legacy protocol, command header and data in a single write */
+static retval_t remote_send_with_header(remote_channel_state_t *c_state, frame_t *header, frame_t *send_frame) {
+	frame_chain_t chain;
+	size_t count;
+	retval_t rv;
+
+	frame_chain_init(&chain);
+	frame_chain_append(&chain, header);
+	frame_chain_append(&chain, send_frame);
+	count = _frame_available_data(send_frame);
+
+	rv = channel_send_chain(c_state->transport, &chain);
+	if (RV_SUCCESS == rv) frame_advance(send_frame, count);
+	return rv;
+}
+
 static retval_t remote_send(const channel_t * const channel, frame_t * const send_frame, const size_t count) {
 	retval_t rv;
 	uint8_t _remote_rv = 0;
@@ -194,15 +661,16 @@ static retval_t remote_send(const channel_t * const channel, frame_t * const sen
 
 	c_state  = (remote_channel_state_t*)channel->state;
 
+	if (REMOTE_PROTOCOL_TAGGED == c_state->protocol) {
+		return tagged_transact(channel, REMOTE_COMMAND_TAGGED_SEND, send_frame, count, 0, NULL);
+	}
+
 	frame_put_u8(&cmd_size, REMOTE_COMMAND_SEND);
 	frame_put_u32(&cmd_size, _frame_available_data(send_frame));
 	frame_reset_for_reading(&cmd_size);
 
 	//	channel_lock(c_state->transport);
-	rv = channel_send(c_state->transport, &cmd_size);
-	if (RV_SUCCESS != rv) return rv;
-
-	rv = channel_send(c_state->transport, send_frame);
+	rv = remote_send_with_header(c_state, &cmd_size, send_frame);
 	if (RV_SUCCESS != rv) return rv;
 
 	rv = channel_recv(c_state->transport, &answer);
@@ -228,6 +696,10 @@ static retval_t remote_recv(const channel_t * const channel, frame_t * const rec
 
 	c_state  = (remote_channel_state_t*)channel->state;
 
+	if (REMOTE_PROTOCOL_TAGGED == c_state->protocol) {
+		return tagged_transact(channel, REMOTE_COMMAND_TAGGED_RECV, NULL, 0, 0, recv_frame);
+	}
+
 	frame_put_u8(&cmd_size, REMOTE_COMMAND_RECV);
 	frame_put_u32(&cmd_size, _frame_available_space(recv_frame));
 	frame_reset_for_reading(&cmd_size);
@@ -265,6 +737,10 @@ static retval_t remote_transact(
 
 	c_state  = (remote_channel_state_t*)channel->state;
 
+	if (REMOTE_PROTOCOL_TAGGED == c_state->protocol) {
+		return tagged_transact(channel, REMOTE_COMMAND_TAGGED_TRANSACT, send_frame, send_bytes, delay_ms, recv_frame);
+	}
+
 	frame_put_u8(&cmd_size, REMOTE_COMMAND_TRANSACT);
 	frame_put_u32(&cmd_size, _frame_available_data(send_frame));
 	frame_put_u32(&cmd_size, delay_ms);
@@ -273,10 +749,7 @@ static retval_t remote_transact(
 	frame_reset_for_reading(&cmd_size);
 
 	//	channel_lock(c_state->transport);
-	rv = channel_send(c_state->transport, &cmd_size);
-	if (RV_SUCCESS != rv) return rv;
-
-	rv = channel_send(c_state->transport, send_frame);
+	rv = remote_send_with_header(c_state, &cmd_size, send_frame);
 	if (RV_SUCCESS != rv) return rv;
 
 	rv = channel_recv(c_state->transport, &answer);
@@ -296,6 +769,29 @@ static retval_t remote_transact(
 	return (retval_t)_remote_rv;
 }
 
+static retval_t remote_transact_batch(const channel_t * const channel,
+		channel_transaction_t * const transactions, const size_t count) {
+	remote_channel_state_t *c_state;
+	channel_transaction_t *t;
+	size_t i;
+
+	c_state  = (remote_channel_state_t*)channel->state;
+
+	if (REMOTE_PROTOCOL_TAGGED == c_state->protocol) {
+		return tagged_transact_batch(c_state, transactions, count);
+	}
+
+	/* legacy, a round trip each */
+	for (i = 0; i < count; i++) {
+		t = &transactions[i];
+		t->rv = remote_transact(channel, t->send_frame, t->delay_ms, t->recv_frame,
+				(NULL != t->send_frame) ? _frame_available_data(t->send_frame) : 0,
+				(NULL != t->recv_frame) ? _frame_available_space(t->recv_frame) : 0);
+		t->ticks = xTaskGetTickCount();
+	}
+	return RV_SUCCESS;
+}
+
 const channel_driver_api_t remote_channel_driver_api = {
 	.initialize = INVALID_PTR,
 	.deinitialize = remote_deinitialize,
@@ -304,6 +800,7 @@ const channel_driver_api_t remote_channel_driver_api = {
 	.send = remote_send,
 	.recv = remote_recv,
 	.transact = remote_transact,
+	.transact_batch = remote_transact_batch,
 };
 
 const channel_driver_api_t remote_portmapped_channel_driver_api = {
@@ -314,6 +811,7 @@ const channel_driver_api_t remote_portmapped_channel_driver_api = {
 	.send = remote_send,
 	.recv = remote_recv,
 	.transact = remote_transact,
+	.transact_batch = remote_transact_batch,
 };
 
 remote_channel_driver_config_t remote_channel_driver_config = {};
@@ -0,0 +1,265 @@
+#include <canopus/drivers/simusat/shm_ring.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+/* How long an opener waits for the other side to finish initializing */
+#define SHM_RING_INIT_WAIT_ms	1000
+
+#define load_acquire(p)			__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v)		__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static size_t map_size(uint32_t size) {
+	return sizeof(shm_ring_header_t) + 2 * (size_t)size;
+}
+
+static void sleep_ms(int ms) {
+	struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L };
+
+	while ((-1 == nanosleep(&ts, &ts)) && (EINTR == errno));
+}
+
+static int64_t now_ms(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Wakeups. The futexes are shared between processes, no FUTEX_PRIVATE_FLAG */
+#ifdef __linux__
+static void futex_wait(volatile uint32_t *addr, uint32_t val, int timeout_ms) {
+	struct timespec ts, *pts = NULL;
+
+	if (timeout_ms >= 0) {
+		ts.tv_sec  = timeout_ms / 1000;
+		ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+		pts = &ts;
+	}
+	(void)syscall(SYS_futex, addr, FUTEX_WAIT, val, pts, NULL, 0);
+}
+
+static void futex_wake(volatile uint32_t *addr) {
+	(void)syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+#else
+/* No futexes, poll every millisecond */
+static void futex_wait(volatile uint32_t *addr, uint32_t val, int timeout_ms) {
+	if ((timeout_ms < 0) || (timeout_ms > 1)) timeout_ms = 1;
+	if (load_acquire(addr) == val) sleep_ms(timeout_ms);
+}
+
+static void futex_wake(volatile uint32_t *addr) {
+}
+#endif
+
+/* Bump the sequence and wake whoever sleeps on it */
+static void ring_signal(volatile uint32_t *seq, volatile uint32_t *waiters) {
+	__atomic_add_fetch(seq, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(waiters, __ATOMIC_SEQ_CST)) futex_wake(seq);
+}
+
+int shm_ring_open(shm_ring_pair_t *pair, const char *name, uint32_t size, int side) {
+	shm_ring_header_t *header;
+	struct stat st;
+	uint8_t *data;
+	size_t msize;
+	int64_t deadline;
+	int fd, err;
+
+	if (0 == size) size = SHM_RING_DEFAULT_SIZE;
+	if (size & (size - 1)) return -EINVAL;
+
+	memset(pair, 0, sizeof(*pair));
+	msize = map_size(size);
+
+	fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+	if (-1 == fd) return -errno;
+
+	/* only ever grow it, the other side may have mapped it already */
+	if ((-1 == fstat(fd, &st)) || ((st.st_size < msize) && (-1 == ftruncate(fd, msize)))) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+
+	header = mmap(NULL, msize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	err = -errno;
+	close(fd);
+	if (MAP_FAILED == header) return err;
+
+	if (SHM_RING_SIDE_HOST == side) {
+		/* The object outlives the simulator: whatever a previous run left
+		 * in the rings, or a header of another version or size, is stale.
+		 * The host starting is the start of a new session, reset it all */
+		__atomic_store_n(&header->initializing, 1, __ATOMIC_SEQ_CST);
+		store_release(&header->magic, 0);
+		memset(header->rings, 0, sizeof(header->rings));
+		header->version = SHM_RING_VERSION;
+		header->size = size;
+		store_release(&header->magic, SHM_RING_MAGIC);
+	} else if (0 == __atomic_exchange_n(&header->initializing, 1, __ATOMIC_ACQ_REL)) {
+		if (SHM_RING_MAGIC != load_acquire(&header->magic)) {
+			memset(header->rings, 0, sizeof(header->rings));
+			header->version = SHM_RING_VERSION;
+			header->size = size;
+			store_release(&header->magic, SHM_RING_MAGIC);
+		}
+	} else {
+		deadline = now_ms() + SHM_RING_INIT_WAIT_ms;
+		while ((SHM_RING_MAGIC != load_acquire(&header->magic)) && (now_ms() < deadline)) {
+			sleep_ms(1);
+		}
+	}
+
+	if ((SHM_RING_MAGIC != load_acquire(&header->magic))
+			|| (SHM_RING_VERSION != header->version) || (size != header->size)) {
+		munmap(header, msize);
+		return -EINVAL;
+	}
+
+	data = (uint8_t *)(header + 1);
+	pair->header   = header;
+	pair->map_size = msize;
+	pair->size     = size;
+	if (SHM_RING_SIDE_HOST == side) {
+		pair->tx      = &header->rings[SHM_RING_TO_DEVICE];
+		pair->tx_data = data + SHM_RING_TO_DEVICE * size;
+		pair->rx      = &header->rings[SHM_RING_TO_HOST];
+		pair->rx_data = data + SHM_RING_TO_HOST * size;
+	} else {
+		pair->tx      = &header->rings[SHM_RING_TO_HOST];
+		pair->tx_data = data + SHM_RING_TO_HOST * size;
+		pair->rx      = &header->rings[SHM_RING_TO_DEVICE];
+		pair->rx_data = data + SHM_RING_TO_DEVICE * size;
+	}
+	return 0;
+}
+
+void shm_ring_close(shm_ring_pair_t *pair) {
+	if (NULL == pair->header) return;
+	munmap(pair->header, pair->map_size);
+	memset(pair, 0, sizeof(*pair));
+}
+
+int shm_ring_unlink(const char *name) {
+	return (-1 == shm_unlink(name)) ? -errno : 0;
+}
+
+size_t shm_ring_readable(const shm_ring_pair_t *pair) {
+	return load_acquire(&pair->rx->head) - pair->rx->tail;
+}
+
+size_t shm_ring_writable(const shm_ring_pair_t *pair) {
+	return pair->size - (pair->tx->head - load_acquire(&pair->tx->tail));
+}
+
+size_t shm_ring_write(shm_ring_pair_t *pair, const void *buf, size_t count) {
+	shm_ring_t *ring = pair->tx;
+	uint32_t head, offset;
+	size_t space, first;
+
+	space = shm_ring_writable(pair);
+	if (count > space) count = space;
+	if (0 == count) return 0;
+
+	head = ring->head;
+	offset = head & (pair->size - 1);
+	first = pair->size - offset;
+	if (first > count) first = count;
+
+	memcpy(pair->tx_data + offset, buf, first);
+	memcpy(pair->tx_data, (const uint8_t *)buf + first, count - first);
+
+	store_release(&ring->head, head + count);
+	ring_signal(&ring->data_seq, &ring->data_waiters);
+	return count;
+}
+
+size_t shm_ring_read(shm_ring_pair_t *pair, void *buf, size_t count) {
+	shm_ring_t *ring = pair->rx;
+	uint32_t tail, offset;
+	size_t available, first;
+
+	available = shm_ring_readable(pair);
+	if (count > available) count = available;
+	if (0 == count) return 0;
+
+	tail = ring->tail;
+	offset = tail & (pair->size - 1);
+	first = pair->size - offset;
+	if (first > count) first = count;
+
+	memcpy(buf, pair->rx_data + offset, first);
+	memcpy((uint8_t *)buf + first, pair->rx_data, count - first);
+
+	store_release(&ring->tail, tail + count);
+	ring_signal(&ring->space_seq, &ring->space_waiters);
+	return count;
+}
+
+/* Sleep on `seq` until ready(pair) is true or the time is up */
+static int ring_wait(shm_ring_pair_t *pair, size_t (*ready)(const shm_ring_pair_t *),
+		volatile uint32_t *seq, volatile uint32_t *waiters, int timeout_ms) {
+	int64_t deadline = now_ms() + timeout_ms;
+	uint32_t val;
+	int left = -1;
+
+	for (;;) {
+		val = __atomic_load_n(seq, __ATOMIC_SEQ_CST);
+		if (ready(pair)) return 0;
+
+		if (timeout_ms >= 0) {
+			left = (int)(deadline - now_ms());
+			if (left <= 0) return -ETIMEDOUT;
+		}
+
+		__atomic_add_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+		/* checked again, after telling the other side we're sleeping */
+		if (!ready(pair)) futex_wait(seq, val, left);
+		__atomic_sub_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+int shm_ring_wait_readable(shm_ring_pair_t *pair, int timeout_ms) {
+	return ring_wait(pair, shm_ring_readable, &pair->rx->data_seq, &pair->rx->data_waiters, timeout_ms);
+}
+
+int shm_ring_wait_writable(shm_ring_pair_t *pair, int timeout_ms) {
+	return ring_wait(pair, shm_ring_writable, &pair->tx->space_seq, &pair->tx->space_waiters, timeout_ms);
+}
+
+ssize_t shm_ring_send(shm_ring_pair_t *pair, const void *buf, size_t count, int timeout_ms) {
+	int64_t deadline = now_ms() + timeout_ms;
+	size_t done = 0;
+	int left = -1;
+
+	for (;;) {
+		done += shm_ring_write(pair, (const uint8_t *)buf + done, count - done);
+		if (done == count) break;
+
+		if (timeout_ms >= 0) {
+			left = (int)(deadline - now_ms());
+			if (left <= 0) break;
+		}
+		if (0 != shm_ring_wait_writable(pair, left)) break;
+	}
+	return done;
+}
+
+ssize_t shm_ring_recv(shm_ring_pair_t *pair, void *buf, size_t count, int timeout_ms) {
+	int rv;
+
+	rv = shm_ring_wait_readable(pair, timeout_ms);
+	if (0 != rv) return rv;
+	return shm_ring_read(pair, buf, count);
+}
@@ -314,6 +314,41 @@ static retval_t _recv(
 	return RV_SUCCESS;
 }
 
+/* I2C has no pipelining: the gain is taking the bus once for the whole
+ * batch, so a housekeeping sweep isn't interleaved with (nor waits for)
+ * other devices' traffic between its transactions */
+static retval_t _transact_batch(
+    const channel_t * const channel,
+    channel_transaction_t * const transactions,
+    const size_t count)
+{
+	channel_transaction_t *t;
+	size_t i, send_count, recv_count;
+	retval_t rv;
+
+	rv = i2c_lock(channel->config->lock_timeout_ms / portTICK_RATE_MS);
+	if (RV_SUCCESS != rv) {
+		for (i = 0; i < count; i++) transactions[i].rv = rv;
+		return rv;
+	}
+
+	for (i = 0; i < count; i++) {
+		t = &transactions[i];
+		send_count = (NULL != t->send_frame) ? _frame_available_data(t->send_frame) : 0;
+		recv_count = (NULL != t->recv_frame) ? _frame_available_space(t->recv_frame) : 0;
+
+		t->rv = _send(channel, t->send_frame, send_count);
+		if ((RV_SUCCESS == t->rv) && (recv_count > 0)) {
+			vTaskDelay(t->delay_ms / portTICK_RATE_MS);
+			t->rv = _recv(channel, t->recv_frame, recv_count);
+		}
+		t->ticks = xTaskGetTickCount();
+	}
+
+	i2c_unlock();
+	return RV_SUCCESS;
+}
+
 static const channel_driver_api_t tms570_i2c_channel_driver_api = {
     .initialize   = &_initialize,
     .deinitialize = &_deinitialize,
@@ -322,6 +357,7 @@ static const channel_driver_api_t tms570_i2c_channel_driver_api = {
     .send     = _send,
     .recv     = _recv,
     .transact = INVALID_PTRC(channel_transact_t *),
+    .transact_batch = &_transact_batch,
 };
 
 const channel_driver_t tms570_i2c_channel_driver = DECLARE_CHANNEL_DRIVER(&tms570_i2c_channel_driver_api, NULL, tms570_i2c_channel_driver_state_t);
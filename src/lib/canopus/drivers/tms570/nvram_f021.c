@@ -202,6 +202,31 @@ nvram_erase_blocking()
 
 }
 
+/* The FEE already spreads writes over its virtual sectors, no journal on top */
+size_t
+nvram_journal_size(void)
+{
+    return 0;
+}
+
+retval_t
+nvram_journal_read(uint32_t offset, void *addr, size_t size)
+{
+    return RV_NOTIMPLEMENTED;
+}
+
+retval_t
+nvram_journal_append(uint32_t offset, const void *addr, size_t size)
+{
+    return RV_NOTIMPLEMENTED;
+}
+
+retval_t
+nvram_journal_erase(void)
+{
+    return RV_NOTIMPLEMENTED;
+}
+
 retval_t
 nvram_format_blocking(uint32_t format_key)
 {
@@ -6,8 +6,106 @@
 #include <FreeRTOS.h>
 #include <task.h>
 
+static DECLARE_FRAME_POOL(SmallFramePool, 16, SMALL_FRAME_SIZE);
 static DECLARE_FRAME_POOL(TheFramePool, 16, MAX_FRAME_SIZE);
 
+/* Sorted by buffer_size, smallest first */
+static frame_pool_t *const FramePools[] = {
+	&SmallFramePool,
+	&TheFramePool,
+};
+
+/*
+ * Word wide access. 16 and 32 bits values are loaded/stored with a single
+ * access when the buffer position happens to be aligned, and byte by byte
+ * otherwise. Either way the bytes in the frame are the same.
+ */
+#if defined(__big_endian__) || defined(__BIG_ENDIAN__) || \
+	(defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__))
+# define HOST_IS_BIG_ENDIAN	1
+#else
+# define HOST_IS_BIG_ENDIAN	0
+#endif
+
+#ifdef __GNUC__
+typedef uint16_t __attribute__((may_alias)) word16_t;
+typedef uint32_t __attribute__((may_alias)) word32_t;
+#else
+typedef uint16_t word16_t;
+typedef uint32_t word32_t;
+#endif
+
+#define IS_ALIGNED(__ptr, __size)	(0 == ((uintptr_t)(__ptr) & ((__size) - 1)))
+
+#define SWAP16(__x)	((uint16_t)(((__x) >> 8) | ((__x) << 8)))
+#define SWAP32(__x)	((((__x) >> 24) & 0x000000ff) | (((__x) >> 8) & 0x0000ff00) | \
+					 (((__x) << 8)  & 0x00ff0000) | (((__x) << 24) & 0xff000000))
+
+#define BE16(__x)	(HOST_IS_BIG_ENDIAN ? (uint16_t)(__x) : SWAP16((uint16_t)(__x)))
+#define LE16(__x)	(HOST_IS_BIG_ENDIAN ? SWAP16((uint16_t)(__x)) : (uint16_t)(__x))
+#define BE32(__x)	(HOST_IS_BIG_ENDIAN ? (uint32_t)(__x) : SWAP32((uint32_t)(__x)))
+#define LE32(__x)	(HOST_IS_BIG_ENDIAN ? SWAP32((uint32_t)(__x)) : (uint32_t)(__x))
+
+static inline uint16_t load_be16(const uint8_t *p) {
+	if (IS_ALIGNED(p, 2)) return BE16(*(const word16_t *)p);
+	return (p[0] << 8) | p[1];
+}
+
+static inline uint16_t load_le16(const uint8_t *p) {
+	if (IS_ALIGNED(p, 2)) return LE16(*(const word16_t *)p);
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t load_be32(const uint8_t *p) {
+	if (IS_ALIGNED(p, 4)) return BE32(*(const word32_t *)p);
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline uint32_t load_le32(const uint8_t *p) {
+	if (IS_ALIGNED(p, 4)) return LE32(*(const word32_t *)p);
+	return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void store_be16(uint8_t *p, uint16_t data) {
+	if (IS_ALIGNED(p, 2)) {
+		*(word16_t *)p = BE16(data);
+		return;
+	}
+	p[0] = data >> 8;
+	p[1] = data;
+}
+
+static inline void store_le16(uint8_t *p, uint16_t data) {
+	if (IS_ALIGNED(p, 2)) {
+		*(word16_t *)p = LE16(data);
+		return;
+	}
+	p[0] = data;
+	p[1] = data >> 8;
+}
+
+static inline void store_be32(uint8_t *p, uint32_t data) {
+	if (IS_ALIGNED(p, 4)) {
+		*(word32_t *)p = BE32(data);
+		return;
+	}
+	p[0] = data >> 24;
+	p[1] = data >> 16;
+	p[2] = data >> 8;
+	p[3] = data;
+}
+
+static inline void store_le32(uint8_t *p, uint32_t data) {
+	if (IS_ALIGNED(p, 4)) {
+		*(word32_t *)p = LE32(data);
+		return;
+	}
+	p[0] = data;
+	p[1] = data >> 8;
+	p[2] = data >> 16;
+	p[3] = data >> 24;
+}
+
 inline size_t _frame_available_data(const frame_t *frame) {
 	return frame->size - frame->position;
 }
@@ -46,8 +144,8 @@ retval_t frame_get_u8(frame_t *frame, uint8_t *value) {
 
 uint16_t inline frame_get_u16_nocheck(frame_t *frame) {
    uint16_t answer;
-   answer  = frame->buf[frame->position++] << 8;
-   answer |= frame->buf[frame->position++];
+   answer = load_be16(&frame->buf[frame->position]);
+   frame->position += 2;
    return answer;
 }
 
@@ -63,8 +161,8 @@ retval_t frame_get_s16(frame_t *frame, int16_t *value) {
 
 uint16_t inline frame_get_u16_le_nocheck(frame_t *frame) {
    uint16_t answer;
-   answer  = frame->buf[frame->position++];
-   answer |= frame->buf[frame->position++] << 8;
+   answer = load_le16(&frame->buf[frame->position]);
+   frame->position += 2;
    return answer;
 }
 
@@ -104,10 +202,8 @@ retval_t frame_get_u24_le(frame_t *frame, uint32_t *value) {
 
 uint32_t inline frame_get_u32_nocheck(frame_t *frame) {
    uint32_t answer;
-   answer  = frame->buf[frame->position++] << 24;
-   answer |= frame->buf[frame->position++] << 16;
-   answer |= frame->buf[frame->position++] << 8;
-   answer |= frame->buf[frame->position++];
+   answer = load_be32(&frame->buf[frame->position]);
+   frame->position += 4;
    return answer;
 }
 
@@ -119,10 +215,8 @@ retval_t frame_get_u32(frame_t *frame, uint32_t *value) {
 
 uint32_t inline frame_get_u32_le_nocheck(frame_t *frame) {
    uint32_t answer;
-   answer  = frame->buf[frame->position++];
-   answer |= frame->buf[frame->position++] << 8;
-   answer |= frame->buf[frame->position++] << 16;
-   answer |= frame->buf[frame->position++] << 24;
+   answer = load_le32(&frame->buf[frame->position]);
+   frame->position += 4;
    return answer;
 }
 
@@ -135,14 +229,8 @@ retval_t frame_get_u32_le(frame_t *frame, uint32_t *value) {
 uint64_t inline frame_get_u64_nocheck(frame_t *frame) {
    uint64_t answer;
    /* cast to avoid warning: left shift count >= width of type */
-   answer  = (uint64_t)frame->buf[frame->position++] << 56;
-   answer |= (uint64_t)frame->buf[frame->position++] << 48;
-   answer |= (uint64_t)frame->buf[frame->position++] << 40;
-   answer |= (uint64_t)frame->buf[frame->position++] << 32;
-   answer |= frame->buf[frame->position++] << 24;
-   answer |= frame->buf[frame->position++] << 16;
-   answer |= frame->buf[frame->position++] << 8;
-   answer |= frame->buf[frame->position++];
+   answer  = (uint64_t)frame_get_u32_nocheck(frame) << 32;
+   answer |= frame_get_u32_nocheck(frame);
    return answer;
 }
 
@@ -247,6 +335,95 @@ retval_t frame_transfer_count(frame_t *dst_frame, frame_t *src_frame, uint32_t s
 	return _frame_transfer_count(dst_frame, src_frame, src_count_real);
 }
 
+void frame_chain_init(frame_chain_t *chain) {
+	chain->count = 0;
+	chain->owned_count = 0;
+}
+
+static void frame_chain_view(frame_t *view, const frame_t *segment) {
+	frame_copy(view, segment);
+	view->buf  = &segment->buf[segment->position];
+	view->size = _frame_available_data(segment);
+	view->position = 0;
+	view->flags = 0;
+}
+
+retval_t frame_chain_append(frame_chain_t *chain, const frame_t *segment) {
+	if (chain->count >= FRAME_CHAIN_MAX_SEGMENTS) return RV_NOSPACE;
+	frame_chain_view(&chain->segments[chain->count++], segment);
+	return RV_SUCCESS;
+}
+
+retval_t frame_chain_prepend(frame_chain_t *chain, const frame_t *segment) {
+	if (chain->count >= FRAME_CHAIN_MAX_SEGMENTS) return RV_NOSPACE;
+	memmove(&chain->segments[1], &chain->segments[0], chain->count * sizeof(chain->segments[0]));
+	chain->count++;
+	frame_chain_view(&chain->segments[0], segment);
+	return RV_SUCCESS;
+}
+
+retval_t frame_chain_own(frame_chain_t *chain, frame_t *frame) {
+	if (chain->owned_count >= FRAME_CHAIN_MAX_SEGMENTS) return RV_NOSPACE;
+	chain->owned[chain->owned_count++] = frame;
+	return RV_SUCCESS;
+}
+
+size_t frame_chain_available_data(const frame_chain_t *chain) {
+	size_t i, answer = 0;
+
+	for (i=0; i < chain->count; i++) {
+		answer += _frame_available_data(&chain->segments[i]);
+	}
+	return answer;
+}
+
+void frame_chain_reset(frame_chain_t *chain) {
+	size_t i;
+
+	for (i=0; i < chain->count; i++) {
+		frame_reset(&chain->segments[i]);
+	}
+}
+
+/**
+ * frame_chain_advance() consumes count bytes from the head of the chain,
+ * i.e. strips headers, crossing segment boundaries as needed.
+ */
+retval_t frame_chain_advance(frame_chain_t *chain, size_t count) {
+	size_t i, available;
+
+	if (frame_chain_available_data(chain) < count) return RV_NOSPACE;
+	for (i=0; (i < chain->count) && (count > 0); i++) {
+		available = _frame_available_data(&chain->segments[i]);
+		if (available > count) available = count;
+		frame_advance_nocheck(&chain->segments[i], available);
+		count -= available;
+	}
+	return RV_SUCCESS;
+}
+
+/**
+ * frame_chain_transfer() flattens the chain into dst_frame, for the few
+ * places where a contiguous buffer is really needed.
+ */
+retval_t frame_chain_transfer(frame_t *dst_frame, frame_chain_t *chain) {
+	size_t i;
+
+	for (i=0; i < chain->count; i++) {
+		SUCCESS_OR_RETURN(frame_transfer(dst_frame, &chain->segments[i]));
+	}
+	return RV_SUCCESS;
+}
+
+void frame_chain_dispose(frame_chain_t *chain) {
+	size_t i;
+
+	for (i=0; i < chain->owned_count; i++) {
+		frame_dispose(chain->owned[i]);
+	}
+	frame_chain_init(chain);
+}
+
 void inline frame_advance_nocheck(frame_t *frame, size_t count) {
     frame->position += count;
 }
@@ -270,22 +447,19 @@ retval_t frame_put_u8(frame_t *frame, uint8_t data) {
 
 retval_t frame_put_u16(frame_t *frame, uint16_t data) {
    if (!frame_hasEnoughSpace(frame, 2)) return RV_NOSPACE;
-   frame->buf[frame->position++] = data >> 8;
-   frame->buf[frame->position++] = data;
+   store_be16(&frame->buf[frame->position], data);
+   frame->position += 2;
    return RV_SUCCESS;
 }
 
 retval_t frame_put_s16(frame_t *frame, int16_t data) {
-   if (!frame_hasEnoughSpace(frame, 2)) return RV_NOSPACE;
-   frame->buf[frame->position++] = data >> 8;
-   frame->buf[frame->position++] = data;
-   return RV_SUCCESS;
+   return frame_put_u16(frame, (uint16_t)data);
 }
 
 retval_t frame_put_u16_le(frame_t *frame, uint16_t data) {
    if (!frame_hasEnoughSpace(frame, 2)) return RV_NOSPACE;
-   frame->buf[frame->position++] = data;
-   frame->buf[frame->position++] = data >> 8;
+   store_le16(&frame->buf[frame->position], data);
+   frame->position += 2;
    return RV_SUCCESS;
 }
 
@@ -307,35 +481,83 @@ retval_t frame_put_u24_le(frame_t *frame, uint32_t data) {
 
 retval_t frame_put_u32(frame_t *frame, uint32_t data) {
    if (!frame_hasEnoughSpace(frame, 4)) return RV_NOSPACE;
-   frame->buf[frame->position++] = data >> 24;
-   frame->buf[frame->position++] = data >> 16;
-   frame->buf[frame->position++] = data >> 8;
-   frame->buf[frame->position++] = data;
+   store_be32(&frame->buf[frame->position], data);
+   frame->position += 4;
    return RV_SUCCESS;
 }
 
 retval_t frame_put_u32_le(frame_t *frame, uint32_t data) {
    if (!frame_hasEnoughSpace(frame, 4)) return RV_NOSPACE;
-   frame->buf[frame->position++] = data;
-   frame->buf[frame->position++] = data >> 8;
-   frame->buf[frame->position++] = data >> 16;
-   frame->buf[frame->position++] = data >> 24;
+   store_le32(&frame->buf[frame->position], data);
+   frame->position += 4;
    return RV_SUCCESS;
 }
 
 retval_t frame_put_u64(frame_t *frame, uint64_t data) {
    if (!frame_hasEnoughSpace(frame, sizeof(uint64_t))) return RV_NOSPACE;
-   frame->buf[frame->position++] = data >> 56;
-   frame->buf[frame->position++] = data >> 48;
-   frame->buf[frame->position++] = data >> 40;
-   frame->buf[frame->position++] = data >> 32;
-   frame->buf[frame->position++] = data >> 24;
-   frame->buf[frame->position++] = data >> 16;
-   frame->buf[frame->position++] = data >> 8;
-   frame->buf[frame->position++] = data;
+   store_be32(&frame->buf[frame->position], data >> 32);
+   store_be32(&frame->buf[frame->position + 4], data);
+   frame->position += 8;
    return RV_SUCCESS;
 }
 
+/**
+ * Bulk array codecs. They give the same result as calling the single value
+ * function once per element: as many whole elements as fit are processed,
+ * and RV_NOSPACE is returned if some didn't.
+ */
+static size_t frame_array_fit(const frame_t *frame, size_t count, size_t element_size) {
+	size_t fit;
+
+	fit = _frame_available_data(frame) / element_size;
+	return fit < count ? fit : count;
+}
+
+#define FRAME_PUT_ARRAY(__name, __type, __wtype, __size, __order, __conv, __store)	\
+retval_t __name(frame_t *frame, const __type *data, size_t count) {					\
+	size_t i, fit;																	\
+	uint8_t *p;																		\
+																					\
+	fit = frame_array_fit(frame, count, __size);									\
+	p = &frame->buf[frame->position];												\
+	if (HOST_IS_BIG_ENDIAN == (__order)) {											\
+		memcpy(p, data, fit * (__size));											\
+	} else if (IS_ALIGNED(p, __size)) {												\
+		for (i = 0; i < fit; i++) ((__wtype *)p)[i] = __conv(data[i]);				\
+	} else {																		\
+		for (i = 0; i < fit; i++, p += (__size)) __store(p, data[i]);				\
+	}																				\
+	frame->position += fit * (__size);												\
+	return fit == count ? RV_SUCCESS : RV_NOSPACE;									\
+}
+
+#define FRAME_GET_ARRAY(__name, __type, __wtype, __size, __order, __conv, __load)	\
+retval_t __name(frame_t *frame, __type *data, size_t count) {						\
+	size_t i, fit;																	\
+	const uint8_t *p;																\
+																					\
+	fit = frame_array_fit(frame, count, __size);									\
+	p = &frame->buf[frame->position];												\
+	if (HOST_IS_BIG_ENDIAN == (__order)) {											\
+		memcpy(data, p, fit * (__size));											\
+	} else if (IS_ALIGNED(p, __size)) {												\
+		for (i = 0; i < fit; i++) data[i] = __conv(((const __wtype *)p)[i]);		\
+	} else {																		\
+		for (i = 0; i < fit; i++, p += (__size)) data[i] = __load(p);				\
+	}																				\
+	frame->position += fit * (__size);												\
+	return fit == count ? RV_SUCCESS : RV_NOSPACE;									\
+}
+
+FRAME_PUT_ARRAY(frame_put_u16_array,    uint16_t, word16_t, 2, 1, BE16, store_be16)
+FRAME_PUT_ARRAY(frame_put_u16_le_array, uint16_t, word16_t, 2, 0, LE16, store_le16)
+FRAME_PUT_ARRAY(frame_put_u32_array,    uint32_t, word32_t, 4, 1, BE32, store_be32)
+FRAME_PUT_ARRAY(frame_put_u32_le_array, uint32_t, word32_t, 4, 0, LE32, store_le32)
+FRAME_GET_ARRAY(frame_get_u16_array,    uint16_t, word16_t, 2, 1, BE16, load_be16)
+FRAME_GET_ARRAY(frame_get_u16_le_array, uint16_t, word16_t, 2, 0, LE16, load_le16)
+FRAME_GET_ARRAY(frame_get_u32_array,    uint32_t, word32_t, 4, 1, BE32, load_be32)
+FRAME_GET_ARRAY(frame_get_u32_le_array, uint32_t, word32_t, 4, 0, LE32, load_le32)
+
 retval_t frame_put_bits_by_4(frame_t *frame, uint32_t data, size_t bits) {
 	uint32_t mask;
 	retval_t rv;
@@ -407,39 +629,61 @@ retval_t frame_put_f(frame_t *frame, float data) {
 	return frame_put_data(frame, &data, sizeof(data));
 }
 
-retval_t _frame_pool_initialize(const frame_pool_t *pool) {
+retval_t _frame_pool_initialize(frame_pool_t *pool) {
 	size_t i;
 	uint8_t *data_buffer_base = pool->big_buffer;
 
+	taskENTER_CRITICAL();
 	for (i=0; i < pool->count; i++) {
 		pool->frames[i].flags = 0;
 		pool->frames[i].buf = data_buffer_base;
 		data_buffer_base += pool->buffer_size;
+		/* Lowest frames are handed out first, like the old linear scan */
+		pool->free_list[pool->count - 1 - i] = &pool->frames[i];
 	}
+	pool->free_count = pool->count;
+	pool->high_water = 0;
+	pool->failures = 0;
+	taskEXIT_CRITICAL();
 	return RV_SUCCESS;
 }
 
 retval_t frame_pool_initialize() {
-	return _frame_pool_initialize(&TheFramePool);
+	size_t i;
+
+	for (i=0; i < ARRAY_COUNT(FramePools); i++) {
+		SUCCESS_OR_RETURN(_frame_pool_initialize(FramePools[i]));
+	}
+	return RV_SUCCESS;
 }
 
 int _frame_free_count(const frame_pool_t *pool) {
-	int answer = 0,i;
-	taskENTER_CRITICAL();
-	for (i=0; i<pool->count; i++) {
-		if (FRAME_IS_AVAILABLE(&pool->frames[i])) {
-			answer++;
-		}
-	}
-	taskEXIT_CRITICAL();
-	return answer;
+	/* single word read, no need for a critical section */
+	return pool->free_count;
 }
 
 int frame_free_count() {
 	return _frame_free_count(&TheFramePool);
 }
 
-retval_t _frame_recycle(const frame_pool_t *pool, frame_t *frame) {
+bool _frame_pool_owns(const frame_pool_t *pool, const frame_t *frame) {
+	return (frame >= &pool->frames[0]) && (frame < &pool->frames[pool->count]);
+}
+
+static frame_pool_t *frame_pool_of(const frame_t *frame) {
+	size_t i;
+
+	for (i=0; i < ARRAY_COUNT(FramePools); i++) {
+		if (_frame_pool_owns(FramePools[i], frame)) return FramePools[i];
+	}
+	return NULL;
+}
+
+bool frame_is_pooled(const frame_t *frame) {
+	return NULL != frame_pool_of(frame);
+}
+
+static retval_t _frame_recycle(const frame_pool_t *pool, frame_t *frame) {
 	frame->position = 0;
 	frame->retry = 0;
 	frame->timeout = 0;
@@ -448,30 +692,47 @@ retval_t _frame_recycle(const frame_pool_t *pool, frame_t *frame) {
 }
 
 retval_t frame_recycle(frame_t *frame) {
-	return _frame_recycle(&TheFramePool, frame);
+	const frame_pool_t *pool;
+
+	pool = frame_pool_of(frame);
+	if (NULL == pool) pool = &TheFramePool; /* i.e. emergency frames, sized as big ones */
+	return _frame_recycle(pool, frame);
 }
 
-retval_t _frame_allocate(const frame_pool_t *pool, frame_t **frame) {
-	size_t i;
+retval_t _frame_allocate(frame_pool_t *pool, frame_t **frame) {
+	size_t in_use;
 
 	taskENTER_CRITICAL();
-	for (i=0; i<pool->count; i++) {
-		if (FRAME_IS_AVAILABLE(&pool->frames[i])) {
-			*frame = &pool->frames[i];
-			(*frame)->flags = FRAME_FLAG_IN_USE;
-			taskEXIT_CRITICAL();     /* As soon as possible */
-			return _frame_recycle(pool, *frame);
-		}
+	if (0 == pool->free_count) {
+		pool->failures++;
+		taskEXIT_CRITICAL();
+		return RV_NOSPACE;
 	}
+	*frame = pool->free_list[--pool->free_count];
+	(*frame)->flags = FRAME_FLAG_IN_USE;
+	in_use = pool->count - pool->free_count;
+	if (in_use > pool->high_water) pool->high_water = in_use;
 	taskEXIT_CRITICAL();
-	return RV_NOSPACE;
+
+	return _frame_recycle(pool, *frame);
 }
 
 retval_t frame_allocate(frame_t **frame) {
 	return _frame_allocate(&TheFramePool, frame);
 }
 
-retval_t _frame_allocate_retry(const frame_pool_t *pool, frame_t **frame, portTickType delay) {
+retval_t frame_allocate_size(frame_t **frame, size_t size) {
+	size_t i;
+
+	/* smallest class that fits, falling back to bigger ones when exhausted */
+	for (i=0; i < ARRAY_COUNT(FramePools); i++) {
+		if (FramePools[i]->buffer_size < size) continue;
+		if (RV_SUCCESS == _frame_allocate(FramePools[i], frame)) return RV_SUCCESS;
+	}
+	return RV_NOSPACE;
+}
+
+static retval_t _frame_allocate_retry(frame_pool_t *pool, frame_t **frame, portTickType delay) {
 	retval_t rv;
 
 	rv = _frame_allocate(pool, frame);
@@ -489,8 +750,45 @@ retval_t frame_allocate_retry(frame_t **frame, portTickType delay) {
 	return _frame_allocate_retry(&TheFramePool, frame, delay);
 }
 
-void inline frame_dispose(frame_t *frame) {
-	frame->flags = 0;
+void _frame_pool_dispose(frame_pool_t *pool, frame_t *frame) {
+	taskENTER_CRITICAL();
+	/* Checking the flag makes a double dispose harmless */
+	if (FRAME_IS_IN_USE(frame)) {
+		frame->flags = 0;
+		pool->free_list[pool->free_count++] = frame;
+	}
+	taskEXIT_CRITICAL();
+}
+
+void frame_dispose(frame_t *frame) {
+	frame_pool_t *pool;
+
+	pool = frame_pool_of(frame);
+	if (NULL == pool) {
+		frame->flags = 0;
+		return;
+	}
+	_frame_pool_dispose(pool, frame);
+}
+
+size_t frame_pool_class_count() {
+	return ARRAY_COUNT(FramePools);
+}
+
+retval_t frame_pool_get_stats(size_t class_index, frame_pool_stats_t *stats) {
+	const frame_pool_t *pool;
+
+	if (class_index >= ARRAY_COUNT(FramePools)) return RV_NOENT;
+	pool = FramePools[class_index];
+
+	taskENTER_CRITICAL();
+	stats->buffer_size = pool->buffer_size;
+	stats->count = pool->count;
+	stats->free = pool->free_count;
+	stats->high_water = pool->high_water;
+	stats->failures = pool->failures;
+	taskEXIT_CRITICAL();
+	return RV_SUCCESS;
 }
 
 void frame_compute_mac(const frame_t *frame, uint32_t nonce, const uint8_t *key, size_t key_length, frame_mac_t *mac) {
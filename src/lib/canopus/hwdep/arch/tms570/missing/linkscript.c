@@ -3,6 +3,8 @@
 const void *_start = NULL; /* in .rodata */
 
 void *_nvram0_addr;
+void *_nvram1_addr;
 void *_cdh_sample_addr;
+void *_cdh_delayed_cmds_addr;
 void *__stage_0_config__;
 void *upload_memory_area_start, *upload_memory_area_stop;
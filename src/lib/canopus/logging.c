@@ -13,6 +13,7 @@
 
 #include <FreeRTOS.h>
 #include <task.h>
+#include <semphr.h>
 
 #define LOGGERS_COUNT 4
 
@@ -105,49 +106,516 @@ log_register(int index, log_report_nb_t *logger)
     loggers[index] = logger;
 }
 
-void
-log_report_nb(portTickType xBlockTime, logbit_t bit, const char *msg)
+/* Deferred logging.
+ *
+ * Once log_deferred_start() is called, log_report_fmt() doesn't format:
+ * it records the bit, the ticks, the format pointer (which is its id) and
+ * the raw arguments (strings copied) in a ring of LOG_RING_SIZE bytes,
+ * and a task at LOG_TASK_PRIORITY formats and dispatches them to the
+ * loggers. The ring is only held for a memcpy() in a critical section,
+ * and a caller never blocks: if it's full the message is dropped and
+ * counted in log_get_stats(), and the LOG task reports how many were
+ * dropped as soon as it has drained the ring. Plain messages are copied
+ * as text, those longer than a record are still dispatched in the caller.
+ *
+ * The mask is checked once, when a message is logged: what was recorded
+ * goes out even if the mask changes before the LOG task gets to it.
+ *
+ * LOG_TASK_PRIORITY is above the periodic AOCS, CDH and thermal tasks,
+ * which log the most, so they can't keep it from draining the ring. It
+ * shares its priority with memory and power and is below platform.
+ */
+#define LOG_RING_SIZE           4096
+#define LOG_RECORD_MAX          160
+#define LOG_TASK_PRIORITY       (tskIDLE_PRIORITY + 3)
+#define LOG_TASK_STACK_DEPTH    (configMINIMAL_STACK_SIZE + 1024)
+
+enum log_record_kind_e {
+    LOG_RECORD_TEXT,
+    LOG_RECORD_FMT,
+};
+
+typedef struct log_record_t {
+    uint16_t size;      /* of the whole record, 0 marks a wrap */
+    uint8_t bit;
+    uint8_t kind;
+    uint8_t args;       /* conversions recorded */
+    portTickType ticks;
+    const char *fmt;
+} log_record_t;
+
+struct log_ring_t {
+    uint8_t buf[LOG_RING_SIZE];
+    size_t head, tail, used;
+    log_stats_t stats;
+};
+
+static struct {
+    log_ring_t ring;
+    xSemaphoreHandle kick;
+    xSemaphoreHandle dispatch_lock;
+    xTaskHandle task;
+    uint32_t dropped_reported;
+} deferred;
+
+static portTickType dispatch_ticks;
+
+/* to all the loggers, as logged at `ticks` */
+static void
+log_dispatch(portTickType xBlockTime, portTickType ticks, logbit_t bit, const char *msg)
 {
     int i;
 
-    FUTURE_HOOK_2(log_report_nb, bit, msg);
-
+    if (NULL != deferred.dispatch_lock) {
+        (void)xSemaphoreTakeRecursive(deferred.dispatch_lock, portMAX_DELAY);
+    }
+    dispatch_ticks = ticks;
     for (i = 0; i < ARRAY_COUNT(loggers); i++) {
         if (IS_PTR_VALID(loggers[i])) {
             loggers[i](xBlockTime, bit, msg);
         }
     }
+    if (NULL != deferred.dispatch_lock) {
+        (void)xSemaphoreGiveRecursive(deferred.dispatch_lock);
+    }
+}
+
+void
+log_report_nb(portTickType xBlockTime, logbit_t bit, const char *msg)
+{
+    FUTURE_HOOK_2(log_report_nb, bit, msg);
+
+    log_dispatch(xBlockTime, xTaskGetTickCount(), bit, msg);
+}
+
+static bool
+log_deferred(void)
+{
+    return (NULL != deferred.task) && (taskSCHEDULER_RUNNING == xTaskGetSchedulerState());
+}
+
+static bool
+log_ring_put(log_ring_t *ring, const uint8_t *rec, size_t size)
+{
+    size_t wasted = 0;
+    bool ok = false;
+
+    taskENTER_CRITICAL();
+    if (LOG_RING_SIZE - ring->head < size) {
+        wasted = LOG_RING_SIZE - ring->head;
+    }
+    if (ring->used + wasted + size <= LOG_RING_SIZE) {
+        if (wasted >= sizeof(uint16_t)) {
+            memset(&ring->buf[ring->head], 0, sizeof(uint16_t));
+        }
+        if (wasted) {
+            ring->head = 0;
+            ring->used += wasted;
+        }
+        memcpy(&ring->buf[ring->head], rec, size);
+        ring->head = (ring->head + size) % LOG_RING_SIZE;
+        ring->used += size;
+        ring->stats.recorded++;
+        if (ring->used > ring->stats.high_water) {
+            ring->stats.high_water = ring->used;
+        }
+        ok = true;
+    } else {
+        ring->stats.dropped++;
+    }
+    taskEXIT_CRITICAL();
+    return ok;
+}
+
+static bool
+log_ring_get(log_ring_t *ring, uint8_t *rec)
+{
+    size_t room;
+    uint16_t size;
+    bool ok = false;
+
+    taskENTER_CRITICAL();
+    while (ring->used) {
+        room = LOG_RING_SIZE - ring->tail;
+        if (room >= sizeof(size)) {
+            memcpy(&size, &ring->buf[ring->tail], sizeof(size));
+        }
+        if ((room < sizeof(size)) || (0 == size)) { /* wrap */
+            ring->tail = 0;
+            ring->used -= room;
+            continue;
+        }
+        memcpy(rec, &ring->buf[ring->tail], size);
+        ring->tail = (ring->tail + size) % LOG_RING_SIZE;
+        ring->used -= size;
+        ok = true;
+        break;
+    }
+    taskEXIT_CRITICAL();
+    return ok;
+}
+
+/* false if it doesn't fit in a record */
+static bool
+log_record_text(log_ring_t *ring, logbit_t bit, const char *msg)
+{
+    uint8_t rec[LOG_RECORD_MAX];
+    log_record_t hdr;
+    size_t len;
+
+    len = strlen(msg) + 1;
+    if (sizeof(hdr) + len > sizeof(rec)) return false;
+
+    hdr.size = sizeof(hdr) + len;
+    hdr.bit = bit;
+    hdr.kind = LOG_RECORD_TEXT;
+    hdr.args = 0;
+    hdr.ticks = xTaskGetTickCount();
+    hdr.fmt = NULL;
+    memcpy(rec, &hdr, sizeof(hdr));
+    memcpy(rec + sizeof(hdr), msg, len);
+    (void)log_ring_put(ring, rec, hdr.size);
+    return true;
 }
 
 void
 log_report(logbit_t bit, const char *msg)
 {
+    if (!log_enabled(bit)) {
+        return;
+    }
+    if (log_deferred() && log_record_text(&deferred.ring, bit, msg)) {
+        (void)xSemaphoreGive(deferred.kick);
+        return;
+    }
     log_report_nb(log_timeout, bit, msg);
 }
 
+log_stats_t
+log_get_stats(void)
+{
+    log_stats_t stats;
+
+    taskENTER_CRITICAL();
+    stats = deferred.ring.stats;
+    taskEXIT_CRITICAL();
+    return stats;
+}
+
 #ifdef VARARGS_SUPPORTED /* va_list is C89 */
 
+/* printf() conversions, as far as the arguments they take */
+typedef enum log_arg_e {
+    LOG_ARG_NONE,       /* %% */
+    LOG_ARG_INT,        /* also char and short, promoted */
+    LOG_ARG_LONG,
+    LOG_ARG_LONGLONG,
+    LOG_ARG_SIZE,
+    LOG_ARG_PTR,        /* %p, and %n, not written */
+    LOG_ARG_STR,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_LONGDOUBLE,
+} log_arg_e;
+
+typedef struct log_spec_t {
+    const char *start;  /* '%', the literal text before it is already out */
+    size_t len;
+    uint8_t stars;      /* int arguments for '*' width/precision */
+    log_arg_e arg;
+} log_spec_t;
+
+/* finds the next conversion from *fmt, false if there're no more */
+static bool
+log_spec_next(const char **fmt, log_spec_t *spec)
+{
+    const char *p = strchr(*fmt, '%');
+    char length = 0;
+
+    if (NULL == p) return false;
+
+    spec->start = p++;
+    spec->stars = 0;
+    while (*p && strchr("-+ #0'", *p)) p++;
+    if ('*' == *p) { spec->stars++; p++; }
+    while (isdigit((int)*p)) p++;
+    if ('.' == *p) {
+        p++;
+        if ('*' == *p) { spec->stars++; p++; }
+        while (isdigit((int)*p)) p++;
+    }
+    while (*p && strchr("hlLqjzt", *p)) {
+        length = (('l' == length) && ('l' == *p)) ? 'q' : *p;
+        p++;
+    }
+
+    switch (*p) {
+    case '%':
+        spec->arg = LOG_ARG_NONE;
+        break;
+    case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+        switch (length) {
+        case 'l': spec->arg = LOG_ARG_LONG; break;
+        case 'q': case 'j': case 'L': spec->arg = LOG_ARG_LONGLONG; break;
+        case 'z': case 't': spec->arg = LOG_ARG_SIZE; break;
+        default: spec->arg = LOG_ARG_INT; break;
+        }
+        break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+        spec->arg = ('L' == length) ? LOG_ARG_LONGDOUBLE : LOG_ARG_DOUBLE;
+        break;
+    case 's':
+        spec->arg = LOG_ARG_STR;
+        break;
+    case 'p': case 'n':
+        spec->arg = LOG_ARG_PTR;
+        break;
+    default: /* broken format, stop here */
+        return false;
+    }
+    spec->len = ++p - spec->start;
+    *fmt = p;
+    return true;
+}
+
+#define LOG_RECORD_ARG(_type_) do {                             \
+        _type_ _v_ = va_arg(*argp, _type_);                     \
+        if (pos + sizeof(_v_) > LOG_RECORD_MAX) return pos;     \
+        memcpy(&rec[pos], &_v_, sizeof(_v_));                   \
+        pos += sizeof(_v_);                                     \
+    } while (0)
+
+/* records the arguments of one conversion at rec[pos], returns the new
+ * pos, or pos if they don't fit */
+static size_t
+log_record_args(uint8_t *rec, size_t pos, const log_spec_t *spec, va_list *argp)
+{
+    const char *s;
+    size_t len;
+    int i;
+
+    for (i = 0; i < spec->stars; i++) {
+        LOG_RECORD_ARG(int);
+    }
+    switch (spec->arg) {
+    case LOG_ARG_NONE:       break;
+    case LOG_ARG_INT:        LOG_RECORD_ARG(int); break;
+    case LOG_ARG_LONG:       LOG_RECORD_ARG(long); break;
+    case LOG_ARG_LONGLONG:   LOG_RECORD_ARG(long long); break;
+    case LOG_ARG_SIZE:       LOG_RECORD_ARG(size_t); break;
+    case LOG_ARG_PTR:        LOG_RECORD_ARG(void *); break;
+    case LOG_ARG_DOUBLE:     LOG_RECORD_ARG(double); break;
+    case LOG_ARG_LONGDOUBLE: LOG_RECORD_ARG(long double); break;
+    case LOG_ARG_STR:
+        s = va_arg(*argp, const char *);
+        if (NULL == s) s = "(null)";
+        if (pos + 1 >= LOG_RECORD_MAX) return pos;
+        for (len = 0; (pos + len + 1 < LOG_RECORD_MAX) && s[len]; len++); /* as much as fits */
+        memcpy(&rec[pos], s, len);
+        rec[pos + len] = '\0';
+        pos += len + 1;
+        break;
+    }
+    return pos;
+}
+#undef LOG_RECORD_ARG
+
 static void
-log_report_varargs_nb(portTickType xBlockTime, logbit_t bit, const char *fmt, const va_list *argp)
+log_record_fmt(log_ring_t *ring, logbit_t bit, const char *fmt, const va_list *argp)
 {
-    char buf[CONSOLE_LINESZ_MAX];
+    uint8_t rec[LOG_RECORD_MAX];
+    log_record_t hdr;
+    log_spec_t spec;
+    const char *p = fmt;
+    size_t pos, next;
+    bool truncated = false;
+    va_list ap;
+
+    hdr.bit = bit;
+    hdr.kind = LOG_RECORD_FMT;
+    hdr.args = 0;
+    hdr.ticks = xTaskGetTickCount();
+    hdr.fmt = fmt;
+
+    va_copy(ap, *(va_list *)argp);
+    for (pos = sizeof(hdr); log_spec_next(&p, &spec); pos = next, hdr.args++) {
+        next = log_record_args(rec, pos, &spec, &ap);
+        if ((next == pos) && (LOG_ARG_NONE != spec.arg || spec.stars)) {
+            truncated = true;
+            break;
+        }
+    }
+    va_end(ap);
+
+    hdr.size = pos;
+    memcpy(rec, &hdr, sizeof(hdr));
+    (void)log_ring_put(ring, rec, hdr.size);
+
+    if (truncated) {
+        taskENTER_CRITICAL();
+        ring->stats.truncated++; /* not exact, it's just a hint */
+        taskEXIT_CRITICAL();
+    }
+}
+
+/* appends to buf[*n], snprintf() style */
+static void
+log_append(char *buf, size_t size, int *n, const char *fmt, ...)
+{
+    va_list argp;
     int sz;
 
-    if (NULL == fmt || !log_enabled(bit) || !loggers_registered()) {
-        /* save time. */
-        return;
+    if (*n >= size) return;
+    va_start(argp, fmt);
+    sz = vsnprintf(buf + *n, size - *n, fmt, argp);
+    va_end(argp);
+    if (sz > 0) *n += sz;
+}
+
+#define LOG_FORMAT_ARG(_type_) do {             \
+        _type_ _v_;                             \
+        memcpy(&_v_, &rec[pos], sizeof(_v_));   \
+        pos += sizeof(_v_);                     \
+        log_append(buf, size, n, spec, _v_);    \
+    } while (0)
+
+/* formats a record written by log_record_fmt() into buf */
+static void
+log_format(const uint8_t *rec, char *buf, size_t size, int *n)
+{
+    log_record_t hdr;
+    log_spec_t s;
+    char spec[32];
+    const char *p, *lit;
+    size_t pos, j, k;
+    int i, star;
+
+    memcpy(&hdr, rec, sizeof(hdr));
+    pos = sizeof(hdr);
+    lit = p = hdr.fmt;
+    for (i = 0; (i < hdr.args) && log_spec_next(&p, &s); i++) {
+        log_append(buf, size, n, "%.*s", (int)(s.start - lit), lit);
+        lit = p;
+
+        /* the conversion alone, with '*' replaced by the values recorded */
+        for (j = 0, k = 0; (j < s.len) && (k < sizeof(spec) - 12); j++) {
+            if ('*' == s.start[j]) {
+                memcpy(&star, &rec[pos], sizeof(star));
+                pos += sizeof(star);
+                k += sprintf(&spec[k], "%d", star);
+            } else {
+                spec[k++] = s.start[j];
+            }
+        }
+        spec[k] = '\0';
+
+        switch (s.arg) {
+        case LOG_ARG_NONE:       log_append(buf, size, n, spec); break;
+        case LOG_ARG_INT:        LOG_FORMAT_ARG(int); break;
+        case LOG_ARG_LONG:       LOG_FORMAT_ARG(long); break;
+        case LOG_ARG_LONGLONG:   LOG_FORMAT_ARG(long long); break;
+        case LOG_ARG_SIZE:       LOG_FORMAT_ARG(size_t); break;
+        case LOG_ARG_DOUBLE:     LOG_FORMAT_ARG(double); break;
+        case LOG_ARG_LONGDOUBLE: LOG_FORMAT_ARG(long double); break;
+        case LOG_ARG_PTR:
+            if ('n' == s.start[s.len - 1]) {
+                pos += sizeof(void *); /* not writing anywhere */
+            } else {
+                LOG_FORMAT_ARG(void *);
+            }
+            break;
+        case LOG_ARG_STR:
+            log_append(buf, size, n, spec, (const char *)&rec[pos]);
+            pos += strlen((const char *)&rec[pos]) + 1;
+            break;
+        }
     }
-    sz = vsnprintf(buf, sizeof(buf), fmt, *argp);
+    if ((i < hdr.args) || !log_spec_next(&p, &s)) {
+        log_append(buf, size, n, "%s", lit);
+    } else {
+        log_append(buf, size, n, "%.*s...\n", (int)(s.start - lit), lit); /* truncated */
+    }
+}
+#undef LOG_FORMAT_ARG
+
+static void
+log_output(portTickType xBlockTime, portTickType ticks, logbit_t bit, char *buf, size_t size, int sz)
+{
     if (sz <= 0) {
         /* nothing to print */
         return;
     }
-    if (sz >= sizeof(buf)) {
+    if (sz >= size) {
         /* shorten the output */
-        buf[sizeof(buf)-1] = '\n';
+        buf[size-1] = '\n';
     }
 
-    log_report_nb(xBlockTime, bit, buf);
+    log_dispatch(xBlockTime, ticks, bit, buf);
+}
+
+static void
+log_task(void *pvParameters)
+{
+    uint8_t rec[LOG_RECORD_MAX];
+    char buf[CONSOLE_LINESZ_MAX];
+    log_record_t hdr;
+    uint32_t dropped;
+    int n;
+
+    while (1) {
+        (void)xSemaphoreTake(deferred.kick, portMAX_DELAY);
+
+        while (log_ring_get(&deferred.ring, rec)) {
+            memcpy(&hdr, rec, sizeof(hdr));
+            if (LOG_RECORD_TEXT == hdr.kind) {
+                log_dispatch(log_timeout, hdr.ticks, hdr.bit, (const char *)&rec[sizeof(hdr)]);
+            } else {
+                n = 0;
+                buf[0] = '\0';
+                log_format(rec, buf, sizeof(buf), &n);
+                log_output(log_timeout, hdr.ticks, hdr.bit, buf, sizeof(buf), n);
+            }
+        }
+
+        dropped = deferred.ring.stats.dropped;
+        if (dropped != deferred.dropped_reported) {
+            n = snprintf(buf, sizeof(buf), "log: %lu messages dropped\r\n", (unsigned long)(dropped - deferred.dropped_reported));
+            deferred.dropped_reported = dropped;
+            log_output(log_timeout, xTaskGetTickCount(), LOG_ALL, buf, sizeof(buf), n);
+        }
+    }
+}
+
+void
+log_deferred_start(void)
+{
+    if (NULL != deferred.task) return;
+
+    deferred.dispatch_lock = xSemaphoreCreateRecursiveMutex();
+    vSemaphoreCreateBinary(deferred.kick);
+    assert(NULL != deferred.dispatch_lock);
+    assert(NULL != deferred.kick);
+    (void)xSemaphoreTake(deferred.kick, 0);
+
+    xTaskCreate(log_task, (signed char *)"LOG", LOG_TASK_STACK_DEPTH, NULL, LOG_TASK_PRIORITY, &deferred.task);
+}
+
+static void
+log_report_varargs_nb(portTickType xBlockTime, logbit_t bit, const char *fmt, const va_list *argp)
+{
+    char buf[CONSOLE_LINESZ_MAX];
+    int sz;
+
+    if (NULL == fmt || !log_enabled(bit) || !loggers_registered()) {
+        /* save time. */
+        return;
+    }
+    if (log_deferred()) {
+        log_record_fmt(&deferred.ring, bit, fmt, argp);
+        (void)xSemaphoreGive(deferred.kick);
+        return;
+    }
+    sz = vsnprintf(buf, sizeof(buf), fmt, *argp);
+    log_output(xBlockTime, xTaskGetTickCount(), bit, buf, sizeof(buf), sz);
 }
 
 void
@@ -185,6 +653,74 @@ log_report_fmt(logbit_t bit, const char *fmt, ...)
     log_report_varargs_nb(log_timeout, bit, fmt, &argp);
     va_end(argp);
 }
+
+/* ====================== for the tests ====================== */
+
+/* Rings of their own for platform_tests, the LOG task doesn't drain them */
+log_ring_t *
+log_test_ring_new(void)
+{
+    log_ring_t *ring = pvPortMalloc(sizeof(*ring));
+
+    if (NULL != ring) {
+        memset(ring, 0, sizeof(*ring));
+    }
+    return ring;
+}
+
+void
+log_test_ring_free(log_ring_t *ring)
+{
+    vPortFree(ring);
+}
+
+bool
+log_test_report(log_ring_t *ring, const char *msg)
+{
+    return log_record_text(ring, LOG_ALL, msg);
+}
+
+void
+log_test_report_fmt(log_ring_t *ring, const char *fmt, ...)
+{
+    va_list argp;
+
+    va_start(argp, fmt);
+    log_record_fmt(ring, LOG_ALL, fmt, &argp);
+    va_end(argp);
+}
+
+/* the oldest message, as the LOG task would dispatch it */
+bool
+log_test_read(log_ring_t *ring, char *buf, size_t size)
+{
+    uint8_t rec[LOG_RECORD_MAX];
+    log_record_t hdr;
+    int n = 0;
+
+    if (!log_ring_get(ring, rec)) return false;
+
+    memcpy(&hdr, rec, sizeof(hdr));
+    buf[0] = '\0';
+    if (LOG_RECORD_TEXT == hdr.kind) {
+        log_append(buf, size, &n, "%s", (const char *)&rec[sizeof(hdr)]);
+    } else {
+        log_format(rec, buf, size, &n);
+        if (n >= size) buf[size - 1] = '\n';
+    }
+    return true;
+}
+
+log_stats_t
+log_test_stats(log_ring_t *ring)
+{
+    log_stats_t stats;
+
+    taskENTER_CRITICAL();
+    stats = ring->stats;
+    taskEXIT_CRITICAL();
+    return stats;
+}
 #endif /* VARARGS_SUPPORTED */
 
 #define XXD_BUFSIZE 16
@@ -215,7 +751,7 @@ log_report_xxd16(logbit_t bit, uint8_t *iptr, size_t size)
     obuf[10 + XXD_BUFSIZE*3 + 2 + 16 + 0] = '\n';
     obuf[10 + XXD_BUFSIZE*3 + 2 + 16 + 1] = '\0';
 
-    log_report_nb(log_timeout, bit, obuf);
+    log_report(bit, obuf);
 }
 
 void
@@ -278,7 +814,8 @@ log_channel_report_nb(portTickType xBlockTime, logbit_t bit, const char *msg)
 
     FUTURE_HOOK_2(log_channel_report_nb, &bit, msg);
 
-    if (NULL == out_chan || NULL == msg || !log_enabled(bit)) { // FIXME not needed
+    /* the mask was checked when it was logged */
+    if (NULL == out_chan || NULL == msg) {
         return;
     }
 
@@ -289,7 +826,7 @@ log_channel_report_nb(portTickType xBlockTime, logbit_t bit, const char *msg)
     if (log_ticks) {
         static char buf[12];
 
-        sprintf(buf, "[%08lx] ", xTaskGetTickCount());
+        sprintf(buf, "[%08lx] ", dispatch_ticks);
         fmsg.buf = (uint8_t *)buf;
         fmsg.size = strlen(buf);
         frame_reset(&fmsg);
@@ -325,4 +862,7 @@ log_channel_init(const channel_t *const out, const char *const prompt)
         fhdr.buf = (uint8_t *)prompt;
         fhdr.size = strlen(prompt);
     }
+#ifdef VARARGS_SUPPORTED
+    log_deferred_start();
+#endif
 }
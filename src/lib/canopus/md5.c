@@ -35,23 +35,38 @@
 #include <canopus/types.h>
 #include <canopus/md5.h>
 
+#include <string.h>
+
+/*
+ * Whole blocks are transformed straight from the caller's buffer, only
+ * the leftovers go through mdContext->in. Words are loaded with a single
+ * access when the block is aligned, and byte by byte otherwise.
+ */
+#if defined(__big_endian__) || defined(__BIG_ENDIAN__) || \
+    (defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__))
+# define HOST_IS_BIG_ENDIAN 1
+#else
+# define HOST_IS_BIG_ENDIAN 0
+#endif
+
+#ifdef __GNUC__
+typedef uint32_t __attribute__((may_alias)) word32_t;
+#else
+typedef uint32_t word32_t;
+#endif
+
+#define IS_ALIGNED(ptr) (0 == ((uintptr_t)(ptr) & 3))
+
+#define SWAP32(x) ((((x) >> 24) & 0x000000ff) | (((x) >> 8) & 0x0000ff00) | \
+                   (((x) << 8)  & 0x00ff0000) | (((x) << 24) & 0xff000000))
+
 /* forward declaration */
-static void Transform(uint32_t *, const uint32_t *);
-
-static unsigned char PADDING[64] = {
-    0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-};
-
-/* F, G and H are basic MD5 functions: selection, majority, parity */
-#define F(x, y, z) (((x) & (y)) | ((~x) & (z)))
-#define G(x, y, z) (((x) & (z)) | ((y) & (~z)))
+static void Transform(uint32_t *, const unsigned char *);
+
+/* F, G and H are basic MD5 functions: selection, majority, parity.
+ * F and G are written with one operation less than in RFC 1321 */
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
 #define H(x, y, z) ((x) ^ (y) ^ (z))
 #define I(x, y, z) ((y) ^ ((x) | (~z))) 
 
@@ -95,13 +110,10 @@ void MD5Init (MD5_CTX *mdContext)
 
 void MD5Update (MD5_CTX *mdContext, const unsigned char *inBuf, unsigned int inLen)
 {
-
-    uint32_t in[16];
-    int mdi;
-    unsigned int i, ii;
+    unsigned int mdi, fill;
 
     /* compute number of bytes mod 64 */
-    mdi = (int)((mdContext->i[0] >> 3) & 0x3F);
+    mdi = (mdContext->i[0] >> 3) & 0x3F;
 
     /* update number of bits */
     if ((mdContext->i[0] + ((uint32_t)inLen << 3)) < mdContext->i[0])
@@ -109,66 +121,81 @@ void MD5Update (MD5_CTX *mdContext, const unsigned char *inBuf, unsigned int inL
     mdContext->i[0] += ((uint32_t)inLen << 3);
     mdContext->i[1] += ((uint32_t)inLen >> 29);
 
-    while (inLen--) {
-        /* add new character to buffer, increment mdi */
-        mdContext->in[mdi++] = *inBuf++;
-
-        /* transform if necessary */
-        if (mdi == 0x40) {
-            for (i = 0, ii = 0; i < 16; i++, ii += 4)
-                in[i] = (((uint32_t)mdContext->in[ii+3]) << 24) |
-                    (((uint32_t)mdContext->in[ii+2]) << 16) |
-                    (((uint32_t)mdContext->in[ii+1]) << 8) |
-                    ((uint32_t)mdContext->in[ii]);
-            Transform (mdContext->buf, in);
-            mdi = 0;
+    /* complete the buffered block first */
+    if (mdi) {
+        fill = 64 - mdi;
+        if (inLen < fill) {
+            memcpy(&mdContext->in[mdi], inBuf, inLen);
+            return;
         }
+        memcpy(&mdContext->in[mdi], inBuf, fill);
+        Transform (mdContext->buf, mdContext->in);
+        inBuf += fill;
+        inLen -= fill;
     }
+
+    for (; inLen >= 64; inBuf += 64, inLen -= 64)
+        Transform (mdContext->buf, inBuf);
+
+    memcpy(mdContext->in, inBuf, inLen);
+}
+
+static void Store32 (unsigned char *p, uint32_t x)
+{
+    p[0] = (unsigned char)(x & 0xFF);
+    p[1] = (unsigned char)((x >> 8) & 0xFF);
+    p[2] = (unsigned char)((x >> 16) & 0xFF);
+    p[3] = (unsigned char)((x >> 24) & 0xFF);
 }
 
 void MD5Final (MD5_CTX * mdContext)
 {
-    uint32_t in[16];
-    int mdi;
+    unsigned int mdi;
     unsigned int i, ii;
-    unsigned int padLen;
-
-    /* save number of bits */
-    in[14] = mdContext->i[0];
-    in[15] = mdContext->i[1];
 
     /* compute number of bytes mod 64 */
-    mdi = (int)((mdContext->i[0] >> 3) & 0x3F);
+    mdi = (mdContext->i[0] >> 3) & 0x3F;
 
-    /* pad out to 56 mod 64 */
-    padLen = (mdi < 56) ? (56 - mdi) : (120 - mdi);
-    MD5Update (mdContext, PADDING, padLen);
+    /* pad with 0x80 then zeros out to 56 mod 64 */
+    mdContext->in[mdi++] = 0x80;
+    if (mdi > 56) {
+        memset(&mdContext->in[mdi], 0, 64 - mdi);
+        Transform (mdContext->buf, mdContext->in);
+        mdi = 0;
+    }
+    memset(&mdContext->in[mdi], 0, 56 - mdi);
 
     /* append length in bits and transform */
-    for (i = 0, ii = 0; i < 14; i++, ii += 4)
-        in[i] = (((uint32_t)mdContext->in[ii+3]) << 24) |
-            (((uint32_t)mdContext->in[ii+2]) << 16) |
-            (((uint32_t)mdContext->in[ii+1]) << 8) |
-            ((uint32_t)mdContext->in[ii]);
-    Transform (mdContext->buf, in);
+    Store32 (&mdContext->in[56], mdContext->i[0]);
+    Store32 (&mdContext->in[60], mdContext->i[1]);
+    Transform (mdContext->buf, mdContext->in);
 
     /* store buffer in digest */
-    for (i = 0, ii = 0; i < 4; i++, ii += 4) {
-        mdContext->digest[ii] = (unsigned char)(mdContext->buf[i] & 0xFF);
-        mdContext->digest[ii+1] =
-            (unsigned char)((mdContext->buf[i] >> 8) & 0xFF);
-        mdContext->digest[ii+2] =
-            (unsigned char)((mdContext->buf[i] >> 16) & 0xFF);
-        mdContext->digest[ii+3] =
-            (unsigned char)((mdContext->buf[i] >> 24) & 0xFF);
-    }
+    for (i = 0, ii = 0; i < 4; i++, ii += 4)
+        Store32 (&mdContext->digest[ii], mdContext->buf[i]);
 }
 
-/* Basic MD5 step. Transform buf based on in.
+/* Basic MD5 step. Transform buf based on the 64 bytes at block.
  */
-static void Transform (uint32_t *buf, const uint32_t *in)
+static void Transform (uint32_t *buf, const unsigned char *block)
 {
     uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+    uint32_t x[16];
+    const word32_t *in;
+    unsigned int i;
+
+    if (!HOST_IS_BIG_ENDIAN && IS_ALIGNED(block)) {
+        in = (const word32_t *)block;
+    } else {
+        for (i = 0; i < 16; i++, block += 4) {
+            if (IS_ALIGNED(block))
+                x[i] = HOST_IS_BIG_ENDIAN ? SWAP32(*(const word32_t *)block) : *(const word32_t *)block;
+            else
+                x[i] = ((uint32_t)block[3] << 24) | ((uint32_t)block[2] << 16) |
+                    ((uint32_t)block[1] << 8) | (uint32_t)block[0];
+        }
+        in = x;
+    }
 
     /* Round 1 */
 #define S11 7
@@ -31,6 +31,7 @@ display_taskname(signed portCHAR *pcTaskName)
 void
 vApplicationStackOverflowHook(xTaskHandle *pxTask, signed portCHAR *pcTaskName)
 {
+    lowlevel_console_emergency();
     lowlevel_console_putnewline();
     lowlevel_console_putstring("STACK OVERFLOW");
     lowlevel_console_putnewline();
@@ -50,6 +51,7 @@ vApplicationStackOverflowHook(xTaskHandle *pxTask, signed portCHAR *pcTaskName)
 void
 vApplicationMallocFailedHook( void )
 {
+    lowlevel_console_emergency();
     lowlevel_console_putnewline();
     lowlevel_console_putstring("MALLOC FAILED");
     lowlevel_console_putnewline();
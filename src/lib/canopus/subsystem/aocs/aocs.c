@@ -14,6 +14,7 @@
 #include <canopus/subsystem/aocs/detumbling.h>
 #include <canopus/subsystem/aocs/pointing.h>
 #include <canopus/subsystem/aocs/algebra.h>
+#include <canopus/subsystem/aocs/aocs_log.h>
 #include <canopus/nvram.h>
 
 #include <math.h>
@@ -56,20 +57,43 @@ volatile uint32_t imu_dready_count = 0;
 #define AOCS_OPEN_CHANNEL_ON_LOW_POWER_AND_RESET (false)
 #endif
 
-#define AOCS_CIRCULAR_BUFFER
-//#undef AOCS_CIRCULAR_BUFFER
-
 #define AOCS_WITH_SAMPLER
 //#undef AOCS_WITH_SAMPLER
 
-#ifdef AOCS_CIRCULAR_BUFFER
-#define AOCS_CIRCULAR_BUFFER_SIZE_IN_BURSTS ((32*1024) / sizeof(adis1640x_data_burst_raw))
-static uint32_t aocs_circular_buffer_size = AOCS_CIRCULAR_BUFFER_SIZE_IN_BURSTS;
-static adis1640x_data_burst_raw aocs_circular_buffer[AOCS_CIRCULAR_BUFFER_SIZE_IN_BURSTS];
+static void aocs_log_imu(const adis1640x_data_burst_raw *burst) {
+	const uint16_t *w = (const uint16_t *)burst;
+	int32_t fields[12];
+	int i;
 
-static bool log_to_aocs_buffer = false;
-static uint32_t aocs_circular_buffer_pointer = 0;
-#endif
+	COMPILER_ASSERT(sizeof(adis1640x_data_burst_raw) == 12 * sizeof(uint16_t));
+	for (i = 0; i < 12; i++) fields[i] = w[i];
+	aocs_log_record(AOCS_LOG_IMU, fields);
+}
+
+static void aocs_log_css(const sun_vector_bits_t *v) {
+	int32_t fields[3] = {v->x, v->y, v->z};
+
+	aocs_log_record(AOCS_LOG_CSS, fields);
+}
+
+static void aocs_log_mtq(const vectorf_t duty) {
+	int32_t fields[3] = {duty[0] * 100, duty[1] * 100, duty[2] * 100};
+
+	aocs_log_record(AOCS_LOG_MTQ, fields);
+}
+
+/* Qv may be NULL when not pointing */
+static void aocs_log_state(const vectorf_t dipole, const vectorf_t Qv, float Qs) {
+	int32_t fields[8] = {aocs_state.mode, dipole[0] * 1e6, dipole[1] * 1e6, dipole[2] * 1e6};
+
+	if (NULL != Qv) {
+		fields[4] = Qs * 16384;
+		fields[5] = Qv[0] * 16384;
+		fields[6] = Qv[1] * 16384;
+		fields[7] = Qv[2] * 16384;
+	}
+	aocs_log_record(AOCS_LOG_STATE, fields);
+}
 
 static void css_read_vector() {
 	float samples[ADC_CHANNELS];
@@ -91,6 +115,7 @@ static void css_read_vector() {
 
 	fill_up_sun_t(&(aocs_state.sun_data),
 			&(aocs_state.sun_data.css_adc_measurement_volts));
+	aocs_log_css(&aocs_state.sun_data.sun_vector_bits);
 }
 
 bool imu_dready_event(void){
@@ -134,14 +159,7 @@ static void imu_dready_task(void *ss) {
 
 			imu_samples_count++;
 
-#ifdef AOCS_CIRCULAR_BUFFER
-			if(log_to_aocs_buffer) {
-				aocs_circular_buffer[aocs_circular_buffer_pointer++] =
-						aocs_state.last_imu_raw;
-				if(aocs_circular_buffer_pointer == aocs_circular_buffer_size)
-					aocs_circular_buffer_pointer = 0;
-			}
-#endif
+			if (RV_SUCCESS == imu_dready_task_rv) aocs_log_imu(&aocs_state.last_imu_raw);
 			xSemaphoreGive(xSemaphore_measuring);
 			aocs_mtq_on();
 		}
@@ -405,6 +423,7 @@ static void aocs_mtq_actuate_duty(const vectorf_t control_dipole) {
     ftoa(control_dipole[2], fbuf[2], sizeof(fbuf[2]));
 
 	pwm_set_duty_vec(control_dipole);
+	aocs_log_mtq(control_dipole);
 	aocs_state.mtq_on = true;
     pwm_allon();
 }
@@ -441,6 +460,7 @@ static void detumbling_step(subsystem_t *ss) {
     B[0] = LASTB(x); B[1] = LASTB(y); B[2] = LASTB(z);
     W[0] = LASTW(x); W[1] = LASTW(y); W[2] = LASTW(z);
   	Bxw_mtq_dipole(B, W, control_dipole);
+    aocs_log_state(control_dipole, NULL, 0);
 
     aocs_mtq_actuate_dipole(control_dipole);
 }
@@ -475,6 +495,7 @@ static retval_t pointing_step(subsystem_t *ss) {
     FUTURE_HOOK_2(fix_dipole, &rv, &control_dipole);
     SUCCESS_OR_RETURN(rv);
 
+    aocs_log_state(control_dipole, Qv, Qs);
     aocs_mtq_actuate_dipole(control_dipole);
 
     return RV_SUCCESS;
@@ -553,6 +574,7 @@ static void AOCS_main_task(void *pvParameters) {
 		} else {
 			// No mode change. Tick
 			PLATFORM_ss_is_alive(ss, HEARTBEAT_MAIN_TASK);
+			ss_telemetry_publish(ss);
 
 			switch (mode) {
 			case SM_OFF:
@@ -821,54 +843,48 @@ static retval_t cmd_set_mode(const subsystem_t *self, frame_t * iframe, frame_t
 
 static retval_t cmd_log_to_buffer(const subsystem_t *self, frame_t * iframe, frame_t * oframe) {
     retval_t rv;
-    uint8_t new_state;
+    uint8_t types;
 
-    rv = frame_get_u8(iframe, &new_state);
+    rv = frame_get_u8(iframe, &types);
     if(rv != RV_SUCCESS) return rv;
 
-    log_to_aocs_buffer = new_state;
+    aocs_log_mask = types & (AOCS_LOG_TYPE_BIT(AOCS_LOG_TYPES) - 1);
 
-    rv = frame_put_u8(oframe, log_to_aocs_buffer);
+    rv = frame_put_u8(oframe, aocs_log_mask);
     if(rv != RV_SUCCESS) return rv;
 
     return RV_SUCCESS;
 }
 
 static retval_t cmd_get_buffer(const subsystem_t *self, frame_t * iframe, frame_t * oframe) {
+    static uint8_t buf[MAX_FRAME_SIZE];
+    aocs_log_cursor_t at, next;
+    uint32_t from_s, to_s;
+    size_t size;
     retval_t rv;
-    uint32_t index=0, count=1;
-    uint32_t i = index;
 
-    rv = frame_get_u32(iframe, &index);
+    rv = frame_get_u32(iframe, &from_s);
+    if(rv != RV_SUCCESS) return rv;
+    rv = frame_get_u32(iframe, &to_s);
     if(rv != RV_SUCCESS) return rv;
-    rv = frame_get_u32(iframe, &count);
+    rv = frame_get_u32(iframe, &at.seq);
+    if(rv != RV_SUCCESS) return rv;
+    rv = frame_get_u16(iframe, &at.offset);
     if(rv != RV_SUCCESS) return rv;
 
-    /* Anti segfault */
-    if (index + count > aocs_circular_buffer_size) {
-    	frame_put_u16(oframe, 0xf2f2);
-    	return RV_SUCCESS;
-    }
+    size = _frame_available_space(oframe);
+    if (size < 12) return RV_NOSPACE;
+    size -= 12;
+    if (size > sizeof(buf)) size = sizeof(buf);
 
-    frame_put_u16(oframe, 0xf1f1);
-
-    for(i = index; i < index + count; i++) {
-    	frame_put_u16(oframe, aocs_circular_buffer[i].power_supply_voltage);
-    	frame_put_u16(oframe, aocs_circular_buffer[i].gyro_x);
-    	frame_put_u16(oframe, aocs_circular_buffer[i].gyro_y);
-    	frame_put_u16(oframe, aocs_circular_buffer[i].gyro_z);
-    	frame_put_u16(oframe, aocs_circular_buffer[i].accel_x);
-    	frame_put_u16(oframe, aocs_circular_buffer[i].accel_y);
-    	frame_put_u16(oframe, aocs_circular_buffer[i].accel_z);
-    	frame_put_u16(oframe, aocs_circular_buffer[i].mag_x);
-    	frame_put_u16(oframe, aocs_circular_buffer[i].mag_y);
-    	frame_put_u16(oframe, aocs_circular_buffer[i].mag_z);
-    	frame_put_u16(oframe, aocs_circular_buffer[i].temp);
-    	frame_put_u16(oframe, aocs_circular_buffer[i].adc);
-    	frame_put_u16(oframe, 0xf1f1);
-    }
+    rv = aocs_log_read(from_s, to_s, &at, &next, buf, &size);
+    if(rv != RV_SUCCESS) return rv;
 
-    return RV_SUCCESS;
+    frame_put_u32(oframe, at.seq);
+    frame_put_u16(oframe, at.offset);
+    frame_put_u32(oframe, next.seq);
+    frame_put_u16(oframe, next.offset);
+    return frame_put_data(oframe, buf, size);
 }
 
 static retval_t cmd_get_adc(const subsystem_t *self, frame_t * iframe, frame_t * oframe) {
@@ -1090,7 +1106,7 @@ static retval_t cmd_configure_sampler(const subsystem_t *self, frame_t * iframe,
 
 extern retval_t aocs_run_test(uint32_t test_number);
 
-const static ss_command_handler_t subsystem_commands[] = {
+const static ss_command_t subsystem_commands[] = {
 	DECLARE_BASIC_COMMANDS("sunvectorX:s16:[sunvectorX/16384.0],sunvectorY:s16:[sunvectorY/16384.0],sunvectorZ:s16:[sunvectorZ/16384.0],magnetometerX_mg:s16:[magnetometerX_mg*0.5],magnetometerY_mg:s16:[magnetometerY_mg*0.5],magnetometerZ_mg:s16:[magnetometerZ_mg*0.5],gyroX_mg:s16:[gyroX_mg*0.0125],gyroY_mg:s16:[gyroY_mg*0.0125],gyroZ_mg:s16:[gyroZ_mg*0.0125],temperature_IMU_C:s16:[(temperature_IMU_C*0.14)+25]", ""),
 	DECLARE_COMMAND(SS_CMD_AOCS_NO_MTQ_ACTUATE, cmd_mtq_actuate, "mtq", "MTQ actuate (1 = Actuate, 0 = Do nothing)", "actuate:u8", ""),
 	DECLARE_COMMAND(SS_CMD_AOCS_SET_DETUMBLING_GAIN, cmd_set_detumbling_gain, "setDetumbling", "Set gain in nvram", "gain:u32", ""),
@@ -1102,8 +1118,8 @@ const static ss_command_handler_t subsystem_commands[] = {
 	DECLARE_COMMAND(SS_CMD_AOCS_PWM_SET_DUTY_CHANNEL, cmd_pwm_set_duty, "pwm_duty", "Set duty cycle for one PWM channel <channel> <signed duty>","channel:u8,duty:s16", ""),
 	DECLARE_COMMAND(SS_CMD_AOCS_SET_DEFAULT_CONTROLLER_FREQUENCY, cmd_set_default_controller_frequency, "setDefaultController", "Set controller frequency in ms","frequency:u32", "frequency:u32"),
 	DECLARE_COMMAND(SS_CMD_AOCS_SET_CURRENT_CONTROLLER_FREQUENCY, cmd_set_current_controller_frequency, "setCurrentController", "Set controller frequency in ms","frequency:u32", "frequency:u32"),
-	DECLARE_COMMAND(SS_CMD_AOCS_LOG_TO_BUFFER, cmd_log_to_buffer, "logToBuffer", "Log IMU bursts to circular buffer", "on:u8", "actual:u8"),
-	DECLARE_COMMAND(SS_CMD_AOCS_GET_BUFFER, cmd_get_buffer, "getBuffer", "Read IMU circular buffer", "index:u32,count:u32", "result:u16[]"),
+	DECLARE_COMMAND(SS_CMD_AOCS_LOG_TO_BUFFER, cmd_log_to_buffer, "logToBuffer", "Log records to the AOCS log, bit 0: IMU, 1: CSS, 2: MTQ, 3: controller", "types:u8", "actual:u8"),
+	DECLARE_COMMAND(SS_CMD_AOCS_GET_BUFFER, cmd_get_buffer, "getBuffer", "Read AOCS log blocks with records in an RTC range, from a cursor", "fromS:u32,toS:u32,seq:u32,offset:u16", "seq:u32,offset:u16,nextSeq:u32,nextOffset:u16,data:u8[]"),
 	DECLARE_COMMAND(SS_CMD_AOCS_GET_ADC, cmd_get_adc, "getCSSADC", "Read last ADC measurement", "", "result:u16[]"),
 	DECLARE_COMMAND(SS_CMD_AOCS_CACA, cmd_breakage_key, "breakage", "Allow AOCS breakage", "key:u16", "result:u16"),
 	DECLARE_COMMAND(SS_CMD_AOCS_IMU_READ, cmd_imu_read_register, "imuRead", "Read IMU register, needs breakage key", "register:u16", "result:u16"),
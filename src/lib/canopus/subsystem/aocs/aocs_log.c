@@ -0,0 +1,197 @@
+#include <canopus/types.h>
+#include <canopus/subsystem/aocs/aocs_log.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <string.h>
+
+#include "../platform/rtc.h"
+
+/* AOCS log.
+ *
+ * Typed records in AOCS_LOG_SIZE bytes of RAM, kept in blocks of
+ * AOCS_LOG_BLOCK_SIZE bytes, the oldest one overwritten when they're full:
+ *
+ *   block:  seq:u32 start_s:u32 start_ms:u16 used:u16 record...
+ *   record: type:u8 dt_ms:varint field:varint...
+ *
+ * seq counts blocks since boot, start_s and start_ms are the RTC time of
+ * the first record, used the bytes written so far, header included, and
+ * dt_ms the time since the previous record in the block (or since start).
+ * Each field is the difference from the same field in the previous record
+ * of its type in the block, 0 for the first one, so every block decodes by
+ * itself. It's zigzag mapped (0, -1, 1, -2... to 0, 1, 2, 3...) and written
+ * 7 bits per byte, least significant first, high bit set on all but the
+ * last one. Big endian headers.
+ *
+ * Writers hold a critical section while they encode and copy one record,
+ * aocs_log_read() while it copies a chunk, so blocks can be downloaded
+ * while the log goes on, the one being written included.
+ */
+#define AOCS_LOG_RECORD_MAX	(1 + 5 + AOCS_LOG_MAX_FIELDS * 5)
+
+static const uint8_t aocs_log_fields[AOCS_LOG_TYPES] = {
+	[AOCS_LOG_IMU]		= 12,
+	[AOCS_LOG_CSS]		= 3,
+	[AOCS_LOG_MTQ]		= 3,
+	[AOCS_LOG_STATE]	= 8,
+};
+
+uint8_t aocs_log_mask = 0;
+
+/* the one the AOCS task writes */
+static aocs_log_t aocs_log;
+
+static void aocs_log_put_u32(uint8_t *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void aocs_log_put_u16(uint8_t *p, uint16_t v) {
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static uint8_t *aocs_log_put_varint(uint8_t *p, uint32_t v) {
+	while (v >= 0x80) {
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+static uint8_t *aocs_log_block_buf(aocs_log_t *log, const aocs_log_block_t *b) {
+	return &log->buf[(b - log->blocks) * AOCS_LOG_BLOCK_SIZE];
+}
+
+/* these two in the critical section */
+static aocs_log_block_t *aocs_log_block_start(aocs_log_t *log, uint64_t now_ms, uint32_t now_s) {
+	aocs_log_block_t *b;
+	uint8_t *p;
+
+	if (log->started) log->current = (log->current + 1) % AOCS_LOG_BLOCKS;
+	log->started = true;
+
+	b = &log->blocks[log->current];
+	b->seq = log->next_seq++;
+	b->first_s = now_s;
+	b->last_s = now_s;
+	b->used = AOCS_LOG_BLOCK_HEADER_SIZE;
+
+	p = aocs_log_block_buf(log, b);
+	aocs_log_put_u32(&p[0], b->seq);
+	aocs_log_put_u32(&p[4], now_s);
+	aocs_log_put_u16(&p[8], now_ms - (uint64_t)now_s * 1000);
+	aocs_log_put_u16(&p[10], b->used);
+
+	log->last_ms = now_ms;
+	memset(log->last, 0, sizeof(log->last));
+	return b;
+}
+
+static size_t aocs_log_encode(const aocs_log_t *log, uint8_t *rec, aocs_log_type_e type, const int32_t *fields, uint32_t dt_ms) {
+	const int32_t *last = log->last[type];
+	uint8_t *p = rec;
+	uint32_t d;
+	int i;
+
+	*p++ = type;
+	p = aocs_log_put_varint(p, dt_ms);
+	for (i = 0; i < aocs_log_fields[type]; i++) {
+		d = (uint32_t)fields[i] - (uint32_t)last[i];
+		p = aocs_log_put_varint(p, (d << 1) ^ (uint32_t)((int32_t)d >> 31));
+	}
+	return p - rec;
+}
+
+void aocs_log_init(aocs_log_t *log) {
+	portENTER_CRITICAL();
+	memset(log, 0, sizeof(*log));
+	portEXIT_CRITICAL();
+}
+
+void aocs_log_record(aocs_log_type_e type, const int32_t *fields) {
+	if (!(aocs_log_mask & AOCS_LOG_TYPE_BIT(type))) return;
+	aocs_log_record_to(&aocs_log, type, fields);
+}
+
+void aocs_log_record_to(aocs_log_t *log, aocs_log_type_e type, const int32_t *fields) {
+	uint8_t rec[AOCS_LOG_RECORD_MAX];
+	aocs_log_block_t *b;
+	uint64_t now_ms;
+	uint32_t now_s;
+	size_t n;
+
+	if (type >= AOCS_LOG_TYPES) return;
+
+	now_ms = rtc_get_current_time();
+	now_s = now_ms / 1000;
+
+	portENTER_CRITICAL();
+	b = &log->blocks[log->current];
+	if (!log->started || now_ms < log->last_ms || now_ms - log->last_ms > 0xffffffff) {
+		/* the RTC was set */
+		b = aocs_log_block_start(log, now_ms, now_s);
+	}
+	n = aocs_log_encode(log, rec, type, fields, now_ms - log->last_ms);
+	if (b->used + n > AOCS_LOG_BLOCK_SIZE) {
+		b = aocs_log_block_start(log, now_ms, now_s);
+		n = aocs_log_encode(log, rec, type, fields, 0);
+	}
+	memcpy(aocs_log_block_buf(log, b) + b->used, rec, n);
+	b->used += n;
+	b->last_s = now_s;
+	aocs_log_put_u16(aocs_log_block_buf(log, b) + 10, b->used);
+	log->last_ms = now_ms;
+	memcpy(log->last[type], fields, aocs_log_fields[type] * sizeof(fields[0]));
+	portEXIT_CRITICAL();
+}
+
+/* Copies up to *size bytes from the first block at or after `at` with
+ * records in [from_s, to_s], and says where to go on from. That's the same
+ * block until it's read whole and closed. RV_NOENT when there's nothing
+ * (yet).
+ */
+retval_t aocs_log_read(uint32_t from_s, uint32_t to_s, aocs_log_cursor_t *at, aocs_log_cursor_t *next, uint8_t *buf, size_t *size) {
+	return aocs_log_read_from(&aocs_log, from_s, to_s, at, next, buf, size);
+}
+
+retval_t aocs_log_read_from(aocs_log_t *log, uint32_t from_s, uint32_t to_s, aocs_log_cursor_t *at, aocs_log_cursor_t *next, uint8_t *buf, size_t *size) {
+	const aocs_log_block_t *b, *found = NULL;
+	size_t n = 0;
+	int i;
+
+	portENTER_CRITICAL();
+	/* oldest first, the current one last */
+	for (i = 1; i <= AOCS_LOG_BLOCKS; i++) {
+		b = &log->blocks[(log->current + i) % AOCS_LOG_BLOCKS];
+		if (0 == b->used || b->seq < at->seq) continue;
+		if (b->first_s > to_s || b->last_s < from_s) continue;
+		found = b;
+		break;
+	}
+	if (NULL != found) {
+		if (found->seq != at->seq || at->offset > found->used) {
+			at->seq = found->seq;
+			at->offset = 0;
+		}
+		n = found->used - at->offset;
+		if (n > *size) n = *size;
+		memcpy(buf, aocs_log_block_buf(log, found) + at->offset, n);
+
+		next->seq = found->seq;
+		next->offset = at->offset + n;
+		if (next->offset == found->used && found != &log->blocks[log->current]) {
+			next->seq++;
+			next->offset = 0;
+		}
+	}
+	portEXIT_CRITICAL();
+
+	*size = n;
+	return (NULL == found) ? RV_NOENT : RV_SUCCESS;
+}
@@ -7,9 +7,12 @@
 #include <canopus/subsystem/aocs/algebra.h>
 #include <canopus/subsystem/aocs/css.h>
 #include <canopus/subsystem/aocs/pointing.h>
+#include <canopus/subsystem/aocs/aocs_log.h>
 #include <canopus/logging.h>
 #include <canopus/board/adc.h>
 
+#include "../platform/rtc.h"
+
 static void test_adis16400_id(void **s) {
 	uint16_t device_id;
 	retval_t rv;
@@ -182,6 +185,219 @@ static void test_pointing(void **state) {
 	assert_true(A[2][0] == 0 && A[2][1] == 0 && A[2][2] == 1);
 }
 
+#define AOCS_LOG_TEST_RECORDS	3000
+
+static uint32_t aocs_log_test_varint(const uint8_t **p) {
+	uint32_t v = 0;
+	int shift = 0;
+
+	do {
+		v |= (uint32_t)(**p & 0x7f) << shift;
+		shift += 7;
+	} while (*(*p)++ & 0x80);
+	return v;
+}
+
+/* slowly changing, like the IMU words */
+static void aocs_log_test_fields(int32_t *fields, int count, int n) {
+	int i;
+
+	fields[0] = n;
+	for (i = 1; i < count; i++) fields[i] = (uint16_t)(0x2000 + i * 100 + (n * i) % 50);
+}
+
+/* checks the records in a block, returns the n of the next one */
+static int aocs_log_test_decode(const uint8_t *block, size_t size, int n) {
+	const int fields[AOCS_LOG_TYPES] = {12, 3, 3, 8};
+	int32_t last[AOCS_LOG_TYPES][AOCS_LOG_MAX_FIELDS] = {{0}};
+	int32_t want[AOCS_LOG_MAX_FIELDS];
+	const uint8_t *p = block + AOCS_LOG_BLOCK_HEADER_SIZE;
+	uint32_t d;
+	uint8_t type;
+	int i;
+
+	assert_int_equal(size, (block[10] << 8) | block[11]);
+	while (p < block + size) {
+		type = *p++;
+		assert_true(AOCS_LOG_IMU == type || AOCS_LOG_STATE == type);
+		(void)aocs_log_test_varint(&p);
+		for (i = 0; i < fields[type]; i++) {
+			d = aocs_log_test_varint(&p);
+			last[type][i] += (int32_t)((d >> 1) ^ -(d & 1));
+		}
+		if (n < 0) {
+			/* first block read, STATE goes after its IMU one */
+			n = last[type][0] + (AOCS_LOG_STATE == type);
+		}
+		aocs_log_test_fields(want, fields[type], (AOCS_LOG_STATE == type) ? n - 1 : n);
+		assert_memory_equal(want, last[type], fields[type] * sizeof(want[0]));
+		if (AOCS_LOG_IMU == type) n++;
+	}
+	assert_true(p == block + size);
+	return n;
+}
+
+static void test_aocs_log(void **state) {
+	/* not the flight log, the AOCS task may be writing that one */
+	static aocs_log_t log;
+	static uint8_t block[AOCS_LOG_BLOCK_SIZE];
+	aocs_log_cursor_t at = {0, 0}, next;
+	int32_t fields[AOCS_LOG_MAX_FIELDS];
+	uint32_t blocks = 0, d;
+	size_t size, used = 0;
+	int n, first = 0, next_n = -1;
+	const uint8_t *p;
+
+	aocs_log_init(&log);
+	for (n = 0; n < AOCS_LOG_TEST_RECORDS; n++) {
+		aocs_log_test_fields(fields, 12, n);
+		aocs_log_record_to(&log, AOCS_LOG_IMU, fields);
+		if (n % 10 == 0) {
+			aocs_log_test_fields(fields, 8, n);
+			aocs_log_record_to(&log, AOCS_LOG_STATE, fields);
+		}
+	}
+
+	/* in chunks, as the ground would, the last block still open */
+	while (1) {
+		size = 200;
+		if (RV_SUCCESS != aocs_log_read_from(&log, 0, 0xffffffff, &at, &next, block + at.offset, &size)) break;
+		if (next.seq == at.seq && next.offset == at.offset) break;
+		if (next.seq != at.seq) {
+			if (0 == blocks) {
+				/* the oldest record kept */
+				p = block + AOCS_LOG_BLOCK_HEADER_SIZE + 1;
+				(void)aocs_log_test_varint(&p);
+				d = aocs_log_test_varint(&p);
+				first = (int32_t)((d >> 1) ^ -(d & 1));
+			}
+			next_n = aocs_log_test_decode(block, at.offset + size, next_n);
+			used += at.offset + size;
+			blocks++;
+		}
+		at = next;
+	}
+	next_n = aocs_log_test_decode(block, at.offset, next_n);
+	used += at.offset;
+	blocks++;
+	assert_int_equal(AOCS_LOG_TEST_RECORDS, next_n);
+	assert_int_equal(AOCS_LOG_SIZE / AOCS_LOG_BLOCK_SIZE, blocks);
+
+	/* goes on logging into the open block */
+	aocs_log_test_fields(fields, 12, n);
+	aocs_log_record_to(&log, AOCS_LOG_IMU, fields);
+	size = sizeof(block) - at.offset;
+	assert_int_equal(RV_SUCCESS, aocs_log_read_from(&log, 0, 0xffffffff, &at, &next, block + at.offset, &size));
+	assert_true(size > 0);
+
+	/* nothing after the open block */
+	at.seq = next.seq + 1;
+	at.offset = 0;
+	size = sizeof(block);
+	assert_int_equal(RV_NOENT, aocs_log_read_from(&log, 0, 0xffffffff, &at, &next, block, &size));
+
+	log_report_fmt(LOG_GLOBAL, "aocs log: %lu IMU bursts kept, %lu bytes each with the controller records (%u raw)\n",
+			(unsigned long)(AOCS_LOG_TEST_RECORDS - first), (unsigned long)(used / (AOCS_LOG_TEST_RECORDS - first)),
+			(unsigned int)sizeof(adis1640x_data_burst_raw));
+}
+
+#define AOCS_LOG_TEST_GROUPS	20
+#define AOCS_LOG_TEST_PER_GROUP	60
+#define AOCS_LOG_TEST_STEP_s	10
+
+/* checks each record's time against its group's, and gives the block's span */
+static void aocs_log_test_times(const uint8_t *block, size_t size, uint64_t t0_ms, uint32_t *first_s, uint32_t *last_s) {
+	const uint8_t *p = block + AOCS_LOG_BLOCK_HEADER_SIZE;
+	uint64_t ms, group_ms;
+	int32_t n = 0;
+	uint32_t d;
+	int i;
+
+	ms = (uint64_t)(((uint32_t)block[4] << 24) | (block[5] << 16) | (block[6] << 8) | block[7]) * 1000 + ((block[8] << 8) | block[9]);
+	*first_s = ms / 1000;
+	while (p < block + size) {
+		assert_int_equal(AOCS_LOG_IMU, *p++);
+		ms += aocs_log_test_varint(&p);
+		d = aocs_log_test_varint(&p);
+		n += (int32_t)((d >> 1) ^ -(d & 1));
+		for (i = 1; i < 12; i++) (void)aocs_log_test_varint(&p);
+
+		/* its group's time, plus what it took to write it */
+		group_ms = t0_ms + (uint64_t)(n / AOCS_LOG_TEST_PER_GROUP) * AOCS_LOG_TEST_STEP_s * 1000;
+		assert_true(ms >= group_ms && ms - group_ms < 1000);
+	}
+	assert_true(p == block + size);
+	*last_s = ms / 1000;
+}
+
+static void test_aocs_log_range(void **state) {
+	static aocs_log_t log;
+	static uint8_t block[AOCS_LOG_BLOCK_SIZE];
+	uint32_t seqs[AOCS_LOG_BLOCKS], first_s[AOCS_LOG_BLOCKS], last_s[AOCS_LOG_BLOCKS];
+	uint32_t from_s, to_s, span_first_s, span_last_s;
+	aocs_log_cursor_t at = {0, 0}, next;
+	int32_t fields[AOCS_LOG_MAX_FIELDS];
+	int blocks = 0, found = 0, n, i;
+	uint64_t t0_ms;
+	size_t size;
+
+	/* groups of records AOCS_LOG_TEST_STEP_s apart, the RTC put forward
+	 * between them and back before anything can fail */
+	aocs_log_init(&log);
+	t0_ms = rtc_get_current_time();
+	for (n = 0; n < AOCS_LOG_TEST_GROUPS * AOCS_LOG_TEST_PER_GROUP; n++) {
+		if (n && (0 == n % AOCS_LOG_TEST_PER_GROUP)) {
+			rtc_set_current_time(rtc_get_current_time() + AOCS_LOG_TEST_STEP_s * 1000);
+		}
+		aocs_log_test_fields(fields, 12, n);
+		aocs_log_record_to(&log, AOCS_LOG_IMU, fields);
+	}
+	rtc_set_current_time(rtc_get_current_time() - (AOCS_LOG_TEST_GROUPS - 1) * AOCS_LOG_TEST_STEP_s * 1000);
+
+	/* all of it, a block at a time */
+	while (1) {
+		size = sizeof(block);
+		assert_int_equal(RV_SUCCESS, aocs_log_read_from(&log, 0, 0xffffffff, &at, &next, block, &size));
+		if (0 == size) break;
+		assert_int_equal(0, at.offset);
+		assert_true(blocks < AOCS_LOG_BLOCKS);
+		seqs[blocks] = at.seq;
+		aocs_log_test_times(block, size, t0_ms, &first_s[blocks], &last_s[blocks]);
+		blocks++;
+		at = next;
+	}
+
+	/* the blocks with records from groups 5 to 9, and only those */
+	from_s = t0_ms / 1000 + 5 * AOCS_LOG_TEST_STEP_s;
+	to_s = t0_ms / 1000 + 9 * AOCS_LOG_TEST_STEP_s;
+	at.seq = 0;
+	at.offset = 0;
+	for (i = 0; i < blocks; i++) {
+		if (first_s[i] > to_s || last_s[i] < from_s) continue;
+		size = sizeof(block);
+		assert_int_equal(RV_SUCCESS, aocs_log_read_from(&log, from_s, to_s, &at, &next, block, &size));
+		assert_int_equal(seqs[i], at.seq);
+		assert_int_equal(0, at.offset);
+		aocs_log_test_times(block, size, t0_ms, &span_first_s, &span_last_s);
+		assert_true(span_first_s <= to_s && span_last_s >= from_s);
+		found++;
+		at = next;
+	}
+	/* then nothing, past the last of them: the open block isn't in range */
+	size = sizeof(block);
+	assert_int_equal(RV_NOENT, aocs_log_read_from(&log, from_s, to_s, &at, &next, block, &size));
+	assert_int_equal(0, size);
+	assert_true(found > 0 && found < blocks - 1);
+	assert_true(first_s[0] < from_s && last_s[blocks - 1] > to_s);
+
+	/* after the last record */
+	at.seq = 0;
+	at.offset = 0;
+	size = sizeof(block);
+	from_s = last_s[blocks - 1] + 1;
+	assert_int_equal(RV_NOENT, aocs_log_read_from(&log, from_s, from_s + 1000, &at, &next, block, &size));
+}
+
 static const UnitTest tests[] = {
     unit_test(test_adis16400_id),
     unit_test(test_read_write),
@@ -189,6 +405,8 @@ static const UnitTest tests[] = {
     unit_test(test_sun_vector),
     unit_test(test_read_burst),
     unit_test(test_pointing),
+    unit_test(test_aocs_log),
+    unit_test(test_aocs_log_range),
 //    unit_test(test_the_adc),
 };
 
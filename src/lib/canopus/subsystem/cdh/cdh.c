@@ -300,14 +300,34 @@ static void CDH_rx_task(void *pvParameters) {
 	}
 }
 
+/* The latest snapshot of every subsystem (see ss_telemetry_publish()), or
+ * its telemetry taken now when there's none. After them
+ *
+ *   stale:u16 age:u8[one per subsystem]
+ *
+ * with bit i of `stale` set when subsystem i has no snapshot or it's older
+ * than SS_TELEMETRY_STALE_ms, and the age of each in seconds (0xff: none) */
 static void cdh_update_beacon(frame_t *data) {
+	uint8_t ages[SS_MAX];
+	uint16_t stale = 0;
+	uint32_t age_ms;
+	int count = 0;
 	ss_id_e i;
 
 	frame_put_u24(data, CDH_SEQUENCE_NUMBER_BEACON);
 	for (i=0; i < ARRAY_COUNT(subsystems); i++) {
         if (!IS_PTR_VALID(subsystems[i])) continue;
-		ss_get_telemetry_beacon(subsystems[i], data, CDH_SEQUENCE_NUMBER_BEACON);
+		if (RV_SUCCESS == ss_telemetry_snapshot(subsystems[i], data, &age_ms)) {
+			if (age_ms > SS_TELEMETRY_STALE_ms) stale |= 1 << i;
+			ages[count++] = (age_ms / 1000 < 0xff) ? age_ms / 1000 : 0xfe;
+		} else {
+			ss_get_telemetry_beacon(subsystems[i], data, CDH_SEQUENCE_NUMBER_BEACON);
+			stale |= 1 << i;
+			ages[count++] = 0xff;
+		}
 	}
+	frame_put_u16(data, stale);
+	frame_put_data(data, ages, count);
 }
 
 #ifdef SHORT_BEACONS
@@ -595,6 +615,7 @@ static void CDH_main_task(void *pvParameters) {
 		} else {
 			// No mode change. Tick
 			PLATFORM_ss_is_alive(ss, HEARTBEAT_MAIN_TASK);
+			ss_telemetry_publish(ss);
 
 			FDIR_CDH_check_last_received_command_time();
 
@@ -606,7 +627,7 @@ static void CDH_main_task(void *pvParameters) {
 			case SM_SURVIVAL:
 			case SM_MISSION:
 			case SM_LOW_POWER:
-				cdh_sample_memory_tick();
+				cdh_sample_tick();
 				break;
 			case SM_COUNT:
 				break;
@@ -702,7 +723,7 @@ static retval_t cmd_get_seen_ax25_calls(const subsystem_t *self, frame_t * ifram
 	return APRS_add_seen_calls_list_to_frame(oframe);
 }
 
-const static ss_command_handler_t subsystem_commands[] = {
+const static ss_command_t subsystem_commands[] = {
 	DECLARE_BASIC_COMMANDS("lastSeenSequenceNumber:u32, antennaDeployStatus:u8", "ticksLow:u8"),
 	DECLARE_COMMAND(SS_CMD_CDH_DELAY_BEACON, cmd_cdh_delay_beacon, "delayBeacon", "Delay next beacon for some seconds (max 600)", "seconds:u16", ""),
 	DECLARE_COMMAND(SS_CMD_CDH_COUNTDOWN_DELAY, cmd_cdh_countdown_delay, "countdown", "Transmit <n> packets, with a delay of <ms> between each of them","times:u16, delay_ms:u16", "count:u16,msg:str"),
@@ -724,14 +745,21 @@ const static ss_command_handler_t subsystem_commands[] = {
 
 	DECLARE_COMMAND(SS_CMD_CDH_ANTENNA_DEPLOY_INHIBIT,cmd_antenna_deploy_inhibit, "antennaDeployInhibit", "Inhibits further attempts to deploy the antenna", "flag:u8", ""),
 
-	DECLARE_COMMAND(SS_CMD_CDH_DELAYED_COMMAND, cmd_delayed_add, "delayedCommandAdd", "Adds a command to the delayed commands list. The command will be executed after waiting <seconds>", "waitSeconds:u32", ""),
-	DECLARE_COMMAND(SS_CMD_CDH_DELAYED_COMMAND_LIST, cmd_delayed_list, "delayedCommandList",  "Retrieves the list of delayed commands. Only next execution tick count, subsys and cmd", "", ""),
-	DECLARE_COMMAND(SS_CMD_CDH_DELAYED_COMMAND_DISCARD, cmd_delayed_discard, "delayedCommandDiscard", "Discards command <n> from the delayed commands list", "index:u8", ""),
+	DECLARE_COMMAND(SS_CMD_CDH_DELAYED_COMMAND, cmd_delayed_add, "delayedCommandAdd", "Adds a command to the delayed commands list. The command will be executed after waiting <seconds>. Returns its id", "waitSeconds:u32,ss:u8,cmd:u8,args:str", "id:u16"),
+	DECLARE_COMMAND(SS_CMD_CDH_DELAYED_COMMAND_AT, cmd_delayed_at, "delayedCommandAt", "Adds a command to the delayed commands list, to be executed when the RTC reaches <utcSeconds>. Returns its id", "utcSeconds:u32,ss:u8,cmd:u8,args:str", "id:u16"),
+	DECLARE_COMMAND(SS_CMD_CDH_DELAYED_COMMAND_LIST, cmd_delayed_list, "delayedCommandList",  "Retrieves the current RTC seconds, how many delayed commands there are and, in execution order from the <first> one, their id, due time, subsys and cmd", "first:u8", "now:u32,count:u8,list:str"),
+	DECLARE_COMMAND(SS_CMD_CDH_DELAYED_COMMAND_DISCARD, cmd_delayed_discard, "delayedCommandDiscard", "Discards command <id> from the delayed commands list", "id:u16", ""),
+	DECLARE_COMMAND(SS_CMD_CDH_DELAYED_COMMAND_DISCARD_ALL, cmd_delayed_discard_all, "delayedCommandDiscardAll", "Discards all the delayed commands", "", ""),
 
 	DECLARE_COMMAND(SS_CMD_CDH_SAMPLE_BEACON, cmd_sample_beacon, "samplerBeacon", "Samples <length> bytes of the beacon, starting at <offset>. Do it <count> times every some seconds (limited to beacon update interval)", "offset:u16, length:u16, count:u16, intervalSeconds:u16", ""),
 	DECLARE_COMMAND(SS_CMD_CDH_SAMPLE_MEMORY, cmd_sample_memory, "samplerMemory", "Samples <length> bytes of the memory at <address>. Do it <count> times every some seconds (the periodicity is not exact)", "address:u32, length:u16, times:u16, intervalSeconds: u16", ""),
 	DECLARE_COMMAND(SS_CMD_CDH_SAMPLE_FLASH_WHEN_DONE, cmd_sample_flash_when_done, "samplerFlashWhenDone", "Enable (1) or disable (0) flashing the sampled data persisten memory when the buffer is full", "enabled:u8", ""),
 	DECLARE_COMMAND(SS_CMD_CDH_SAMPLE_RETRIEVE, cmd_sample_retrieve, "samplerRetrieve", "Retrieve sampler's remaining wanted samples count, current buffer size, and the beginning of the sampled data", "", "wanted:u16, position:u16, data:str"),
+	DECLARE_COMMAND(SS_CMD_CDH_SAMPLE_STREAM, cmd_sample_stream, "samplerStream", "Samples sampler <stream> (0 to 3) from the beacon (type 0, source is the offset), memory (type 1, source is the address) or the answer of command <ss> <cmd> <args> (type 2, source is the offset). Keeps <count> samples (0xffff forever), one every <decimation> or their average as <average> byte words (0 for none). Flags: 1 spill to flash, 2 timestamp", "stream:u8, type:u8, source:u32, length:u16, count:u16, intervalSeconds:u16, decimation:u8, average:u8, flags:u8, ss:u8, cmd:u8, args:str", ""),
+	DECLARE_COMMAND(SS_CMD_CDH_SAMPLE_TRIGGER, cmd_sample_trigger, "samplerTrigger", "Only samples of <stream> where the <word> byte word at <offset> is (1) greater, (2) less, (3) equal, (4) not equal to <threshold>, or (5) changed by <threshold> are taken. (0) takes all. Set it after samplerStream", "stream:u8, offset:u16, word:u8, op:u8, threshold:u32", ""),
+	DECLARE_COMMAND(SS_CMD_CDH_SAMPLE_STOP, cmd_sample_stop, "samplerStop", "Stops sampler <stream>, what's left is spilled to flash if enabled", "stream:u8", ""),
+	DECLARE_COMMAND(SS_CMD_CDH_SAMPLE_READ, cmd_sample_read, "samplerRead", "Retrieves the samples kept by <stream>, since sample number <from>, while sampling", "stream:u8, from:u32", "written:u32, first:u32, recordSize:u8, data:str"),
+	DECLARE_COMMAND(SS_CMD_CDH_SAMPLE_STATUS, cmd_sample_status, "samplerStatus", "Retrieves type, flags, wanted samples, kept samples and spilled samples of every stream, and where the flash log is and how much of it is used", "", "streams:str, flashAddress:u32, flashUsed:u32"),
 
 	DECLARE_COMMAND(SS_CMD_GET_SEEN_AX25_CALLS, cmd_get_seen_ax25_calls, "getSeenCalls", "Retrieve a list of the last 10 AX25 calls received", "", "list:str"),
 };
@@ -2,9 +2,15 @@
 #include <canopus/types.h>
 #include <canopus/drivers/channel.h>
 #include <canopus/subsystem/subsystem.h>
+#include <canopus/subsystem/cdh.h>
 #include <canopus/drivers/radio/lithium.h>
 #include <cmockery.h>
 
+#include <string.h>
+
+#include "delayed_cmds.h"
+#include "../platform/rtc.h"
+
 static void test_lithium_op_counter_increments(void **s) {
     int op_counter;
     lithium_telemetry_t telemetry;
@@ -21,8 +27,443 @@ static void test_lithium_op_counter_increments(void **s) {
     assert_true(op_counter < telemetry.op_counter);
 }
 
+/* -- delayed commands ---------------------------------------------------- */
+
+/* A flash of our own for the log, programming only clears bits. After
+ * `tear` more bytes (none when negative) the power is gone: nothing else
+ * is written until the next reload. A broken one fails every operation */
+static struct {
+    uint8_t bytes[CDH_DELAYED_CMDS_STORE_SIZE];
+    size_t written;
+    int erases;
+    int tear;
+    bool broken;
+} delayed_flash = { .tear = -1 };
+
+static retval_t delayed_flash_erase(uint32_t offset, size_t size) {
+    if (delayed_flash.broken) return RV_ERROR;
+    if (offset + size > sizeof(delayed_flash.bytes)) return RV_ILLEGAL;
+    if (0 == delayed_flash.tear) return RV_SUCCESS;
+    memset(&delayed_flash.bytes[offset], 0xff, size);
+    delayed_flash.erases++;
+    return RV_SUCCESS;
+}
+
+static retval_t delayed_flash_write(uint32_t offset, const void *data, size_t size) {
+    const uint8_t *p = data;
+    size_t i;
+
+    if (delayed_flash.broken) return RV_ERROR;
+    if (offset + size > sizeof(delayed_flash.bytes)) return RV_ILLEGAL;
+    for (i = 0; (i < size) && (0 != delayed_flash.tear); i++) {
+        delayed_flash.bytes[offset + i] &= p[i];
+        delayed_flash.written++;
+        if (delayed_flash.tear > 0) delayed_flash.tear--;
+    }
+    return RV_SUCCESS;
+}
+
+static const cdh_delayed_storage_t delayed_test_storage = {
+    .base  = delayed_flash.bytes,
+    .erase = &delayed_flash_erase,
+    .write = &delayed_flash_write,
+};
+
+/* Far enough ahead for the task to leave them alone */
+#define DELAYED_TEST_DUE_s(_s)    ((uint32_t)(rtc_get_current_time() / 1000) + 1000 + (_s))
+
+static void delayed_test_start(void) {
+    delayed_flash.tear = -1;
+    delayed_flash.broken = false;
+    (void)delayed_flash_erase(0, sizeof(delayed_flash.bytes));
+    delayed_flash.written = 0;
+    delayed_flash.erases = 0;
+    _CDH_delayed_reload(&delayed_test_storage);
+}
+
+/* the board's queue again */
+static void delayed_test_end(void) {
+    _CDH_delayed_reload(NULL);
+}
+
+static uint16_t delayed_test_schedule(uint32_t due_s, uint8_t cmd) {
+    uint16_t id = 0;
+
+    assert_int_equal(RV_SUCCESS, CDH_command_schedule(due_s, 0, SS_CDH, cmd, &cmd, 1, &id));
+    assert_true(0 != id);
+    return id;
+}
+
+/* ids in execution order, returns how many */
+static int delayed_test_list(uint16_t *ids) {
+    frame_t iframe = DECLARE_FRAME_BYTES(0);
+    frame_t oframe = DECLARE_FRAME_SPACE(5 + 8 * CDH_DELAYED_CMDS_MAX);
+    uint32_t now, due, last_due = 0;
+    uint8_t count, ss, cmd;
+    int i;
+
+    assert_int_equal(RV_SUCCESS, cmd_delayed_list(NULL, &iframe, &oframe));
+    frame_reset_for_reading(&oframe);
+    assert_int_equal(RV_SUCCESS, frame_get_u32(&oframe, &now));
+    assert_int_equal(RV_SUCCESS, frame_get_u8(&oframe, &count));
+    for (i = 0; i < count; i++) {
+        assert_int_equal(RV_SUCCESS, frame_get_u16(&oframe, &ids[i]));
+        assert_int_equal(RV_SUCCESS, frame_get_u32(&oframe, &due));
+        assert_int_equal(RV_SUCCESS, frame_get_u8(&oframe, &ss));
+        assert_int_equal(RV_SUCCESS, frame_get_u8(&oframe, &cmd));
+        assert_true(due >= last_due);
+        last_due = due;
+    }
+    return count;
+}
+
+static void test_delayed_order(void **state) {
+    static const uint32_t due_s[] = { 30, 10, 20, 10, 40 };
+    uint16_t ids[CDH_DELAYED_CMDS_MAX], added[5];
+    int i;
+
+    delayed_test_start();
+    for (i = 0; i < 5; i++) {
+        added[i] = delayed_test_schedule(DELAYED_TEST_DUE_s(due_s[i]), i);
+    }
+
+    /* by due time, the same one in the order they were added */
+    assert_int_equal(5, delayed_test_list(ids));
+    assert_int_equal(added[1], ids[0]);
+    assert_int_equal(added[3], ids[1]);
+    assert_int_equal(added[2], ids[2]);
+    assert_int_equal(added[0], ids[3]);
+    assert_int_equal(added[4], ids[4]);
+    delayed_test_end();
+}
+
+static void test_delayed_discard(void **state) {
+    uint16_t ids[CDH_DELAYED_CMDS_MAX], added[3];
+    int i;
+
+    delayed_test_start();
+    for (i = 0; i < 3; i++) {
+        added[i] = delayed_test_schedule(DELAYED_TEST_DUE_s(i), i);
+    }
+
+    assert_int_equal(RV_SUCCESS, CDH_command_discard_delayed(added[1]));
+    assert_int_equal(RV_ILLEGAL, CDH_command_discard_delayed(added[1]));
+    assert_int_equal(2, delayed_test_list(ids));
+    assert_int_equal(added[0], ids[0]);
+    assert_int_equal(added[2], ids[1]);
+
+    /* and it stays discarded */
+    _CDH_delayed_reload(&delayed_test_storage);
+    assert_int_equal(2, delayed_test_list(ids));
+    assert_int_equal(added[0], ids[0]);
+    assert_int_equal(added[2], ids[1]);
+
+    CDH_command_discard_all_delayed();
+    assert_int_equal(0, delayed_test_list(ids));
+    _CDH_delayed_reload(&delayed_test_storage);
+    assert_int_equal(0, delayed_test_list(ids));
+    delayed_test_end();
+}
+
+static void test_delayed_replay(void **state) {
+    uint16_t ids[CDH_DELAYED_CMDS_MAX], before[CDH_DELAYED_CMDS_MAX], last;
+    int i, count;
+
+    delayed_test_start();
+    for (i = 0; i < 4; i++) {
+        last = delayed_test_schedule(DELAYED_TEST_DUE_s(4 - i), i);
+    }
+    count = delayed_test_list(before);
+
+    _CDH_delayed_reload(&delayed_test_storage);
+    assert_int_equal(count, delayed_test_list(ids));
+    assert_memory_equal(before, ids, count * sizeof(ids[0]));
+
+    /* ids go on from the ones in the log */
+    assert_true((int16_t)(delayed_test_schedule(DELAYED_TEST_DUE_s(50), 9) - last) > 0);
+    count = delayed_test_list(before);
+
+    /* more than the log holds, it's compacted on the way */
+    for (i = 0; i < 200; i++) {
+        assert_int_equal(RV_SUCCESS, CDH_command_discard_delayed(delayed_test_schedule(DELAYED_TEST_DUE_s(i), i)));
+    }
+    _CDH_delayed_reload(&delayed_test_storage);
+    assert_int_equal(count, delayed_test_list(ids));
+    assert_memory_equal(before, ids, count * sizeof(ids[0]));
+    delayed_test_end();
+}
+
+static void test_delayed_torn_record(void **state) {
+    uint16_t ids[CDH_DELAYED_CMDS_MAX], first, added;
+    size_t record_size, written;
+    int tear;
+
+    /* the first one also starts the log */
+    delayed_test_start();
+    (void)delayed_test_schedule(DELAYED_TEST_DUE_s(0), 0);
+    written = delayed_flash.written;
+    (void)delayed_test_schedule(DELAYED_TEST_DUE_s(0), 0);
+    record_size = delayed_flash.written - written;
+    delayed_test_end();
+
+    /* a reset at every byte of the second record */
+    for (tear = 0; tear <= record_size; tear++) {
+        delayed_test_start();
+        first = delayed_test_schedule(DELAYED_TEST_DUE_s(1), 1);
+        delayed_flash.tear = tear;
+        (void)delayed_test_schedule(DELAYED_TEST_DUE_s(2), 2);
+        delayed_flash.tear = -1;
+
+        _CDH_delayed_reload(&delayed_test_storage);
+        assert_int_equal((tear < record_size) ? 1 : 2, delayed_test_list(ids));
+        assert_int_equal(first, ids[0]);
+
+        /* the log is written again past the broken record */
+        added = delayed_test_schedule(DELAYED_TEST_DUE_s(3), 3);
+        _CDH_delayed_reload(&delayed_test_storage);
+        assert_int_equal((tear < record_size) ? 2 : 3, delayed_test_list(ids));
+        assert_int_equal(first, ids[0]);
+        assert_int_equal(added, ids[(tear < record_size) ? 1 : 2]);
+        delayed_test_end();
+    }
+}
+
+/* schedules and discards a command, one of the two for each `op` */
+static void delayed_test_churn(int op) {
+    static uint16_t id;
+
+    if (0 == op % 2) {
+        id = delayed_test_schedule(DELAYED_TEST_DUE_s(100 + op), op);
+    } else {
+        assert_int_equal(RV_SUCCESS, CDH_command_discard_delayed(id));
+    }
+}
+
+/* A reset at every byte of a compaction: after it the queue is the one
+ * from before or, once it's all written, the one after */
+static void test_delayed_torn_compaction(void **state) {
+    uint16_t before[CDH_DELAYED_CMDS_MAX], after[CDH_DELAYED_CMDS_MAX], ids[CDH_DELAYED_CMDS_MAX];
+    int i, ops, erases, tear, count_before, count_after;
+    size_t compaction_size, written = 0;
+
+    /* which change fills the log up, and what it writes */
+    delayed_test_start();
+    for (i = 0; i < 3; i++) (void)delayed_test_schedule(DELAYED_TEST_DUE_s(i), i);
+    erases = delayed_flash.erases;
+    for (ops = 0; erases == delayed_flash.erases; ops++) {
+        assert_true(ops < 1000);
+        written = delayed_flash.written;
+        delayed_test_churn(ops);
+    }
+    compaction_size = delayed_flash.written - written;
+    delayed_test_end();
+
+    for (tear = 0; tear <= compaction_size; tear++) {
+        delayed_test_start();
+        for (i = 0; i < 3; i++) (void)delayed_test_schedule(DELAYED_TEST_DUE_s(i), i);
+        for (i = 0; i < ops - 1; i++) delayed_test_churn(i);
+        count_before = delayed_test_list(before);
+
+        delayed_flash.tear = tear;
+        delayed_test_churn(ops - 1);
+        delayed_flash.tear = -1;
+        count_after = delayed_test_list(after);
+
+        _CDH_delayed_reload(&delayed_test_storage);
+        if (tear < compaction_size) {
+            assert_int_equal(count_before, delayed_test_list(ids));
+            assert_memory_equal(before, ids, count_before * sizeof(ids[0]));
+        } else {
+            assert_int_equal(count_after, delayed_test_list(ids));
+            assert_memory_equal(after, ids, count_after * sizeof(ids[0]));
+        }
+
+        /* and it goes on from there */
+        (void)delayed_test_schedule(DELAYED_TEST_DUE_s(50), 50);
+        _CDH_delayed_reload(&delayed_test_storage);
+        assert_int_equal(((tear < compaction_size) ? count_before : count_after) + 1, delayed_test_list(ids));
+        delayed_test_end();
+    }
+}
+
+/* A command that can't be logged isn't queued */
+static void test_delayed_store_broken(void **state) {
+    uint16_t ids[CDH_DELAYED_CMDS_MAX], first, id = 0;
+    uint8_t arg = 0;
+
+    delayed_test_start();
+    first = delayed_test_schedule(DELAYED_TEST_DUE_s(0), 0);
+
+    delayed_flash.broken = true;
+    assert_int_equal(RV_ERROR, CDH_command_schedule(DELAYED_TEST_DUE_s(1), 0, SS_CDH, 1, &arg, 1, &id));
+    assert_int_equal(0, id);
+    assert_int_equal(1, delayed_test_list(ids));
+    assert_int_equal(first, ids[0]);
+
+    /* out of the queue, but it would be back after a reboot */
+    assert_int_equal(RV_ERROR, CDH_command_discard_delayed(first));
+    assert_int_equal(0, delayed_test_list(ids));
+    delayed_flash.broken = false;
+    _CDH_delayed_reload(&delayed_test_storage);
+    assert_int_equal(1, delayed_test_list(ids));
+    assert_int_equal(first, ids[0]);
+    delayed_test_end();
+}
+
+/* -- sampler ------------------------------------------------------------- */
+
+/* The streams at the end, the CDH task keeps ticking them meanwhile: on
+ * our clock it samples what we would */
+#define SAMPLE_TEST_STREAM_A    (CDH_SAMPLE_STREAMS - 1)
+#define SAMPLE_TEST_STREAM_B    (CDH_SAMPLE_STREAMS - 2)
+
+#define SAMPLE_TEST_TICKS(_ms)  ((_ms) / portTICK_RATE_MS)
+
+static portTickType sample_test_now;
+
+static portTickType sample_test_clock(void) {
+    return sample_test_now;
+}
+
+static void sample_test_start(void) {
+    sample_test_now = SAMPLE_TEST_TICKS(1000000);
+    cdh_sample_set_clock(&sample_test_clock);
+}
+
+static void sample_test_end(void) {
+    frame_t iframe_a = DECLARE_FRAME_BYTES(SAMPLE_TEST_STREAM_A);
+    frame_t iframe_b = DECLARE_FRAME_BYTES(SAMPLE_TEST_STREAM_B);
+    frame_t oframe = DECLARE_FRAME_SPACE(1);
+
+    (void)cmd_sample_stop(NULL, &iframe_a, &oframe);
+    (void)cmd_sample_stop(NULL, &iframe_b, &oframe);
+    cdh_sample_set_clock(NULL);
+}
+
+static void sample_test_memory_stream(uint8_t stream, const void *source, uint16_t size,
+        uint16_t count, uint16_t interval, uint8_t decimation, uint8_t average) {
+    uint8_t ibuf[20];
+    frame_t iframe = DECLARE_FRAME(ibuf);
+    frame_t oframe = DECLARE_FRAME_SPACE(1);
+
+    frame_put_u8(&iframe, stream);
+    frame_put_u8(&iframe, 1);   /* memory */
+    frame_put_u32(&iframe, (uintptr_t)source);
+    frame_put_u16(&iframe, size);
+    frame_put_u16(&iframe, count);
+    frame_put_u16(&iframe, interval);
+    frame_put_u8(&iframe, decimation);
+    frame_put_u8(&iframe, average);
+    frame_put_u8(&iframe, 0);   /* flags */
+    frame_reset_for_reading(&iframe);
+    assert_int_equal(RV_SUCCESS, cmd_sample_stream(NULL, &iframe, &oframe));
+}
+
+static void sample_test_advance_ms(uint32_t ms) {
+    sample_test_now += SAMPLE_TEST_TICKS(ms);
+    (void)cdh_sample_tick();
+}
+
+/* samplerRead of `stream` from `from` into a new `oframe`, returns written */
+static uint32_t sample_test_read(uint8_t stream, uint32_t from, frame_t *oframe) {
+    frame_t iframe = DECLARE_FRAME_BYTES(stream, from >> 24, from >> 16, from >> 8, from);
+    uint32_t written, first;
+    uint8_t record_size;
+
+    assert_int_equal(RV_SUCCESS, cmd_sample_read(NULL, &iframe, oframe));
+    frame_reset_for_reading(oframe);
+    assert_int_equal(RV_SUCCESS, frame_get_u32(oframe, &written));
+    assert_int_equal(RV_SUCCESS, frame_get_u32(oframe, &first));
+    assert_int_equal(RV_SUCCESS, frame_get_u8(oframe, &record_size));
+    return written;
+}
+
+static uint32_t sample_test_written(uint8_t stream) {
+    frame_t oframe = DECLARE_FRAME_SPACE(9);
+
+    return sample_test_read(stream, 0xffffffff, &oframe);
+}
+
+static void test_sample_schedule(void **state) {
+    static uint8_t source[4];
+
+    sample_test_start();
+    sample_test_memory_stream(SAMPLE_TEST_STREAM_A, source, sizeof(source), 3, 0, 1, 0);
+    sample_test_memory_stream(SAMPLE_TEST_STREAM_B, source, sizeof(source), CDH_SAMPLE_FOREVER, 1, 1, 0);
+
+    /* both right away, then when more than their interval went by */
+    sample_test_advance_ms(0);
+    assert_int_equal(1, sample_test_written(SAMPLE_TEST_STREAM_A));
+    assert_int_equal(1, sample_test_written(SAMPLE_TEST_STREAM_B));
+
+    sample_test_advance_ms(0);
+    sample_test_advance_ms(900);
+    assert_int_equal(1, sample_test_written(SAMPLE_TEST_STREAM_A));
+    assert_int_equal(1, sample_test_written(SAMPLE_TEST_STREAM_B));
+
+    sample_test_advance_ms(200);
+    assert_int_equal(2, sample_test_written(SAMPLE_TEST_STREAM_A));
+    assert_int_equal(1, sample_test_written(SAMPLE_TEST_STREAM_B));
+
+    sample_test_advance_ms(1000);
+    assert_int_equal(3, sample_test_written(SAMPLE_TEST_STREAM_A));
+    assert_int_equal(2, sample_test_written(SAMPLE_TEST_STREAM_B));
+
+    /* A has all it wanted */
+    sample_test_advance_ms(1100);
+    sample_test_advance_ms(1100);
+    assert_int_equal(3, sample_test_written(SAMPLE_TEST_STREAM_A));
+    assert_int_equal(3, sample_test_written(SAMPLE_TEST_STREAM_B));
+    sample_test_end();
+}
+
+static void test_sample_stream_output(void **state) {
+    static uint8_t source[5];
+    static const uint8_t samples[4][5] = {
+        { 0x00, 0x0a, 0xff, 0xfc, 0x01 },   /*  10,  -4 */
+        { 0x00, 0x14, 0xff, 0xf8, 0x02 },   /*  20,  -8 */
+        { 0xff, 0xff, 0x00, 0x64, 0x03 },   /*  -1, 100 */
+        { 0xff, 0xfe, 0x01, 0x2c, 0x04 },   /*  -2, 300 */
+    };
+    /* the average of every two, the odd byte from the last one */
+    static const uint8_t kept[2][5] = {
+        { 0x00, 0x0f, 0xff, 0xfa, 0x02 },   /*  15,  -6 */
+        { 0xff, 0xff, 0x00, 0xc8, 0x04 },   /*  -1, 200 */
+    };
+    frame_t all = DECLARE_FRAME_SPACE(9 + 2 * sizeof(source));
+    frame_t second = DECLARE_FRAME_SPACE(9 + 2 * sizeof(source));
+    int i;
+
+    sample_test_start();
+    memcpy(source, samples[0], sizeof(source));
+    sample_test_memory_stream(SAMPLE_TEST_STREAM_A, source, sizeof(source), 2, 0, 2, 2);
+    sample_test_advance_ms(0);
+    for (i = 1; i < 4; i++) {
+        memcpy(source, samples[i], sizeof(source));
+        sample_test_advance_ms(1100);
+    }
+
+    assert_int_equal(2, sample_test_read(SAMPLE_TEST_STREAM_A, 0, &all));
+    assert_int_equal(2 * sizeof(source), _frame_available_data(&all));
+    assert_memory_equal(kept, frame_get_data_pointer_nocheck(&all, 2 * sizeof(source)), 2 * sizeof(source));
+
+    /* from the second one on */
+    assert_int_equal(2, sample_test_read(SAMPLE_TEST_STREAM_A, 1, &second));
+    assert_int_equal(sizeof(source), _frame_available_data(&second));
+    assert_memory_equal(kept[1], frame_get_data_pointer_nocheck(&second, sizeof(source)), sizeof(source));
+    sample_test_end();
+}
+
 static const UnitTest tests[] = {
     unit_test(test_lithium_op_counter_increments),
+    unit_test(test_delayed_order),
+    unit_test(test_delayed_discard),
+    unit_test(test_delayed_replay),
+    unit_test(test_delayed_torn_record),
+    unit_test(test_delayed_torn_compaction),
+    unit_test(test_delayed_store_broken),
+    unit_test(test_sample_schedule),
+    unit_test(test_sample_stream_output),
 };
 
 const ss_tests_t cdh_tests = {
@@ -1,56 +1,511 @@
 #include <canopus/subsystem/subsystem.h>
 #include <canopus/subsystem/cdh.h>
+#include <canopus/drivers/flash.h>
+#include <canopus/logging.h>
 
 #include <canopus/frame.h>
 
-static portTickType delayed_cmds_next_due_time;
-static frame_t *delayed_cmds_next_cmd;
-static xTaskHandle delayed_cmd_task;
+#include <stddef.h>
+#include <string.h>
 
-retval_t CDH_command_enqueue_delayed(uint32_t delay_s, frame_t *cmd) {
-	frame_t *old_cmd;
-	portTickType old_due_time, due_time;
+#include "delayed_cmds.h"
+#include "../platform/rtc.h"
+
+extern const char _cdh_delayed_cmds_addr;
+
+typedef struct delayed_cmd_t {
+	uint32_t due_s;
+	uint32_t sequence_number;
+	uint16_t id;
+	uint8_t ss;
+	uint8_t cmd;
+	uint8_t size;
+	uint8_t args[CDH_DELAYED_CMD_ARGS_SIZE];
+} delayed_cmd_t;
+
+typedef struct delayed_record_t {
+	uint16_t kind;
+	uint16_t id;
+	uint16_t sum;
+	uint16_t commit;
+} delayed_record_t;
+
+#define CDH_DELAYED_ADD		0x0add
+#define CDH_DELAYED_DROP	0xd409
+#define CDH_DELAYED_BANK	0xba4c	/* id is the bank's generation */
+#define CDH_DELAYED_ERASED	0xffff
+
+#define CDH_DELAYED_COMMIT	0x0000	/* programmed once the rest is */
+
+static struct {
+	xSemaphoreHandle lock;
+	xSemaphoreHandle kick;
+	xTaskHandle task;
+
+	delayed_cmd_t slots[CDH_DELAYED_CMDS_MAX];
+	uint8_t heap[CDH_DELAYED_CMDS_MAX];		/* slots, earliest due first */
+	uint8_t count;
+	uint8_t free[CDH_DELAYED_CMDS_MAX];		/* slots not in the heap */
+	uint8_t free_count;
+	uint16_t last_id;
+
+	const cdh_delayed_storage_t *storage;
+	uint8_t bank;			/* the one in use */
+	uint16_t generation;	/* of the bank in use */
+	uint32_t store_head;	/* in the bank in use */
+} delayed;
+
+static retval_t delayed_flash_erase(uint32_t offset, size_t size) {
+	if (FLASH_ERR_OK != flash_erase(&_cdh_delayed_cmds_addr + offset, size)) return RV_ERROR;
+	return RV_SUCCESS;
+}
+
+static retval_t delayed_flash_write(uint32_t offset, const void *data, size_t size) {
+	if (FLASH_ERR_OK != flash_write(&_cdh_delayed_cmds_addr + offset, data, size)) return RV_ERROR;
+	return RV_SUCCESS;
+}
+
+static const cdh_delayed_storage_t delayed_board_storage = {
+	.base  = (const uint8_t *)&_cdh_delayed_cmds_addr,
+	.erase = &delayed_flash_erase,
+	.write = &delayed_flash_write,
+};
+
+static uint32_t delayed_now_s(void) {
+	return rtc_get_current_time() / 1000;
+}
+
+/* -- heap of slots ------------------------------------------------------- */
+
+static bool delayed_before(const delayed_cmd_t *a, const delayed_cmd_t *b) {
+	if (a->due_s != b->due_s) return a->due_s < b->due_s;
+	return (int16_t)(a->id - b->id) < 0;	/* same time: first added first */
+}
+
+static void heap_sift_up(uint8_t *heap, int pos) {
+	uint8_t slot = heap[pos];
+	int parent;
+
+	while (pos > 0) {
+		parent = (pos - 1) / 2;
+		if (!delayed_before(&delayed.slots[slot], &delayed.slots[heap[parent]])) break;
+		heap[pos] = heap[parent];
+		pos = parent;
+	}
+	heap[pos] = slot;
+}
+
+static void heap_sift_down(uint8_t *heap, int count, int pos) {
+	uint8_t slot = heap[pos];
+	int child;
+
+	while ((child = 2 * pos + 1) < count) {
+		if ((child + 1 < count) && delayed_before(&delayed.slots[heap[child + 1]], &delayed.slots[heap[child]])) {
+			child++;
+		}
+		if (!delayed_before(&delayed.slots[heap[child]], &delayed.slots[slot])) break;
+		heap[pos] = heap[child];
+		pos = child;
+	}
+	heap[pos] = slot;
+}
+
+/* takes heap[pos] out, returns its slot */
+static uint8_t heap_remove(uint8_t *heap, int *count, int pos) {
+	uint8_t slot = heap[pos];
+
+	if (pos != --*count) {
+		heap[pos] = heap[*count];
+		heap_sift_up(heap, pos);
+		heap_sift_down(heap, *count, pos);
+	}
+	return slot;
+}
+
+static int delayed_find(uint16_t id) {
+	int i;
+
+	for (i = 0; i < delayed.count; i++) {
+		if (delayed.slots[delayed.heap[i]].id == id) return i;
+	}
+	return -1;
+}
+
+static bool delayed_insert(const delayed_cmd_t *dcmd) {
+	uint8_t slot;
+
+	if (0 == delayed.free_count) return false;
+	slot = delayed.free[--delayed.free_count];
+	delayed.slots[slot] = *dcmd;
+	delayed.heap[delayed.count] = slot;
+	heap_sift_up(delayed.heap, delayed.count++);
+	return true;
+}
+
+static void delayed_remove(int pos) {
+	int count = delayed.count;
+
+	delayed.free[delayed.free_count++] = heap_remove(delayed.heap, &count, pos);
+	delayed.count = count;
+}
+
+static void delayed_clear(void) {
+	int i;
+
+	delayed.count = 0;
+	delayed.free_count = CDH_DELAYED_CMDS_MAX;
+	for (i = 0; i < CDH_DELAYED_CMDS_MAX; i++) {
+		delayed.free[i] = CDH_DELAYED_CMDS_MAX - 1 - i;
+	}
+}
+
+/* -- flash log ----------------------------------------------------------- */
+
+static uint16_t delayed_record_sum(const delayed_record_t *rec, const delayed_cmd_t *dcmd) {
+	const uint8_t *p;
+	uint16_t a = 0, b = 0;
+	size_t i, size;
+	int part;
+
+	for (part = 0; part < 2; part++) {
+		switch (part) {
+		case 0:  p = (const uint8_t *)rec; size = offsetof(delayed_record_t, sum); break;
+		default: p = (const uint8_t *)dcmd; size = dcmd ? sizeof(*dcmd) : 0; break;
+		}
+		for (i = 0; i < size; i++) {
+			a = (a + p[i]) % 255;
+			b = (b + a) % 255;
+		}
+	}
+	return (b << 8) | a;
+}
+
+static size_t delayed_record_size(uint16_t kind) {
+	return sizeof(delayed_record_t) + ((CDH_DELAYED_ADD == kind) ? sizeof(delayed_cmd_t) : 0);
+}
+
+/* a record at `offset` in `bank`, committed once the rest is written */
+static retval_t delayed_record_write(uint8_t bank, uint32_t offset, uint16_t kind, uint16_t id, const delayed_cmd_t *dcmd) {
+	static const uint16_t commit = CDH_DELAYED_COMMIT;
+	delayed_record_t rec;
+
+	offset += bank * CDH_DELAYED_CMDS_BANK_SIZE;
+	rec.kind = kind;
+	rec.id = id;
+	rec.commit = CDH_DELAYED_ERASED;
+	rec.sum = delayed_record_sum(&rec, dcmd);
+
+	/* the sum can't tell 0x00 from 0xff, a record cut short by a reset
+	 * isn't committed */
+	if (((NULL != dcmd) && (RV_SUCCESS != delayed.storage->write(offset + sizeof(rec), dcmd, sizeof(*dcmd))))
+			|| (RV_SUCCESS != delayed.storage->write(offset, &rec, sizeof(rec)))
+			|| (RV_SUCCESS != delayed.storage->write(offset + offsetof(delayed_record_t, commit), &commit, sizeof(commit)))) {
+		return RV_ERROR;
+	}
+	return RV_SUCCESS;
+}
+
+static retval_t delayed_store_write(uint16_t kind, uint16_t id, const delayed_cmd_t *dcmd) {
+	size_t size = delayed_record_size(kind);
+
+	if (delayed.store_head + size > CDH_DELAYED_CMDS_BANK_SIZE) return RV_NOSPACE;
+
+	if (RV_SUCCESS != delayed_record_write(delayed.bank, delayed.store_head, kind, id, dcmd)) {
+		/* half written, next time starts over */
+		delayed.store_head = CDH_DELAYED_CMDS_BANK_SIZE;
+		return RV_ERROR;
+	}
+	delayed.store_head += size;
+	return RV_SUCCESS;
+}
+
+/* Writes what's pending to the other bank, and its header last: until
+ * that's committed, a reset leaves the bank in use as it was */
+static retval_t delayed_store_compact(void) {
+	const delayed_cmd_t *dcmd;
+	uint8_t bank = !delayed.bank;
+	uint16_t generation = delayed.generation + 1;
+	uint32_t head = sizeof(delayed_record_t);
+	int i;
+
+	if (RV_SUCCESS != delayed.storage->erase(bank * CDH_DELAYED_CMDS_BANK_SIZE, CDH_DELAYED_CMDS_BANK_SIZE)) {
+		log_report(LOG_SS_CDH, "delayed: can't erase store\n");
+		return RV_ERROR;
+	}
+	for (i = 0; i < delayed.count; i++) {
+		dcmd = &delayed.slots[delayed.heap[i]];
+		if (RV_SUCCESS != delayed_record_write(bank, head, CDH_DELAYED_ADD, dcmd->id, dcmd)) return RV_ERROR;
+		head += delayed_record_size(CDH_DELAYED_ADD);
+	}
+	if (RV_SUCCESS != delayed_record_write(bank, 0, CDH_DELAYED_BANK, generation, NULL)) return RV_ERROR;
+
+	delayed.bank = bank;
+	delayed.generation = generation;
+	delayed.store_head = head;
+	return RV_SUCCESS;
+}
+
+static retval_t delayed_store_append(uint16_t kind, uint16_t id, const delayed_cmd_t *dcmd) {
 	retval_t rv;
 
-	rv = RV_SUCCESS;
-	due_time  = xTaskGetTickCount();
-	due_time += delay_s * 1000 * portTICK_RATE_MS;
-	if ((NULL == delayed_cmds_next_cmd) || (delayed_cmds_next_due_time > due_time)) {
-		old_due_time = delayed_cmds_next_due_time;
-		old_cmd = delayed_cmds_next_cmd;
+	rv = delayed_store_write(kind, id, dcmd);
+	if (RV_SUCCESS != rv) {
+		/* full or broken, write it again from the queue */
+		rv = delayed_store_compact();
+	}
+	if (RV_SUCCESS != rv) log_report(LOG_SS_CDH, "delayed: store not updated\n");
+	return rv;
+}
+
+/* room for a record at `offset` of `bank` */
+static bool delayed_store_is_erased(const uint8_t *bank, uint32_t offset) {
+	uint32_t end = offset + delayed_record_size(CDH_DELAYED_ADD);
+
+	if (end > CDH_DELAYED_CMDS_BANK_SIZE) end = CDH_DELAYED_CMDS_BANK_SIZE;
+	for (; offset < end; offset++) {
+		if (0xff != bank[offset]) return false;
+	}
+	return true;
+}
+
+/* true if `bank` has a committed header */
+static bool delayed_bank_generation(uint8_t bank, uint16_t *generation) {
+	delayed_record_t rec;
 
-		delayed_cmds_next_cmd = cmd;
-		delayed_cmds_next_due_time = due_time;
+	memcpy(&rec, delayed.storage->base + bank * CDH_DELAYED_CMDS_BANK_SIZE, sizeof(rec));
+	if ((CDH_DELAYED_BANK != rec.kind) || (CDH_DELAYED_COMMIT != rec.commit)
+			|| (delayed_record_sum(&rec, NULL) != rec.sum)) {
+		return false;
+	}
+	*generation = rec.id;
+	return true;
+}
+
+static void delayed_store_load(void) {
+	delayed_record_t rec;
+	delayed_cmd_t dcmd;
+	const uint8_t *base;
+	uint16_t generation[2];
+	bool valid[2];
+	uint32_t offset;
+	size_t size;
+	int pos;
+
+	/* the newest bank with a header, a compaction cut short left the other */
+	valid[0] = delayed_bank_generation(0, &generation[0]);
+	valid[1] = delayed_bank_generation(1, &generation[1]);
+	delayed.bank = (valid[1] && (!valid[0] || ((int16_t)(generation[1] - generation[0]) > 0))) ? 1 : 0;
+	delayed.generation = generation[delayed.bank];
+	base = delayed.storage->base + delayed.bank * CDH_DELAYED_CMDS_BANK_SIZE;
+
+	/* none yet, the first change starts one */
+	offset = valid[delayed.bank] ? sizeof(rec) : CDH_DELAYED_CMDS_BANK_SIZE;
+
+	while (offset + sizeof(rec) <= CDH_DELAYED_CMDS_BANK_SIZE) {
+		memcpy(&rec, base + offset, sizeof(rec));
+		if (CDH_DELAYED_ERASED == rec.kind) {
+			/* a command cut short before its header, not to be written over */
+			if (!delayed_store_is_erased(base, offset)) offset = CDH_DELAYED_CMDS_BANK_SIZE;
+			break;
+		}
+
+		size = delayed_record_size(rec.kind);
+		if (((CDH_DELAYED_ADD != rec.kind) && (CDH_DELAYED_DROP != rec.kind))
+				|| (offset + size > CDH_DELAYED_CMDS_BANK_SIZE)) {
+			offset = CDH_DELAYED_CMDS_BANK_SIZE;
+			break;
+		}
+		if (CDH_DELAYED_ADD == rec.kind) {
+			memcpy(&dcmd, base + offset + sizeof(rec), sizeof(dcmd));
+		}
+		if ((CDH_DELAYED_COMMIT != rec.commit)
+				|| (delayed_record_sum(&rec, (CDH_DELAYED_ADD == rec.kind) ? &dcmd : NULL) != rec.sum)) {
+			/* torn write, keep what was before and compact on the next change */
+			offset = CDH_DELAYED_CMDS_BANK_SIZE;
+			break;
+		}
 
-		FUTURE_HOOK_3(cdh_enqueue_delayed_new_is_sooner, &old_cmd, &old_due_time, &rv);
-		if (NULL != old_cmd) {
-			frame_dispose(old_cmd);
-			rv = RV_PARTIAL;
+		if ((int16_t)(rec.id - delayed.last_id) > 0) delayed.last_id = rec.id;
+		pos = delayed_find(rec.id);
+		if (pos >= 0) delayed_remove(pos);
+		if ((CDH_DELAYED_ADD == rec.kind) && (dcmd.size <= CDH_DELAYED_CMD_ARGS_SIZE)) {
+			(void)delayed_insert(&dcmd);
 		}
-	} else {
-		rv = RV_ERROR;
+		offset += size;
 	}
+	delayed.store_head = offset;
+	log_report_fmt(LOG_SS_CDH, "delayed: %d commands pending\n", delayed.count);
+}
+
+/* -- API ----------------------------------------------------------------- */
+
+retval_t CDH_command_schedule(uint32_t due_s, uint32_t sequence_number, uint8_t ss, uint8_t cmd, const void *args, size_t size, uint16_t *id) {
+	delayed_cmd_t dcmd;
+	retval_t rv;
+
+	if (size > CDH_DELAYED_CMD_ARGS_SIZE) return RV_NOSPACE;
+	if (NULL == delayed.lock) return RV_ERROR;
+
+	memset(&dcmd, 0, sizeof(dcmd));
+	dcmd.due_s = due_s;
+	dcmd.sequence_number = sequence_number;
+	dcmd.ss = ss;
+	dcmd.cmd = cmd;
+	dcmd.size = size;
+	if (size > 0) memcpy(dcmd.args, args, size);
+
+	xSemaphoreTake(delayed.lock, portMAX_DELAY);
+	if (0 == delayed.free_count) {
+		xSemaphoreGive(delayed.lock);
+		return RV_NOSPACE;
+	}
+	if (0 == ++delayed.last_id) delayed.last_id = 1;
+	dcmd.id = delayed.last_id;
+	(void)delayed_insert(&dcmd);
+	rv = delayed_store_append(CDH_DELAYED_ADD, dcmd.id, &dcmd);
+	if (RV_SUCCESS != rv) {
+		/* it wouldn't survive a reset, don't run it either */
+		delayed_remove(delayed_find(dcmd.id));
+	}
+	xSemaphoreGive(delayed.lock);
+	if (RV_SUCCESS != rv) return rv;
+
+	if (NULL != id) *id = dcmd.id;
+	xSemaphoreGive(delayed.kick);
+	return RV_SUCCESS;
+}
+
+/* `cmd` as made by CDH_command_new(), disposed if it's accepted */
+retval_t CDH_command_enqueue_delayed(uint32_t delay_s, frame_t *cmd) {
+	uint32_t mac, sequence_number;
+	uint8_t ss, cmd_id;
+	size_t size;
+	retval_t rv;
+
+	frame_reset_for_reading(cmd);
+	if ((RV_SUCCESS != frame_get_u24(cmd, &mac))
+			|| (RV_SUCCESS != frame_get_u24(cmd, &sequence_number))
+			|| (RV_SUCCESS != frame_get_u8(cmd, &ss))
+			|| (RV_SUCCESS != frame_get_u8(cmd, &cmd_id))) {
+		return RV_ILLEGAL;
+	}
+	size = _frame_available_data(cmd);
+	rv = CDH_command_schedule(delayed_now_s() + delay_s, sequence_number, ss, cmd_id,
+			frame_get_data_pointer_nocheck(cmd, size), size, NULL);
+	if (RV_SUCCESS == rv) frame_dispose(cmd);
+	return rv;
+}
+
+retval_t CDH_command_discard_delayed(uint16_t id) {
+	retval_t rv = RV_ILLEGAL;
+	int pos;
+
+	if (NULL == delayed.lock) return RV_ERROR;
+
+	xSemaphoreTake(delayed.lock, portMAX_DELAY);
+	pos = delayed_find(id);
+	if (pos >= 0) {
+		delayed_remove(pos);
+		rv = delayed_store_append(CDH_DELAYED_DROP, id, NULL);
+	}
+	xSemaphoreGive(delayed.lock);
+
 	return rv;
 }
 
+void CDH_command_discard_all_delayed(void) {
+	if (NULL == delayed.lock) return;
+
+	xSemaphoreTake(delayed.lock, portMAX_DELAY);
+	delayed_clear();
+	if (RV_SUCCESS != delayed_store_compact()) log_report(LOG_SS_CDH, "delayed: store not updated\n");
+	xSemaphoreGive(delayed.lock);
+}
+
+/* -- task ---------------------------------------------------------------- */
+
+/* The earliest command if it's due, as a frame and already dropped from
+ * the queue. Otherwise NULL and `sleep_s` lowered to when it will be */
+static frame_t *delayed_take_due(uint32_t *sleep_s) {
+	const delayed_cmd_t *next;
+	frame_t *cmd_frame = NULL;
+	uint32_t now;
+	uint16_t id;
+
+	xSemaphoreTake(delayed.lock, portMAX_DELAY);
+	now = delayed_now_s();
+	if (delayed.count > 0) {
+		next = &delayed.slots[delayed.heap[0]];
+		if ((int32_t)(next->due_s - now) > 0) {
+			if (next->due_s - now < *sleep_s) *sleep_s = next->due_s - now;
+		} else if (RV_SUCCESS != CDH_command_new(&cmd_frame, next->sequence_number, next->ss, next->cmd)) {
+			cmd_frame = NULL;
+			*sleep_s = 1;	/* no frames now, next time */
+		} else {
+			frame_put_data(cmd_frame, next->args, next->size);
+
+			id = next->id;
+			delayed_remove(0);
+			(void)delayed_store_append(CDH_DELAYED_DROP, id, NULL);
+		}
+	}
+	xSemaphoreGive(delayed.lock);
+
+	return cmd_frame;
+}
+
 void cdh_delayed_cmd_task(void *arg) {
-	portTickType now;
+	frame_t *cmd_frame;
+	uint32_t sleep_s;
+
 	while (1) {
-		now = xTaskGetTickCount();
+		sleep_s = CDH_DELAYED_CMDS_MAX_SLEEP_s;
 
-		if ((NULL != delayed_cmds_next_cmd) && (now >= delayed_cmds_next_due_time)) {
-			CDH_command_enqueue(delayed_cmds_next_cmd);
-			delayed_cmds_next_cmd = NULL;
-			delayed_cmds_next_due_time = 0;
+		while (NULL != (cmd_frame = delayed_take_due(&sleep_s))) {
+			/* without the lock, it waits up to a second for room in the queue */
+			if (RV_SUCCESS != CDH_command_enqueue(cmd_frame)) {
+				log_report(LOG_SS_CDH, "delayed: can't enqueue command\n");
+				frame_dispose(cmd_frame);
+			}
 		}
 
-		vTaskDelay(1000 / portTICK_RATE_MS);
+		xSemaphoreTake(delayed.kick, sleep_s * 1000 / portTICK_RATE_MS);
 	}
 }
 
+static bool delayed_create_locks(void) {
+	if (NULL == delayed.lock) {
+		delayed.lock = xSemaphoreCreateMutex();
+		if (NULL == delayed.lock) return false;
+	}
+	if (NULL == delayed.kick) {
+		vSemaphoreCreateBinary(delayed.kick);
+		if (NULL == delayed.kick) return false;
+	}
+	return true;
+}
+
+static void delayed_reload(const cdh_delayed_storage_t *storage) {
+	delayed.storage = (NULL != storage) ? storage : &delayed_board_storage;
+	delayed_clear();
+	delayed.last_id = 0;
+	delayed_store_load();
+}
+
+void _CDH_delayed_reload(const cdh_delayed_storage_t *storage) {
+	if (!delayed_create_locks()) return;
+
+	xSemaphoreTake(delayed.lock, portMAX_DELAY);
+	delayed_reload(storage);
+	xSemaphoreGive(delayed.lock);
+	xSemaphoreGive(delayed.kick);
+}
+
 void cmd_delayed_init() {
-	delayed_cmds_next_cmd = NULL;
-	delayed_cmds_next_due_time = 0;
+	if (NULL != delayed.task) return;
+	if (!delayed_create_locks()) return;
+
+	delayed_reload(NULL);
 
 	(void)xTaskCreate(
 			&cdh_delayed_cmd_task,
@@ -58,37 +513,85 @@ void cmd_delayed_init() {
 			configMINIMAL_STACK_SIZE + 100,
 			NULL,
 			TASK_PRIORITY_SUBSYSTEM_CDH,
-    		&delayed_cmd_task);
+    		&delayed.task);
 }
 
-retval_t cmd_delayed_add(const subsystem_t *self, frame_t *iframe, frame_t *oframe, uint32_t sequence_number) {
-	uint32_t delay_s;
+/* -- commands ------------------------------------------------------------ */
+
+static retval_t delayed_add(uint32_t due_s, frame_t *iframe, frame_t *oframe, uint32_t sequence_number) {
 	uint8_t ss;
 	uint8_t cmd;
-	frame_t *delayed_cmd;
+	uint16_t id;
+	size_t size;
 	retval_t rv;
 
-	if (RV_SUCCESS != frame_get_u32(iframe, &delay_s)) return RV_ERROR;
 	if (RV_SUCCESS != frame_get_u8(iframe, &ss)) return RV_ERROR;
 	if (RV_SUCCESS != frame_get_u8(iframe, &cmd)) return RV_ERROR;
 
-	if (RV_SUCCESS != CDH_command_new(&delayed_cmd, sequence_number, ss, cmd)) return RV_NOSPACE;
+	size = _frame_available_data(iframe);
+	rv = CDH_command_schedule(due_s, sequence_number, ss, cmd,
+			frame_get_data_pointer_nocheck(iframe, size), size, &id);
+	if (RV_SUCCESS != rv) return rv;
 
-	frame_transfer(delayed_cmd, iframe);
-	rv = CDH_command_enqueue_delayed(delay_s, delayed_cmd);
-	if (RV_SUCCESS != rv) frame_dispose(delayed_cmd);
-	return rv;
+	return frame_put_u16(oframe, id);
 }
 
+retval_t cmd_delayed_add(const subsystem_t *self, frame_t *iframe, frame_t *oframe, uint32_t sequence_number) {
+	uint32_t delay_s;
+
+	if (RV_SUCCESS != frame_get_u32(iframe, &delay_s)) return RV_ERROR;
+
+	return delayed_add(delayed_now_s() + delay_s, iframe, oframe, sequence_number);
+}
+
+retval_t cmd_delayed_at(const subsystem_t *self, frame_t *iframe, frame_t *oframe, uint32_t sequence_number) {
+	uint32_t due_s;
+
+	if (RV_SUCCESS != frame_get_u32(iframe, &due_s)) return RV_ERROR;
+
+	return delayed_add(due_s, iframe, oframe, sequence_number);
+}
+
+/* now:u32 count:u8 then, in due order from the <first> one, as many
+ * id:u16 due:u32 ss:u8 cmd:u8 as fit */
 retval_t cmd_delayed_list(const subsystem_t *ss, frame_t *iframe, frame_t *oframe) {
-	retval_t rv = RV_SUCCESS;
-	FUTURE_HOOK_3(cmd_delayed_list, iframe, oframe, &rv);
-	return rv;
+	uint8_t heap[CDH_DELAYED_CMDS_MAX];
+	const delayed_cmd_t *dcmd;
+	uint8_t first;
+	int i, count;
+
+	if (RV_SUCCESS != frame_get_u8(iframe, &first)) first = 0;
+	if (NULL == delayed.lock) return RV_ERROR;
+
+	xSemaphoreTake(delayed.lock, portMAX_DELAY);
+	count = delayed.count;
+	memcpy(heap, delayed.heap, count);
+
+	frame_put_u32(oframe, delayed_now_s());
+	frame_put_u8(oframe, count);
+	for (i = 0; count > 0; i++) {
+		dcmd = &delayed.slots[heap_remove(heap, &count, 0)];
+		if (i < first) continue;
+		if (!frame_hasEnoughData(oframe, 8)) break;
+		frame_put_u16(oframe, dcmd->id);
+		frame_put_u32(oframe, dcmd->due_s);
+		frame_put_u8(oframe, dcmd->ss);
+		frame_put_u8(oframe, dcmd->cmd);
+	}
+	xSemaphoreGive(delayed.lock);
+
+	return RV_SUCCESS;
 }
 
 retval_t cmd_delayed_discard(const subsystem_t *ss, frame_t *iframe, frame_t *oframe) {
-	retval_t rv = RV_SUCCESS;
-	FUTURE_HOOK_3(cmd_delayed_discard, iframe, oframe, &rv);
-	return rv;
+	uint16_t id;
+
+	if (RV_SUCCESS != frame_get_u16(iframe, &id)) return RV_ERROR;
+
+	return CDH_command_discard_delayed(id);
 }
 
+retval_t cmd_delayed_discard_all(const subsystem_t *ss, frame_t *iframe, frame_t *oframe) {
+	CDH_command_discard_all_delayed();
+	return RV_SUCCESS;
+}
@@ -8,10 +8,69 @@
 #ifndef DELAYED_CMDS_H_
 #define DELAYED_CMDS_H_
 
+/* Delayed commands.
+ *
+ * Up to CDH_DELAYED_CMDS_MAX commands wait in a binary heap keyed on their
+ * due time, in RTC seconds (see platform/rtc.c), so a whole pass plan can be
+ * uploaded at once. Adding one, or taking out the earliest, is O(log n).
+ * Discarding one by id first looks for it through the whole heap, O(n),
+ * at most CDH_DELAYED_CMDS_MAX. When the earliest one is due it's
+ * enqueued as if it had just arrived, trusted and with the sequence
+ * number of the command that added it.
+ *
+ * The queue is kept in a log at _cdh_delayed_cmds_addr (linkscript provided),
+ * CDH_DELAYED_CMDS_STORE_SIZE bytes of flash, so it survives a reboot:
+ *
+ *   record: kind:u16 id:u16 sum:u16 commit:u16 [delayed_cmd_t]
+ *
+ * CDH_DELAYED_ADD records carry the command, CDH_DELAYED_DROP ones only
+ * say it was executed or discarded. commit is programmed to 0 last, a
+ * record without it was cut short by a reset and ends the log. A command
+ * is dropped before it's enqueued: after a reset in between it's lost
+ * rather than run twice.
+ *
+ * The store is two banks of CDH_DELAYED_CMDS_BANK_SIZE, each in flash
+ * sectors of its own. The log is in the one whose CDH_DELAYED_BANK
+ * header, the first record, has the newest generation in its id. When
+ * the log is full, the pending commands are written to the other bank,
+ * erased first, and then its header: a reset before that leaves the old
+ * log in use. CDH_command_schedule() fails, and the command isn't
+ * queued, if it can't be logged. A discard that can't be logged still
+ * takes it out of the queue, and returns the error: after a reboot it
+ * would be back.
+ *
+ * Nothing is run until the RTC has passed their due time, so after a
+ * reboot they wait until the time is set again.
+ */
+
+#define CDH_DELAYED_CMDS_MAX		32
+#define CDH_DELAYED_CMD_ARGS_SIZE	48
+#define CDH_DELAYED_CMDS_BANK_SIZE	(8*1024)
+#define CDH_DELAYED_CMDS_STORE_SIZE	(2*CDH_DELAYED_CMDS_BANK_SIZE)
+#define CDH_DELAYED_CMDS_MAX_SLEEP_s	10	/* to follow RTC changes */
+
+retval_t CDH_command_schedule(uint32_t due_s, uint32_t sequence_number, uint8_t ss, uint8_t cmd, const void *args, size_t size, uint16_t *id);
+retval_t CDH_command_discard_delayed(uint16_t id);
+void CDH_command_discard_all_delayed(void);
+
 retval_t cmd_delayed_add(const subsystem_t *self, frame_t *iframe, frame_t *oframe, uint32_t sequence_number);
+retval_t cmd_delayed_at(const subsystem_t *self, frame_t *iframe, frame_t *oframe, uint32_t sequence_number);
 retval_t cmd_delayed_list(const subsystem_t *ss, frame_t *iframe, frame_t *oframe);
 retval_t cmd_delayed_discard(const subsystem_t *ss, frame_t *iframe, frame_t *oframe);
+retval_t cmd_delayed_discard_all(const subsystem_t *ss, frame_t *iframe, frame_t *oframe);
 
 void cmd_delayed_init(void);
 
+/* Where the log is kept, read as memory at `base`. The board's is the
+ * flash at _cdh_delayed_cmds_addr, the tests give one of their own */
+typedef struct cdh_delayed_storage_t {
+	const uint8_t *base;
+	retval_t (*erase)(uint32_t offset, size_t size);
+	retval_t (*write)(uint32_t offset, const void *data, size_t size);
+} cdh_delayed_storage_t;
+
+/* Drops the queue and loads it again from `storage` (NULL for the board's),
+ * as after a reboot */
+void _CDH_delayed_reload(const cdh_delayed_storage_t *storage);
+
 #endif /* DELAYED_CMDS_H_ */
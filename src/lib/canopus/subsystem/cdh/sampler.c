@@ -1,154 +1,507 @@
 #include <canopus/assert.h>
+#include <canopus/logging.h>
 #include <canopus/drivers/channel.h>
 #include <canopus/subsystem/subsystem.h>
 #include <canopus/subsystem/cdh.h>
 #include <canopus/subsystem/mm.h>
 #include <canopus/drivers/flash.h>
 
-extern const char _cdh_sample_addr;
+#include <string.h>
+
+#include "../platform/rtc.h"
 
-struct {
+/* Flash log, records of
+ *
+ *   stream:u8 recordSize:u8 count:u16 first:u32 records[count] (padded to 4)
+ *
+ * with `first` the index of the first record in the stream. When it's full
+ * it's erased and starts over.
+ */
+extern const char _cdh_sample_addr;
+#define cdh_sample_flash ((const uint8_t *)&_cdh_sample_addr)
+
+#define CDH_SAMPLE_FLASH_HEADER_SIZE	8
+#define CDH_SAMPLE_SPILL_SIZE			1024	/* bytes spilled at once, at most */
+
+enum {
+	CDH_SAMPLE_TYPE_BEACON  = 0,
+	CDH_SAMPLE_TYPE_MEMORY  = 1,
+	CDH_SAMPLE_TYPE_COMMAND = 2,
+	CDH_SAMPLE_TYPE_COUNT,
+};
+
+enum {
+	CDH_SAMPLE_FLASH		= 1 << 0,
+	CDH_SAMPLE_TIMESTAMP	= 1 << 1,	/* RTC seconds:u32 before each sample */
+};
+
+enum {
+	CDH_SAMPLE_ALWAYS = 0,
+	CDH_SAMPLE_GREATER,
+	CDH_SAMPLE_LESS,
+	CDH_SAMPLE_EQUAL,
+	CDH_SAMPLE_NOT_EQUAL,
+	CDH_SAMPLE_CHANGED,		/* by threshold or more since the last one */
+	CDH_SAMPLE_OP_COUNT,
+};
+
+typedef struct cdh_sample_stream_t {
+	uint8_t type;
+	uint8_t flags;
 	union {
-		uint16_t offset;
+		uint16_t offset;	/* in the beacon or the answer */
 		void *address;
 	} source;
 	uint16_t source_size;
+	uint8_t ss;
+	uint8_t cmd;
+	uint8_t args_size;
+	uint8_t args[CDH_SAMPLE_MAX_ARGS];
 	uint16_t samples_wanted;
 	uint16_t interval;
 	portTickType last_sampled_ticks;
-	enum {
-		CDH_SAMPLE_TYPE_BEACON  = 0 << 0,
-		CDH_SAMPLE_TYPE_MEMORY  = 1 << 0,
-		CDH_SAMPLE_TYPE_MASK	= 1 << 0,
-		CDH_SAMPLE_FLASH   		= 1 << 1,
-	} flags;
-	frame_t data;
-} cdh_sample_config;
 
-void cdh_sample_init() {
-	cdh_sample_config.flags = 0;
-	cdh_sample_config.source_size  = 0;
-	cdh_sample_config.samples_wanted = 0;
+	uint8_t decimation;
+	uint8_t average;		/* word size, 0 keeps the first of each `decimation` */
+	uint8_t taken;
+	int64_t acc[CDH_SAMPLE_MAX_SIZE];
 
-    assert(MEMORY_uploadarea_size() > 0);
-    cdh_sample_config.data = (frame_t)DECLARE_FRAME_SIZE_TIMEOUT_RETRY(MEMORY_uploadarea_address(), MEMORY_uploadarea_size(), 0, 0);
+	struct {
+		uint16_t offset;
+		uint8_t word;
+		uint8_t op;
+		int32_t threshold;
+		int32_t last;
+	} trigger;
+
+	uint8_t *ring;
+	uint32_t ring_size;
+	uint8_t record_size;
+	uint32_t capacity;		/* records */
+	uint32_t written;		/* records kept since configured */
+	uint32_t spilled;
+} cdh_sample_stream_t;
+
+static struct {
+	xSemaphoreHandle lock;
+	cdh_sample_clock_t *clock;
+	cdh_sample_stream_t streams[CDH_SAMPLE_STREAMS];
+	uint32_t flash_head;
+	uint8_t answer_buf[MAX_FRAME_SIZE];
+} cdh_sample;
+
+/* words are signed and big endian, as in the beacon, but u8 */
+static int32_t cdh_sample_get_word(const uint8_t *p, uint8_t word) {
+	switch (word) {
+	case 1:  return p[0];
+	case 2:  return (int16_t)((p[0] << 8) | p[1]);
+	default: return (int32_t)(((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | (p[2] << 8) | p[3]);
+	}
 }
 
-#define ELAPSED_SECONDS_FROM_TO(start, stop)	((stop-start) * portTICK_RATE_MS / 1000)
+static void cdh_sample_put_word(uint8_t *p, uint8_t word, int32_t value) {
+	switch (word) {
+	case 4:
+		*p++ = value >> 24;
+		*p++ = value >> 16;
+	case 2:
+		*p++ = value >> 8;
+	case 1:
+		*p++ = value;
+	}
+}
 
-static retval_t cdh_sample_data(void *source, uint16_t size) {
-	bool this_wanted;
-	portTickType now;
-	retval_t rv;
-	uint16_t flashW_size = 0;
+static bool cdh_sample_word_valid(uint8_t word) {
+	return (1 == word) || (2 == word) || (4 == word);
+}
+
+static bool cdh_sample_lock(void) {
+	if (NULL == cdh_sample.lock) return false;
+	xSemaphoreTake(cdh_sample.lock, portMAX_DELAY);
+	return true;
+}
 
-	now = xTaskGetTickCount();
-	this_wanted = ELAPSED_SECONDS_FROM_TO(cdh_sample_config.last_sampled_ticks, now) > cdh_sample_config.interval;
+static void cdh_sample_unlock(void) {
+	xSemaphoreGive(cdh_sample.lock);
+}
 
-	if (!this_wanted) return RV_NACK;
+static portTickType cdh_sample_now(void) {
+	cdh_sample_clock_t *clock = cdh_sample.clock;
 
-	cdh_sample_config.last_sampled_ticks = now;
+	return (NULL != clock) ? clock() : xTaskGetTickCount();
+}
 
-	rv = frame_put_data(&cdh_sample_config.data, source, size);
-	cdh_sample_config.samples_wanted--;
+void cdh_sample_set_clock(cdh_sample_clock_t *clock) {
+	cdh_sample.clock = clock;
+}
 
-	if (0 == cdh_sample_config.samples_wanted) {
-		// We are done, save to flash if required
-		if (cdh_sample_config.flags & CDH_SAMPLE_FLASH) {
-			cdh_sample_config.samples_wanted = 0;
+static cdh_sample_stream_t *cdh_sample_get_stream(frame_t *iframe) {
+	uint8_t n;
 
-			flashW_size = cdh_sample_config.data.position;
-			if (flashW_size > 8*1024) flashW_size = 8*1024; /* 8K @ .cdh_sample in flash1 */
+	if (RV_SUCCESS != frame_get_u8(iframe, &n)) return NULL;
+	if (n >= CDH_SAMPLE_STREAMS) return NULL;
+	return &cdh_sample.streams[n];
+}
 
-			frame_reset(&cdh_sample_config.data);
+static uint32_t cdh_sample_first(const cdh_sample_stream_t *s) {
+	return (s->written > s->capacity) ? s->written - s->capacity : 0;
+}
 
-			rv = flash_erase(&_cdh_sample_addr, flashW_size);
-			FUTURE_HOOK_3(cdh_sample_flash_erase_now, &_cdh_sample_addr, &flashW_size, &rv);
+/* -- flash --------------------------------------------------------------- */
 
-			rv = flash_write(&_cdh_sample_addr, frame_get_data_pointer_nocheck(&cdh_sample_config.data, flashW_size), flashW_size);
+static void cdh_sample_flash_scan(void) {
+	const uint8_t *hdr;
+	uint32_t head = 0;
+	uint32_t size;
 
-			FUTURE_HOOK_2(cdh_sample_flash_write_now, &cdh_sample_config.data, &rv);
+	while (head + CDH_SAMPLE_FLASH_HEADER_SIZE <= CDH_SAMPLE_FLASH_SIZE) {
+		hdr = cdh_sample_flash + head;
+		if (0xff == hdr[0]) break;
+		if ((hdr[0] >= CDH_SAMPLE_STREAMS) || (0 == hdr[1])) {
+			head = CDH_SAMPLE_FLASH_SIZE;	/* garbage, erased on the next spill */
+			break;
 		}
+		size = hdr[1] * ((hdr[2] << 8) | hdr[3]);
+		head += CDH_SAMPLE_FLASH_HEADER_SIZE + ((size + 3) & ~3);
 	}
+	if (head > CDH_SAMPLE_FLASH_SIZE) head = CDH_SAMPLE_FLASH_SIZE;
+	cdh_sample.flash_head = head;
+}
+
+static retval_t cdh_sample_flash_write(uint32_t offset, const void *data, size_t size) {
+	retval_t rv = RV_SUCCESS;
+	uint16_t flashW_size = size;
 
+	if (FLASH_ERR_OK != flash_write(cdh_sample_flash + offset, data, size)) rv = RV_ERROR;
+	FUTURE_HOOK_3(cdh_sample_flash_write_now, &offset, &flashW_size, &rv);
 	return rv;
 }
 
+/* writes down what the stream kept since the last time, called with the lock */
+static retval_t cdh_sample_spill(cdh_sample_stream_t *s) {
+	uint8_t hdr[CDH_SAMPLE_FLASH_HEADER_SIZE];
+	uint32_t count, chunk, first, index, n, room;
+	uint16_t flashW_size = CDH_SAMPLE_FLASH_SIZE;
+	retval_t rv;
+
+	if (s->spilled < cdh_sample_first(s)) s->spilled = cdh_sample_first(s);	/* lost */
+	count = s->written - s->spilled;
+	if (0 == count) return RV_SUCCESS;
+
+	chunk = CDH_SAMPLE_SPILL_SIZE / s->record_size;
+	if (chunk > s->capacity / 2) chunk = s->capacity / 2;
+	if (0 == chunk) chunk = 1;
+	if ((0 != s->samples_wanted) && (count < chunk)) return RV_SUCCESS;	/* later */
+	if (count > chunk) count = chunk;
+
+	room = (CDH_SAMPLE_FLASH_SIZE - CDH_SAMPLE_FLASH_HEADER_SIZE) / s->record_size;
+	if (cdh_sample.flash_head + CDH_SAMPLE_FLASH_HEADER_SIZE + count * s->record_size > CDH_SAMPLE_FLASH_SIZE) {
+		rv = (FLASH_ERR_OK == flash_erase(cdh_sample_flash, CDH_SAMPLE_FLASH_SIZE)) ? RV_SUCCESS : RV_ERROR;
+		FUTURE_HOOK_3(cdh_sample_flash_erase_now, &_cdh_sample_addr, &flashW_size, &rv);
+		if (RV_SUCCESS != rv) return rv;
+		cdh_sample.flash_head = 0;
+		if (count > room) count = room;
+	}
+
+	first = s->spilled;
+	hdr[0] = s - cdh_sample.streams;
+	hdr[1] = s->record_size;
+	hdr[2] = count >> 8;
+	hdr[3] = count;
+	hdr[4] = first >> 24;
+	hdr[5] = first >> 16;
+	hdr[6] = first >> 8;
+	hdr[7] = first;
+
+	/* records first, the header makes them count */
+	rv = RV_SUCCESS;
+	for (index = first; (RV_SUCCESS == rv) && (index < first + count); index += n) {
+		n = s->capacity - index % s->capacity;		/* up to the end of the ring */
+		if (n > first + count - index) n = first + count - index;
+		rv = cdh_sample_flash_write(cdh_sample.flash_head + CDH_SAMPLE_FLASH_HEADER_SIZE + (index - first) * s->record_size,
+				s->ring + (index % s->capacity) * s->record_size, n * s->record_size);
+	}
+	if (RV_SUCCESS == rv) rv = cdh_sample_flash_write(cdh_sample.flash_head, hdr, sizeof(hdr));
+
+	if (RV_SUCCESS != rv) {
+		cdh_sample.flash_head = CDH_SAMPLE_FLASH_SIZE;
+		return rv;
+	}
+	cdh_sample.flash_head += CDH_SAMPLE_FLASH_HEADER_SIZE + ((count * s->record_size + 3) & ~3);
+	s->spilled += count;
+	return RV_SUCCESS;
+}
+
+/* -- sampling ------------------------------------------------------------ */
+
+#define ELAPSED_SECONDS_FROM_TO(start, stop)	((stop-start) * portTICK_RATE_MS / 1000)
+
+static bool cdh_sample_due(const cdh_sample_stream_t *s, portTickType now) {
+	if (0 == s->samples_wanted) return false;
+	return ELAPSED_SECONDS_FROM_TO(s->last_sampled_ticks, now) > s->interval;
+}
+
+static bool cdh_sample_triggered(cdh_sample_stream_t *s, const uint8_t *source) {
+	int32_t value, delta;
+	bool pass;
+
+	if (CDH_SAMPLE_ALWAYS == s->trigger.op) return true;
+
+	value = cdh_sample_get_word(source + s->trigger.offset, s->trigger.word);
+	switch (s->trigger.op) {
+	case CDH_SAMPLE_GREATER:	pass = value > s->trigger.threshold; break;
+	case CDH_SAMPLE_LESS:		pass = value < s->trigger.threshold; break;
+	case CDH_SAMPLE_EQUAL:		pass = value == s->trigger.threshold; break;
+	case CDH_SAMPLE_NOT_EQUAL:	pass = value != s->trigger.threshold; break;
+	case CDH_SAMPLE_CHANGED:
+		delta = value - s->trigger.last;
+		if (delta < 0) delta = -delta;
+		pass = delta >= s->trigger.threshold;
+		if (pass) s->trigger.last = value;
+		break;
+	default:
+		pass = false;
+	}
+	return pass;
+}
+
+static void cdh_sample_keep(cdh_sample_stream_t *s, const uint8_t *sample) {
+	uint8_t *record;
+
+	record = s->ring + (s->written % s->capacity) * s->record_size;
+	if (s->flags & CDH_SAMPLE_TIMESTAMP) {
+		cdh_sample_put_word(record, 4, rtc_get_current_time() / 1000);
+		record += 4;
+	}
+	memcpy(record, sample, s->source_size);
+	s->written++;
+
+	if (CDH_SAMPLE_FOREVER != s->samples_wanted) s->samples_wanted--;
+}
+
+/* called with the lock and `source` pointing to source_size bytes */
+static retval_t cdh_sample_data(cdh_sample_stream_t *s, const uint8_t *source, portTickType now) {
+	uint8_t averaged[CDH_SAMPLE_MAX_SIZE];
+	int i, words;
+
+	s->last_sampled_ticks = now;
+
+	if (!cdh_sample_triggered(s, source)) return RV_NACK;
+
+	if (0 == s->average) {
+		if (0 == s->taken) cdh_sample_keep(s, source);
+		if (++s->taken >= s->decimation) s->taken = 0;
+		return RV_SUCCESS;
+	}
+
+	words = s->source_size / s->average;
+	for (i = 0; i < words; i++) {
+		s->acc[i] += cdh_sample_get_word(source + i * s->average, s->average);
+	}
+	if (++s->taken < s->decimation) return RV_SUCCESS;
+
+	/* bytes not making a whole word are from the last sample */
+	memcpy(averaged, source, s->source_size);
+	for (i = 0; i < words; i++) {
+		cdh_sample_put_word(averaged + i * s->average, s->average, s->acc[i] / s->decimation);
+		s->acc[i] = 0;
+	}
+	s->taken = 0;
+	cdh_sample_keep(s, averaged);
+	return RV_SUCCESS;
+}
+
 retval_t cdh_sample_beacon_tick(frame_t *beacon) {
+	cdh_sample_stream_t *s;
+	portTickType now;
 	uint8_t *source;
+	retval_t rv = RV_NACK;
+	int i;
 
-	if (0 == cdh_sample_config.samples_wanted) return RV_NACK;
+	if (!cdh_sample_lock()) return RV_NACK;
 
-	if (CDH_SAMPLE_TYPE_BEACON != (cdh_sample_config.flags & CDH_SAMPLE_TYPE_MASK)) return RV_NACK;
+	now = cdh_sample_now();
+	for (i = 0; i < CDH_SAMPLE_STREAMS; i++) {
+		s = &cdh_sample.streams[i];
+		if ((CDH_SAMPLE_TYPE_BEACON != s->type) || !cdh_sample_due(s, now)) continue;
 
-	if (!frame_hasEnoughData(beacon, cdh_sample_config.source.offset + cdh_sample_config.source_size)) {
-		return RV_ILLEGAL;
+		if (!frame_hasEnoughData(beacon, s->source.offset + s->source_size)) {
+			rv = RV_ILLEGAL;
+			continue;
+		}
+
+		source  = frame_get_data_pointer_nocheck(beacon, s->source_size);
+		source += s->source.offset;
+
+		if (RV_SUCCESS == cdh_sample_data(s, source, now)) rv = RV_SUCCESS;
 	}
+	cdh_sample_unlock();
+
+	return rv;
+}
 
-	source  = frame_get_data_pointer_nocheck(beacon, cdh_sample_config.source_size);
-	source += cdh_sample_config.source.offset;
+/* runs the command of a stream, outside of the lock */
+static retval_t cdh_sample_command(uint8_t ss_id, uint8_t cmd, const uint8_t *args, uint8_t args_size, frame_t *answer) {
+	uint8_t buf[1 + CDH_SAMPLE_MAX_ARGS];
+	frame_t iframe = DECLARE_FRAME(buf);
+	subsystem_t *ss;
 
-	return cdh_sample_data(source, cdh_sample_config.source_size);
+	if (ss_id >= SS_MAX) return RV_ILLEGAL;
+	ss = subsystems[ss_id];
+	if (!IS_PTR_VALID(ss)) return RV_ILLEGAL;
+
+	frame_put_u8(&iframe, cmd);
+	frame_put_data(&iframe, args, args_size);
+	frame_reset_for_reading(&iframe);
+
+	return ss->api->command_execute(ss, &iframe, answer, 0);
 }
 
-retval_t cdh_sample_memory_tick() {
-	if (0 == cdh_sample_config.samples_wanted) return RV_NACK;
+retval_t cdh_sample_tick() {
+	cdh_sample_stream_t *s;
+	frame_t answer = DECLARE_FRAME(cdh_sample.answer_buf);
+	uint8_t args[CDH_SAMPLE_MAX_ARGS];
+	uint8_t ss_id, cmd, args_size;
+	portTickType now;
+	retval_t rv = RV_NACK;
+	int i;
+
+	if (!cdh_sample_lock()) return RV_NACK;
+
+	for (i = 0; i < CDH_SAMPLE_STREAMS; i++) {
+		s = &cdh_sample.streams[i];
+		now = cdh_sample_now();
+
+		if ((CDH_SAMPLE_TYPE_MEMORY == s->type) && cdh_sample_due(s, now)) {
+			if (RV_SUCCESS == cdh_sample_data(s, s->source.address, now)) rv = RV_SUCCESS;
+		} else
+		if ((CDH_SAMPLE_TYPE_COMMAND == s->type) && cdh_sample_due(s, now)) {
+			ss_id = s->ss;
+			cmd = s->cmd;
+			args_size = s->args_size;
+			memcpy(args, s->args, args_size);
+			cdh_sample_unlock();
+
+			frame_reset(&answer);
+			answer.size = sizeof(cdh_sample.answer_buf);
+			if ((RV_SUCCESS == cdh_sample_command(ss_id, cmd, args, args_size, &answer))) {
+				frame_reset_for_reading(&answer);
+			} else {
+				answer.size = 0;
+			}
+
+			(void)cdh_sample_lock();
+			/* it could have been reconfigured meanwhile */
+			if ((CDH_SAMPLE_TYPE_COMMAND == s->type) && cdh_sample_due(s, now)
+					&& frame_hasEnoughData(&answer, s->source.offset + s->source_size)) {
+				if (RV_SUCCESS == cdh_sample_data(s, answer.buf + s->source.offset, now)) rv = RV_SUCCESS;
+			}
+		}
 
-	if (CDH_SAMPLE_TYPE_MEMORY != (cdh_sample_config.flags & CDH_SAMPLE_TYPE_MASK)) return RV_NACK;
+		if (s->flags & CDH_SAMPLE_FLASH) (void)cdh_sample_spill(s);
+	}
+	cdh_sample_unlock();
 
-	return cdh_sample_data(cdh_sample_config.source.address, cdh_sample_config.source_size);
+	return rv;
 }
 
 #undef ELAPSED_SECONDS_FROM_TO
 
-retval_t cmd_sample_beacon(const subsystem_t *self, frame_t * iframe, frame_t * oframe) {
-	uint16_t offset;
-	uint16_t source_size;
-	uint16_t interval;
-	uint16_t count;
+void cdh_sample_init() {
+	cdh_sample_stream_t *s;
+	size_t ring_size;
+	int i;
 
-	if (RV_SUCCESS != frame_get_u16(iframe, &offset)) return RV_ILLEGAL;
-	if (RV_SUCCESS != frame_get_u16(iframe, &source_size)) return RV_ILLEGAL;
-	if (RV_SUCCESS != frame_get_u16(iframe, &count)) return RV_ILLEGAL;
-	if (RV_SUCCESS != frame_get_u16(iframe, &interval)) return RV_ILLEGAL;
+	if (NULL == cdh_sample.lock) {
+		cdh_sample.lock = xSemaphoreCreateMutex();
+		if (NULL == cdh_sample.lock) return;
+	}
 
-	// First turn off, reconfigure, then turn on
-	cdh_sample_config.samples_wanted   = 0;
-	cdh_sample_config.interval 		   = interval;
-	cdh_sample_config.last_sampled_ticks = 0;
-	cdh_sample_config.source_size      = source_size;
-	cdh_sample_config.source.offset    = offset;
-	cdh_sample_config.flags			   = CDH_SAMPLE_TYPE_BEACON;
+	/* each one big enough for a record at least, or they're all disabled:
+	 * nothing can be configured on an empty ring */
+	ring_size = MEMORY_uploadarea_size() / CDH_SAMPLE_STREAMS;
+	if (ring_size < CDH_SAMPLE_MAX_SIZE + 4) {
+		log_report(LOG_SS_CDH, "sampler: no upload area, streams disabled\n");
+		ring_size = 0;
+	}
 
-	frame_reset(&cdh_sample_config.data);
+	cdh_sample_lock();
+	for (i = 0; i < CDH_SAMPLE_STREAMS; i++) {
+		s = &cdh_sample.streams[i];
+		memset(s, 0, sizeof(*s));
+		s->ring = (0 != ring_size) ? (uint8_t *)MEMORY_uploadarea_address() + i * ring_size : NULL;
+		s->ring_size = ring_size;
+	}
+	cdh_sample_flash_scan();
+	cdh_sample_unlock();
+}
 
-	cdh_sample_config.samples_wanted = count;
+/* -- commands ------------------------------------------------------------ */
+
+/* stops and sets up `s`, called with the lock. Starts it if all is right */
+static retval_t cdh_sample_configure(cdh_sample_stream_t *s, uint8_t type, uint8_t flags, uint32_t source,
+		uint16_t source_size, uint16_t count, uint16_t interval, uint8_t decimation, uint8_t average) {
+	size_t record_size;
+
+	s->samples_wanted = 0;
+
+	record_size = source_size + ((flags & CDH_SAMPLE_TIMESTAMP) ? 4 : 0);
+	if ((0 == source_size) || (source_size > CDH_SAMPLE_MAX_SIZE) || (record_size > s->ring_size)) return RV_ILLEGAL;
+	if ((0 != average) && !cdh_sample_word_valid(average)) return RV_ILLEGAL;
+	if ((CDH_SAMPLE_TYPE_MEMORY != type) && (source > 0xffff)) return RV_ILLEGAL;
+
+	s->type = type;
+	s->flags = flags;
+	if (CDH_SAMPLE_TYPE_MEMORY == type) s->source.address = (void *)(uintptr_t)source;
+	else s->source.offset = source;
+	s->source_size = source_size;
+	s->interval = interval;
+	s->last_sampled_ticks = 0;
+	s->decimation = decimation ? decimation : 1;
+	s->average = average;
+	s->taken = 0;
+	memset(s->acc, 0, sizeof(s->acc));
+	memset(&s->trigger, 0, sizeof(s->trigger));
+
+	s->record_size = record_size;
+	s->capacity = s->ring_size / record_size;
+	s->written = 0;
+	s->spilled = 0;
+
+	s->samples_wanted = count;
 	return RV_SUCCESS;
 }
 
-retval_t cmd_sample_memory(const subsystem_t *self, frame_t * iframe, frame_t * oframe) {
-	void *source_addr;
+static retval_t cdh_sample_configure_stream0(uint8_t type, frame_t *iframe) {
+	uint32_t source;
+	uint16_t offset;
 	uint16_t source_size;
 	uint16_t interval;
 	uint16_t count;
+	retval_t rv;
 
-	if (RV_SUCCESS != frame_get_u32(iframe, (uint32_t *)&source_addr)) return RV_ILLEGAL;
+	if (CDH_SAMPLE_TYPE_MEMORY == type) {
+		if (RV_SUCCESS != frame_get_u32(iframe, &source)) return RV_ILLEGAL;
+	} else {
+		if (RV_SUCCESS != frame_get_u16(iframe, &offset)) return RV_ILLEGAL;
+		source = offset;
+	}
 	if (RV_SUCCESS != frame_get_u16(iframe, &source_size)) return RV_ILLEGAL;
 	if (RV_SUCCESS != frame_get_u16(iframe, &count)) return RV_ILLEGAL;
 	if (RV_SUCCESS != frame_get_u16(iframe, &interval)) return RV_ILLEGAL;
 
-	// First turn off, reconfigure, then turn on
-	cdh_sample_config.samples_wanted   = 0;
-	cdh_sample_config.interval 		   = interval;
-	cdh_sample_config.last_sampled_ticks = 0;
-	cdh_sample_config.source_size      = source_size;
-	cdh_sample_config.source.address   = source_addr;
-	cdh_sample_config.flags			   = CDH_SAMPLE_TYPE_MEMORY;
+	if (!cdh_sample_lock()) return RV_ERROR;
+	rv = cdh_sample_configure(&cdh_sample.streams[0], type, 0, source, source_size, count, interval, 1, 0);
+	cdh_sample_unlock();
+	return rv;
+}
 
-	frame_reset(&cdh_sample_config.data);
+retval_t cmd_sample_beacon(const subsystem_t *self, frame_t * iframe, frame_t * oframe) {
+	return cdh_sample_configure_stream0(CDH_SAMPLE_TYPE_BEACON, iframe);
+}
 
-	cdh_sample_config.samples_wanted = count;
-	return RV_SUCCESS;
+retval_t cmd_sample_memory(const subsystem_t *self, frame_t * iframe, frame_t * oframe) {
+	return cdh_sample_configure_stream0(CDH_SAMPLE_TYPE_MEMORY, iframe);
 }
 
 retval_t cmd_sample_flash_when_done(const subsystem_t *self, frame_t * iframe, frame_t * oframe) {
@@ -156,19 +509,148 @@ retval_t cmd_sample_flash_when_done(const subsystem_t *self, frame_t * iframe, f
 
 	if (RV_SUCCESS != frame_get_u8(iframe, &flash_when_done)) return RV_ILLEGAL;
 
-	if (flash_when_done) cdh_sample_config.flags |= CDH_SAMPLE_FLASH;
-	else cdh_sample_config.flags &= ~CDH_SAMPLE_FLASH;
+	if (!cdh_sample_lock()) return RV_ERROR;
+	if (flash_when_done) cdh_sample.streams[0].flags |= CDH_SAMPLE_FLASH;
+	else cdh_sample.streams[0].flags &= ~CDH_SAMPLE_FLASH;
+	cdh_sample_unlock();
 	return RV_SUCCESS;
 }
 
 retval_t cmd_sample_retrieve(const subsystem_t *self, frame_t * iframe, frame_t * oframe) {
-	frame_t data_copy;
+	cdh_sample_stream_t *s = &cdh_sample.streams[0];
+	uint32_t first, kept, size;
+
+	if (!cdh_sample_lock()) return RV_ERROR;
+
+	first = cdh_sample_first(s);
+	kept = (s->written - first) * s->record_size;
+	frame_put_u16(oframe, s->samples_wanted);
+	frame_put_u16(oframe, (kept > 0xffff) ? 0xffff : kept);
 
-	frame_copy(&data_copy, &cdh_sample_config.data);
-	frame_reset_for_reading(&data_copy);
-	frame_put_u16(oframe, cdh_sample_config.samples_wanted);
-	frame_put_u16(oframe, cdh_sample_config.data.position);
-	return frame_transfer(oframe, &data_copy);
+	/* from the oldest one to the end of the ring */
+	size = (s->capacity - (s->written > s->capacity ? first % s->capacity : 0)) * s->record_size;
+	if (size > kept) size = kept;
+	if (size > _frame_available_data(oframe)) size = _frame_available_data(oframe);
+	if (size > 0) frame_put_data(oframe, s->ring + (first % s->capacity) * s->record_size, size);
+
+	cdh_sample_unlock();
+	return RV_SUCCESS;
+}
+
+retval_t cmd_sample_stream(const subsystem_t *self, frame_t * iframe, frame_t * oframe) {
+	cdh_sample_stream_t *s;
+	uint8_t type, flags, decimation, average;
+	uint8_t ss = 0, cmd = 0, args_size = 0;
+	uint32_t source;
+	uint16_t source_size, count, interval;
+	retval_t rv;
+
+	if (NULL == (s = cdh_sample_get_stream(iframe))) return RV_ILLEGAL;
+	if (RV_SUCCESS != frame_get_u8(iframe, &type)) return RV_ILLEGAL;
+	if (RV_SUCCESS != frame_get_u32(iframe, &source)) return RV_ILLEGAL;
+	if (RV_SUCCESS != frame_get_u16(iframe, &source_size)) return RV_ILLEGAL;
+	if (RV_SUCCESS != frame_get_u16(iframe, &count)) return RV_ILLEGAL;
+	if (RV_SUCCESS != frame_get_u16(iframe, &interval)) return RV_ILLEGAL;
+	if (RV_SUCCESS != frame_get_u8(iframe, &decimation)) return RV_ILLEGAL;
+	if (RV_SUCCESS != frame_get_u8(iframe, &average)) return RV_ILLEGAL;
+	if (RV_SUCCESS != frame_get_u8(iframe, &flags)) return RV_ILLEGAL;
+	if (type >= CDH_SAMPLE_TYPE_COUNT) return RV_ILLEGAL;
+
+	if (CDH_SAMPLE_TYPE_COMMAND == type) {
+		if (RV_SUCCESS != frame_get_u8(iframe, &ss)) return RV_ILLEGAL;
+		if (RV_SUCCESS != frame_get_u8(iframe, &cmd)) return RV_ILLEGAL;
+		if (_frame_available_data(iframe) > CDH_SAMPLE_MAX_ARGS) return RV_NOSPACE;
+		args_size = _frame_available_data(iframe);
+	}
+
+	if (!cdh_sample_lock()) return RV_ERROR;
+	s->samples_wanted = 0;
+	s->ss = ss;
+	s->cmd = cmd;
+	s->args_size = args_size;
+	frame_get_data(iframe, s->args, args_size);
+	rv = cdh_sample_configure(s, type, flags, source, source_size, count, interval, decimation, average);
+	cdh_sample_unlock();
+	return rv;
 }
 
+retval_t cmd_sample_trigger(const subsystem_t *self, frame_t * iframe, frame_t * oframe) {
+	cdh_sample_stream_t *s;
+	uint16_t offset;
+	uint8_t word, op;
+	uint32_t threshold;
 
+	if (NULL == (s = cdh_sample_get_stream(iframe))) return RV_ILLEGAL;
+	if (RV_SUCCESS != frame_get_u16(iframe, &offset)) return RV_ILLEGAL;
+	if (RV_SUCCESS != frame_get_u8(iframe, &word)) return RV_ILLEGAL;
+	if (RV_SUCCESS != frame_get_u8(iframe, &op)) return RV_ILLEGAL;
+	if (RV_SUCCESS != frame_get_u32(iframe, &threshold)) return RV_ILLEGAL;
+	if ((op >= CDH_SAMPLE_OP_COUNT) || !cdh_sample_word_valid(word)) return RV_ILLEGAL;
+
+	if (!cdh_sample_lock()) return RV_ERROR;
+	if (offset + word > s->source_size) {
+		cdh_sample_unlock();
+		return RV_ILLEGAL;
+	}
+	s->trigger.offset = offset;
+	s->trigger.word = word;
+	s->trigger.op = op;
+	s->trigger.threshold = (int32_t)threshold;
+	s->trigger.last = 0;
+	cdh_sample_unlock();
+	return RV_SUCCESS;
+}
+
+retval_t cmd_sample_stop(const subsystem_t *self, frame_t * iframe, frame_t * oframe) {
+	cdh_sample_stream_t *s;
+
+	if (NULL == (s = cdh_sample_get_stream(iframe))) return RV_ILLEGAL;
+
+	if (!cdh_sample_lock()) return RV_ERROR;
+	s->samples_wanted = 0;		/* the rest is spilled on the next tick */
+	cdh_sample_unlock();
+	return RV_SUCCESS;
+}
+
+/* written:u32 first:u32 recordSize:u8 then the records from <from> on
+ * (or the first one still there) that fit */
+retval_t cmd_sample_read(const subsystem_t *self, frame_t * iframe, frame_t * oframe) {
+	cdh_sample_stream_t *s;
+	uint32_t from, first;
+
+	if (NULL == (s = cdh_sample_get_stream(iframe))) return RV_ILLEGAL;
+	if (RV_SUCCESS != frame_get_u32(iframe, &from)) from = 0;
+
+	if (!cdh_sample_lock()) return RV_ERROR;
+	first = cdh_sample_first(s);
+	if (from < first) from = first;
+
+	frame_put_u32(oframe, s->written);
+	frame_put_u32(oframe, first);
+	frame_put_u8(oframe, s->record_size);
+	while ((from < s->written) && frame_hasEnoughData(oframe, s->record_size)) {
+		frame_put_data(oframe, s->ring + (from % s->capacity) * s->record_size, s->record_size);
+		from++;
+	}
+	cdh_sample_unlock();
+	return RV_SUCCESS;
+}
+
+retval_t cmd_sample_status(const subsystem_t *self, frame_t * iframe, frame_t * oframe) {
+	cdh_sample_stream_t *s;
+	int i;
+
+	if (!cdh_sample_lock()) return RV_ERROR;
+	for (i = 0; i < CDH_SAMPLE_STREAMS; i++) {
+		s = &cdh_sample.streams[i];
+		frame_put_u8(oframe, s->type);
+		frame_put_u8(oframe, s->flags);
+		frame_put_u16(oframe, s->samples_wanted);
+		frame_put_u32(oframe, s->written);
+		frame_put_u32(oframe, s->spilled);
+	}
+	frame_put_u32(oframe, (uintptr_t)cdh_sample_flash);
+	frame_put_u32(oframe, cdh_sample.flash_head);
+	cdh_sample_unlock();
+	return RV_SUCCESS;
+}
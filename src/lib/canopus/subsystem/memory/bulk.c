@@ -0,0 +1,520 @@
+#include <canopus/types.h>
+#include <canopus/logging.h>
+#include <canopus/md5.h>
+#include <canopus/drivers/radio/lithium.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+#include <semphr.h>
+
+#include <string.h>
+
+#include "bulk.h"
+#include "comp_bcl/lz.h"
+
+#define MM_BULK_STACKSIZE		(configMINIMAL_STACK_SIZE + 256)
+#define MM_BULK_PRIORITY		(tskIDLE_PRIORITY + 1)	/* below CDH, acks get in */
+/* How often an idle task looks at the timeouts */
+#define MM_BULK_POLL_ms			500
+/* Bytes counted for the lz marker per turn of the task */
+#define MM_BULK_LZ_SCAN_STEP	4096
+
+/* State of a compressed download, allocated with the session */
+typedef struct mm_bulk_lz_t {
+	lz_stream_t stream;
+	uint8_t level;
+	bool started;			/* stream initialized, the histogram is done */
+	uint32_t scanned;		/* bytes counted in histogram */
+	uint32_t histogram[256];
+	uint32_t produced;		/* chunks out of the coder */
+	uint32_t last_count;	/* bytes in the last chunk out of the coder */
+	uint8_t ring[MM_BULK_LZ_WINDOW][MM_BULK_CHUNK_SIZE];	/* chunk i in i % MM_BULK_LZ_WINDOW, for resending */
+} mm_bulk_lz_t;
+
+typedef struct mm_bulk_session_t {
+	uint8_t id;				/* 0 when free */
+	bool acked;				/* false for readLong: no acks, no retransmissions, no MD5 */
+	bool suspended;			/* out of retries, waiting for the ground */
+	bool finalized;			/* md5.digest is ready, or the lz stream ended */
+	uint8_t window;
+	uint8_t retries;
+	uint32_t seqnum;
+	const uint8_t *address;
+	uint32_t size;
+	uint32_t units;			/* chunks, plus the MD5 trailer */
+	uint32_t base;			/* units before this one were acknowledged */
+	uint32_t next;			/* first unit never sent */
+	uint32_t resend;		/* bit i: send unit base+i again */
+	uint32_t hashed;		/* chunks already in md5 */
+	MD5_CTX md5;
+	mm_bulk_lz_t *lz;		/* compressed download, NULL otherwise */
+	portTickType last_ack;
+	portTickType last_heard;
+} mm_bulk_session_t;
+
+static struct {
+	mm_bulk_session_t sessions[MM_BULK_SESSIONS];
+	uint8_t last_id;
+	uint8_t turn;
+	xSemaphoreHandle lock;
+	xSemaphoreHandle kick;
+	xTaskHandle task;
+	mm_bulk_send_t *send;
+} bulk;
+
+static inline uint32_t window_mask(uint32_t count) {
+	if (count >= MM_BULK_MAX_WINDOW) return 0xFFFFFFFF;
+	return (1UL << count) - 1;
+}
+
+static inline bool elapsed(portTickType now, portTickType since, uint32_t ms) {
+	return (portTickType)(now - since) >= ms / portTICK_RATE_MS;
+}
+
+/* Must be called with the lock taken */
+static void session_free(mm_bulk_session_t *s) {
+	if (NULL != s->lz) vPortFree(s->lz);
+	s->lz = NULL;
+	s->id = 0;
+}
+
+static mm_bulk_session_t *session_find(uint8_t id) {
+	int i;
+
+	if (0 == id) return NULL;
+	for (i = 0; i < MM_BULK_SESSIONS; i++) {
+		if (bulk.sessions[i].id == id) return &bulk.sessions[i];
+	}
+	return NULL;
+}
+
+static inline uint32_t unit_size(const mm_bulk_session_t *s, uint32_t unit) {
+	uint32_t offset = unit * MM_BULK_CHUNK_SIZE;
+
+	if (!s->acked) return MM_BULK_CHUNK_SIZE;
+	if (offset + MM_BULK_CHUNK_SIZE > s->size) return s->size - offset;
+	return MM_BULK_CHUNK_SIZE;
+}
+
+/* Must be called with the lock taken. Picks the next unit of `s` to send,
+ * false if there's nothing to send right now */
+static bool session_pick(mm_bulk_session_t *s, portTickType now, uint32_t *unit) {
+	int bit;
+
+	if ((NULL != s->lz) && !s->lz->started) return false;
+
+	if (s->resend) {
+		for (bit = 0; !(s->resend & (1UL << bit)); bit++);
+		s->resend &= ~(1UL << bit);
+		*unit = s->base + bit;
+		return true;
+	}
+
+	if (s->suspended) return false;
+
+	if ((s->next < s->units) && (!s->acked || (s->next - s->base < s->window))) {
+		*unit = s->next++;
+		return true;
+	}
+
+	if (s->acked && (s->base < s->next) && elapsed(now, s->last_ack, MM_BULK_ACK_TIMEOUT_ms)) {
+		if (++s->retries > MM_BULK_MAX_RETRIES) {
+			log_report_fmt(LOG_SS_MEMORY, "bulk: session %d suspended at %d\n", s->id, s->base);
+			s->suspended = true;
+			return false;
+		}
+		/* nothing heard for a while, the whole window again */
+		s->resend = window_mask(s->next - s->base) & ~1UL;
+		s->last_ack = now;
+		*unit = s->base;
+		return true;
+	}
+	return false;
+}
+
+/* Must be called with the lock taken */
+static void session_expire(mm_bulk_session_t *s, portTickType now) {
+	if (0 == s->id) return;
+
+	if (!s->acked && (s->next == s->units)) {
+		session_free(s);	/* readLong done */
+	} else if (s->acked && (s->base == s->units)) {
+		session_free(s);
+	} else if (elapsed(now, s->last_heard, MM_BULK_IDLE_TIMEOUT_s * 1000)) {
+		log_report_fmt(LOG_SS_MEMORY, "bulk: session %d dropped\n", s->id);
+		session_free(s);
+	}
+}
+
+/* Must be called with the lock taken. The marker is the least used byte
+ * of the area, counted MM_BULK_LZ_SCAN_STEP bytes per turn of the task so
+ * neither the command nor a single turn goes through all of it. false when
+ * there's nothing left to count */
+static bool session_scan_lz(mm_bulk_session_t *s) {
+	mm_bulk_lz_t *lz = s->lz;
+	uint32_t count, i;
+	int marker;
+
+	if ((NULL == lz) || lz->started) return false;
+
+	count = s->size - lz->scanned;
+	if (count > MM_BULK_LZ_SCAN_STEP) count = MM_BULK_LZ_SCAN_STEP;
+	for (i = 0; i < count; i++) lz->histogram[s->address[lz->scanned + i]]++;
+	lz->scanned += count;
+	if (lz->scanned < s->size) return true;
+
+	for (marker = 0, i = 1; i < 256; i++) {
+		if (lz->histogram[i] < lz->histogram[marker]) marker = i;
+	}
+	LZ_StreamInit(&lz->stream, marker, lz->level);
+	lz->started = true;
+	return true;
+}
+
+/* Must be called with the lock taken. Fills `out` with as much compressed
+ * data as fits, the input is fed to the coder a chunk at a time */
+static void session_compress_lz(mm_bulk_session_t *s, uint8_t *out) {
+	lz_stream_t *stream = &s->lz->stream;
+	uint32_t offset, count;
+
+	stream->next_out = out;
+	stream->avail_out = MM_BULK_CHUNK_SIZE;
+	while (0 != stream->avail_out) {
+		if (0 == stream->avail_in) {
+			offset = s->hashed * MM_BULK_CHUNK_SIZE;
+			if (offset < s->size) {
+				count = s->size - offset;
+				if (count > MM_BULK_CHUNK_SIZE) count = MM_BULK_CHUNK_SIZE;
+				stream->next_in = s->address + offset;
+				stream->avail_in = count;
+				MD5Update(&s->md5, (unsigned char *)stream->next_in, count);
+				s->hashed++;
+			}
+		}
+		if (LZ_STREAM_END == LZ_StreamCompress(stream, stream->total_in + stream->avail_in == s->size)) {
+			MD5Final(&s->md5);
+			s->finalized = true;
+			s->units = s->lz->produced + 2;		/* this one and the trailer */
+			break;
+		}
+	}
+	s->lz->last_count = MM_BULK_CHUNK_SIZE - stream->avail_out;
+	s->lz->produced++;
+}
+
+/* Must be called with the lock taken. Chunks are compressed the first time
+ * they're sent and kept in the ring until acknowledged */
+static retval_t session_packet_lz(mm_bulk_session_t *s, uint32_t unit, frame_t *packet) {
+	mm_bulk_lz_t *lz = s->lz;
+	uint8_t *out;
+	uint32_t count = MM_BULK_CHUNK_SIZE;
+
+	frame_put_u8(packet, s->id);
+	if (s->finalized && (unit == lz->produced)) {
+		frame_put_u32(packet, unit | MM_BULK_LZ_LAST);
+		frame_put_u32(packet, s->size);
+		frame_put_u32(packet, lz->stream.total_out);
+		return frame_put_data(packet, s->md5.digest, sizeof(s->md5.digest));
+	}
+
+	frame_put_u32(packet, unit);
+	out = lz->ring[unit % MM_BULK_LZ_WINDOW];
+	if (unit == lz->produced) session_compress_lz(s, out);
+	if (s->finalized && (unit + 1 == lz->produced)) count = lz->last_count;
+	return frame_put_data(packet, out, count);
+}
+
+/* Must be called with the lock taken */
+static retval_t session_packet(mm_bulk_session_t *s, uint32_t unit, frame_t *packet) {
+	const uint8_t *data;
+	uint32_t count;
+
+	frame_put_u24(packet, s->seqnum);
+	if (NULL != s->lz) return session_packet_lz(s, unit, packet);
+	if (!s->acked) {
+		data = s->address + unit * MM_BULK_CHUNK_SIZE;
+		frame_put_u32(packet, (uintptr_t)data);
+		return frame_put_data(packet, data, MM_BULK_CHUNK_SIZE);
+	}
+
+	frame_put_u8(packet, s->id);
+	frame_put_u32(packet, unit);
+
+	if (unit + 1 == s->units) {
+		/* chunks are sent for the first time in order, all of them are in */
+		if (!s->finalized) {
+			MD5Final(&s->md5);
+			s->finalized = true;
+		}
+		return frame_put_data(packet, s->md5.digest, sizeof(s->md5.digest));
+	}
+
+	data = s->address + unit * MM_BULK_CHUNK_SIZE;
+	count = unit_size(s, unit);
+	if (unit == s->hashed) {
+		MD5Update(&s->md5, (unsigned char *)data, count);
+		s->hashed++;
+	}
+	return frame_put_data(packet, data, count);
+}
+
+static void bulk_task(void *params) {
+	mm_bulk_session_t *s;
+	mm_bulk_send_t *send;
+	frame_t *packet;
+	portTickType now;
+	uint32_t unit;
+	bool busy;
+	int i;
+
+	for (;;) {
+		busy = false;
+
+		/* one packet per session in turn */
+		for (i = 0; i < MM_BULK_SESSIONS; i++) {
+			/* before picking, a picked unit must make it to the radio */
+			if (RV_SUCCESS != frame_allocate(&packet)) break;
+
+			xSemaphoreTake(bulk.lock, portMAX_DELAY);
+			now = xTaskGetTickCount();
+			s = &bulk.sessions[(bulk.turn + i) % MM_BULK_SESSIONS];
+			session_expire(s, now);
+			if (s->id && session_scan_lz(s)) {
+				busy = true;	/* still choosing the marker */
+				frame_dispose(packet);
+				packet = NULL;
+			} else if (!s->id || !session_pick(s, now, &unit) || (RV_SUCCESS != session_packet(s, unit, packet))) {
+				frame_dispose(packet);
+				packet = NULL;
+			}
+			xSemaphoreGive(bulk.lock);
+
+			if (NULL != packet) {
+				frame_reset_for_reading(packet);
+				send = bulk.send;
+				if (NULL == send) send = lithium_send_data;
+				(void)send(packet);
+				busy = true;
+			}
+		}
+		bulk.turn++;
+
+		if (!busy) xSemaphoreTake(bulk.kick, MM_BULK_POLL_ms / portTICK_RATE_MS);
+	}
+}
+
+static retval_t bulk_initialize(void) {
+	if (NULL != bulk.task) return RV_SUCCESS;
+
+	if (NULL == bulk.lock) {
+		bulk.lock = xSemaphoreCreateMutex();
+		if (NULL == bulk.lock) return RV_NOSPACE;
+	}
+	if (NULL == bulk.kick) {
+		vSemaphoreCreateBinary(bulk.kick);
+		if (NULL == bulk.kick) return RV_NOSPACE;
+	}
+
+	if (pdPASS != xTaskCreate(bulk_task, (signed char *)"MM/bulk",
+			MM_BULK_STACKSIZE, NULL, MM_BULK_PRIORITY, &bulk.task)) {
+		log_report(LOG_SS_MEMORY, "Can't create bulk task\n");
+		return RV_NOSPACE;
+	}
+	return RV_SUCCESS;
+}
+
+static retval_t bulk_start(uint32_t seqnum, const void *address, uint32_t size, bool acked, uint8_t window,
+		mm_bulk_lz_t *lz, mm_bulk_session_t *out) {
+	mm_bulk_session_t *s = NULL;
+	retval_t rv;
+	int i;
+
+	/* only called from the commands, all in the CDH task */
+	rv = bulk_initialize();
+	if (RV_SUCCESS != rv) return rv;
+
+	if (0 == window) window = MM_BULK_DEFAULT_WINDOW;
+	if (window > MM_BULK_MAX_WINDOW) window = MM_BULK_MAX_WINDOW;
+
+	xSemaphoreTake(bulk.lock, portMAX_DELAY);
+	for (i = 0; i < MM_BULK_SESSIONS; i++) {
+		if (0 == bulk.sessions[i].id) {
+			s = &bulk.sessions[i];
+			break;
+		}
+	}
+
+	if (NULL != s) {
+		memset(s, 0, sizeof(*s));
+		if (0 == ++bulk.last_id) bulk.last_id = 1;
+		s->id      = bulk.last_id;
+		s->acked   = acked;
+		s->window  = window;
+		s->seqnum  = seqnum;
+		s->address = address;
+		s->size    = size;
+		s->units   = (size + MM_BULK_CHUNK_SIZE - 1) / MM_BULK_CHUNK_SIZE;
+		if (acked) s->units++;					/* MD5 trailer */
+		else if (0 == s->units) s->units = 1;	/* readLong always answered */
+		if (NULL != lz) s->units = 0xFFFFFFFF;	/* until the stream ends */
+		s->lz      = lz;
+		s->last_ack = s->last_heard = xTaskGetTickCount();
+		MD5Init(&s->md5);
+		*out = *s;
+	}
+	xSemaphoreGive(bulk.lock);
+
+	if (NULL == s) return RV_BUSY;
+	xSemaphoreGive(bulk.kick);
+	return RV_SUCCESS;
+}
+
+retval_t mm_bulk_read_long(uint32_t seqnum, const void *address, uint32_t size) {
+	mm_bulk_session_t s;
+
+	return bulk_start(seqnum, address, size, false, 0, NULL, &s);
+}
+
+retval_t cmd_mem_bulk_read(const subsystem_t *self, frame_t *iframe, frame_t *oframe, uint32_t seqnum) {
+	mm_bulk_session_t s;
+	uint32_t address, size;
+	uint8_t window;
+	retval_t rv;
+
+	if (RV_SUCCESS != frame_get_u32(iframe, &address)) return RV_NOSPACE;
+	if (RV_SUCCESS != frame_get_u32(iframe, &size)) return RV_NOSPACE;
+	if (RV_SUCCESS != frame_get_u8(iframe, &window)) return RV_NOSPACE;
+
+	rv = bulk_start(seqnum, (const void *)(uintptr_t)address, size, true, window, NULL, &s);
+	if (RV_SUCCESS != rv) return rv;
+
+	frame_put_u8(oframe, s.id);
+	frame_put_u32(oframe, s.units - 1);
+	return frame_put_u16(oframe, MM_BULK_CHUNK_SIZE);
+}
+
+retval_t cmd_mem_bulk_read_lz(const subsystem_t *self, frame_t *iframe, frame_t *oframe, uint32_t seqnum) {
+	mm_bulk_session_t s;
+	uint32_t address, size;
+	uint8_t level, window;
+	mm_bulk_lz_t *lz;
+	retval_t rv;
+
+	if (RV_SUCCESS != frame_get_u32(iframe, &address)) return RV_NOSPACE;
+	if (RV_SUCCESS != frame_get_u32(iframe, &size)) return RV_NOSPACE;
+	if (RV_SUCCESS != frame_get_u8(iframe, &level)) return RV_NOSPACE;
+	if (RV_SUCCESS != frame_get_u8(iframe, &window)) return RV_NOSPACE;
+
+	/* chunks not acknowledged are resent from the ring */
+	if ((0 == window) || (window > MM_BULK_LZ_WINDOW)) window = MM_BULK_LZ_WINDOW;
+
+	/* the marker is chosen and the stream started by the bulk task */
+	lz = pvPortMalloc(sizeof(*lz));
+	if (NULL == lz) return RV_NOSPACE;
+	memset(lz, 0, sizeof(*lz));
+	lz->level = level;
+
+	rv = bulk_start(seqnum, (const void *)(uintptr_t)address, size, true, window, lz, &s);
+	if (RV_SUCCESS != rv) {
+		vPortFree(lz);
+		return rv;
+	}
+	frame_put_u8(oframe, s.id);
+	return frame_put_u16(oframe, MM_BULK_CHUNK_SIZE);
+}
+
+retval_t cmd_mem_bulk_ack(const subsystem_t *self, frame_t *iframe, frame_t *oframe) {
+	mm_bulk_session_t *s;
+	uint32_t base, missing, shift;
+	uint8_t id;
+	retval_t rv = RV_SUCCESS;
+
+	if (RV_SUCCESS != frame_get_u8(iframe, &id)) return RV_NOSPACE;
+	if (RV_SUCCESS != frame_get_u32(iframe, &base)) return RV_NOSPACE;
+	if (RV_SUCCESS != frame_get_u32(iframe, &missing)) return RV_NOSPACE;
+	if (NULL == bulk.lock) return RV_NOENT;
+
+	xSemaphoreTake(bulk.lock, portMAX_DELAY);
+	s = session_find(id);
+	if ((NULL == s) || !s->acked) {
+		rv = RV_NOENT;
+	} else {
+		s->last_heard = xTaskGetTickCount();
+		if (base > s->next) base = s->next;		/* can't have what wasn't sent */
+		if (base < s->base) {
+			/* overtaken by a later one, its bits are from where it was */
+			shift = s->base - base;
+			missing = (shift >= MM_BULK_MAX_WINDOW) ? 0 : missing >> shift;
+			base = s->base;
+		}
+		if (base > s->base) {
+			shift = base - s->base;
+			s->resend = (shift >= MM_BULK_MAX_WINDOW) ? 0 : s->resend >> shift;
+			s->base = base;
+			s->retries = 0;
+			s->suspended = false;
+			s->last_ack = s->last_heard;
+		}
+		s->resend |= missing & window_mask(s->next - s->base);
+		if (missing) s->last_ack = s->last_heard;
+		if (s->base == s->units) session_free(s);	/* all done */
+	}
+	xSemaphoreGive(bulk.lock);
+
+	xSemaphoreGive(bulk.kick);
+	return rv;
+}
+
+retval_t cmd_mem_bulk_resume(const subsystem_t *self, frame_t *iframe, frame_t *oframe) {
+	mm_bulk_session_t *s;
+	uint32_t from, units = 0;
+	uint8_t id;
+	retval_t rv = RV_SUCCESS;
+
+	if (RV_SUCCESS != frame_get_u8(iframe, &id)) return RV_NOSPACE;
+	if (RV_SUCCESS != frame_get_u32(iframe, &from)) return RV_NOSPACE;
+	if (NULL == bulk.lock) return RV_NOENT;
+
+	xSemaphoreTake(bulk.lock, portMAX_DELAY);
+	s = session_find(id);
+	if ((NULL == s) || !s->acked) {
+		rv = RV_NOENT;
+	} else {
+		/* the ground knows best what it has, but compressed chunks
+		 * can only come again from the ring */
+		if (from > s->next) from = s->next;
+		if ((NULL != s->lz) && (from < s->base)) from = s->base;
+		s->base = s->next = from;
+		s->resend = 0;
+		s->retries = 0;
+		s->suspended = false;
+		s->last_ack = s->last_heard = xTaskGetTickCount();
+		units = s->units;
+	}
+	xSemaphoreGive(bulk.lock);
+	if (RV_SUCCESS != rv) return rv;
+
+	xSemaphoreGive(bulk.kick);
+	frame_put_u8(oframe, id);
+	return frame_put_u32(oframe, units - 1);
+}
+
+void mm_bulk_set_send(mm_bulk_send_t *send) {
+	bulk.send = send;
+}
+
+retval_t cmd_mem_bulk_abort(const subsystem_t *self, frame_t *iframe, frame_t *oframe) {
+	mm_bulk_session_t *s;
+	uint8_t id;
+	retval_t rv = RV_SUCCESS;
+
+	if (RV_SUCCESS != frame_get_u8(iframe, &id)) return RV_NOSPACE;
+	if (NULL == bulk.lock) return RV_NOENT;
+
+	xSemaphoreTake(bulk.lock, portMAX_DELAY);
+	s = session_find(id);
+	if (NULL == s) rv = RV_NOENT;
+	else session_free(s);
+	xSemaphoreGive(bulk.lock);
+	return rv;
+}
@@ -0,0 +1,75 @@
+#ifndef _CANOPUS_SUBSYSTEM_MEMORY_BULK_H
+#define _CANOPUS_SUBSYSTEM_MEMORY_BULK_H
+
+#include <canopus/types.h>
+#include <canopus/frame.h>
+#include <canopus/subsystem/subsystem.h>
+#include <canopus/subsystem/mm.h>
+
+/* Bulk memory download.
+ *
+ * A session splits a memory area in MM_BULK_CHUNK_SIZE chunks and a task
+ * streams them down, as fast as the radio takes them, keeping at most
+ * `window` chunks not acknowledged by the ground. Every packet is
+ *
+ *   seqnum:u24 session:u8 chunk:u32 data[MM_BULK_CHUNK_SIZE]
+ *
+ * with the sequence number of the command starting the session. The chunk
+ * after the last one carries the MD5 of the whole area instead of data, and
+ * is acknowledged like the rest.
+ *
+ * The ground acknowledges with bulkAck <session> <base> <missing>: every
+ * chunk before `base` arrived, and bit i of `missing` asks for chunk base+i
+ * again; one overtaken by a later ack only asks for chunks still not
+ * acknowledged. When nothing is acknowledged for MM_BULK_ACK_TIMEOUT_ms the
+ * window is sent again, up to MM_BULK_MAX_RETRIES times, then the session
+ * waits for the ground, who can pick it up with bulkResume <session> <from>.
+ * Sessions nobody talks to for MM_BULK_IDLE_TIMEOUT_s are dropped.
+ */
+
+#define MM_BULK_SESSIONS		2
+#define MM_BULK_CHUNK_SIZE		MEM_READ_BLOCK_SIZE
+#define MM_BULK_MAX_WINDOW		32		/* bits in the `missing` bitmap */
+#define MM_BULK_DEFAULT_WINDOW	8
+#define MM_BULK_ACK_TIMEOUT_ms	5000
+#define MM_BULK_MAX_RETRIES		3
+#define MM_BULK_IDLE_TIMEOUT_s	600
+
+retval_t cmd_mem_bulk_read(const subsystem_t *self, frame_t *iframe, frame_t *oframe, uint32_t seqnum);
+retval_t cmd_mem_bulk_ack(const subsystem_t *self, frame_t *iframe, frame_t *oframe);
+retval_t cmd_mem_bulk_resume(const subsystem_t *self, frame_t *iframe, frame_t *oframe);
+retval_t cmd_mem_bulk_abort(const subsystem_t *self, frame_t *iframe, frame_t *oframe);
+
+/* Compressed download, a session like the ones above. The area goes
+ * through the streaming LZ coder (comp_bcl/lz.h) and every packet is
+ *
+ *   seqnum:u24 session:u8 chunk:u32 data[up to MM_BULK_CHUNK_SIZE]
+ *
+ * with chunk i holding the compressed stream from i * MM_BULK_CHUNK_SIZE,
+ * LZ_Uncompress() takes the data put together. Only the last data chunk
+ * can be short. The one after it is
+ *
+ *   seqnum:u24 session:u8 (chunk | MM_BULK_LZ_LAST):u32 size:u32 compressedSize:u32 md5:u8[16]
+ *
+ * with the MD5 of the uncompressed area. The number of chunks isn't known
+ * until the coder is done, bulkResume answers 0xFFFFFFFE until then.
+ * Chunks are acknowledged with bulkAck, and kept for resending in a ring
+ * of MM_BULK_LZ_WINDOW, so the window is at most that and bulkResume can't
+ * go back past the last acknowledged chunk. The answer is the session id
+ * and the chunk size.
+ */
+#define MM_BULK_LZ_WINDOW		MM_BULK_DEFAULT_WINDOW
+#define MM_BULK_LZ_LAST			0x80000000
+
+retval_t cmd_mem_bulk_read_lz(const subsystem_t *self, frame_t *iframe, frame_t *oframe, uint32_t seqnum);
+
+/* Unacknowledged session, packets are seqnum:u24 address:u32 data[MEM_READ_BLOCK_SIZE]
+ * as they have always been for readLong */
+retval_t mm_bulk_read_long(uint32_t seqnum, const void *address, uint32_t size);
+
+/* Where the packets go, lithium_send_data() unless set (NULL sets it back).
+ * It takes the frame */
+typedef retval_t mm_bulk_send_t(frame_t *packet);
+void mm_bulk_set_send(mm_bulk_send_t *send);
+
+#endif
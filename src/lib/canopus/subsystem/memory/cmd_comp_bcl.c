@@ -6,6 +6,8 @@
 
 #include <string.h>
 
+#include <FreeRTOS.h>
+
 #include "compression.h"
 
 #include "comp_bcl/lz.h"
@@ -17,6 +19,7 @@ cmd_mem_compress_bcl_lz(const subsystem_t *self, frame_t *iframe, frame_t *ofram
 	unsigned int insize;
 	int outsize;
 	uint8_t digest_expected;
+	lz_stream_t *work;
 
 	if (!frame_hasEnoughSpace(iframe, sizeof(uint32_t)*3 + sizeof(uint8_t))) {
 		return RV_NOSPACE;
@@ -27,7 +30,12 @@ cmd_mem_compress_bcl_lz(const subsystem_t *self, frame_t *iframe, frame_t *ofram
 	out = (unsigned char *)frame_get_u32_nocheck(iframe);
 	digest_expected = frame_get_u8_nocheck(iframe);
 
-	outsize = LZ_Compress(in, out, insize);
+	work = pvPortMalloc(sizeof(*work));
+	if (NULL == work) {
+		return RV_NOSPACE;
+	}
+	outsize = LZ_CompressHC(in, out, insize, LZ_STREAM_DEFAULT_LEVEL, work);
+	vPortFree(work);
 	frame_put_u32(oframe, outsize);
 
 	if (0 == outsize) {
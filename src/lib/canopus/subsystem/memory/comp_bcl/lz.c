@@ -78,6 +78,11 @@
 *************************************************************************/
 
 
+#include <string.h>
+
+#include "lz.h"
+
+
 /*************************************************************************
 * Constants used for LZ77 coding
 *************************************************************************/
@@ -480,6 +485,455 @@ int LZ_CompressFast( unsigned char *in, unsigned char *out,
 #endif
 
 
+/*************************************************************************
+*                  STREAMING HASH CHAIN CODER (ALTERED)                  *
+*************************************************************************/
+
+/* max_chain, nice_length and lazy for levels 1 to 9 */
+static const struct {
+    unsigned short max_chain;
+    unsigned short nice_length;
+    unsigned char  lazy;
+} _LZ_levels[ 9 ] = {
+    {    4,  16, 0 },
+    {    8,  32, 0 },
+    {   16,  64, 0 },
+    {   16,  64, 1 },
+    {   32, 128, 1 },
+    {   64, 255, 1 },
+    {  128, 255, 1 },
+    {  512, 255, 1 },
+    { 4096, 255, 1 },
+};
+
+
+/*************************************************************************
+* _LZ_VarSizeLength() - Bytes _LZ_WriteVarSize() uses for x.
+*************************************************************************/
+
+static unsigned int _LZ_VarSizeLength( unsigned int x )
+{
+    unsigned int num_bytes = 1;
+
+    while( (x >>= 7) != 0 ) ++ num_bytes;
+    return num_bytes;
+}
+
+
+/*************************************************************************
+* _LZ_MatchGain() - Bytes saved coding length bytes as a reference,
+* 0 or less if it's not worth it.
+*************************************************************************/
+
+static int _LZ_MatchGain( unsigned int length, unsigned int offset )
+{
+    return (int) length - (int) (1 + _LZ_VarSizeLength( length ) +
+                                 _LZ_VarSizeLength( offset ));
+}
+
+
+/*************************************************************************
+* _LZ_Hash() - Hash of the LZ_STREAM_MIN_MATCH bytes at p.
+*************************************************************************/
+
+static unsigned int _LZ_Hash( const unsigned char *p )
+{
+    unsigned int x;
+
+    x = ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) |
+        ((unsigned int)p[2] << 8) | (unsigned int)p[3];
+    return (x * 2654435761u) >> (32 - LZ_STREAM_HASH_BITS);
+}
+
+
+/*************************************************************************
+* _LZ_Insert() - Add every position before pos to the hash chains.
+* Chain entries are positions in the window plus one, 0 ends the chain.
+*************************************************************************/
+
+static void _LZ_Insert( lz_stream_t *s, unsigned int pos )
+{
+    unsigned int h;
+
+    for( ; s->inserted < pos; ++ s->inserted )
+    {
+        /* Not enough data to hash yet, try again after the next fill */
+        if( s->inserted + LZ_STREAM_MIN_MATCH > s->end ) break;
+        h = _LZ_Hash( &s->window[ s->inserted ] );
+        s->prev[ s->inserted & (LZ_STREAM_WINDOW-1) ] = s->head[ h ];
+        s->head[ h ] = (unsigned short) (s->inserted + 1);
+    }
+}
+
+
+/*************************************************************************
+* _LZ_FindMatch() - Walk the hash chain for the best reference at pos.
+* Returns the gain, 0 when there is none worth it.
+*************************************************************************/
+
+static int _LZ_FindMatch( lz_stream_t *s, unsigned int pos,
+    unsigned int *bestlength, unsigned int *bestoffset )
+{
+    unsigned char *ptr1, *ptr2;
+    unsigned int maxlength, length, offset, entry, next, chain;
+    int gain, bestgain;
+
+    if( (pos == s->cached_pos) && (s->cached_length != 0) )
+    {
+        *bestlength = s->cached_length;
+        *bestoffset = s->cached_offset;
+        return _LZ_MatchGain( *bestlength, *bestoffset );
+    }
+
+    _LZ_Insert( s, pos );
+
+    *bestlength = 0;
+    *bestoffset = 0;
+    bestgain = 0;
+
+    maxlength = s->end - pos;
+    if( maxlength > LZ_STREAM_MAX_MATCH ) maxlength = LZ_STREAM_MAX_MATCH;
+    if( maxlength < LZ_STREAM_MIN_MATCH ) return 0;
+
+    ptr1 = &s->window[ pos ];
+    entry = s->head[ _LZ_Hash( ptr1 ) ];
+    for( chain = s->max_chain; (entry != 0) && (chain != 0); -- chain )
+    {
+        offset = pos - (entry - 1);
+        if( offset >= LZ_STREAM_WINDOW ) break;
+
+        ptr2 = &s->window[ entry - 1 ];
+        length = (*bestlength < maxlength) ? *bestlength : 0;
+        if( (ptr2[ length ] == ptr1[ length ]) && (ptr2[ 0 ] == ptr1[ 0 ]) )
+        {
+            /* Overlapping the current position is fine, the decoder
+               copies one byte at a time */
+            length = _LZ_StringCompare( ptr1, ptr2, 0, maxlength );
+            gain = _LZ_MatchGain( length, offset );
+            if( gain > bestgain )
+            {
+                bestgain = gain;
+                *bestlength = length;
+                *bestoffset = offset;
+                if( length >= s->nice_length ) break;
+            }
+        }
+
+        /* Chains only go back in the window */
+        next = s->prev[ (entry - 1) & (LZ_STREAM_WINDOW-1) ];
+        if( next >= entry ) break;
+        entry = next;
+    }
+
+    s->cached_pos = pos;
+    s->cached_length = *bestlength;
+    s->cached_offset = *bestoffset;
+    return bestgain;
+}
+
+
+/*************************************************************************
+* _LZ_Slide() - Drop the oldest half of the window.
+*************************************************************************/
+
+static void _LZ_Slide( lz_stream_t *s )
+{
+    unsigned int i;
+
+    /* Matches skip positions, hash them before their numbers change */
+    _LZ_Insert( s, s->pos );
+
+    memmove( s->window, &s->window[ LZ_STREAM_WINDOW ], LZ_STREAM_WINDOW );
+    s->pos -= LZ_STREAM_WINDOW;
+    s->end -= LZ_STREAM_WINDOW;
+    s->inserted -= LZ_STREAM_WINDOW;
+    s->cached_length = 0;
+
+    for( i = 0; i < (1 << LZ_STREAM_HASH_BITS); ++ i )
+    {
+        s->head[ i ] = (s->head[ i ] > LZ_STREAM_WINDOW) ?
+            s->head[ i ] - LZ_STREAM_WINDOW : 0;
+    }
+    for( i = 0; i < LZ_STREAM_WINDOW; ++ i )
+    {
+        s->prev[ i ] = (s->prev[ i ] > LZ_STREAM_WINDOW) ?
+            s->prev[ i ] - LZ_STREAM_WINDOW : 0;
+    }
+}
+
+
+/*************************************************************************
+* _LZ_Fill() - Move input into the window.
+*************************************************************************/
+
+static void _LZ_Fill( lz_stream_t *s )
+{
+    unsigned int count;
+
+    /* Slide only when short of lookahead, the history is worth keeping.
+       A match being extended needs its source: only once it's at the end */
+    if( (s->end == 2 * LZ_STREAM_WINDOW) &&
+        (s->end - s->pos < LZ_STREAM_MAX_MATCH + 2) && (s->avail_in != 0) &&
+        ((s->run_length == 0) || (s->pos == s->end)) )
+    {
+        _LZ_Slide( s );
+    }
+
+    count = 2 * LZ_STREAM_WINDOW - s->end;
+    if( count > s->avail_in ) count = s->avail_in;
+    memcpy( &s->window[ s->end ], s->next_in, count );
+    s->end += count;
+    s->next_in += count;
+    s->avail_in -= count;
+    s->total_in += count;
+}
+
+
+/*************************************************************************
+* _LZ_Start() - Empty the pending buffer for the next token.
+*************************************************************************/
+
+static void _LZ_Start( lz_stream_t *s )
+{
+    s->pending_pos = 0;
+    s->pending_len = 0;
+
+    if( !s->started )
+    {
+        /* Remember the marker symbol for the decoder */
+        s->pending[ s->pending_len ++ ] = s->marker;
+        s->started = 1;
+    }
+}
+
+
+/*************************************************************************
+* _LZ_Reference() - Code a (length,offset) reference into pending.
+*************************************************************************/
+
+static void _LZ_Reference( lz_stream_t *s, unsigned int length,
+    unsigned int offset )
+{
+    s->pending[ s->pending_len ++ ] = s->marker;
+    s->pending_len += _LZ_WriteVarSize( length, &s->pending[ s->pending_len ] );
+    s->pending_len += _LZ_WriteVarSize( offset, &s->pending[ s->pending_len ] );
+}
+
+
+/*************************************************************************
+* _LZ_Extend() - Go on with a match as long as the data repeats. Returns
+* non zero once it ended and its reference is pending.
+*************************************************************************/
+
+static int _LZ_Extend( lz_stream_t *s, int flush )
+{
+    /* pos only reaches end here, so the window slides with pos - offset
+       still in it */
+    while( (s->pos < s->end) &&
+           (s->window[ s->pos ] == s->window[ s->pos - s->run_offset ]) )
+    {
+        ++ s->pos;
+        ++ s->run_length;
+    }
+    if( (s->pos == s->end) && !flush )
+    {
+        return 0;
+    }
+
+    _LZ_Start( s );
+    _LZ_Reference( s, s->run_length, s->run_offset );
+    s->run_length = 0;
+    return 1;
+}
+
+
+/*************************************************************************
+* _LZ_Token() - Code what's at pos into the pending buffer.
+*************************************************************************/
+
+static void _LZ_Token( lz_stream_t *s, int flush )
+{
+    unsigned int length, offset, length2, offset2;
+    unsigned char symbol;
+    int gain;
+
+    _LZ_Start( s );
+
+    gain = _LZ_FindMatch( s, s->pos, &length, &offset );
+
+    /* Lazy matching, is it better to start the match one byte later? */
+    if( (gain > 0) && s->lazy && (length < s->nice_length) &&
+        (flush || (s->end - s->pos > LZ_STREAM_MAX_MATCH + 1)) &&
+        (_LZ_FindMatch( s, s->pos + 1, &length2, &offset2 ) > gain) )
+    {
+        gain = 0;
+    }
+
+    if( (gain > 0) && (length == LZ_STREAM_MAX_MATCH) )
+    {
+        /* As long as the lookahead, it may go on: written when it ends */
+        s->run_length = length;
+        s->run_offset = offset;
+        s->pos += length;
+    }
+    else if( gain > 0 )
+    {
+        _LZ_Reference( s, length, offset );
+        s->pos += length;
+    }
+    else
+    {
+        /* Output single byte (or two bytes if marker byte) */
+        symbol = s->window[ s->pos ++ ];
+        s->pending[ s->pending_len ++ ] = symbol;
+        if( symbol == s->marker )
+        {
+            s->pending[ s->pending_len ++ ] = 0;
+        }
+    }
+}
+
+
+/*************************************************************************
+* LZ_ChooseMarker() - Least common byte in the input, the best marker.
+*************************************************************************/
+
+unsigned char LZ_ChooseMarker( const unsigned char *in, unsigned int insize )
+{
+    unsigned int histogram[ 256 ], i;
+    unsigned char marker;
+
+    for( i = 0; i < 256; ++ i )
+    {
+        histogram[ i ] = 0;
+    }
+    for( i = 0; i < insize; ++ i )
+    {
+        ++ histogram[ in[ i ] ];
+    }
+
+    marker = 0;
+    for( i = 1; i < 256; ++ i )
+    {
+        if( histogram[ i ] < histogram[ marker ] )
+        {
+            marker = i;
+        }
+    }
+    return marker;
+}
+
+
+/*************************************************************************
+* LZ_StreamInit() - Prepare a stream.
+*  stream - State, about 6*LZ_STREAM_WINDOW bytes.
+*  marker - Marker symbol, LZ_ChooseMarker() of the data if possible,
+*           any byte works, a common one just costs ratio.
+*  level  - 1 (fast) to 9 (best ratio), 0 for LZ_STREAM_DEFAULT_LEVEL.
+*************************************************************************/
+
+void LZ_StreamInit( lz_stream_t *stream, unsigned char marker, int level )
+{
+    if( level <= 0 ) level = LZ_STREAM_DEFAULT_LEVEL;
+    if( level > 9 ) level = 9;
+
+    memset( stream, 0, sizeof(*stream) );
+    stream->marker = marker;
+    stream->max_chain = _LZ_levels[ level-1 ].max_chain;
+    stream->nice_length = _LZ_levels[ level-1 ].nice_length;
+    stream->lazy = _LZ_levels[ level-1 ].lazy;
+    stream->cached_pos = (unsigned int) -1;
+}
+
+
+/*************************************************************************
+* LZ_StreamCompress() - Compress as much as possible.
+*  stream - next_in/avail_in and next_out/avail_out set by the caller.
+*  flush  - Non zero once all the input was given.
+* Returns LZ_STREAM_OK when it needs more input or more output space,
+* LZ_STREAM_END when flushing and everything was written out.
+*************************************************************************/
+
+int LZ_StreamCompress( lz_stream_t *stream, int flush )
+{
+    lz_stream_t *s = stream;
+    unsigned int count;
+
+    for( ;; )
+    {
+        /* Output what's pending */
+        count = s->pending_len - s->pending_pos;
+        if( count > s->avail_out ) count = s->avail_out;
+        memcpy( s->next_out, &s->pending[ s->pending_pos ], count );
+        s->pending_pos += count;
+        s->next_out += count;
+        s->avail_out -= count;
+        s->total_out += count;
+        if( s->pending_pos < s->pending_len ) return LZ_STREAM_OK;
+
+        _LZ_Fill( s );
+
+        if( s->run_length != 0 )
+        {
+            if( _LZ_Extend( s, flush && (s->avail_in == 0) ) ||
+                (s->avail_in != 0) )
+            {
+                continue;
+            }
+            return LZ_STREAM_OK;
+        }
+
+        if( s->pos == s->end )
+        {
+            return (flush && (s->avail_in == 0)) ? LZ_STREAM_END : LZ_STREAM_OK;
+        }
+
+        /* Keep enough lookahead for the longest match, unless it's the end */
+        if( !(flush && (s->avail_in == 0)) &&
+            (s->end - s->pos < LZ_STREAM_MAX_MATCH + 2) )
+        {
+            return LZ_STREAM_OK;
+        }
+
+        _LZ_Token( s, flush && (s->avail_in == 0) );
+    }
+}
+
+
+/*************************************************************************
+* LZ_CompressHC() - Compress a block of data with the hash chain coder.
+*  in     - Input (uncompressed) buffer.
+*  out    - Output (compressed) buffer, same size requirements as for
+*           LZ_Compress().
+*  insize - Number of input bytes.
+*  level  - 1 to 9, 0 for LZ_STREAM_DEFAULT_LEVEL.
+*  work   - Working memory.
+* The function returns the size of the compressed data.
+*************************************************************************/
+
+int LZ_CompressHC( unsigned char *in, unsigned char *out,
+    unsigned int insize, int level, lz_stream_t *work )
+{
+    if( insize < 1 )
+    {
+        return 0;
+    }
+
+    LZ_StreamInit( work, LZ_ChooseMarker( in, insize ), level );
+    work->next_in = in;
+    work->avail_in = insize;
+    work->next_out = out;
+    work->avail_out = insize + insize / 256 + 1;
+
+    while( LZ_STREAM_END != LZ_StreamCompress( work, 1 ) )
+    {
+        if( work->avail_out == 0 ) break;   /* can't happen */
+    }
+    return work->total_out;
+}
+
+
+
 /*************************************************************************
 * LZ_Uncompress() - Uncompress a block of data using an LZ77 decoder.
 *  in      - Input (compressed) buffer.
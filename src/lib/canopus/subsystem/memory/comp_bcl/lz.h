@@ -37,6 +37,62 @@ extern "C" {
 #endif
 
 
+/*************************************************************************
+* Streaming hash chain coder (not part of the original lz.c)
+*
+* Produces the same format LZ_Uncompress() reads, with bounded memory:
+* matches are looked up through hash chains over a sliding window of
+* LZ_STREAM_WINDOW bytes instead of searching the whole history. The
+* level (1-9) trades speed for ratio: longer chains, and from level 4 on
+* lazy matching (a match is deferred if the next position has a better
+* one). Matches are looked for up to LZ_STREAM_MAX_MATCH bytes, one that
+* long goes on as far as the data repeats, past the lookahead.
+*
+* Input and output are given in pieces, as with zlib: set next_in,
+* avail_in, next_out and avail_out and call LZ_StreamCompress() until it
+* returns LZ_STREAM_END with flush set. Concatenating every piece of
+* output gives one stream for LZ_Uncompress().
+*************************************************************************/
+
+#ifndef LZ_STREAM_WINDOW_BITS
+#define LZ_STREAM_WINDOW_BITS   11      /* 9 to 14 */
+#endif
+#define LZ_STREAM_WINDOW        (1 << LZ_STREAM_WINDOW_BITS)
+#define LZ_STREAM_HASH_BITS     LZ_STREAM_WINDOW_BITS
+#define LZ_STREAM_MIN_MATCH     4
+#define LZ_STREAM_MAX_MATCH     255
+#define LZ_STREAM_MAX_TOKEN     11      /* marker + 2 * 5 bytes */
+#define LZ_STREAM_DEFAULT_LEVEL 6
+
+#define LZ_STREAM_OK            0       /* needs more input or more output space */
+#define LZ_STREAM_END           1       /* flushed, all done */
+
+typedef struct lz_stream_t {
+    /* Set by the caller, updated by LZ_StreamCompress() */
+    const unsigned char *next_in;
+    unsigned int  avail_in;
+    unsigned char *next_out;
+    unsigned int  avail_out;
+    unsigned int  total_in;
+    unsigned int  total_out;
+
+    /* Internal state */
+    unsigned char marker;
+    unsigned char started;
+    unsigned char lazy;
+    unsigned short max_chain;
+    unsigned short nice_length;
+    unsigned int  pos, end, inserted;
+    unsigned int  cached_pos, cached_length, cached_offset;
+    unsigned int  run_length, run_offset;   /* match being extended */
+    unsigned char pending[ LZ_STREAM_MAX_TOKEN ];
+    unsigned int  pending_len, pending_pos;
+    unsigned short head[ 1 << LZ_STREAM_HASH_BITS ];
+    unsigned short prev[ LZ_STREAM_WINDOW ];
+    unsigned char window[ 2 * LZ_STREAM_WINDOW ];
+} lz_stream_t;
+
+
 /*************************************************************************
 * Function prototypes
 *************************************************************************/
@@ -48,6 +104,12 @@ int LZ_CompressFast( unsigned char *in, unsigned char *out,
 void LZ_Uncompress( unsigned char *in, unsigned char *out,
                     unsigned int insize );
 
+unsigned char LZ_ChooseMarker( const unsigned char *in, unsigned int insize );
+void LZ_StreamInit( lz_stream_t *stream, unsigned char marker, int level );
+int LZ_StreamCompress( lz_stream_t *stream, int flush );
+int LZ_CompressHC( unsigned char *in, unsigned char *out,
+                   unsigned int insize, int level, lz_stream_t *work );
+
 
 #ifdef __cplusplus
 }
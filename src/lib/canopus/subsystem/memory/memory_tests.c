@@ -0,0 +1,624 @@
+#include <cmockery.h>
+#include <canopus/types.h>
+#include <canopus/subsystem/subsystem.h>
+#include <canopus/drivers/nvram.h>
+#include <canopus/nvram.h>
+#include <canopus/md5.h>
+#include <canopus/frame.h>
+
+#include <FreeRTOS.h>
+#include <queue.h>
+
+#include <stddef.h>
+#include <string.h>
+
+#include "bulk.h"
+#include "comp_bcl/lz.h"
+
+extern const nvram_t nvram_default;
+
+/* A flash of our own for nvram stores: the image is rewritten whole, the
+ * journal only programmed (bits cleared) after an erase, as the real ones */
+#define NV_TEST_JOURNAL_SIZE	512
+#define NV_TEST_RECORD_HEADER	8	/* size:u16 offset:u16 sum:u16 commit:u16 */
+
+static struct {
+	uint8_t image[sizeof(nvram_t)];
+	uint8_t journal[NV_TEST_JOURNAL_SIZE];
+	int writes;
+	int appends;
+	int tear;			/* bytes programmed before the power goes, -1 never */
+} nv_flash;
+
+static retval_t nv_test_read(void *addr, size_t size) {
+	if (size > sizeof(nv_flash.image)) size = sizeof(nv_flash.image);
+	memcpy(addr, nv_flash.image, size);
+	return RV_SUCCESS;
+}
+
+static retval_t nv_test_write(const void *addr, size_t size) {
+	if (size > sizeof(nv_flash.image)) return RV_ILLEGAL;
+	if (0 == nv_flash.tear) return RV_SUCCESS;
+	memcpy(nv_flash.image, addr, size);
+	nv_flash.writes++;
+	return RV_SUCCESS;
+}
+
+static size_t nv_test_journal_size(void) {
+	return sizeof(nv_flash.journal);
+}
+
+static retval_t nv_test_journal_read(uint32_t offset, void *addr, size_t size) {
+	if (offset + size > sizeof(nv_flash.journal)) return RV_ILLEGAL;
+	memcpy(addr, &nv_flash.journal[offset], size);
+	return RV_SUCCESS;
+}
+
+static retval_t nv_test_journal_append(uint32_t offset, const void *addr, size_t size) {
+	const uint8_t *data = addr;
+	size_t i;
+
+	if (offset + size > sizeof(nv_flash.journal)) return RV_ILLEGAL;
+	if (nv_flash.tear >= 0) {
+		if (size > nv_flash.tear) size = nv_flash.tear;
+		nv_flash.tear -= size;
+	}
+	for (i = 0; i < size; i++) {
+		nv_flash.journal[offset + i] &= data[i];
+	}
+	nv_flash.appends++;
+	return RV_SUCCESS;
+}
+
+static retval_t nv_test_journal_erase(void) {
+	if (0 == nv_flash.tear) return RV_SUCCESS;
+	memset(nv_flash.journal, 0xff, sizeof(nv_flash.journal));
+	return RV_SUCCESS;
+}
+
+static const nvram_storage_t nv_test_storage = {
+	.read           = &nv_test_read,
+	.write          = &nv_test_write,
+	.journal_size   = &nv_test_journal_size,
+	.journal_read   = &nv_test_journal_read,
+	.journal_append = &nv_test_journal_append,
+	.journal_erase  = &nv_test_journal_erase,
+};
+
+static nvram_t nv_test_ram, nv_test_scratch;
+static nvram_store_t nv_test_store;
+
+static void nv_test_erase_flash(void) {
+	memset(&nv_flash, 0xff, sizeof(nv_flash));
+	nv_flash.writes = 0;
+	nv_flash.appends = 0;
+	nv_flash.tear = -1;
+}
+
+/* Power on: nothing in RAM, the store loads from the flash */
+static void nv_test_boot(void) {
+	xSemaphoreHandle lock = nv_test_store.lock;
+
+	memset(&nv_test_store, 0, sizeof(nv_test_store));
+	nv_test_store.storage = &nv_test_storage;
+	nv_test_store.ram = &nv_test_ram;
+	nv_test_store.scratch = &nv_test_scratch;
+	nv_test_store.lock = lock;
+
+	memset(&nv_test_ram, 0, sizeof(nv_test_ram));
+	nv_flash.tear = -1;
+	nvram_store_reload(&nv_test_store);
+	assert_int_equal(NVRAM_VERSION_CURRENT, nv_test_ram.hdr.version);
+}
+
+#define NV_TEST_SAVE(_field) \
+	nvram_store_flush_partial(&nv_test_store, offsetof(nvram_t, _field), sizeof(nv_test_ram._field))
+
+static void test_nvram_journal_replay(void **s) {
+	uint16_t count;
+	int i;
+
+	nv_test_erase_flash();
+	nv_test_boot();
+	assert_memory_equal(&nvram_default.cdh, &nv_test_ram.cdh, sizeof(nv_test_ram.cdh));
+	assert_int_equal(RV_SUCCESS, nvram_store_flush(&nv_test_store));
+	assert_int_equal(1, nv_flash.writes);
+
+	/* small saves go to the journal, what's not saved is lost */
+	for (i = 1; i <= 5; i++) {
+		nv_test_ram.platform.reset_count = i;
+		assert_int_equal(RV_SUCCESS, NV_TEST_SAVE(platform.reset_count));
+	}
+	nv_test_ram.cdh.command_response_delay_ms++;
+	assert_int_equal(1, nv_flash.writes);
+
+	nv_test_boot();
+	assert_int_equal(5, nv_test_ram.platform.reset_count);
+	assert_int_equal(nvram_default.cdh.command_response_delay_ms, nv_test_ram.cdh.command_response_delay_ms);
+
+	/* on after the reboot, until it's full and compacted */
+	count = nv_test_ram.platform.reset_count;
+	while (1 == nv_flash.writes) {
+		assert_true(count < 1000);
+		nv_test_ram.platform.reset_count = ++count;
+		assert_int_equal(RV_SUCCESS, NV_TEST_SAVE(platform.reset_count));
+	}
+	assert_int_equal(2, nv_flash.writes);
+	/* at least half of it used by records */
+	assert_true((count - 1) * 2 * (NV_TEST_RECORD_HEADER + sizeof(count)) >= NV_TEST_JOURNAL_SIZE);
+
+	nv_test_ram.cdh.command_response_delay_ms++;
+	nv_test_ram.platform.reset_count = ++count;
+	assert_int_equal(RV_SUCCESS, NV_TEST_SAVE(platform.reset_count));
+	nv_test_boot();
+	assert_int_equal(count, nv_test_ram.platform.reset_count);
+	assert_int_equal(nvram_default.cdh.command_response_delay_ms, nv_test_ram.cdh.command_response_delay_ms);
+}
+
+/* The power goes in the middle of an append, at every point of the record
+ * and before its commit: the save is lost, the ones before it aren't, and
+ * the next one compacts */
+static void test_nvram_journal_torn_write(void **s) {
+	static const int tears[] = {
+		0, 2, NV_TEST_RECORD_HEADER - 1, NV_TEST_RECORD_HEADER, NV_TEST_RECORD_HEADER + 1,
+		NV_TEST_RECORD_HEADER + sizeof(uint16_t),	/* all but the commit */
+	};
+	uint16_t count = 0;
+	int i, writes;
+
+	nv_test_erase_flash();
+	nv_test_boot();
+	assert_int_equal(RV_SUCCESS, nvram_store_flush(&nv_test_store));
+
+	for (i = 0; i < ARRAY_COUNT(tears); i++) {
+		nv_test_ram.platform.reset_count = ++count;
+		assert_int_equal(RV_SUCCESS, NV_TEST_SAVE(platform.reset_count));
+
+		nv_test_ram.platform.reset_count = count + 1;
+		nv_flash.tear = tears[i];
+		(void)NV_TEST_SAVE(platform.reset_count);
+
+		nv_test_boot();
+		assert_int_equal(count, nv_test_ram.platform.reset_count);
+
+		writes = nv_flash.writes;
+		nv_test_ram.platform.reset_count = ++count;
+		assert_int_equal(RV_SUCCESS, NV_TEST_SAVE(platform.reset_count));
+		if (tears[i] > 0) {
+			/* something was programmed, it can't be appended after */
+			assert_int_equal(writes + 1, nv_flash.writes);
+		}
+
+		nv_test_boot();
+		assert_int_equal(count, nv_test_ram.platform.reset_count);
+	}
+}
+
+/* Fletcher-16, independent from nvram.c */
+static uint16_t nv_test_fletcher16(const uint8_t *p, size_t size) {
+	uint32_t a = 0, b = 0;
+
+	while (size--) {
+		a = (a + *p++) % 255;
+		b = (b + a) % 255;
+	}
+	return (b << 8) | a;
+}
+
+#define NV_TEST_SECTION(_s) { offsetof(nvram_t, _s), sizeof(((nvram_t *)0)->_s) }
+
+static const struct {
+	size_t offset;
+	size_t size;
+} nv_test_sections[NVRAM_SECTION_COUNT] = {
+	NV_TEST_SECTION(bootloader),
+	NV_TEST_SECTION(platform),
+	NV_TEST_SECTION(cdh),
+	NV_TEST_SECTION(aocs),
+	NV_TEST_SECTION(mm),
+	NV_TEST_SECTION(power),
+	NV_TEST_SECTION(payload),
+	NV_TEST_SECTION(thermal),
+};
+
+static void test_nvram_section_sums(void **s) {
+	const nvram_t *image = (const nvram_t *)nv_flash.image;
+	int i;
+
+	nv_test_erase_flash();
+	nv_test_boot();
+	nv_test_ram.platform.reset_count = 7;
+	nv_test_ram.cdh.command_response_delay_ms = 321;
+	assert_int_equal(RV_SUCCESS, nvram_store_flush(&nv_test_store));
+
+	for (i = 0; i < NVRAM_SECTION_COUNT; i++) {
+		assert_int_equal(nv_test_fletcher16(&nv_flash.image[nv_test_sections[i].offset], nv_test_sections[i].size),
+				image->hdr.section_sum[i]);
+	}
+}
+
+static void nv_test_corrupt(size_t offset) {
+	nv_flash.image[offset] ^= 0x5a;
+}
+
+/* A bad section goes back to its defaults, the others are kept */
+static void test_nvram_section_recovery(void **s) {
+	int i, writes;
+
+	nv_test_erase_flash();
+	nv_test_boot();
+	nv_test_ram.platform.reset_count = 7;
+	nv_test_ram.cdh.command_response_delay_ms = 321;
+	assert_int_equal(RV_SUCCESS, nvram_store_flush(&nv_test_store));
+
+	/* one section */
+	nv_test_corrupt(offsetof(nvram_t, cdh) + 1);
+	nv_test_boot();
+	assert_memory_equal(&nvram_default.cdh, &nv_test_ram.cdh, sizeof(nv_test_ram.cdh));
+	assert_int_equal(7, nv_test_ram.platform.reset_count);
+
+	/* the journal of the bad image isn't appended to, the next save rewrites it */
+	writes = nv_flash.writes;
+	nv_test_ram.platform.reset_count = 8;
+	assert_int_equal(RV_SUCCESS, NV_TEST_SAVE(platform.reset_count));
+	assert_int_equal(writes + 1, nv_flash.writes);
+	nv_test_boot();
+	assert_int_equal(8, nv_test_ram.platform.reset_count);
+	assert_memory_equal(&nvram_default.cdh, &nv_test_ram.cdh, sizeof(nv_test_ram.cdh));
+
+	/* only the digest, nothing is lost */
+	nv_test_corrupt(0);
+	nv_test_boot();
+	assert_int_equal(8, nv_test_ram.platform.reset_count);
+
+	/* all of them, nothing worth keeping */
+	for (i = 0; i < NVRAM_SECTION_COUNT; i++) {
+		if (nv_test_sections[i].size) nv_test_corrupt(nv_test_sections[i].offset);
+	}
+	nv_test_boot();
+	assert_int_equal(nvram_default.platform.reset_count, nv_test_ram.platform.reset_count);
+}
+
+#define LZ_TEST_SIZE	(3 * LZ_STREAM_WINDOW + 123)
+
+static lz_stream_t lz_test_stream;
+static unsigned char lz_test_in[LZ_TEST_SIZE];
+static unsigned char lz_test_out[LZ_TEST_SIZE * 2];
+static unsigned char lz_test_pieces[LZ_TEST_SIZE * 2];
+static unsigned char lz_test_back[LZ_TEST_SIZE];
+
+static void test_lz_stream_roundtrip(void **s) {
+	lz_stream_t *lz = &lz_test_stream;
+	int outsize, i, rv;
+
+	/* repetitive with some noise, and a run longer than a match */
+	for (i=0; i<LZ_TEST_SIZE; i++) lz_test_in[i] = "canopus lz stream "[i % 18] ^ ((i * 7919) % 13 == 0);
+	memset(&lz_test_in[LZ_STREAM_WINDOW], 0, 2 * LZ_STREAM_MAX_MATCH);
+
+	outsize = LZ_CompressHC(lz_test_in, lz_test_out, LZ_TEST_SIZE, 0, lz);
+	assert_true(outsize > 0);
+	assert_true(outsize < LZ_TEST_SIZE / 2);
+	LZ_Uncompress(lz_test_out, lz_test_back, outsize);
+	assert_memory_equal(lz_test_in, lz_test_back, LZ_TEST_SIZE);
+
+	/* the same, 100 bytes in and 37 out at a time */
+	LZ_StreamInit(lz, LZ_ChooseMarker(lz_test_in, LZ_TEST_SIZE), 0);
+	lz->next_out = lz_test_pieces;
+	do {
+		if (0 == lz->avail_in) {
+			lz->next_in = &lz_test_in[lz->total_in];
+			lz->avail_in = LZ_TEST_SIZE - lz->total_in;
+			if (lz->avail_in > 100) lz->avail_in = 100;
+		}
+		lz->avail_out = 37;
+		rv = LZ_StreamCompress(lz, LZ_TEST_SIZE == lz->total_in + lz->avail_in);
+	} while (LZ_STREAM_END != rv);
+	assert_int_equal(LZ_TEST_SIZE, lz->total_in);
+	assert_int_equal(outsize, lz->total_out);
+	assert_memory_equal(lz_test_out, lz_test_pieces, outsize);
+}
+
+/* a match goes on past the lookahead, also when it comes in pieces */
+static void test_lz_stream_long_run(void **s) {
+	lz_stream_t *lz = &lz_test_stream;
+	int outsize, rv;
+
+	memset(lz_test_in, 0, LZ_TEST_SIZE);
+	memcpy(&lz_test_in[LZ_TEST_SIZE - 5], "lz!!!", 5);
+
+	outsize = LZ_CompressHC(lz_test_in, lz_test_out, LZ_TEST_SIZE, 0, lz);
+	assert_true((outsize > 0) && (outsize < 32));
+	memset(lz_test_back, 0xaa, LZ_TEST_SIZE);
+	LZ_Uncompress(lz_test_out, lz_test_back, outsize);
+	assert_memory_equal(lz_test_in, lz_test_back, LZ_TEST_SIZE);
+
+	LZ_StreamInit(lz, LZ_ChooseMarker(lz_test_in, LZ_TEST_SIZE), 0);
+	lz->next_out = lz_test_pieces;
+	do {
+		if (0 == lz->avail_in) {
+			lz->next_in = &lz_test_in[lz->total_in];
+			lz->avail_in = LZ_TEST_SIZE - lz->total_in;
+			if (lz->avail_in > 100) lz->avail_in = 100;
+		}
+		lz->avail_out = 3;
+		rv = LZ_StreamCompress(lz, LZ_TEST_SIZE == lz->total_in + lz->avail_in);
+	} while (LZ_STREAM_END != rv);
+	assert_int_equal(outsize, lz->total_out);
+	assert_memory_equal(lz_test_out, lz_test_pieces, outsize);
+}
+
+/* RFC 1321, appendix A.5 */
+static const struct {
+	const char *msg;
+	const unsigned char digest[16];
+} md5_vectors[] = {
+	{ "", { 0xd4,0x1d,0x8c,0xd9,0x8f,0x00,0xb2,0x04,0xe9,0x80,0x09,0x98,0xec,0xf8,0x42,0x7e } },
+	{ "a", { 0x0c,0xc1,0x75,0xb9,0xc0,0xf1,0xb6,0xa8,0x31,0xc3,0x99,0xe2,0x69,0x77,0x26,0x61 } },
+	{ "abc", { 0x90,0x01,0x50,0x98,0x3c,0xd2,0x4f,0xb0,0xd6,0x96,0x3f,0x7d,0x28,0xe1,0x7f,0x72 } },
+	{ "message digest", { 0xf9,0x6b,0x69,0x7d,0x7c,0xb7,0x93,0x8d,0x52,0x5a,0x2f,0x31,0xaa,0xf1,0x61,0xd0 } },
+	{ "abcdefghijklmnopqrstuvwxyz", { 0xc3,0xfc,0xd3,0xd7,0x61,0x92,0xe4,0x00,0x7d,0xfb,0x49,0x6c,0xca,0x67,0xe1,0x3b } },
+	{ "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+		{ 0xd1,0x74,0xab,0x98,0xd2,0x77,0xd9,0xf5,0xa5,0x61,0x1c,0x2c,0x9f,0x41,0x9d,0x9f } },
+	{ "12345678901234567890123456789012345678901234567890123456789012345678901234567890",
+		{ 0x57,0xed,0xf4,0xa2,0x2b,0xe3,0xc9,0x55,0xac,0x49,0xda,0x2e,0x21,0x07,0xb6,0x7a } },
+};
+
+static void test_md5_rfc1321(void **s) {
+	unsigned char unaligned[96];
+	MD5_CTX ctx;
+	size_t i, j, len;
+
+	for (i=0; i<ARRAY_COUNT(md5_vectors); i++) {
+		len = strlen(md5_vectors[i].msg);
+
+		MD5Init(&ctx);
+		MD5Update(&ctx, (const unsigned char *)md5_vectors[i].msg, len);
+		MD5Final(&ctx);
+		assert_memory_equal(md5_vectors[i].digest, ctx.digest, 16);
+
+		/* a byte at a time, through the context buffer */
+		MD5Init(&ctx);
+		for (j=0; j<len; j++) MD5Update(&ctx, (const unsigned char *)&md5_vectors[i].msg[j], 1);
+		MD5Final(&ctx);
+		assert_memory_equal(md5_vectors[i].digest, ctx.digest, 16);
+
+		/* whole blocks from an odd address */
+		memcpy(&unaligned[1], md5_vectors[i].msg, len);
+		MD5Init(&ctx);
+		MD5Update(&ctx, &unaligned[1], len);
+		MD5Final(&ctx);
+		assert_memory_equal(md5_vectors[i].digest, ctx.digest, 16);
+	}
+}
+
+/* Bulk downloads to a ground of our own: the packets land in a queue, the
+ * tests take them out and acknowledge like the ground would */
+#define BULK_TEST_CHUNKS	10
+#define BULK_TEST_SEQNUM	0x123456
+
+static uint8_t bulk_test_area[BULK_TEST_CHUNKS * MM_BULK_CHUNK_SIZE - 17];	/* the last chunk short */
+static uint8_t bulk_test_got[sizeof(bulk_test_area)];
+static uint8_t bulk_test_md5[MD5_DIGEST_SIZE];
+static xQueueHandle bulk_test_packets;
+static uint8_t bulk_test_id;
+
+static retval_t bulk_test_send(frame_t *packet) {
+	if (pdTRUE != xQueueSend(bulk_test_packets, &packet, 0)) frame_dispose(packet);
+	return RV_SUCCESS;
+}
+
+/* The chunk of the next packet in timeout_ms, -1 if none. What's in it is
+ * kept in bulk_test_got, or bulk_test_md5 for the trailer */
+static int bulk_test_receive(uint8_t id, int timeout_ms) {
+	frame_t *packet;
+	uint32_t unit;
+	size_t count;
+
+	if (pdTRUE != xQueueReceive(bulk_test_packets, &packet, timeout_ms / portTICK_RATE_MS)) return -1;
+
+	assert_int_equal(BULK_TEST_SEQNUM, frame_get_u24_nocheck(packet));
+	assert_int_equal(id, frame_get_u8_nocheck(packet));
+	unit = frame_get_u32_nocheck(packet);
+	count = _frame_available_data(packet);
+	if (BULK_TEST_CHUNKS == unit) {
+		assert_int_equal(sizeof(bulk_test_md5), count);
+		memcpy(bulk_test_md5, frame_get_data_pointer_nocheck(packet, count), count);
+	} else {
+		assert_true(unit < BULK_TEST_CHUNKS);
+		assert_int_equal((BULK_TEST_CHUNKS - 1 == unit) ? sizeof(bulk_test_area) - unit * MM_BULK_CHUNK_SIZE : MM_BULK_CHUNK_SIZE, count);
+		memcpy(&bulk_test_got[unit * MM_BULK_CHUNK_SIZE], frame_get_data_pointer_nocheck(packet, count), count);
+	}
+	frame_dispose(packet);
+	return unit;
+}
+
+static retval_t bulk_test_abort(uint8_t id) {
+	uint8_t buf[1];
+	frame_t in = DECLARE_FRAME(buf);
+
+	frame_put_u8(&in, id);
+	frame_reset_for_reading(&in);
+	return cmd_mem_bulk_abort(NULL, &in, NULL);
+}
+
+static uint8_t bulk_test_start(uint8_t window) {
+	uint8_t in_buf[9], out_buf[7];
+	frame_t in = DECLARE_FRAME(in_buf);
+	frame_t out = DECLARE_FRAME(out_buf);
+	frame_t *packet;
+	uint8_t id;
+	size_t i;
+
+	if (NULL == bulk_test_packets) bulk_test_packets = xQueueCreate(16, sizeof(frame_t *));
+	assert_true(NULL != bulk_test_packets);
+	mm_bulk_set_send(bulk_test_send);
+	/* whatever a failed test left behind */
+	if (0 != bulk_test_id) (void)bulk_test_abort(bulk_test_id);
+	while (pdTRUE == xQueueReceive(bulk_test_packets, &packet, 0)) frame_dispose(packet);
+
+	for (i = 0; i < sizeof(bulk_test_area); i++) bulk_test_area[i] = i * 7 + (i >> 8);
+	memset(bulk_test_got, 0, sizeof(bulk_test_got));
+	memset(bulk_test_md5, 0, sizeof(bulk_test_md5));
+
+	frame_put_u32(&in, (uint32_t)(uintptr_t)bulk_test_area);
+	frame_put_u32(&in, sizeof(bulk_test_area));
+	frame_put_u8(&in, window);
+	frame_reset_for_reading(&in);
+	assert_int_equal(RV_SUCCESS, cmd_mem_bulk_read(NULL, &in, &out, BULK_TEST_SEQNUM));
+
+	frame_reset_for_reading(&out);
+	id = bulk_test_id = frame_get_u8_nocheck(&out);
+	assert_int_equal(BULK_TEST_CHUNKS, frame_get_u32_nocheck(&out));
+	assert_int_equal(MM_BULK_CHUNK_SIZE, frame_get_u16_nocheck(&out));
+	return id;
+}
+
+static retval_t bulk_test_ack(uint8_t id, uint32_t base, uint32_t missing) {
+	uint8_t buf[9];
+	frame_t in = DECLARE_FRAME(buf);
+
+	frame_put_u8(&in, id);
+	frame_put_u32(&in, base);
+	frame_put_u32(&in, missing);
+	frame_reset_for_reading(&in);
+	return cmd_mem_bulk_ack(NULL, &in, NULL);
+}
+
+static uint32_t bulk_test_resume(uint8_t id, uint32_t from) {
+	uint8_t in_buf[5], out_buf[5];
+	frame_t in = DECLARE_FRAME(in_buf);
+	frame_t out = DECLARE_FRAME(out_buf);
+
+	frame_put_u8(&in, id);
+	frame_put_u32(&in, from);
+	frame_reset_for_reading(&in);
+	assert_int_equal(RV_SUCCESS, cmd_mem_bulk_resume(NULL, &in, &out));
+	frame_reset_for_reading(&out);
+	assert_int_equal(id, frame_get_u8_nocheck(&out));
+	return frame_get_u32_nocheck(&out);
+}
+
+/* Everything acknowledged: it all arrived and the session is gone */
+static void bulk_test_done(uint8_t id) {
+	MD5_CTX md5;
+
+	assert_int_equal(RV_SUCCESS, bulk_test_ack(id, BULK_TEST_CHUNKS + 1, 0));
+	assert_int_equal(-1, bulk_test_receive(id, 100));
+	mm_bulk_set_send(NULL);
+
+	assert_int_equal(RV_NOENT, bulk_test_abort(id));
+
+	assert_memory_equal(bulk_test_area, bulk_test_got, sizeof(bulk_test_area));
+	MD5Init(&md5);
+	MD5Update(&md5, bulk_test_area, sizeof(bulk_test_area));
+	MD5Final(&md5);
+	assert_memory_equal(md5.digest, bulk_test_md5, sizeof(bulk_test_md5));
+}
+
+static void test_bulk_window(void **s) {
+	uint8_t id;
+	int i;
+
+	id = bulk_test_start(4);
+	for (i = 0; i < 4; i++) assert_int_equal(i, bulk_test_receive(id, 1000));
+	assert_int_equal(-1, bulk_test_receive(id, 100));
+
+	/* the window moves with the acks */
+	assert_int_equal(RV_SUCCESS, bulk_test_ack(id, 2, 0));
+	for (i = 4; i < 6; i++) assert_int_equal(i, bulk_test_receive(id, 1000));
+	assert_int_equal(-1, bulk_test_receive(id, 100));
+
+	assert_int_equal(RV_SUCCESS, bulk_test_ack(id, 6, 0));
+	for (i = 6; i < 10; i++) assert_int_equal(i, bulk_test_receive(id, 1000));
+	assert_int_equal(-1, bulk_test_receive(id, 100));
+
+	/* the trailer too */
+	assert_int_equal(RV_SUCCESS, bulk_test_ack(id, 7, 0));
+	assert_int_equal(BULK_TEST_CHUNKS, bulk_test_receive(id, 1000));
+
+	bulk_test_done(id);
+}
+
+/* Lost chunks asked for again, and an ack overtaken by a later one */
+static void test_bulk_retransmit(void **s) {
+	uint8_t id;
+	int i;
+
+	id = bulk_test_start(8);
+	for (i = 0; i < 8; i++) assert_int_equal(i, bulk_test_receive(id, 1000));
+
+	/* 3 and 5 didn't make it: those first, then the window goes on */
+	assert_int_equal(RV_SUCCESS, bulk_test_ack(id, 3, (1 << 0) | (1 << 2)));
+	assert_int_equal(3, bulk_test_receive(id, 1000));
+	assert_int_equal(5, bulk_test_receive(id, 1000));
+	for (i = 8; i <= BULK_TEST_CHUNKS; i++) assert_int_equal(i, bulk_test_receive(id, 1000));
+
+	/* 9 didn't either, and an older ack asking for 5 comes in late */
+	assert_int_equal(RV_SUCCESS, bulk_test_ack(id, 8, 1 << 1));
+	assert_int_equal(9, bulk_test_receive(id, 1000));
+	assert_int_equal(RV_SUCCESS, bulk_test_ack(id, 3, 1 << 2));
+	assert_int_equal(-1, bulk_test_receive(id, 100));
+
+	bulk_test_done(id);
+}
+
+/* The acks are lost: the window comes again after MM_BULK_ACK_TIMEOUT_ms */
+static void test_bulk_ack_timeout(void **s) {
+	uint8_t id;
+	int i;
+
+	id = bulk_test_start(4);
+	for (i = 0; i < 4; i++) assert_int_equal(i, bulk_test_receive(id, 1000));
+	assert_int_equal(-1, bulk_test_receive(id, MM_BULK_ACK_TIMEOUT_ms / 2));
+	for (i = 0; i < 4; i++) assert_int_equal(i, bulk_test_receive(id, MM_BULK_ACK_TIMEOUT_ms));
+
+	assert_int_equal(RV_SUCCESS, bulk_test_ack(id, 4, 0));
+	for (i = 4; i < 8; i++) assert_int_equal(i, bulk_test_receive(id, 1000));
+	assert_int_equal(RV_SUCCESS, bulk_test_ack(id, 8, 0));
+	for (i = 8; i <= BULK_TEST_CHUNKS; i++) assert_int_equal(i, bulk_test_receive(id, 1000));
+
+	bulk_test_done(id);
+}
+
+/* The ground lost what it had after chunk 2 and picks it up from there */
+static void test_bulk_resume(void **s) {
+	uint8_t id;
+	int i;
+
+	id = bulk_test_start(4);
+	for (i = 0; i < 4; i++) assert_int_equal(i, bulk_test_receive(id, 1000));
+	assert_int_equal(RV_SUCCESS, bulk_test_ack(id, 2, 0));
+	for (i = 4; i < 6; i++) assert_int_equal(i, bulk_test_receive(id, 1000));
+
+	memset(&bulk_test_got[2 * MM_BULK_CHUNK_SIZE], 0, sizeof(bulk_test_got) - 2 * MM_BULK_CHUNK_SIZE);
+	assert_int_equal(BULK_TEST_CHUNKS, bulk_test_resume(id, 2));
+	for (i = 2; i < 6; i++) assert_int_equal(i, bulk_test_receive(id, 1000));
+	assert_int_equal(-1, bulk_test_receive(id, 100));
+
+	/* past what was sent: from what was */
+	assert_int_equal(BULK_TEST_CHUNKS, bulk_test_resume(id, 50));
+	for (i = 6; i < 10; i++) assert_int_equal(i, bulk_test_receive(id, 1000));
+	assert_int_equal(RV_SUCCESS, bulk_test_ack(id, 10, 0));
+	assert_int_equal(BULK_TEST_CHUNKS, bulk_test_receive(id, 1000));
+
+	bulk_test_done(id);
+}
+
+static const UnitTest tests[] = {
+    unit_test(test_nvram_journal_replay),
+    unit_test(test_nvram_journal_torn_write),
+    unit_test(test_nvram_section_sums),
+    unit_test(test_nvram_section_recovery),
+    unit_test(test_lz_stream_roundtrip),
+    unit_test(test_lz_stream_long_run),
+    unit_test(test_md5_rfc1321),
+    unit_test(test_bulk_window),
+    unit_test(test_bulk_retransmit),
+    unit_test(test_bulk_ack_timeout),
+    unit_test(test_bulk_resume),
+};
+
+const ss_tests_t memory_tests = {
+		.tests = tests,
+		.count = ARRAY_COUNT(tests)
+};
@@ -1,15 +1,117 @@
 // TODO rename nvram_common_driver.c ?
+#include <canopus/assert.h>
 #include <canopus/drivers/nvram.h>
 #include <canopus/nvram.h>
 
+#include <stddef.h>
 #include <string.h>
 
+#include <task.h>
+
 nvram_t nvram; /* global */
 
 extern const nvram_t nvram_default;
 
-static uint16_t flash_access_count = 0; /* valid since last reboot */
-static bool flushing_disabled = false;
+/* Journal.
+ *
+ * Small saves don't rewrite the whole image, they're appended as delta
+ * records to the journal area (see nvram_journal_size()):
+ *
+ *   header:  magic:u32 reserved:u32 digest:u8[16]
+ *   record:  size:u16 offset:u16 sum:u16 commit:u16 data[size]
+ *
+ * padded to NVRAM_JOURNAL_ALIGN, up to the first erased record. commit is
+ * programmed on its own once the rest is in: the sum alone can't tell a
+ * 0x00 from an erased 0xff, so a cut write could pass for a good one. The
+ * header names the image the records apply to by its digest, so a journal
+ * left behind by a crash right after the image was rewritten is ignored.
+ * Loading replays the records in order; the first one with a wrong sum
+ * or no commit (a write cut short) ends the replay, and the next save compacts. When
+ * it's full, or for anything bigger than
+ * NVRAM_JOURNAL_MAX_DELTA, the image is rewritten with everything in it
+ * and the journal erased: a compaction.
+ */
+#define NVRAM_JOURNAL_MAGIC     0x4e564a31  /* "NVJ1" */
+#define NVRAM_JOURNAL_ALIGN     8
+#define NVRAM_JOURNAL_MAX_DELTA 64
+#define NVRAM_JOURNAL_END       0xffff      /* erased */
+#define NVRAM_JOURNAL_COMMIT    0x0000
+
+typedef struct nv_journal_header_t {
+    uint32_t magic;
+    uint32_t reserved;
+    unsigned char digest[MD5_DIGEST_SIZE];
+} nv_journal_header_t;
+
+typedef struct nv_journal_record_t {
+    uint16_t size;
+    uint16_t offset;
+    uint16_t sum;
+    uint16_t commit;
+} nv_journal_record_t;
+
+/* Sections of nvram_t, each with its own sum in the header. One that's
+ * gone bad can be reset to its defaults without touching the rest */
+#define NV_SECTION(_s) { offsetof(nvram_t, _s), sizeof(((nvram_t *)0)->_s), #_s }
+
+static const struct {
+    uint16_t offset;
+    uint16_t size;
+    const char *name;
+} nv_sections[NVRAM_SECTION_COUNT] = {
+    NV_SECTION(bootloader),
+    NV_SECTION(platform),
+    NV_SECTION(cdh),
+    NV_SECTION(aocs),
+    NV_SECTION(mm),
+    NV_SECTION(power),
+    NV_SECTION(payload),
+    NV_SECTION(thermal),
+};
+
+static const nvram_storage_t nv_board_storage = {
+    .read           = &nvram_read_blocking,
+    .write          = &nvram_write_blocking,
+    .journal_size   = &nvram_journal_size,
+    .journal_read   = &nvram_journal_read,
+    .journal_append = &nvram_journal_append,
+    .journal_erase  = &nvram_journal_erase,
+};
+
+static nvram_t nv_scratch;
+
+static nvram_store_t nv_store = {
+    .storage = &nv_board_storage,
+    .ram     = &nvram,
+    .scratch = &nv_scratch,
+};
+
+/* Only once the scheduler runs, the boot is alone before */
+static void
+nv_lock(nvram_store_t *store)
+{
+    if (taskSCHEDULER_RUNNING != xTaskGetSchedulerState()) {
+        return;
+    }
+    if (NULL == store->lock) {
+        vTaskSuspendAll();
+        if (NULL == store->lock) {
+            store->lock = xSemaphoreCreateRecursiveMutex();
+        }
+        (void)xTaskResumeAll();
+    }
+    assert(NULL != store->lock);
+    (void)xSemaphoreTakeRecursive(store->lock, portMAX_DELAY);
+}
+
+static void
+nv_unlock(nvram_store_t *store)
+{
+    if ((taskSCHEDULER_RUNNING != xTaskGetSchedulerState()) || (NULL == store->lock)) {
+        return;
+    }
+    (void)xSemaphoreGiveRecursive(store->lock);
+}
 
 static void
 nv_copy(nvram_t *dst, const nvram_t *src)
@@ -17,15 +119,50 @@ nv_copy(nvram_t *dst, const nvram_t *src)
     memcpy(dst, src, sizeof(nvram_t));
 }
 
+/* Fletcher-16, going on from `sum` (0 to start) */
+static uint16_t
+nv_fletcher16(uint16_t sum, const void *data, size_t size)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    uint16_t a = sum & 0xff, b = sum >> 8;
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        a = (a + p[i]) % 255;
+        b = (b + a) % 255;
+    }
+    return (b << 8) | a;
+}
+
+static uint16_t
+nv_section_sum(const nvram_t *nv, int section)
+{
+    return nv_fletcher16(0, (const uint8_t *)nv + nv_sections[section].offset, nv_sections[section].size);
+}
+
+/* MD5 of the image as if hdr.digest were zeroed, without a copy of it */
+static void
+nv_digest(const nvram_t *nv, MD5_CTX *ctx)
+{
+    static const unsigned char zeros[MD5_DIGEST_SIZE];
+
+    MD5Init(ctx);
+    MD5Update(ctx, (unsigned char *)zeros, sizeof(zeros));
+    MD5Update(ctx, (unsigned char *)nv + sizeof(zeros), sizeof(nvram_t) - sizeof(zeros));
+    MD5Final(ctx);
+}
+
 static void
 nv_update_digest(nvram_t *nv)
 {
     MD5_CTX ctx;
+    int i;
 
-    memset(nv->hdr.digest, 0, sizeof(nv->hdr.digest));
-    MD5Init(&ctx);
-    MD5Update(&ctx, (unsigned char *)nv, sizeof(nvram_t));
-    MD5Final(&ctx);
+    for (i = 0; i < NVRAM_SECTION_COUNT; i++) {
+        nv->hdr.section_sum[i] = nv_section_sum(nv, i);
+    }
+
+    nv_digest(nv, &ctx);
     //LOG_REPORT_MD5(LOG_NVRAM, "nv_update_digest: ", &ctx);
 
     memcpy(nv->hdr.digest, ctx.digest, sizeof(ctx.digest));
@@ -40,15 +177,9 @@ nv_is_version_valid(const nvram_t *nv)
 static bool
 nv_is_digest_valid(const nvram_t *nv)
 {
-    nvram_t copy;
     MD5_CTX ctx;
 
-    nv_copy(&copy, nv);
-
-    memset(copy.hdr.digest, 0, sizeof(copy.hdr.digest));
-    MD5Init(&ctx);
-    MD5Update(&ctx, (unsigned char *)&copy, sizeof(nvram_t));
-    MD5Final(&ctx);
+    nv_digest(nv, &ctx);
     //LOG_REPORT_MD5(LOG_NVRAM, "nv_is_digest_valid: ", &ctx);
 
     return !memcmp(ctx.digest, nv->hdr.digest, sizeof(ctx.digest));
@@ -73,30 +204,251 @@ nv_is_valid(const nvram_t *nv, const char *desc)
     return true;
 }
 
+/* The digest is wrong: resets the sections whose sum is wrong to their
+ * defaults. False if none was right, nothing worth keeping */
+static bool
+nv_repair_sections(nvram_t *nv, const char *desc)
+{
+    int i, bad = 0;
+
+    for (i = 0; i < NVRAM_SECTION_COUNT; i++) {
+        if (nv_section_sum(nv, i) != nv->hdr.section_sum[i]) {
+            bad++;
+        }
+    }
+    if (NVRAM_SECTION_COUNT == bad) {
+        return false;
+    }
+
+    for (i = 0; i < NVRAM_SECTION_COUNT; i++) {
+        if (nv_section_sum(nv, i) != nv->hdr.section_sum[i]) {
+            NVRAM_REPORT("nvram: [%s] section %s corrupted, reset to default\n", desc, nv_sections[i].name);
+            memcpy((uint8_t *)nv + nv_sections[i].offset,
+                    (const uint8_t *)&nvram_default + nv_sections[i].offset, nv_sections[i].size);
+        }
+    }
+
+    return true;
+}
+
+#define NV_JOURNAL_ALIGN_UP(x) (((x) + NVRAM_JOURNAL_ALIGN - 1) & ~(NVRAM_JOURNAL_ALIGN - 1))
+
+/* Fletcher-16 of the record header and its data */
+static uint16_t
+nv_journal_sum(const nv_journal_record_t *rec, const uint8_t *data)
+{
+    uint16_t words[2] = { rec->size, rec->offset };
+
+    return nv_fletcher16(nv_fletcher16(0, words, sizeof(words)), data, rec->size);
+}
+
+/* Replays the journal of the image whose digest is `digest` on `nv` (NULL
+ * just to find the head), returns how many records. Leaves journal.head
+ * at 0 if it's not the journal of that image, and at the end of the area
+ * if it's damaged: the records before the damage must be compacted into
+ * the image before the journal is erased. */
+static int
+nv_journal_scan(nvram_store_t *store, nvram_t *nv, const unsigned char *digest)
+{
+    nv_journal_header_t header;
+    nv_journal_record_t rec;
+    uint8_t data[NVRAM_JOURNAL_MAX_DELTA];
+    uint32_t pos, size;
+    int count = 0;
+
+    store->journal.open = false;
+    store->journal.head = 0;
+    memcpy(store->journal.digest, digest, sizeof(store->journal.digest));
+
+    size = store->storage->journal_size();
+    if (0 == size) {
+        return 0;
+    }
+    store->journal.open = true;
+
+    if ((RV_SUCCESS != store->storage->journal_read(0, &header, sizeof(header)))
+            || (NVRAM_JOURNAL_MAGIC != header.magic)
+            || memcmp(header.digest, digest, sizeof(header.digest))) {
+        return 0;
+    }
+
+    pos = NV_JOURNAL_ALIGN_UP(sizeof(header));
+    while (pos + sizeof(rec) <= size) {
+        if (RV_SUCCESS != store->storage->journal_read(pos, &rec, sizeof(rec))) {
+            store->journal.head = size;
+            return count;
+        }
+        if (NVRAM_JOURNAL_END == rec.size) {
+            break;
+        }
+        if ((rec.size > NVRAM_JOURNAL_MAX_DELTA)
+                || (rec.offset + rec.size > sizeof(nvram_t))
+                || (NVRAM_JOURNAL_COMMIT != rec.commit)
+                || (pos + sizeof(rec) + rec.size > size)
+                || (RV_SUCCESS != store->storage->journal_read(pos + sizeof(rec), data, rec.size))
+                || (nv_journal_sum(&rec, data) != rec.sum)) {
+            NVRAM_REPORT("nvram: journal damaged at %d, %d records replayed\n", (int)pos, count);
+            store->journal.head = size;
+            return count;
+        }
+        if (NULL != nv) {
+            memcpy((uint8_t *)nv + rec.offset, data, rec.size);
+        }
+        pos += NV_JOURNAL_ALIGN_UP(sizeof(rec) + rec.size);
+        count++;
+    }
+
+    NVRAM_REPORT("nvram: journal %d records, %d bytes used\n", count, (int)pos);
+    store->journal.head = pos;
+
+    return count;
+}
+
+/* Starts a new journal for the image in flash */
+static retval_t
+nv_journal_reset(nvram_store_t *store, const unsigned char *digest)
+{
+    nv_journal_header_t header;
+    retval_t rv;
+
+    store->journal.open = false;
+    if (0 == store->storage->journal_size()) {
+        return RV_NOTIMPLEMENTED;
+    }
+
+    rv = store->storage->journal_erase();
+    if (RV_SUCCESS != rv) {
+        return rv;
+    }
+
+    memset(&header, 0xff, sizeof(header));
+    header.magic = NVRAM_JOURNAL_MAGIC;
+    memcpy(header.digest, digest, sizeof(header.digest));
+    rv = store->storage->journal_append(0, &header, sizeof(header));
+    if (RV_SUCCESS != rv) {
+        return rv;
+    }
+
+    memcpy(store->journal.digest, digest, sizeof(store->journal.digest));
+    store->journal.head = NV_JOURNAL_ALIGN_UP(sizeof(header));
+    store->journal.open = true;
+
+    return RV_SUCCESS;
+}
+
+/* Finds out where the journal of the image in flash ends. The header names
+ * the image, that's all that's read of it */
+static retval_t
+nv_journal_open(nvram_store_t *store)
+{
+    nvram_header_t hdr;
+
+    if (store->journal.open) {
+        return RV_SUCCESS;
+    }
+    if (0 == store->storage->journal_size()) {
+        return RV_NOTIMPLEMENTED;
+    }
+
+    if ((RV_SUCCESS != store->storage->read((uint8_t *)&hdr, sizeof(hdr)))
+            || (NVRAM_VERSION_CURRENT != hdr.version)) {
+        return RV_ERROR;
+    }
+    (void)nv_journal_scan(store, NULL, hdr.digest);
+
+    return store->journal.open ? RV_SUCCESS : RV_ERROR;
+}
+
+/* RV_NOSPACE when it's time to compact */
+static retval_t
+nv_journal_append(nvram_store_t *store, uint16_t offset, uint16_t size)
+{
+    uint8_t buf[NV_JOURNAL_ALIGN_UP(sizeof(nv_journal_record_t) + NVRAM_JOURNAL_MAX_DELTA)];
+    const uint8_t *data = (const uint8_t *)store->ram + offset;
+    nv_journal_record_t rec;
+    uint32_t len;
+    retval_t rv;
+
+    if (size > NVRAM_JOURNAL_MAX_DELTA) {
+        return RV_NOSPACE;
+    }
+
+    rv = nv_journal_open(store);
+    if (RV_SUCCESS != rv) {
+        return rv;
+    }
+    if (0 == store->journal.head) {
+        rv = nv_journal_reset(store, store->journal.digest);
+        if (RV_SUCCESS != rv) {
+            return rv;
+        }
+    }
+
+    len = NV_JOURNAL_ALIGN_UP(sizeof(rec) + size);
+    if (store->journal.head + len > store->storage->journal_size()) {
+        return RV_NOSPACE;
+    }
+
+    rec.size = size;
+    rec.offset = offset;
+    rec.sum = nv_journal_sum(&rec, data);
+    rec.commit = NVRAM_JOURNAL_END;
+
+    memset(buf, 0xff, sizeof(buf));
+    memcpy(buf, &rec, sizeof(rec));
+    memcpy(buf + sizeof(rec), data, size);
+
+    rv = store->storage->journal_append(store->journal.head, buf, len);
+    if (RV_SUCCESS == rv) {
+        rec.commit = NVRAM_JOURNAL_COMMIT;
+        rv = store->storage->journal_append(store->journal.head + offsetof(nv_journal_record_t, commit),
+                &rec.commit, sizeof(rec.commit));
+    }
+    if (RV_SUCCESS != rv) {
+        store->journal.head = store->storage->journal_size(); /* don't trust what's there, compact */
+        return rv;
+    }
+    store->journal.head += len;
+
+    return RV_SUCCESS;
+}
+
 static void
-nv_fill_valid(nvram_t *nv, const char *desc)
+nv_fill_valid(nvram_store_t *store, nvram_t *nv, const char *desc)
 {
-    nvram_t nvbuf;
+    unsigned char digest[MD5_DIGEST_SIZE];
+    bool valid, repaired;
 
     #if 0
     // XXX do we want to restore nvram?
-    if (&nvram == nv) {
+    if (store->ram == nv) {
         return;
     }
     #endif
 
     /* check ram */
-    if (nv_is_valid(&nvram, "RAM")) {
+    if (nv_is_valid(store->ram, "RAM")) {
         NVRAM_REPORT("nvram_fill [%s]: ram correct!\n", desc);
-        nv_copy(nv, &nvram);
+        if (store->ram != nv) {
+            nv_copy(nv, store->ram);
+        }
         return;
     }
 
-    /* try restore from flash */
-    if (RV_SUCCESS == nvram_read_blocking((uint8_t *)&nvbuf, sizeof(nvbuf))) {
-        if (nv_is_valid(&nvbuf, "FLASH")) {
+    /* try restore from flash, straight into nv: it's to be overwritten anyway */
+    if (RV_SUCCESS == store->storage->read((uint8_t *)nv, sizeof(*nv))) {
+        valid = nv_is_valid(nv, "FLASH");
+        repaired = !valid && nv_is_version_valid(nv) && nv_repair_sections(nv, "FLASH");
+        if (valid || repaired) {
             NVRAM_REPORT("nvram_fill [%s]: nvram0/flash correct! restoring\n", desc);
-            nv_copy(nv, &nvbuf);
+            /* the journal goes with the digest the image was written with */
+            memcpy(digest, nv->hdr.digest, sizeof(digest));
+            if ((nv_journal_scan(store, nv, digest) > 0) || repaired) {
+                nv_update_digest(nv);
+            }
+            if (repaired && store->journal.open) {
+                store->journal.head = store->storage->journal_size(); /* next save rewrites the image */
+            }
             return;
         }
     }
@@ -125,17 +477,15 @@ nv_are_all_values_correct(const nvram_t *nv)
 }
 
 static retval_t
-nv_save_flash(const nvram_t *nv)
+nv_save_flash(nvram_store_t *store, const nvram_t *nv)
 {
-    return nvram_write_blocking((uint8_t *)nv, sizeof(*nv));
+    return store->storage->write((uint8_t *)nv, sizeof(*nv));
 }
 
 static retval_t
-nv_save(const nvram_t *nv, const char *desc)
+nv_can_save(nvram_store_t *store, const nvram_t *nv, const char *desc)
 {
-    nvram_t copy;
-
-    if (flushing_disabled) {
+    if (store->flushing_disabled) {
         NVRAM_REPORT("nvram_save [%s]: flushing disabled\n", desc);
         return RV_PERM;
     }
@@ -145,62 +495,116 @@ nv_save(const nvram_t *nv, const char *desc)
         return RV_ILLEGAL;
     }
 
-    NVRAM_REPORT("nvram_save [%s]: access_count=%d\n", desc, flash_access_count);
+    return RV_SUCCESS;
+}
+
+/* Writes nv as it is, header updated in place: no copy of it on the stack */
+static retval_t
+nv_save(nvram_store_t *store, nvram_t *nv, const char *desc)
+{
+    retval_t rv;
+
+    rv = nv_can_save(store, nv, desc);
+    if (RV_SUCCESS != rv) {
+        return rv;
+    }
+
+    NVRAM_REPORT("nvram_save [%s]: access_count=%d\n", desc, store->flash_access_count);
+
+    nv->hdr.flash_access_count = store->flash_access_count++;
 
-    nv_copy(&copy, nv);
-    copy.hdr.flash_access_count = flash_access_count++;
+    nv_update_digest(nv);
+
+    rv = nv_save_flash(store, nv);
+    if (RV_SUCCESS != rv) {
+        store->journal.open = false;
+        return rv;
+    }
 
-    nv_update_digest(&copy);
+    /* everything is in the image now */
+    (void)nv_journal_reset(store, nv->hdr.digest);
 
-    return nv_save_flash(&copy);
+    return RV_SUCCESS;
 }
 
-// FIXME scheduler critical lock?
 void
-nvram_reload()
+nvram_store_reload(nvram_store_t *store)
 {
-    NVRAM_REPORT("==nvram_reload\n");
-    nv_fill_valid(&nvram, "RAM");
+    nv_lock(store);
+    nv_fill_valid(store, store->ram, "RAM");
+    nv_unlock(store);
 }
 
-// FIXME scheduler critical lock?
 retval_t
-nvram_flush_partial(uint16_t offset, int16_t size)
+nvram_store_flush_partial(nvram_store_t *store, uint16_t offset, int16_t size)
 {
-    nvram_t copy;
+    retval_t rv;
 
-    NVRAM_REPORT("==nvram_flush_partial\n");
     if (offset + size > sizeof(nvram_t)) {
         return RV_ILLEGAL;
     }
 
-    /* fill with previous */
-    nv_fill_valid(&copy, "copy");
+    nv_lock(store);
+    rv = nv_can_save(store, store->ram, "journal");
+    if ((RV_SUCCESS == rv) && (RV_SUCCESS != nv_journal_append(store, offset, size))) {
+        /* compaction: fill with previous */
+        nv_fill_valid(store, store->scratch, "copy");
+
+        /* update with current */
+        memcpy((char *)store->scratch + offset, (const char *)store->ram + offset, size);
 
-    /* update with current */
-    memcpy((char *)&copy + offset, (const char *)&nvram + offset, size);
+        rv = nv_save(store, store->scratch, "copy");
+    }
+    nv_unlock(store);
+
+    return rv;
+}
 
-    return nv_save(&copy, "copy");
+retval_t
+nvram_store_flush(nvram_store_t *store)
+{
+    retval_t rv;
+
+    nv_lock(store);
+    rv = nv_save(store, store->ram, "RAM");
+    nv_unlock(store);
+
+    return rv;
+}
+
+void
+nvram_reload()
+{
+    NVRAM_REPORT("==nvram_reload\n");
+    nvram_store_reload(&nv_store);
+}
+
+retval_t
+nvram_flush_partial(uint16_t offset, int16_t size)
+{
+    NVRAM_REPORT("==nvram_flush_partial\n");
+    return nvram_store_flush_partial(&nv_store, offset, size);
 }
 
-// FIXME scheduler critical lock?
 void
 nvram_flush()
 {
     NVRAM_REPORT("==nvram_flush\n");
-    (void)nv_save(&nvram, "RAM");
+    (void)nvram_store_flush(&nv_store);
 }
 
 retval_t
 nvram_erase()
 {
+	nv_store.journal.open = false;
 	return nvram_erase_blocking();
 }
 
 retval_t
 nvram_format_and_disable_flushing(uint32_t format_key, bool disable_flushing)
 {
-	flushing_disabled = disable_flushing;
+	nv_store.flushing_disabled = disable_flushing;
+	nv_store.journal.open = false;
 
 	return nvram_format_blocking(format_key);
 }
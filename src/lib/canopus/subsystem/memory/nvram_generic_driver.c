@@ -8,10 +8,21 @@
 extern const char _nvram0_addr; /* linkscript provided */
 #define nvram0 ((const nvram_t *)&_nvram0_addr)
 
+/* the journal has nvram1 for itself */
+extern const char _nvram1_addr; /* linkscript provided */
+#define nvram1 ((const uint8_t *)&_nvram1_addr)
+
+#ifndef NVRAM_JOURNAL_SIZE
+#define NVRAM_JOURNAL_SIZE (8*1024)
+#endif
+
 retval_t
 nvram_read_blocking(void *addr, size_t size)
 {
-	memcpy(addr, nvram0, sizeof(nvram_t));
+	if (size > sizeof(nvram_t)) {
+		size = sizeof(nvram_t);
+	}
+	memcpy(addr, nvram0, size);
 
 	return RV_SUCCESS;
 }
@@ -32,6 +43,47 @@ nvram_write_blocking(const void *addr, size_t size)
     return RV_SUCCESS;
 }
 
+size_t
+nvram_journal_size()
+{
+    return NVRAM_JOURNAL_SIZE;
+}
+
+retval_t
+nvram_journal_read(uint32_t offset, void *addr, size_t size)
+{
+    if (offset + size > NVRAM_JOURNAL_SIZE) {
+        return RV_ILLEGAL;
+    }
+    memcpy(addr, nvram1 + offset, size);
+
+    return RV_SUCCESS;
+}
+
+retval_t
+nvram_journal_append(uint32_t offset, const void *addr, size_t size)
+{
+    if (offset + size > NVRAM_JOURNAL_SIZE) {
+        return RV_ILLEGAL;
+    }
+    if (FLASH_ERR_OK != flash_write(nvram1 + offset, addr, size)) {
+        return RV_ERROR;
+    }
+
+    return RV_SUCCESS;
+}
+
+retval_t
+nvram_journal_erase()
+{
+    NVRAM_REPORT("nvram: journal flash_erase\n");
+    if (FLASH_ERR_OK != flash_erase(nvram1, NVRAM_JOURNAL_SIZE)) {
+        return RV_ERROR;
+    }
+
+    return RV_SUCCESS;
+}
+
 retval_t
 nvram_erase_blocking()
 {
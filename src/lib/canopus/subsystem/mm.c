@@ -12,6 +12,7 @@
 
 #include "memory/string.h"
 #include "memory/compression.h"
+#include "memory/bulk.h"
 
 retval_t
 MEMORY_nvram_save(const void *start, size_t size)
@@ -60,6 +61,8 @@ MEMORY_uploadarea_size()
 {
     extern char upload_memory_area_start, upload_memory_area_stop;
 
+    /* none if the bounds are wrong */
+    if (&upload_memory_area_stop <= &upload_memory_area_start) return 0;
     return (ptrdiff_t)&upload_memory_area_stop - (ptrdiff_t)&upload_memory_area_start;
 }
 
@@ -98,6 +101,7 @@ static void MEMORY_main_task(void *pvParameters) {
 		} else {
 			// No mode change. Tick
 			PLATFORM_ss_is_alive(ss, HEARTBEAT_MAIN_TASK);
+			ss_telemetry_publish(ss);
 
 			switch (mode) {
 			case SM_OFF:
@@ -139,37 +143,23 @@ static retval_t cmd_mem_read(const subsystem_t *self, frame_t * iframe, frame_t
 	return RV_SUCCESS;
 }
 
+/* Same packets as always, streamed by the bulk task at the pace of the radio */
 static retval_t cmd_mem_read_long(const subsystem_t *self, frame_t * iframe, frame_t * oframe, uint32_t seqnum) {
 	void *src=0;
-	frame_t *cmd_frame;
 	uint32_t size;
-	retval_t rv;
 
 	if (RV_SUCCESS != frame_get_u32(iframe, (void*)&src)) return RV_NOSPACE;
 	if (RV_SUCCESS != frame_get_u32(iframe, &size)) return RV_NOSPACE;
 
-	if (RV_SUCCESS != frame_put_u32(oframe, (uintptr_t)src)) return RV_NOSPACE;
-	if (RV_SUCCESS != frame_put_data(oframe, src, MEM_READ_BLOCK_SIZE)) return RV_NOSPACE;
-
-	rv = RV_SUCCESS;
-	if (size > MEM_READ_BLOCK_SIZE) {
-		rv = CDH_command_new(&cmd_frame, seqnum, SS_MEMORY, SS_CMD_MM_MEMORY_READ_LONG);
-		if (RV_SUCCESS == rv) {
-			frame_put_u32(cmd_frame, (uint32_t)src+MEM_READ_BLOCK_SIZE);
-			frame_put_u32(cmd_frame, size - MEM_READ_BLOCK_SIZE);
-
-			vTaskDelay(nvram.mm.inter_bulk_cmd_delay_ms / portTICK_RATE_MS);
-			rv = CDH_command_enqueue(cmd_frame);
-		}
-	}
-	return rv;
+	return mm_bulk_read_long(seqnum, src, size);
 }
 
 static retval_t cmd_mem_read_chunked(const subsystem_t *self, frame_t * iframe, frame_t * oframe, uint32_t seqnum) {
 	uint8_t *src=0;
 	frame_t *cmd_frame;
 	uint32_t offset, chunk_count, chunk_size, chunk_period;
-	uint32_t i, chunk_number, chunk_offset, total_size;
+	uint32_t i, chunk_number, chunk_offset, total_size, run;
+	size_t space;
 	retval_t rv;
 
 	if (RV_SUCCESS != frame_get_u32(iframe, (void*)&src)) return RV_NOSPACE;
@@ -182,10 +172,19 @@ static retval_t cmd_mem_read_chunked(const subsystem_t *self, frame_t * iframe,
 
 	if (RV_SUCCESS != frame_put_u32(oframe, offset)) return RV_NOSPACE;
 
-	for (i=0; i < MEM_READ_BLOCK_SIZE && offset < total_size; i++, offset++) {
+	/* copy whole contiguous runs, one division per chunk instead of per byte */
+	for (i=0; i < MEM_READ_BLOCK_SIZE && offset < total_size; i += run, offset += run) {
 		chunk_number = offset / chunk_size;
 		chunk_offset = offset % chunk_size;
-		if (RV_SUCCESS != frame_put_u8(oframe, src[chunk_period*chunk_number + chunk_offset])) return RV_NOSPACE;
+		run = chunk_size - chunk_offset;
+		if (run > MEM_READ_BLOCK_SIZE - i) run = MEM_READ_BLOCK_SIZE - i;
+		if (run > total_size - offset) run = total_size - offset;
+		space = _frame_available_space(oframe);
+		if (space < run) {
+			frame_put_data(oframe, &src[chunk_period*chunk_number + chunk_offset], space);
+			return RV_NOSPACE;
+		}
+		frame_put_data(oframe, &src[chunk_period*chunk_number + chunk_offset], run);
 	}
 
 	rv = RV_SUCCESS;
@@ -373,26 +372,39 @@ static retval_t cmd_flash_sector_write_mem(const subsystem_t *self, frame_t * if
 }
 
 #ifdef CMD_FLASH_PATCH
+/* More address:u32,data:str8 can follow the first patch, all of them share
+ * the sector cache: patches to one sector cost one erase */
 static retval_t cmd_flash_patch(const subsystem_t *self, frame_t * iframe, frame_t * oframe) {
 	void *dst=0, *data;
 	uint8_t len, mode;
+	retval_t rv = RV_SUCCESS;
     bool is_flashpatch_bug_fixed = false;
 
 	if (RV_SUCCESS != frame_get_u32(iframe, (uint32_t*)&dst)) return RV_NOSPACE;
 	if (RV_SUCCESS != frame_get_u8(iframe, &mode)) return RV_NOSPACE;
-	if (RV_SUCCESS != frame_get_u8(iframe, &len)) return RV_NOSPACE;
-	if (RV_SUCCESS != frame_get_data_pointer(iframe, &data, len)) return RV_NOSPACE;
-
-	frame_advance(iframe, len);
 
     FUTURE_HOOK_1(flash_patch_bug_fixed, &is_flashpatch_bug_fixed);
     if (!is_flashpatch_bug_fixed) {
         return RV_NOTIMPLEMENTED;
     }
 
-    if (FLASH_ERR_OK != flash_patch_ex(dst, data, len, mode)) return RV_ERROR;
+	flash_cache_begin();
+	do {
+		if ((RV_SUCCESS != frame_get_u8(iframe, &len)) ||
+			(RV_SUCCESS != frame_get_data_pointer(iframe, &data, len))) {
+			rv = RV_NOSPACE;
+			break;
+		}
+		frame_advance(iframe, len);
 
-	return RV_SUCCESS;
+		if (FLASH_ERR_OK != flash_patch_ex(dst, data, len, mode)) {
+			rv = RV_ERROR;
+			break;
+		}
+	} while (RV_SUCCESS == frame_get_u32(iframe, (uint32_t*)&dst));
+	if ((FLASH_ERR_OK != flash_cache_end()) && (RV_SUCCESS == rv)) rv = RV_ERROR;
+
+	return rv;
 }
 #endif
 
@@ -487,7 +499,24 @@ static retval_t cmd_mem_info(const subsystem_t *self, frame_t * iframe, frame_t
 
     return rv;
 }
-const static ss_command_handler_t subsystem_commands[] = {
+static retval_t cmd_frame_pool_stats(const subsystem_t *self, frame_t * iframe, frame_t * oframe) {
+	frame_pool_stats_t stats;
+	size_t i;
+	retval_t rv;
+
+	rv = frame_put_u8(oframe, frame_pool_class_count());
+	for (i=0; i < frame_pool_class_count(); i++) {
+		frame_pool_get_stats(i, &stats);
+		frame_put_u16(oframe, stats.buffer_size);
+		frame_put_u16(oframe, stats.count);
+		frame_put_u16(oframe, stats.free);
+		frame_put_u16(oframe, stats.high_water);
+		rv = frame_put_u32(oframe, stats.failures);
+	}
+	return rv;
+}
+
+const static ss_command_t subsystem_commands[] = {
 	DECLARE_BASIC_COMMANDS("free:u32", ""),
     DECLARE_COMMAND(SS_CMD_MM_MEMORY_READ, cmd_mem_read, "read", "Reads 200 bytes from remote memory", "address:u32", "data:u8[200]"),
     DECLARE_COMMAND(SS_CMD_MM_MEMORY_READ_LONG, cmd_mem_read_long, "read", "Reads from memory <addr>, <n> bytes. The answers is broken down in many packets", "address:u32, size:u32", "address:u32,data:str"),
@@ -502,7 +531,7 @@ const static ss_command_handler_t subsystem_commands[] = {
     DECLARE_COMMAND(SS_CMD_MM_FLASH_WRITE, cmd_flash_write, "flashWrite", "Writes some bytes to flash, no erase is done (prefer flash_patch) <dst_addr> <len> <data>", "address:u32,data:str8", ""),
     DECLARE_COMMAND(SS_CMD_MM_FLASH_SECTOR_WRITE_FROM_MEMORY, cmd_flash_sector_write_mem, "flashWrite", "Writes some bytes to flash from memory if the md5 matches, erases sectors first. The MD5 is an array of 16 bytes #[123 1 5 3 ...]", "from:u32, to:u32, size:u32, md5:u8[16]", "rv:retval_t, md5:u8[16]"),
 #ifdef CMD_FLASH_PATCH
-    DECLARE_COMMAND(SS_CMD_MM_FLASH_PATCH, cmd_flash_patch, "flashPatch", "Writes some bytes to memory, saving content around in the same sector", "address:u32,mode:u8,data:str8", ""),
+    DECLARE_COMMAND(SS_CMD_MM_FLASH_PATCH, cmd_flash_patch, "flashPatch", "Writes some bytes to memory, saving content around in the same sector. More <address> <data> can follow, written with one erase per sector", "address:u32,mode:u8,data:str8", ""),
 #endif
     DECLARE_COMMAND(SS_CMD_MM_FLASH_WRITE_FROM_MEMORY, flash_write_direct, "flashWriteDirect", "Writes some bytes to flash, <dst_addr> <src_addr> <size>", "dst:u32,src:u32,size:u32", "flash_err:u32"),
 
@@ -525,6 +554,12 @@ const static ss_command_handler_t subsystem_commands[] = {
 #endif
     DECLARE_COMMAND(SS_CMD_MM_MEMORY_COMPRESS_BCL_LZ77, cmd_mem_compress_bcl_lz, "lzCompress", "Compress from memory to memory using LZ77", "srcAddress:u32, srcSize:u32, destAddress:u32, expectedMD5:u8", "compressedSize:u32, md5:u8[16]"),
     DECLARE_COMMAND(SS_CMD_MM_MEMORY_DECOMPRESS_BCL_LZ77, cmd_mem_decompress_bcl_lz, "lzDecompress", "Decompress from memory to memory using LZ77", "srcAddress:u32, srcSize:u32, destAddress:u32, expectedSize:u32", "md5:u8[16]"),
+    DECLARE_COMMAND(SS_CMD_MM_FRAME_POOL_STATS, cmd_frame_pool_stats, "framePoolStats", "Frame pool usage for each size class", "", "classes:u8,{size:u16,count:u16,free:u16,highWater:u16,failures:u32}[]"),
+    DECLARE_COMMAND(SS_CMD_MM_BULK_READ, cmd_mem_bulk_read, "bulkRead", "Starts a windowed download of <size> bytes from <addr>, <window> chunks not acknowledged at most (0=default). Chunks come as session:u8,chunk:u32,data, the one after the last carries the MD5", "address:u32,size:u32,window:u8", "session:u8,chunks:u32,chunkSize:u16"),
+    DECLARE_COMMAND(SS_CMD_MM_BULK_ACK, cmd_mem_bulk_ack, "bulkAck", "All chunks before <base> arrived, bit i of <missing> asks for chunk base+i again", "session:u8,base:u32,missing:u32", ""),
+    DECLARE_COMMAND(SS_CMD_MM_BULK_RESUME, cmd_mem_bulk_resume, "bulkResume", "Restarts a download from chunk <from>", "session:u8,from:u32", "session:u8,chunks:u32"),
+    DECLARE_COMMAND(SS_CMD_MM_BULK_ABORT, cmd_mem_bulk_abort, "bulkAbort", "Drops a download", "session:u8", ""),
+    DECLARE_COMMAND(SS_CMD_MM_BULK_READ_LZ, cmd_mem_bulk_read_lz, "lzRead", "Downloads <size> bytes from <addr> LZ77 compressed (level 1-9, 0=default), acknowledged like bulkRead with <window> up to 8 (0=default). Chunks come as session:u8,chunk:u32,data, the one after the last as session:u8,chunk|0x80000000:u32,size:u32,compressedSize:u32,md5:u8[16]", "address:u32,size:u32,level:u8,window:u8", "session:u8,chunkSize:u16"),
 };
 
 static subsystem_api_t subsystem_api = {
@@ -532,12 +567,15 @@ static subsystem_api_t subsystem_api = {
     .command_execute = &ss_command_execute,
 };
 
+extern const ss_tests_t memory_tests;
+
 static subsystem_config_t subsystem_config = {
     .uxPriority = TASK_PRIORITY_SUBSYSTEM_MEMORY,
     .usStackDepth = STACK_DEPTH_MEMORY,
     .id = SS_MEMORY,
     .name = "MEMORY",
     DECLARE_COMMAND_HANDLERS(subsystem_commands),
+    .tests = &memory_tests,
 };
 
 static subsystem_state_t subsystem_state;
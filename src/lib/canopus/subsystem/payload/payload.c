@@ -73,6 +73,7 @@ static void PAYLOAD_main_task(void *pvParameters) {
 		} else {
 			// No mode change. Tick
 			PLATFORM_ss_is_alive(ss, HEARTBEAT_MAIN_TASK);
+			ss_telemetry_publish(ss);
 
 	    	switch (mode) {
 			case SM_OFF:
@@ -323,7 +324,7 @@ retval_t cmd_svip_transact(const subsystem_t *self, frame_t * iframe, frame_t *o
 	return PAYLOAD_svip_transact(iframe, oframe, true, true);
 }
 
-const static ss_command_handler_t subsystem_commands[] = {
+const static ss_command_t subsystem_commands[] = {
 	DECLARE_BASIC_COMMANDS("experimentsRun:u16, experimentsFailed:u16", ""),
     DECLARE_COMMAND(SS_CMD_PAYLOAD_DELAY, cmd_delay, "delay", "Just a delay in milliseconds", "ms:u32", ""),
     DECLARE_COMMAND(SS_CMD_OCTOPUS_GPIO_SET, cmd_octopus_gpio_set, "gpio", "Just a delay in milliseconds", "set:u32", "ack:u8"),
@@ -18,9 +18,12 @@
 #include <task.h>
 #include <semphr.h>
 #include "rtc.h"
+#include <string.h>
 
 static satellite_mode_e g_mode, g_previous_mode, g_next_mode;
 static void *saved_last_boot_reason;
+static xSemaphoreHandle mode_ack;
+static pm_mode_change_report_t mode_change_report;
 
 #define MODE_NAME(MODE)		[SM_##MODE]     = #MODE
 static const char *smode[] = {
@@ -43,10 +46,18 @@ satellite_mode_e PLATFORM_previous_satellite_mode() {
 void PLATFORM_request_mode_change(satellite_mode_e new_mode) {
     log_report_fmt(LOG_SS_PLATFORM, "MODE change request: %s -> %s\r\n", smode[g_mode], smode[new_mode]);
 	g_next_mode = new_mode;
+	if (NULL != mode_ack) xSemaphoreGive(mode_ack);
 }
 
-void PLATFORM_ss_is_ready(subsystem_t *ss) {
+/* Whatever the status was: one that reported an error during the mode
+ * change is ready now too. The barrier checks who is */
+void _PLATFORM_ss_is_ready(subsystem_t *ss, xSemaphoreHandle ack) {
 	ss->state->status = SS_ST_READY;
+	if (NULL != ack) xSemaphoreGive(ack);
+}
+
+void PLATFORM_ss_is_ready(subsystem_t *ss) {
+	_PLATFORM_ss_is_ready(ss, mode_ack);
 }
 
 void PLATFORM_ss_expect_heartbeats(subsystem_t *ss, uint8_t heartbeat_bits) {
@@ -204,41 +215,112 @@ static bool wait_all_ss_ready(portTickType xTicksTimeout) {
     return ready;
 }
 
-static retval_t mode_change_synchronous(satellite_mode_e new_mode, portTickType perSSTimeout_ticks) {
-	// PM Has the highest priority, so xSemaphoreGive() will not force a context switch
+static portTickType mode_change_timeout_ticks(const subsystem_t *ss) {
+	uint16_t timeout_ms;
+
+	timeout_ms = ss->config->mode_change_timeout_ms;
+	if (0 == timeout_ms) timeout_ms = PM_SS_MODE_CHANGE_TIMEOUT_MS;
+	return timeout_ms / portTICK_RATE_MS;
+}
+
+/* Gives g_mode to the subsystems of `list` at once and waits on `ack` until
+ * each is ready or its timeout expired. PLATFORM has the highest priority, so
+ * it runs as soon as an acknowledge gives `ack` and ack_ms is accurate */
+retval_t _PLATFORM_mode_change_barrier(subsystem_t *const *list, size_t count, xSemaphoreHandle ack, uint16_t *ack_ms) {
+	portTickType start, elapsed, wait, timeout[SS_MAX];
+	uint32_t waiting;
+	retval_t answer;
+	size_t i;
+
+	if (count > ARRAY_COUNT(timeout)) return RV_ILLEGAL;
+
+	answer = RV_SUCCESS;
+	waiting = 0;
+	(void)xSemaphoreTake(ack, 0); /* stale acknowledges */
+
+	for (i=0; i < count; i++) {
+		ack_ms[i] = PM_MODE_ACK_NONE;
+		if (!IS_PTR_VALID(list[i])) continue;
+		if (list[i] == &SUBSYSTEM_PLATFORM) continue;
+
+		timeout[i] = mode_change_timeout_ticks(list[i]);
+		list[i]->state->status = SS_ST_MODE_CHANGE_PENDING;
+		waiting |= 1 << i;
+	}
+
+	start = xTaskGetTickCount();
+	for (i=0; i < count; i++) {
+		if (waiting & (1 << i)) xSemaphoreGive(list[i]->state->semphr);
+	}
+
+	while (waiting) {
+		if (g_next_mode != g_mode) return RV_BUSY;
+
+		elapsed = xTaskGetTickCount() - start;
+		wait = portMAX_DELAY;
+		for (i=0; i < count; i++) {
+			if (!(waiting & (1 << i))) continue;
+
+			if (SS_ST_READY == list[i]->state->status) {
+				waiting &= ~(1 << i);
+				ack_ms[i] = elapsed * portTICK_RATE_MS; /* < timeout */
+				log_report_fmt(LOG_SS_PLATFORM, "%s is ready (%d ms).\r\n", list[i]->config->name, ack_ms[i]);
+			} else if (elapsed >= timeout[i]) {
+				waiting &= ~(1 << i);
+				answer = RV_TIMEOUT;
+				log_report_fmt(LOG_SS_PLATFORM, "%s is not ready.\r\n", list[i]->config->name);
+			} else {
+				if (timeout[i] - elapsed < wait) wait = timeout[i] - elapsed;
+			}
+		}
+		if (waiting) (void)xSemaphoreTake(ack, wait);
+	}
+	return answer;
+}
+
+static retval_t mode_change_barrier(uint16_t *ack_ms) {
+	subsystem_t *list[SS_MAX];
 	ss_id_e i;
-    bool ready;
-    retval_t answer;
-    portTickType timeout;
-    subsystem_state_t *ss_state;
-//    portBASE_TYPE rv;
 
-    answer = RV_SUCCESS;
+	for (i=0; i < ARRAY_COUNT(subsystems); i++) {
+		list[i] = IS_SS_VALID(i) ? subsystems[i] : NULL;
+	}
+	return _PLATFORM_mode_change_barrier(list, ARRAY_COUNT(list), mode_ack, ack_ms);
+}
 
-    g_previous_mode = g_mode;
-    g_mode = new_mode;
+static bool mode_change_may_roll_back(satellite_mode_e new_mode) {
+	return SM_MISSION == new_mode;
+}
 
-    for (i=0; i < ARRAY_COUNT(subsystems); i++) {
-		if (i == SS_PLATFORM) continue;
-        if (!IS_SS_VALID(i)) continue;
+static retval_t mode_change_synchronous(satellite_mode_e new_mode) {
+	uint16_t rollback_ack_ms[SS_MAX];
+	portTickType start;
+	uint32_t total_ms;
+	retval_t answer;
 
-		ss_state = subsystems[i]->state;
-		ss_state->status = SS_ST_MODE_CHANGE_PENDING;
+	start = xTaskGetTickCount();
+	mode_change_report.from = g_mode;
+	mode_change_report.to = new_mode;
 
-        log_report_fmt(LOG_SS_PLATFORM, "Changing mode for %s (%s -> %s).\r\n", subsystems[i]->config->name, smode[g_previous_mode], smode[g_mode]);
-		timeout = perSSTimeout_ticks + xTaskGetTickCount();
-        /* rv = */ xSemaphoreGive(ss_state->semphr);
-//        assert(pdTRUE == rv);
+	g_previous_mode = g_mode;
+	g_mode = new_mode;
 
-        do {
-        	ready = (SS_ST_READY == ss_state->status);
-            if (!ready) {
-            	vTaskDelay(PM_MODE_CHANGE_WAIT_TIME_SLOT_MS / portTICK_RATE_MS);
-            }
-        } while ((!ready) && (timeout > xTaskGetTickCount()));
-        log_report_fmt(LOG_SS_PLATFORM, "%s is %s.\r\n", subsystems[i]->config->name, ready?"ready":"not ready");
-        if (!ready) answer = RV_TIMEOUT;
-    }
+	log_report_fmt(LOG_SS_PLATFORM, "Changing mode (%s -> %s).\r\n", smode[g_previous_mode], smode[g_mode]);
+	answer = mode_change_barrier(mode_change_report.ack_ms);
+
+	if ((RV_TIMEOUT == answer) && mode_change_may_roll_back(new_mode)) {
+		g_mode = g_previous_mode;
+		g_previous_mode = new_mode;
+		if (g_next_mode == new_mode) g_next_mode = g_mode;
+
+		log_report_fmt(LOG_SS_PLATFORM, "Rolling back mode (%s -> %s).\r\n", smode[g_previous_mode], smode[g_mode]);
+		(void)mode_change_barrier(rollback_ack_ms);
+		answer = RV_NACK;
+	}
+
+	mode_change_report.result = answer;
+	total_ms = (xTaskGetTickCount() - start) * portTICK_RATE_MS;
+	mode_change_report.total_ms = (total_ms < 0xffff) ? total_ms : 0xffff;
     report_ss_states_and_hang(false);
     return answer;
 }
@@ -327,6 +409,9 @@ static void PLATFORM_main_task(void* pvParameters) {
     g_mode = g_next_mode = SM_BOOTING;
     retval_t rv;
 
+    vSemaphoreCreateBinary(mode_ack);
+    assert(NULL != mode_ack);
+
     initialize_nvram();
     increment_reboot_counter();
     saved_last_boot_reason = nvram.platform.last_boot_reason;
@@ -352,10 +437,11 @@ static void PLATFORM_main_task(void* pvParameters) {
 
     while (1) {
 		PLATFORM_ss_is_alive(ss, HEARTBEAT_MAIN_TASK);
+		ss_telemetry_publish(ss);
 
-    	if (g_mode != g_next_mode) {
+    	while (g_mode != g_next_mode) {
 			FUTURE_HOOK_3(platform_mode_change, ss, &g_mode, &g_next_mode);
-    		mode_change_synchronous(g_next_mode, PM_SS_MODE_CHANGE_TIMEOUT_MS);
+    		mode_change_synchronous(g_next_mode);
 			PLATFORM_ss_is_ready(ss);
     	}
 
@@ -375,7 +461,8 @@ static void PLATFORM_main_task(void* pvParameters) {
 
     	check_and_update_heartbeat_watchdog();
 
-    	vTaskDelay(PM_MODE_CHANGE_DETECT_TIME_SLOT_MS / portTICK_RATE_MS);
+    	/* woken early by PLATFORM_request_mode_change() */
+    	(void)xSemaphoreTake(mode_ack, PM_MODE_CHANGE_DETECT_TIME_SLOT_MS / portTICK_RATE_MS);
     }
 }
 
@@ -512,6 +599,45 @@ static retval_t cmd_dump_runtime_stats(const subsystem_t *self, frame_t *iframe,
 #endif
 }
 
+static retval_t cmd_channel_stats(const subsystem_t *self, frame_t *iframe, frame_t *oframe) {
+	channel_stats_t stats;
+	uint8_t index;
+
+	if (RV_SUCCESS != frame_get_u8(iframe, &index)) return RV_ILLEGAL;
+
+	frame_put_u8(oframe, channel_stats_count());
+	if (RV_SUCCESS != channel_stats_get(index, NULL, &stats)) return RV_NOENT;
+
+	frame_put_u32(oframe, stats.bytes_out);
+	frame_put_u32(oframe, stats.bytes_in);
+	frame_put_u32(oframe, stats.sends);
+	frame_put_u32(oframe, stats.recvs);
+	frame_put_u32(oframe, stats.transacts);
+	frame_put_u32(oframe, stats.lock_wait_total_ms);
+	frame_put_u32(oframe, stats.lock_wait_max_ms);
+	frame_put_u32(oframe, stats.transact_max_ms);
+	frame_put_u16_array(oframe, stats.errors, CHANNEL_STATS_RV_COUNT);
+	return frame_put_u16_array(oframe, stats.transact_latency, CHANNEL_STATS_LATENCY_BUCKETS);
+}
+
+#define ALL_CHANNELS 0xff
+static retval_t cmd_channel_stats_reset(const subsystem_t *self, frame_t *iframe, frame_t *oframe) {
+	const channel_t *channel;
+	uint8_t index;
+
+	if (RV_SUCCESS != frame_get_u8(iframe, &index)) return RV_ILLEGAL;
+
+	if (ALL_CHANNELS == index) {
+		channel_stats_reset_all();
+		return RV_SUCCESS;
+	}
+
+	if (RV_SUCCESS != channel_stats_get(index, &channel, NULL)) return RV_NOENT;
+	channel_stats_reset(channel);
+	return RV_SUCCESS;
+}
+#undef ALL_CHANNELS
+
 static retval_t cmd_uart_connect(const subsystem_t *self, frame_t *iframe, frame_t *oframe) {
 	uint8_t deviceA, deviceB;
 	retval_t rv;
@@ -572,7 +698,75 @@ static retval_t cmd_get_fpga_ticks(const subsystem_t *self, frame_t *iframe, fra
 	return frame_put_u64(oframe, ticks);
 }
 
-const static ss_command_handler_t subsystem_commands[] = {
+static retval_t cmd_mode_change_report(const subsystem_t *self, frame_t *iframe, frame_t *oframe) {
+	frame_put_u8(oframe, mode_change_report.from);
+	frame_put_u8(oframe, mode_change_report.to);
+	frame_put_u8(oframe, mode_change_report.result);
+	frame_put_u16(oframe, mode_change_report.total_ms);
+	return frame_put_u16_array(oframe, mode_change_report.ack_ms, SS_MAX);
+}
+
+/* Lists the commands of subsystem `ss`, starting at `from`, with their
+ * metadata (see command.h) as it's in the table, for as many as fit:
+ *
+ *   count:u8 { id:u8 total:u16 offset:u16 length:u16 data[length] }
+ *
+ * data is the slice [offset, offset + length) of the command's
+ * "name\0args\0answer\0description" string, which is total bytes long.
+ * Entries that don't fit go in slices, the first one starting at `offset`
+ * (0 if not given) and the last one cut at the end of the frame. The ground
+ * asks again from the last id and offset + length while it's short of
+ * total, or from the last id + 1 until count is reached, so every answer
+ * moves forward whatever the size of the entries. Commands without
+ * metadata are skipped */
+#define COMMAND_LIST_ENTRY_HEADER_SIZE	(1 + 2 + 2 + 2)
+
+static retval_t cmd_command_list(const subsystem_t *self, frame_t *iframe, frame_t *oframe) {
+#ifndef COMMAND_METADATA_DISABLED
+	const subsystem_t *ss;
+	const char *metadata;
+	uint8_t ss_id, from;
+	uint16_t offset = 0;
+	size_t cmd, size, length, space;
+	int field;
+
+	if (RV_SUCCESS != frame_get_u8(iframe, &ss_id)) return RV_ILLEGAL;
+	if (RV_SUCCESS != frame_get_u8(iframe, &from)) return RV_ILLEGAL;
+	(void)frame_get_u16(iframe, &offset);
+	if (ss_id >= SS_MAX) return RV_ILLEGAL;
+	ss = subsystems[ss_id];
+	if (!IS_PTR_VALID(ss)) return RV_NOENT;
+
+	SUCCESS_OR_RETURN(frame_put_u8(oframe, ss->config->command_handlers_count));
+	for (cmd = from; cmd < ss->config->command_handlers_count; ++cmd, offset = 0) {
+		metadata = SS_COMMAND_METADATA(ss->config->command_handlers[cmd]);
+		if (NULL == metadata) continue;
+
+		for (size = 0, field = 0; field < SS_COMMAND_METADATA_FIELDS; ++field) {
+			size += strlen(&metadata[size]) + 1;
+		}
+		if (offset >= size) continue;
+
+		space = _frame_available_space(oframe);
+		if (space <= COMMAND_LIST_ENTRY_HEADER_SIZE) break;
+		length = size - offset;
+		if (length > space - COMMAND_LIST_ENTRY_HEADER_SIZE) {
+			length = space - COMMAND_LIST_ENTRY_HEADER_SIZE;
+		}
+		frame_put_u8(oframe, cmd);
+		frame_put_u16(oframe, size);
+		frame_put_u16(oframe, offset);
+		frame_put_u16(oframe, length);
+		frame_put_data(oframe, &metadata[offset], length);
+		if (offset + length < size) break;
+	}
+	return RV_SUCCESS;
+#else
+	return RV_NOTIMPLEMENTED;
+#endif
+}
+
+const static ss_command_t subsystem_commands[] = {
     DECLARE_BASIC_COMMANDS("uptime_s:u32, resetCount:u24, currentMode:u8, lastBootReason:u32", ""),
     DECLARE_COMMAND(SS_CMD_PM_SET_MODE, cmd_set_mode, "set", "Force a satellite mode change to the new mode", "mode:u8", ""),
     DECLARE_COMMAND(SS_CMD_PM_SOFT_RESET_SYSTEM, cmd_soft_reset_system, "reset", "reset: Force CPU reset", "", ""),
@@ -588,6 +782,10 @@ const static ss_command_handler_t subsystem_commands[] = {
     DECLARE_COMMAND(SS_CMD_PM_GET_ON_BOARD_TIME, cmd_rtc_get_time, "getTimeMS", "Get onboard time", "", "timeMs:u64:[Time fromSeconds: timeMs/1000]"),
     DECLARE_COMMAND(SS_CMD_PM_SET_ON_BOARD_TIME, cmd_rtc_set_time, "set", "Set onboard time", "timeMs:u64", "setTimeMs:u64:[Time fromSeconds: setTimeMs/1000]"),
     DECLARE_COMMAND(SS_CMD_PM_GET_FPGA_TICKS, cmd_get_fpga_ticks, "getFpgaTicks", "Get Tick counter from FPGA", "", "ticks:u64"),
+    DECLARE_COMMAND(SS_CMD_PM_CHANNEL_STATS, cmd_channel_stats, "channelStats", "Get I/O statistics of a channel, by opening order. Latencies in ms, histogram buckets <1,1,2-3,4-7,...,>=256", "index:u8", "channels:u8,bytesOut:u32,bytesIn:u32,sends:u32,recvs:u32,transacts:u32,lockWaitTotal:u32,lockWaitMax:u32,transactMax:u32,errors:u16[12],transactLatency:u16[10]"),
+    DECLARE_COMMAND(SS_CMD_PM_CHANNEL_STATS_RESET, cmd_channel_stats_reset, "channelStatsReset", "Reset I/O statistics of a channel, 255 for all", "index:u8", ""),
+    DECLARE_COMMAND(SS_CMD_PM_COMMAND_LIST, cmd_command_list, "commandList", "List the commands of a subsystem from an id and offset, as slices of their name, args, answer and description strings", "ss:u8,from:u8,offset:u16", "count:u8,commands:bytes"),
+    DECLARE_COMMAND(SS_CMD_PM_MODE_CHANGE_REPORT, cmd_mode_change_report, "modeChangeReport", "Report of the last mode change: result and each subsystem's acknowledge time in ms by subsystem id, 0xffff if none", "", "from:u8,to:u8,result:u8,totalMs:u16,ackMs:u16[]"),
 };
 
 static subsystem_api_t subsystem_api = {
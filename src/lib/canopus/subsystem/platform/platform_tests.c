@@ -3,6 +3,18 @@
 #include <canopus/subsystem/subsystem.h>
 #include <canopus/board/channels.h>
 #include <canopus/drivers/commhub_1500.h>
+#include <canopus/subsystem/command.h>
+#include <canopus/subsystem/platform.h>
+#include <canopus/logging.h>
+#include <canopus/frame.h>
+#include <canopus/drivers/channel.h>
+#include <canopus/drivers/console_lowlevel.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <stdio.h>
+#include <string.h>
 
 static void test_commhub_sync(void **s) {
 	retval_t rv;
@@ -40,10 +52,1016 @@ static void test_commhub_write(void **s) {
 	assert_int_equal((data1 & 0x000F) | 0x5A50, data2);
 }
 
+#ifndef COMMAND_METADATA_DISABLED
+/* Usable answer size of a CDH response, smaller than some entries */
+#define COMMAND_LIST_TEST_ANSWER_SIZE	250
+
+/* Pages commandList through every subsystem with answers smaller than the
+ * biggest entries, rebuilding each entry from its slices */
+static void test_command_list_paging(void **s) {
+	uint8_t entry[1024];
+	const subsystem_t *ss;
+	const char *metadata;
+	uint8_t ss_id, from, count, id;
+	uint16_t offset, total, slice_offset, length;
+	size_t size, biggest = 0;
+	int field, answers, entries;
+
+	for (ss_id = 0; ss_id < SS_MAX; ++ss_id) {
+		ss = subsystems[ss_id];
+		if (!IS_PTR_VALID(ss)) continue;
+
+		from = 0;
+		offset = 0;
+		for (answers = 0; ; ++answers) {
+			uint8_t ibuf[5];
+			frame_t iframe = DECLARE_FRAME(ibuf);
+			frame_t oframe = DECLARE_FRAME_SPACE(COMMAND_LIST_TEST_ANSWER_SIZE);
+			uint8_t last_from = from;
+			uint16_t last_offset = offset;
+
+			assert_true(answers < 1000);
+			frame_put_u8(&iframe, SS_CMD_PM_COMMAND_LIST);
+			frame_put_u8(&iframe, ss_id);
+			frame_put_u8(&iframe, from);
+			frame_put_u16(&iframe, offset);
+			frame_reset_for_reading(&iframe);
+
+			assert_int_equal(RV_SUCCESS, subsystems[SS_PLATFORM]->api->command_execute(subsystems[SS_PLATFORM], &iframe, &oframe, 0));
+			frame_reset_for_reading(&oframe);
+			assert_int_equal(RV_SUCCESS, frame_get_u8(&oframe, &count));
+			assert_int_equal(ss->config->command_handlers_count, count);
+
+			for (entries = 0; RV_SUCCESS == frame_get_u8(&oframe, &id); ++entries) {
+				assert_int_equal(RV_SUCCESS, frame_get_u16(&oframe, &total));
+				assert_int_equal(RV_SUCCESS, frame_get_u16(&oframe, &slice_offset));
+				assert_int_equal(RV_SUCCESS, frame_get_u16(&oframe, &length));
+				assert_true(total <= sizeof(entry));
+				assert_true(slice_offset + length <= total);
+				assert_int_equal(RV_SUCCESS, frame_get_data(&oframe, &entry[slice_offset], length));
+
+				if (slice_offset + length < total) {
+					from = id;
+					offset = slice_offset + length;
+					break;
+				}
+				metadata = SS_COMMAND_METADATA(ss->config->command_handlers[id]);
+				assert_true(NULL != metadata);
+				for (size = 0, field = 0; field < SS_COMMAND_METADATA_FIELDS; ++field) {
+					size += strlen(&metadata[size]) + 1;
+				}
+				assert_int_equal(size, total);
+				assert_memory_equal(metadata, entry, total);
+				if (total > biggest) biggest = total;
+				from = id + 1;
+				offset = 0;
+			}
+			if (0 == entries || from >= count) break;
+			/* every answer moves forward */
+			assert_true(from > last_from || (from == last_from && offset > last_offset));
+		}
+	}
+	assert_true(biggest > COMMAND_LIST_TEST_ANSWER_SIZE);
+}
+#endif
+
+#ifdef VARARGS_SUPPORTED
+#define LOG_TEST_LINE_MAX	256
+
+/* Messages of every size, read back a few behind, so the ring wraps with
+ * records of all the lengths around its end */
+static void test_log_ring_wraparound(void **s) {
+	char got[LOG_TEST_LINE_MAX], want[LOG_TEST_LINE_MAX], pad[64];
+	log_ring_t *ring = log_test_ring_new();
+	int written, read;
+	log_stats_t stats;
+
+	assert_true(NULL != ring);
+	memset(pad, '-', sizeof(pad));
+	for (written = 0, read = 0; written < 500; written++) {
+		log_test_report_fmt(ring, "message %d %.*s\n", written, (int)(written % sizeof(pad)), pad);
+		if (written % 4 != 3) continue;
+		for (; read <= written; read++) {
+			assert_true(log_test_read(ring, got, sizeof(got)));
+			snprintf(want, sizeof(want), "message %d %.*s\n", read, (int)(read % sizeof(pad)), pad);
+			assert_string_equal(want, got);
+		}
+	}
+	assert_false(log_test_read(ring, got, sizeof(got)));
+
+	stats = log_test_stats(ring);
+	assert_int_equal(written, stats.recorded);
+	assert_int_equal(0, stats.dropped);
+	log_test_ring_free(ring);
+}
+
+/* Nobody reads, messages are dropped and counted once it's full, and fit
+ * again once it's read */
+static void test_log_ring_full(void **s) {
+	static const char msg[] = "a message that takes some room in the ring\n";
+	char got[LOG_TEST_LINE_MAX];
+	log_ring_t *ring = log_test_ring_new();
+	log_stats_t stats;
+	uint32_t n;
+
+	assert_true(NULL != ring);
+	for (n = 0; 0 == log_test_stats(ring).dropped; n++) {
+		assert_true(n < 1000);
+		assert_true(log_test_report(ring, msg));
+	}
+	assert_true(log_test_report(ring, msg));
+
+	stats = log_test_stats(ring);
+	assert_int_equal(n - 1, stats.recorded);
+	assert_int_equal(2, stats.dropped);
+	assert_true(stats.high_water >= stats.recorded * sizeof(msg));
+
+	for (n = 0; log_test_read(ring, got, sizeof(got)); n++) {
+		assert_string_equal(msg, got);
+	}
+	assert_int_equal(stats.recorded, n);
+
+	assert_true(log_test_report(ring, msg));
+	assert_true(log_test_read(ring, got, sizeof(got)));
+	assert_int_equal(2, log_test_stats(ring).dropped);
+	log_test_ring_free(ring);
+}
+
+static void test_log_fmt_conversions(void **s) {
+	char got[LOG_TEST_LINE_MAX], want[LOG_TEST_LINE_MAX];
+	log_ring_t *ring = log_test_ring_new();
+
+	assert_true(NULL != ring);
+
+	/* '*' width and precision */
+	log_test_report_fmt(ring, "[%*d|%-*.*s|%.*f|%0*lx]\n", 6, 42, 8, 3, "abcdef", 2, 3.14159, 10, 0xbeefUL);
+	snprintf(want, sizeof(want), "[%*d|%-*.*s|%.*f|%0*lx]\n", 6, 42, 8, 3, "abcdef", 2, 3.14159, 10, 0xbeefUL);
+	assert_true(log_test_read(ring, got, sizeof(got)));
+	assert_string_equal(want, got);
+
+	/* %% takes no argument */
+	log_test_report_fmt(ring, "100%% %d%% %s\n", 5, "done");
+	assert_true(log_test_read(ring, got, sizeof(got)));
+	assert_string_equal("100% 5% done\n", got);
+
+	assert_int_equal(0, log_test_stats(ring).truncated);
+	log_test_ring_free(ring);
+}
+
+/* Strings are cut to what fits in a record, the arguments that don't fit
+ * after them aren't printed and the message says so */
+static void test_log_fmt_truncation(void **s) {
+	char got[LOG_TEST_LINE_MAX], big[300];
+	log_ring_t *ring = log_test_ring_new();
+	size_t len;
+
+	assert_true(NULL != ring);
+	memset(big, 'x', sizeof(big) - 1);
+	big[sizeof(big) - 1] = '\0';
+
+	log_test_report_fmt(ring, "%s|\n", big);
+	assert_true(log_test_read(ring, got, sizeof(got)));
+	len = strspn(got, "x");
+	assert_true(len > 0);
+	assert_true(len < sizeof(big) - 1);
+	assert_string_equal("|\n", &got[len]);
+	assert_int_equal(0, log_test_stats(ring).truncated);
+
+	log_test_report_fmt(ring, "s=%s d=%d\n", big, 7);
+	assert_true(log_test_read(ring, got, sizeof(got)));
+	assert_memory_equal("s=", got, 2);
+	len = strspn(&got[2], "x");
+	assert_true(len > 0);
+	assert_string_equal(" d=...\n", &got[2 + len]);
+	assert_int_equal(1, log_test_stats(ring).truncated);
+	log_test_ring_free(ring);
+}
+#endif /* VARARGS_SUPPORTED */
+
+#define LOG_TEST_LOGGER		3	/* the console is 0 */
+
+static int log_test_dispatched;
+
+static void log_test_logger(portTickType xBlockTime, logbit_t bit, const char *msg) {
+	if (LOG_DEPRECATED == bit) log_test_dispatched++;
+}
+
+/* The mask is checked when a message is logged, not by the loggers */
+static void test_log_mask_at_enqueue(void **s) {
+	logmask_t previous;
+	int i;
+
+	log_test_dispatched = 0;
+	log_register(LOG_TEST_LOGGER, &log_test_logger);
+
+	previous = log_setmask(0, false);
+	log_report(LOG_DEPRECATED, "log test, masked\n");
+	log_setmask(bitmask(LOG_DEPRECATED), false);
+	log_report(LOG_DEPRECATED, "log test, enabled\n");
+	log_setmask(previous, false);
+
+	for (i = 0; (i < 100) && (0 == log_test_dispatched); i++) vTaskDelay(1);
+	vTaskDelay(10);
+	log_register(LOG_TEST_LOGGER, NULL);
+	assert_int_equal(1, log_test_dispatched);
+}
+
+static void test_frame_pool_allocate_all(void **s) {
+	DECLARE_FRAME_POOL(pool, 4, 16);
+	frame_t *frames[4], *extra;
+	int i;
+
+	assert_int_equal(RV_SUCCESS, _frame_pool_initialize(&pool));
+	assert_int_equal(4, _frame_free_count(&pool));
+
+	for (i=0; i<4; i++) {
+		assert_int_equal(RV_SUCCESS, _frame_allocate(&pool, &frames[i]));
+		assert_true(FRAME_IS_IN_USE(frames[i]));
+		assert_true(_frame_pool_owns(&pool, frames[i]));
+		assert_int_equal(16, frames[i]->size);
+		assert_int_equal(0, frames[i]->position);
+	}
+	assert_int_equal(0, _frame_free_count(&pool));
+	assert_int_equal(RV_NOSPACE, _frame_allocate(&pool, &extra));
+	assert_int_equal(1, pool.failures);
+	assert_int_equal(4, pool.high_water);
+
+	/* all different frames, with different buffers */
+	assert_true(frames[0] != frames[1] && frames[1] != frames[2] && frames[2] != frames[3]);
+	assert_true(frames[0]->buf != frames[3]->buf);
+
+	_frame_pool_dispose(&pool, frames[2]);
+	assert_int_equal(1, _frame_free_count(&pool));
+	assert_int_equal(RV_SUCCESS, _frame_allocate(&pool, &extra));
+	assert_true(frames[2] == extra);
+
+	for (i=0; i<4; i++) _frame_pool_dispose(&pool, frames[i]);
+	assert_int_equal(4, _frame_free_count(&pool));
+	assert_int_equal(4, pool.high_water);
+}
+
+static void test_frame_pool_double_dispose(void **s) {
+	DECLARE_FRAME_POOL(pool, 2, 16);
+	frame_t *a, *b;
+
+	_frame_pool_initialize(&pool);
+	assert_int_equal(RV_SUCCESS, _frame_allocate(&pool, &a));
+	_frame_pool_dispose(&pool, a);
+	_frame_pool_dispose(&pool, a);
+	assert_int_equal(2, _frame_free_count(&pool));
+
+	assert_int_equal(RV_SUCCESS, _frame_allocate(&pool, &a));
+	assert_int_equal(RV_SUCCESS, _frame_allocate(&pool, &b));
+	assert_true(a != b);
+	_frame_pool_dispose(&pool, a);
+	_frame_pool_dispose(&pool, b);
+}
+
+static void test_frame_allocate_size_classes(void **s) {
+	frame_pool_stats_t small, big, stats;
+	frame_t *frame;
+	int free_count;
+
+	assert_true(frame_pool_class_count() >= 2);
+	assert_int_equal(RV_SUCCESS, frame_pool_get_stats(0, &small));
+	assert_int_equal(RV_SUCCESS, frame_pool_get_stats(frame_pool_class_count() - 1, &big));
+	assert_int_equal(SMALL_FRAME_SIZE, small.buffer_size);
+	assert_int_equal(MAX_FRAME_SIZE, big.buffer_size);
+	assert_int_equal(RV_NOENT, frame_pool_get_stats(frame_pool_class_count(), &small));
+
+	free_count = frame_free_count();
+
+	/* frame_free_count() is about the frames frame_allocate() hands out */
+	assert_int_equal(big.free, free_count);
+	assert_int_equal(RV_SUCCESS, frame_allocate_size(&frame, 10));
+	assert_int_equal(SMALL_FRAME_SIZE, frame->size);
+	assert_int_equal(free_count, frame_free_count());
+	frame_pool_get_stats(0, &stats);
+	assert_int_equal(small.free - 1, stats.free);
+	frame_dispose(frame);
+	frame_pool_get_stats(0, &stats);
+	assert_int_equal(small.free, stats.free);
+
+	assert_int_equal(RV_SUCCESS, frame_allocate_size(&frame, SMALL_FRAME_SIZE + 1));
+	assert_int_equal(MAX_FRAME_SIZE, frame->size);
+	assert_int_equal(free_count - 1, frame_free_count());
+	frame_dispose(frame);
+
+	assert_int_equal(RV_NOSPACE, frame_allocate_size(&frame, MAX_FRAME_SIZE + 1));
+	assert_int_equal(free_count, frame_free_count());
+}
+
+static void test_frame_chain_prepend_and_strip(void **s) {
+	frame_t header = DECLARE_FRAME_BYTES(0xAA, 0xBB);
+	frame_t payload = DECLARE_FRAME_BYTES(1, 2, 3, 4, 5);
+	frame_t trailer = DECLARE_FRAME_BYTES(0xCC);
+	frame_t flat = DECLARE_FRAME_SPACE(16);
+	frame_chain_t chain;
+	uint8_t expected[] = {0xAA, 0xBB, 2, 3, 4, 5, 0xCC};
+
+	frame_chain_init(&chain);
+	frame_advance(&payload, 1);		/* only from the current position on */
+	assert_int_equal(RV_SUCCESS, frame_chain_append(&chain, &payload));
+	assert_int_equal(RV_SUCCESS, frame_chain_prepend(&chain, &header));
+	assert_int_equal(RV_SUCCESS, frame_chain_append(&chain, &trailer));
+	assert_int_equal(sizeof(expected), frame_chain_available_data(&chain));
+
+	/* segments point to the original buffers, nothing was copied */
+	assert_true(chain.segments[1].buf == &payload.buf[1]);
+
+	assert_int_equal(RV_SUCCESS, frame_chain_transfer(&flat, &chain));
+	frame_reset_for_reading(&flat);
+	assert_int_equal(sizeof(expected), flat.size);
+	assert_memory_equal(expected, flat.buf, sizeof(expected));
+	assert_int_equal(0, frame_chain_available_data(&chain));
+
+	/* strip the header and one payload byte, across segments */
+	frame_chain_reset(&chain);
+	assert_int_equal(RV_SUCCESS, frame_chain_advance(&chain, 3));
+	assert_int_equal(sizeof(expected) - 3, frame_chain_available_data(&chain));
+	assert_int_equal(3, frame_get_u8_nocheck(&chain.segments[1]));
+	assert_int_equal(RV_NOSPACE, frame_chain_advance(&chain, 10));
+}
+
+static void test_frame_chain_full(void **s) {
+	frame_t segment = DECLARE_FRAME_BYTES(1);
+	frame_chain_t chain;
+	int i;
+
+	frame_chain_init(&chain);
+	for (i=0; i<FRAME_CHAIN_MAX_SEGMENTS; i++) {
+		assert_int_equal(RV_SUCCESS, frame_chain_append(&chain, &segment));
+	}
+	assert_int_equal(RV_NOSPACE, frame_chain_append(&chain, &segment));
+	assert_int_equal(RV_NOSPACE, frame_chain_prepend(&chain, &segment));
+	assert_int_equal(FRAME_CHAIN_MAX_SEGMENTS, frame_chain_available_data(&chain));
+}
+
+static void test_frame_chain_dispose_owned(void **s) {
+	frame_chain_t chain;
+	frame_t *frame;
+	int free_count;
+
+	free_count = frame_free_count();
+	assert_int_equal(RV_SUCCESS, frame_allocate(&frame));
+	assert_true(frame_is_pooled(frame));
+	frame_put_u32(frame, 0x12345678);
+	frame_reset_for_reading(frame);
+
+	frame_chain_init(&chain);
+	frame_chain_append(&chain, frame);
+	frame_chain_own(&chain, frame);
+	assert_int_equal(free_count - 1, frame_free_count());
+
+	frame_chain_dispose(&chain);
+	assert_int_equal(free_count, frame_free_count());
+	assert_int_equal(0, frame_chain_available_data(&chain));
+}
+
+static void test_frame_codec_arrays(void **s) {
+	frame_t frame = DECLARE_FRAME_SPACE(15);
+	uint16_t u16[4] = {0x0102, 0x0304, 0x0506, 0x0708};
+	uint32_t u32[2] = {0x01020304, 0x05060708};
+	uint16_t u16_back[4];
+	uint32_t u32_back[2];
+	uint8_t expected[15];
+	int i;
+
+	/* odd position, so the unaligned path is used too */
+	frame_put_u8(&frame, 0xaa);
+	assert_int_equal(RV_SUCCESS, frame_put_u16_array(&frame, u16, 4));
+	assert_int_equal(RV_SUCCESS, frame_put_u32_le_array(&frame, u32, 1));
+	assert_int_equal(RV_NOSPACE, frame_put_u16_le_array(&frame, u16, 4));
+	assert_int_equal(15, frame.position);
+
+	frame_reset(&frame);
+	frame_put_u8(&frame, 0xaa);
+	for (i=0; i<4; i++) frame_put_u16(&frame, u16[i]);
+	frame_put_u32_le(&frame, u32[0]);
+	frame_put_u16_le(&frame, u16[0]);
+	assert_int_equal(RV_NOSPACE, frame_put_u16_le(&frame, u16[1]));
+	assert_int_equal(15, frame.position);
+	memcpy(expected, frame.buf, sizeof(expected));
+
+	frame_reset(&frame);
+	frame_put_u8(&frame, 0xaa);
+	frame_put_u16_array(&frame, u16, 4);
+	frame_put_u32_le_array(&frame, u32, 1);
+	frame_put_u16_le_array(&frame, u16, 4);
+	assert_memory_equal(expected, frame.buf, sizeof(expected));
+	assert_int_equal(0x01, expected[1]);
+	assert_int_equal(0x04, expected[9]);
+
+	frame_reset_for_reading(&frame);
+	frame_advance(&frame, 1);
+	assert_int_equal(RV_SUCCESS, frame_get_u16_array(&frame, u16_back, 4));
+	assert_memory_equal(u16, u16_back, sizeof(u16));
+	assert_int_equal(RV_SUCCESS, frame_get_u32_le_array(&frame, u32_back, 1));
+	assert_int_equal(u32[0], u32_back[0]);
+	assert_int_equal(RV_NOSPACE, frame_get_u32_array(&frame, u32_back, 2));
+	assert_int_equal(2, _frame_available_data(&frame));	/* nothing consumed */
+
+	frame_reset(&frame);
+	frame_put_u32_array(&frame, u32, 2);
+	frame_reset_for_reading(&frame);
+	assert_int_equal(0x01020304, frame_get_u32_nocheck(&frame));
+	assert_int_equal(0x0605, frame_get_u16_le_nocheck(&frame));
+}
+
+/* Loopback driver: what's sent is kept in test_loop_frame, and read back on recv */
+static frame_t test_loop_frame = DECLARE_FRAME_SPACE(32);
+static channel_request_t *test_pending_request;
+
+static retval_t test_loop_send(const channel_t *const channel, frame_t *const send_frame, const size_t count) {
+	return frame_transfer(&test_loop_frame, send_frame);
+}
+
+static retval_t test_loop_recv(const channel_t *const channel, frame_t *const recv_frame, const size_t count) {
+	frame_t written;
+
+	frame_copy_for_reading(&written, &test_loop_frame);
+	frame_reset(&test_loop_frame);
+	return frame_transfer(recv_frame, &written);
+}
+
+/* only completes when test_loop_finish() is called */
+static retval_t test_loop_submit(const channel_t *const channel, channel_request_t *const request) {
+	test_pending_request = request;
+	return RV_SUCCESS;
+}
+
+static retval_t test_loop_cancel(const channel_t *const channel, channel_request_t *const request) {
+	if (test_pending_request != request) return RV_ILLEGAL;
+	test_pending_request = NULL;
+	return RV_SUCCESS;
+}
+
+static void test_loop_finish(void) {
+	channel_request_t *request = test_pending_request;
+
+	test_pending_request = NULL;
+	channel_request_complete(request, test_loop_send(request->channel, request->send_frame, 0));
+}
+
+static const channel_driver_api_t test_loop_driver_api = {
+	.send = test_loop_send,
+	.recv = test_loop_recv,
+};
+
+static const channel_driver_api_t test_loop_submit_driver_api = {
+	.send = test_loop_send,
+	.recv = test_loop_recv,
+	.submit = test_loop_submit,
+	.cancel = test_loop_cancel,
+};
+
+static channel_driver_state_t test_loop_driver_state;
+static channel_driver_state_t test_loop_submit_driver_state;
+static const channel_driver_t test_loop_driver = {
+	.config = NULL,
+	.state = &test_loop_driver_state,
+	.api = &test_loop_driver_api,
+};
+static const channel_driver_t test_loop_submit_driver = {
+	.config = NULL,
+	.state = &test_loop_submit_driver_state,
+	.api = &test_loop_submit_driver_api,
+};
+
+static const channel_config_t test_loop_channel_config = DECLARE_CHANNEL_CONFIG(0, 100, 1000);
+static channel_state_t test_loop_channel_state;
+static channel_state_t test_loop_submit_channel_state;
+static const channel_t test_loop_channel = {
+	.config = &test_loop_channel_config,
+	.state = &test_loop_channel_state,
+	.driver = &test_loop_driver,
+};
+static const channel_t test_loop_submit_channel = {
+	.config = &test_loop_channel_config,
+	.state = &test_loop_submit_channel_state,
+	.driver = &test_loop_submit_driver,
+};
+
+/* A device slow to take what's sent, to keep a worker busy */
+#define TEST_SLOW_SEND_MS	300
+
+static retval_t test_slow_send(const channel_t *const channel, frame_t *const send_frame, const size_t count) {
+	vTaskDelay(TEST_SLOW_SEND_MS / portTICK_RATE_MS);
+	return test_loop_send(channel, send_frame, count);
+}
+
+static const channel_driver_api_t test_slow_driver_api = {
+	.send = test_slow_send,
+	.recv = test_loop_recv,
+};
+
+static channel_driver_state_t test_slow_driver_state;
+static const channel_driver_t test_slow_driver = {
+	.config = NULL,
+	.state = &test_slow_driver_state,
+	.api = &test_slow_driver_api,
+};
+
+static channel_state_t test_slow_channel_state;
+static const channel_t test_slow_channel = {
+	.config = &test_loop_channel_config,
+	.state = &test_slow_channel_state,
+	.driver = &test_slow_driver,
+};
+
+static int test_completions;
+static retval_t test_last_rv;
+
+static void test_request_complete(channel_request_t *request, retval_t rv) {
+	(*(int *)request->context)++;
+	test_last_rv = rv;
+}
+
+static void test_loop_open(const channel_t *channel) {
+	if (!channel->driver->state->is_initialized) {
+		assert_int_equal(RV_SUCCESS, channel_driver_initialize(channel->driver));
+	}
+	if (!channel->state->is_open) {
+		assert_int_equal(RV_SUCCESS, channel_open(channel));
+	}
+	frame_reset(&test_loop_frame);
+}
+
+static void test_channel_async_driver_submit(void **s) {
+	channel_request_t request = DECLARE_CHANNEL_REQUEST(test_request_complete, &test_completions, 0);
+	frame_t data = DECLARE_FRAME_BYTES(1, 2, 3);
+
+	test_loop_open(&test_loop_submit_channel);
+	test_completions = 0;
+
+	assert_int_equal(RV_SUCCESS, channel_send_async(&test_loop_submit_channel, &request, &data));
+	assert_true(test_pending_request == &request);
+	assert_int_equal(RV_BUSY, channel_send_async(&test_loop_submit_channel, &request, &data));
+	assert_int_equal(0, test_completions);
+
+	test_loop_finish();
+	assert_int_equal(1, test_completions);
+	assert_int_equal(RV_SUCCESS, test_last_rv);
+	assert_int_equal(3, test_loop_frame.position);
+
+	/* cancelled by the driver, the callback still gets called */
+	frame_reset(&data);
+	assert_int_equal(RV_SUCCESS, channel_send_async(&test_loop_submit_channel, &request, &data));
+	assert_int_equal(RV_SUCCESS, channel_request_cancel(&request));
+	assert_int_equal(2, test_completions);
+	assert_int_equal(RV_ERROR, test_last_rv);
+	assert_int_equal(RV_ILLEGAL, channel_request_cancel(&request));
+	assert_int_equal(3, test_loop_frame.position);
+}
+
+static void test_channel_async_cancel_queued(void **s) {
+	channel_request_t first = DECLARE_CHANNEL_REQUEST(test_request_complete, &test_completions, 0);
+	channel_request_t second = DECLARE_CHANNEL_REQUEST(test_request_complete, &test_completions, 0);
+	frame_t data = DECLARE_FRAME_BYTES(1, 2, 3);
+	frame_t answer = DECLARE_FRAME_SPACE(3);
+
+	test_loop_open(&test_loop_channel);
+	test_completions = 0;
+
+	/* keep the workers from running while the requests are queued */
+	vTaskSuspendAll();
+	assert_int_equal(RV_SUCCESS, channel_send_async(&test_loop_channel, &first, &data));
+	assert_int_equal(RV_SUCCESS, channel_recv_async(&test_loop_channel, &second, &answer));
+	assert_int_equal(RV_BUSY, channel_recv_async(&test_loop_channel, &second, &answer));
+	assert_int_equal(RV_SUCCESS, channel_request_cancel(&second));
+	assert_int_equal(RV_SUCCESS, channel_request_cancel(&first));
+	assert_int_equal(RV_ILLEGAL, channel_request_cancel(&first));
+	xTaskResumeAll();
+
+	assert_int_equal(2, test_completions);
+	assert_int_equal(RV_ERROR, test_last_rv);
+	assert_int_equal(0, test_loop_frame.position);
+	assert_int_equal(RV_ILLEGAL, channel_transact_async(&test_loop_channel, &first, NULL, 0, NULL));
+}
+
+static bool test_wait_idle(const channel_request_t *request, int timeout_ms) {
+	for (; timeout_ms > 0; timeout_ms -= 10) {
+		if (CHANNEL_REQUEST_IDLE == request->status) return true;
+		vTaskDelay(10 / portTICK_RATE_MS);
+	}
+	return CHANNEL_REQUEST_IDLE == request->status;
+}
+
+/* No submit in the driver: the workers run the requests, in order */
+static void test_channel_async_worker_fallback(void **s) {
+	channel_request_t send = DECLARE_CHANNEL_REQUEST(test_request_complete, &test_completions, 0);
+	channel_request_t recv = DECLARE_CHANNEL_REQUEST(test_request_complete, &test_completions, 0);
+	frame_t data = DECLARE_FRAME_BYTES(1, 2, 3);
+	frame_t answer = DECLARE_FRAME_SPACE(3);
+
+	test_loop_open(&test_loop_channel);
+	test_completions = 0;
+
+	assert_int_equal(RV_SUCCESS, channel_send_async(&test_loop_channel, &send, &data));
+	assert_int_equal(RV_SUCCESS, channel_recv_async(&test_loop_channel, &recv, &answer));
+	assert_true(test_wait_idle(&recv, 1000));
+	assert_true(test_wait_idle(&send, 1000));
+
+	assert_int_equal(2, test_completions);
+	assert_int_equal(RV_SUCCESS, send.rv);
+	assert_int_equal(RV_SUCCESS, recv.rv);
+	assert_int_equal(3, answer.position);
+	assert_memory_equal(((uint8_t[]){1, 2, 3}), answer.buf, 3);
+}
+
+/* Queued behind a slow request on the same channel until its deadline */
+static void test_channel_async_timeout(void **s) {
+	channel_request_t slow = DECLARE_CHANNEL_REQUEST(NULL, NULL, 0);
+	channel_request_t late = DECLARE_CHANNEL_REQUEST(NULL, NULL, 50);
+	frame_t data = DECLARE_FRAME_BYTES(1, 2, 3);
+	frame_t more = DECLARE_FRAME_BYTES(4, 5);
+
+	test_loop_open(&test_slow_channel);
+
+	assert_int_equal(RV_SUCCESS, channel_send_async(&test_slow_channel, &slow, &data));
+	assert_int_equal(RV_SUCCESS, channel_send_async(&test_slow_channel, &late, &more));
+	assert_true(test_wait_idle(&late, TEST_SLOW_SEND_MS * 2 / 3));
+	assert_int_equal(RV_TIMEOUT, late.rv);
+	assert_true(CHANNEL_REQUEST_RUNNING == slow.status);
+
+	assert_true(test_wait_idle(&slow, TEST_SLOW_SEND_MS * 2));
+	assert_int_equal(RV_SUCCESS, slow.rv);
+	assert_int_equal(3, test_loop_frame.position);	/* the late one never went out */
+}
+
+static void test_channel_stats(void **s) {
+	frame_t data = DECLARE_FRAME_BYTES(1, 2, 3);
+	frame_t answer = DECLARE_FRAME_SPACE(2);
+	const channel_t *channel;
+	channel_stats_t stats;
+	uint8_t i;
+
+	test_loop_open(&test_loop_channel);
+	channel_stats_reset(&test_loop_channel);
+
+	for (i = 0; i < channel_stats_count(); i++) {
+		assert_int_equal(RV_SUCCESS, channel_stats_get(i, &channel, NULL));
+		if (channel == &test_loop_channel) break;
+	}
+	assert_true(i < channel_stats_count());
+	assert_int_equal(RV_NOENT, channel_stats_get(CHANNEL_STATS_MAX_CHANNELS, &channel, &stats));
+
+	assert_int_equal(RV_SUCCESS, channel_send(&test_loop_channel, &data));
+	assert_int_equal(RV_NOSPACE, channel_recv(&test_loop_channel, &answer));
+	frame_reset(&data);
+	assert_int_equal(RV_SUCCESS, channel_transact(&test_loop_channel, &data, 0, &answer));
+
+	channel_stats_get(i, NULL, &stats);
+	assert_int_equal(1, stats.sends);
+	assert_int_equal(1, stats.recvs);
+	assert_int_equal(1, stats.transacts);
+	assert_int_equal(6, stats.bytes_out);
+	assert_int_equal(2, stats.bytes_in);
+	assert_int_equal(1, stats.errors[RV_NOSPACE]);
+	assert_int_equal(0, stats.errors[RV_SUCCESS]);
+	assert_int_equal(1, stats.transact_latency[0] + stats.transact_latency[1]);
+
+	channel_stats_reset_all();
+	channel_stats_get(i, NULL, &stats);
+	assert_int_equal(0, stats.sends);
+	assert_int_equal(0, stats.bytes_out);
+	assert_int_equal(0, stats.errors[RV_NOSPACE]);
+}
+
+static void test_channel_transact_batch(void **s) {
+	frame_t data[3] = {
+		DECLARE_FRAME_BYTES(1, 2),
+		DECLARE_FRAME_BYTES(3, 4, 5),
+		DECLARE_FRAME_BYTES(6),
+	};
+	frame_t answer[3] = {
+		DECLARE_FRAME_SPACE(2),
+		DECLARE_FRAME_SPACE(2),		/* too short for what comes back */
+		DECLARE_FRAME_SPACE(1),
+	};
+	channel_transaction_t transactions[3] = {
+		DECLARE_CHANNEL_TRANSACTION(&data[0], 0, &answer[0]),
+		DECLARE_CHANNEL_TRANSACTION(&data[1], 0, &answer[1]),
+		DECLARE_CHANNEL_TRANSACTION(&data[2], 0, &answer[2]),
+	};
+	channel_stats_t stats;
+	const channel_t *channel;
+	uint8_t i;
+
+	test_loop_open(&test_loop_channel);
+	channel_stats_reset(&test_loop_channel);
+	for (i = 0; i < channel_stats_count(); i++) {
+		channel_stats_get(i, &channel, NULL);
+		if (channel == &test_loop_channel) break;
+	}
+
+	assert_int_equal(RV_SUCCESS, channel_transact_batch(&test_loop_channel, NULL, 0));
+	assert_int_equal(RV_NOSPACE, channel_transact_batch(&test_loop_channel, transactions, 3));
+
+	/* the failure doesn't stop the ones after it */
+	assert_int_equal(RV_SUCCESS, transactions[0].rv);
+	assert_int_equal(RV_NOSPACE, transactions[1].rv);
+	assert_int_equal(RV_SUCCESS, transactions[2].rv);
+	assert_memory_equal(answer[0].buf, ((uint8_t[]){1, 2}), 2);
+	assert_int_equal(6, answer[2].buf[0]);
+	assert_true((portTickType)(transactions[2].ticks - transactions[0].ticks) < 1000);
+	assert_true((portTickType)(xTaskGetTickCount() - transactions[2].ticks) < 1000);
+
+	channel_stats_get(i, NULL, &stats);
+	assert_int_equal(3, stats.transacts);
+	assert_int_equal(6, stats.bytes_out);
+	assert_int_equal(1, stats.errors[RV_NOSPACE]);
+}
+
+/* Subsystems of our own for the mode change barrier, with the default
+ * timeout, 100 ms and 400 ms. Each acknowledges ack_after_ms after it's
+ * told, or never when negative, then waits to be told again. Those in
+ * test_barrier_error report an error first */
+#define TEST_BARRIER_SS		3
+
+static subsystem_config_t test_barrier_config[TEST_BARRIER_SS] = {
+	{ .name = "BARRIER0" },
+	{ .name = "BARRIER1", .mode_change_timeout_ms = 100 },
+	{ .name = "BARRIER2", .mode_change_timeout_ms = 400 },
+};
+static subsystem_state_t test_barrier_state[TEST_BARRIER_SS];
+static subsystem_t test_barrier_ss[TEST_BARRIER_SS] = {
+	{ .config = &test_barrier_config[0], .state = &test_barrier_state[0] },
+	{ .config = &test_barrier_config[1], .state = &test_barrier_state[1] },
+	{ .config = &test_barrier_config[2], .state = &test_barrier_state[2] },
+};
+static subsystem_t *const test_barrier_list[TEST_BARRIER_SS] = {
+	&test_barrier_ss[0], &test_barrier_ss[1], &test_barrier_ss[2],
+};
+static int test_barrier_ack_after_ms[TEST_BARRIER_SS];
+static bool test_barrier_error[TEST_BARRIER_SS];
+static xSemaphoreHandle test_barrier_ack;
+
+static void test_barrier_ss_task(void *params) {
+	subsystem_t *ss = (subsystem_t *)params;
+	int ack_after_ms;
+
+	for (;;) {
+		(void)xSemaphoreTake(ss->state->semphr, portMAX_DELAY);
+		ack_after_ms = test_barrier_ack_after_ms[ss - test_barrier_ss];
+		if (ack_after_ms < 0) continue;
+
+		vTaskDelay(ack_after_ms / portTICK_RATE_MS);
+		if (test_barrier_error[ss - test_barrier_ss]) {
+			SS_CRITICAL_ERROR(ss);
+		}
+		_PLATFORM_ss_is_ready(ss, test_barrier_ack);
+	}
+}
+
+static retval_t test_barrier_run(const int *ack_after_ms, uint16_t *ack_ms, uint32_t *elapsed_ms) {
+	portTickType start;
+	retval_t rv;
+	int i;
+
+	if (NULL == test_barrier_ack) vSemaphoreCreateBinary(test_barrier_ack);
+	assert_true(NULL != test_barrier_ack);
+
+	for (i = 0; i < TEST_BARRIER_SS; i++) {
+		test_barrier_ack_after_ms[i] = ack_after_ms[i];
+		if (NULL != test_barrier_state[i].task_handle) continue;
+
+		vSemaphoreCreateBinary(test_barrier_state[i].semphr);
+		assert_true(NULL != test_barrier_state[i].semphr);
+		(void)xSemaphoreTake(test_barrier_state[i].semphr, 0);
+		assert_int_equal(pdPASS, xTaskCreate(test_barrier_ss_task, (signed char *)"barrier",
+				configMINIMAL_STACK_SIZE + 256, (void *)&test_barrier_ss[i], tskIDLE_PRIORITY + 1,
+				&test_barrier_state[i].task_handle));
+	}
+
+	start = xTaskGetTickCount();
+	rv = _PLATFORM_mode_change_barrier(test_barrier_list, TEST_BARRIER_SS, test_barrier_ack, ack_ms);
+	*elapsed_ms = (xTaskGetTickCount() - start) * portTICK_RATE_MS;
+	return rv;
+}
+
+static void test_mode_change_barrier_all_ready(void **s) {
+	static const int ack_after_ms[TEST_BARRIER_SS] = { 100, 0, 50 };
+	uint16_t ack_ms[TEST_BARRIER_SS];
+	uint32_t elapsed_ms;
+
+	assert_int_equal(RV_SUCCESS, test_barrier_run(ack_after_ms, ack_ms, &elapsed_ms));
+	/* done with the last one, not at a timeout */
+	assert_true(elapsed_ms < 300);
+	assert_true(ack_ms[1] < 50);
+	assert_true((ack_ms[2] >= 50) && (ack_ms[2] < ack_ms[0]));
+	assert_true((ack_ms[0] >= 100) && (ack_ms[0] < 300));
+}
+
+/* One never answers: its timeout doesn't end the wait for the others, and
+ * their acknowledges after it still count */
+static void test_mode_change_barrier_partial(void **s) {
+	static const int ack_after_ms[TEST_BARRIER_SS] = { 0, -1, 200 };
+	uint16_t ack_ms[TEST_BARRIER_SS];
+	uint32_t elapsed_ms;
+
+	assert_int_equal(RV_TIMEOUT, test_barrier_run(ack_after_ms, ack_ms, &elapsed_ms));
+	assert_true(ack_ms[0] < 50);
+	assert_int_equal(PM_MODE_ACK_NONE, ack_ms[1]);
+	assert_true((ack_ms[2] >= 200) && (ack_ms[2] < 400));
+	assert_true(elapsed_ms < 400);
+	assert_int_equal(SS_ST_MODE_CHANGE_PENDING, test_barrier_state[1].status);
+}
+
+/* One with the default timeout fails to initialize something and says so,
+ * then it's ready: the wait ends there */
+static void test_mode_change_barrier_error_then_ready(void **s) {
+	static const int ack_after_ms[TEST_BARRIER_SS] = { 50, 0, 0 };
+	uint16_t ack_ms[TEST_BARRIER_SS];
+	uint32_t elapsed_ms;
+	retval_t rv;
+
+	test_barrier_error[0] = true;
+	rv = test_barrier_run(ack_after_ms, ack_ms, &elapsed_ms);
+	test_barrier_error[0] = false;
+
+	assert_int_equal(RV_SUCCESS, rv);
+	assert_true((ack_ms[0] >= 50) && (ack_ms[0] < 300));
+	assert_true(elapsed_ms < 300);
+}
+
+/* Each gets its own timeout, the wait ends with the longest one */
+static void test_mode_change_barrier_timeout(void **s) {
+	static const int ack_after_ms[TEST_BARRIER_SS] = { 0, -1, -1 };
+	uint16_t ack_ms[TEST_BARRIER_SS];
+	uint32_t elapsed_ms;
+
+	assert_int_equal(RV_TIMEOUT, test_barrier_run(ack_after_ms, ack_ms, &elapsed_ms));
+	assert_true(ack_ms[0] < 50);
+	assert_int_equal(PM_MODE_ACK_NONE, ack_ms[1]);
+	assert_int_equal(PM_MODE_ACK_NONE, ack_ms[2]);
+	assert_true((elapsed_ms >= 400) && (elapsed_ms < 600));
+}
+
+#ifdef DEBUG_CONSOLE_ENABLED
+#define TEST_CONSOLE_RING_SIZE	2048	/* CONSOLE_RING_SIZE */
+#define TEST_CONSOLE_OUTPUT		3000
+
+/* What the console task writes instead of the UART, which can stall */
+static struct {
+	uint8_t buf[2 * TEST_CONSOLE_OUTPUT];
+	size_t count;
+	portTickType stall_ticks;
+	console_policy_e policy;
+	uint32_t block_ms;
+} test_console;
+
+static uint8_t test_console_output[TEST_CONSOLE_OUTPUT];
+
+static void test_console_write(const void *buf, size_t count) {
+	if (test_console.count + count <= sizeof(test_console.buf)) {
+		memcpy(&test_console.buf[test_console.count], buf, count);
+	}
+	test_console.count += count;
+	if (test_console.stall_ticks > 0) {
+		vTaskDelay(test_console.stall_ticks);
+	}
+}
+
+/* the console task drains while we sleep */
+static void test_console_drain(void) {
+	vTaskDelay(300 / portTICK_RATE_MS);
+}
+
+static void test_console_start(console_policy_e policy, uint32_t block_ms) {
+	size_t i;
+
+	for (i = 0; i < sizeof(test_console_output); i++) {
+		test_console_output[i] = i % 251;
+	}
+	test_console_drain();
+	lowlevel_console_set_write(&test_console_write);
+	test_console.count = 0;
+	test_console.stall_ticks = 0;
+	test_console.policy = lowlevel_console_get_policy(&test_console.block_ms);
+	lowlevel_console_set_policy(policy, block_ms);
+}
+
+static void test_console_end(void) {
+	test_console.stall_ticks = 0;
+	test_console_drain();
+	lowlevel_console_set_write(NULL);
+	lowlevel_console_set_policy(test_console.policy, test_console.block_ms);
+}
+
+/* as the console task reports them */
+static void test_console_assert_dropped_report(const uint8_t *at, uint32_t dropped) {
+	char msg[] = "\r\nconsole: bytes dropped 0x________\r\n";
+
+	snprintf(&msg[sizeof(msg) - 11], 11, "%08x\r\n", (unsigned int)dropped);
+	assert_memory_equal(msg, at, sizeof(msg) - 1);
+}
+
+static void test_console_ring_drop_oldest(void **s) {
+	const size_t report_size = sizeof("\r\nconsole: bytes dropped 0x________\r\n") - 1;
+	uint32_t dropped;
+	int i;
+
+	test_console_start(CONSOLE_POLICY_DROP_OLDEST, 0);
+	dropped = lowlevel_console_dropped();
+
+	/* the console task is above us, keep it from running meanwhile */
+	vTaskSuspendAll();
+	for (i = 0; i < TEST_CONSOLE_OUTPUT; i += 100) {
+		lowlevel_console_putbuf(&test_console_output[i], 100);
+	}
+	xTaskResumeAll();
+	dropped = lowlevel_console_dropped() - dropped;
+	assert_int_equal(TEST_CONSOLE_OUTPUT - TEST_CONSOLE_RING_SIZE, dropped);
+
+	/* the newest ones, in order across the end of the ring, then the count */
+	test_console_drain();
+	assert_int_equal(TEST_CONSOLE_RING_SIZE + report_size, test_console.count);
+	assert_memory_equal(&test_console_output[dropped], test_console.buf, TEST_CONSOLE_RING_SIZE);
+	test_console_assert_dropped_report(&test_console.buf[TEST_CONSOLE_RING_SIZE], dropped);
+	test_console_end();
+}
+
+static void test_console_block_waits(void **s) {
+	uint32_t dropped;
+
+	test_console_start(CONSOLE_POLICY_BLOCK, 1000);
+	dropped = lowlevel_console_dropped();
+
+	lowlevel_console_putbuf(test_console_output, TEST_CONSOLE_OUTPUT);
+	assert_int_equal(dropped, lowlevel_console_dropped());
+
+	test_console_drain();
+	assert_int_equal(TEST_CONSOLE_OUTPUT, test_console.count);
+	assert_memory_equal(test_console_output, test_console.buf, TEST_CONSOLE_OUTPUT);
+	test_console_end();
+}
+
+static void test_console_block_timeout(void **s) {
+	const size_t report_size = sizeof("\r\nconsole: bytes dropped 0x________\r\n") - 1;
+	const size_t tail = 128;
+	portTickType start;
+	uint32_t dropped;
+
+	test_console_start(CONSOLE_POLICY_BLOCK, 20);
+	test_console.stall_ticks = 100 / portTICK_RATE_MS;
+	dropped = lowlevel_console_dropped();
+
+	/* the UART stalls: it waits no more than a few block_ms, then drops */
+	start = xTaskGetTickCount();
+	lowlevel_console_putbuf(test_console_output, TEST_CONSOLE_OUTPUT);
+	assert_true((xTaskGetTickCount() - start) * portTICK_RATE_MS < 100);
+	dropped = lowlevel_console_dropped() - dropped;
+	assert_true(dropped > 0);
+	assert_true(dropped <= TEST_CONSOLE_OUTPUT - TEST_CONSOLE_RING_SIZE);
+
+	/* the oldest ones went, the end made it */
+	test_console.stall_ticks = 0;
+	test_console_drain();
+	assert_int_equal(TEST_CONSOLE_OUTPUT - dropped + report_size, test_console.count);
+	assert_memory_equal(&test_console_output[TEST_CONSOLE_OUTPUT - tail],
+			&test_console.buf[test_console.count - report_size - tail], tail);
+	test_console_assert_dropped_report(&test_console.buf[test_console.count - report_size], dropped);
+	test_console_end();
+}
+#endif /* DEBUG_CONSOLE_ENABLED */
+
 static const UnitTest tests[] = {
 	unit_test(test_commhub_sync),
     unit_test(test_commhub_read_constant),
     unit_test(test_commhub_write),
+#ifndef COMMAND_METADATA_DISABLED
+    unit_test(test_command_list_paging),
+#endif
+#ifdef VARARGS_SUPPORTED
+    unit_test(test_log_ring_wraparound),
+    unit_test(test_log_ring_full),
+    unit_test(test_log_fmt_conversions),
+    unit_test(test_log_fmt_truncation),
+#endif
+    unit_test(test_log_mask_at_enqueue),
+    unit_test(test_frame_pool_allocate_all),
+    unit_test(test_frame_pool_double_dispose),
+    unit_test(test_frame_allocate_size_classes),
+    unit_test(test_frame_chain_prepend_and_strip),
+    unit_test(test_frame_chain_full),
+    unit_test(test_frame_chain_dispose_owned),
+    unit_test(test_frame_codec_arrays),
+    unit_test(test_channel_async_driver_submit),
+    unit_test(test_channel_async_cancel_queued),
+    unit_test(test_channel_async_worker_fallback),
+    unit_test(test_channel_async_timeout),
+    unit_test(test_channel_stats),
+    unit_test(test_channel_transact_batch),
+    unit_test(test_mode_change_barrier_all_ready),
+    unit_test(test_mode_change_barrier_partial),
+    unit_test(test_mode_change_barrier_timeout),
+    unit_test(test_mode_change_barrier_error_then_ready),
+#ifdef DEBUG_CONSOLE_ENABLED
+    unit_test(test_console_ring_drop_oldest),
+    unit_test(test_console_block_waits),
+    unit_test(test_console_block_timeout),
+#endif
 };
 
 const ss_tests_t platform_tests = {
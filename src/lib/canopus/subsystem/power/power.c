@@ -153,43 +153,48 @@ static void improve_battery_voltage_measurement() {
 	}
 }
 
+/* Status, bus voltage and current of a power domain, in one batch */
+static void update_ina_telemetry(const channel_t *const channel, uint16_t *status, float *mV, float *mA) {
+	ina209_sample_t samples[] = {
+		{ .reg = INA209_STATUS },
+		{ .reg = INA209_BUS_VOLTAGE },
+		{ .reg = INA209_CURRENT },
+	};
+
+	(void)ina209_readRegisterBatch(channel, samples, ARRAY_COUNT(samples));
+
+	*status = (RV_SUCCESS == samples[0].rv) ? samples[0].value : 0xFFFF;
+	if (RV_SUCCESS == samples[1].rv) *mV = ina209_from_reg(INA209_BUS_VOLTAGE, samples[1].value) * 1000.0;
+	if (RV_SUCCESS == samples[2].rv) *mA = ina209_from_reg(INA209_CURRENT, samples[2].value);
+}
+
 static void update_raw_telemetry(bool force_all_channels) {
+	eps_adc_sample_t samples[EPS_ADC_CHANNEL_COUNT];
 	eps_adc_channel_t channel_id;
-	float new_value;
-	retval_t rv;
+	size_t count = 0, i;
 
-    eps_broken = false;
 	for (channel_id=0;channel_id<ARRAY_COUNT(eps_adc_raw);channel_id++) {
 		if (force_all_channels || eps_is_interesting_adc_channel(channel_id))
-			if (RV_SUCCESS != eps_GetADCRaw(channel_id, &eps_adc_raw[channel_id])) {
-				eps_adc_raw[channel_id] = ADC_INVALID_VALUE;
-				eps_broken = true;
-				cumulative_eps_error_count++;
-			}
-	    }
-
-	improve_battery_voltage_measurement();
-
-	pd_3v3_status = 0xFFFF;
-	(void)ina209_getStatus(ch_ina_pd3v3, &pd_3v3_status);
-	rv = ina209_getBusVoltage(ch_ina_pd3v3, &new_value);
-	if (RV_SUCCESS == rv) pd_3v3_mV = new_value * 1000.0;
-
-	(void)ina209_getCurrent(ch_ina_pd3v3, &pd_3v3_mA);
-
-	pd_5v_status = 0xFFFF;
-	(void)ina209_getStatus(ch_ina_pd5v, &pd_5v_status);
-	rv = ina209_getBusVoltage(ch_ina_pd5v, &new_value);
-	if (RV_SUCCESS == rv) pd_5v_mV = new_value * 1000.0;
+			samples[count++].channel = channel_id;
+	}
 
-	(void)ina209_getCurrent(ch_ina_pd5v, &pd_5v_mA);
+	eps_broken = false;
+	(void)eps_GetADCRawBatch(samples, count);
+	for (i=0;i<count;i++) {
+		if (RV_SUCCESS == samples[i].rv) {
+			eps_adc_raw[samples[i].channel] = samples[i].raw;
+		} else {
+			eps_adc_raw[samples[i].channel] = ADC_INVALID_VALUE;
+			eps_broken = true;
+			cumulative_eps_error_count++;
+		}
+	}
 
-	pd_12v_status = 0xFFFF;
-	(void)ina209_getStatus(ch_ina_pd12v, &pd_12v_status);
-	rv = ina209_getBusVoltage(ch_ina_pd12v, &new_value);
-	if (RV_SUCCESS == rv) pd_12v_mV = new_value * 1000.0;
+	improve_battery_voltage_measurement();
 
-	(void)ina209_getCurrent(ch_ina_pd12v, &pd_12v_mA);
+	update_ina_telemetry(ch_ina_pd3v3, &pd_3v3_status, &pd_3v3_mV, &pd_3v3_mA);
+	update_ina_telemetry(ch_ina_pd5v, &pd_5v_status, &pd_5v_mV, &pd_5v_mA);
+	update_ina_telemetry(ch_ina_pd12v, &pd_12v_status, &pd_12v_mV, &pd_12v_mA);
 }
 
 static void change_mode_according_to_battery_v(subsystem_t *ss) {
@@ -479,6 +484,7 @@ static void POWER_main_task(void *pvParameters) {
 		} else {
 			// No mode change. Tick
 			PLATFORM_ss_is_alive(ss, HEARTBEAT_MAIN_TASK);
+			ss_telemetry_publish(ss);
 
 			switch (mode) {
 			case SM_OFF:
@@ -662,7 +668,7 @@ static retval_t cmd_eps_fast_sample(const subsystem_t *self, frame_t * iframe, f
 	return RV_SUCCESS;
 }
 
-const static ss_command_handler_t subsystem_commands[] = {
+const static ss_command_t subsystem_commands[] = {
 	DECLARE_BASIC_COMMANDS("low_voltage_counter:u16, raw_battery_v:u16:[10.11521 - (raw_battery_v * 0.01185) min: 8.5 max: 6], nice_battery_v:u16:[(nice_battery_v /1000.0) min: 8.5 max: 6], battery_mA:u16:[8380.809 - (battery_mA * 8.20101)], array_1_v:u16:[35.01082 - (array_1_v * 0.03606)], array_1p_mA:u16:[691.3017 - (array_1p_mA * 0.54012)], array_1m_mA:u16:[692.3604 - (array_1m_mA * 0.53886)], array_2_v:u16:[34.5597 - (array_2_v * 0.03538)], array_2p_mA:u16:[694.3171 - (array_2p_mA * 0.54414)], array_2m_mA:u16:[695.4475 - (array_2m_mA * 0.54869)], _3v3_mA:u16:[4623.646 - (_3v3_mA * 5.43512)], _5v_mA:u16:[5262.442 - (_5v_mA * 5.39879)], _12v_mA:u16:[5284.683 - (_12v_mA * 5.40332)]", ""),
 	DECLARE_COMMAND(SS_CMD_POWER_HARD_RESET_SYSTEM, cmd_hard_reset_system, "reset", "Power-cycle the whole system", "", ""),
 	DECLARE_COMMAND(SS_CMD_POWER_EPS_GET_ALL_ADC_RAW, cmd_eps_get_all_adc_raw, "epsGetADC", "Get EPS version, and ADC last reading", "", "version:u16,adc0:u16,adc1:u16,adc2:u16,adc3:u16,adc4:u16,adc5:u16,adc6:u16,adc7:u16,adc8:u16,adc9:u16,adc10:u16,adc11:u16,adc12:u16,adc13:u16,adc14:u16,adc15:u16,adc16:u16,adc17:u16,adc18:u16,adc19:u16,adc20:u16,adc21:u16,adc22:u16,adc23:u16,adc24:u16,adc25:u16,adc26:u16,adc27:u16,adc28:u16,adc29:u16,adc30:u16,adc31:u16,status:u16"),
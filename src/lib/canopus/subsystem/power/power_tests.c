@@ -5,6 +5,9 @@
 #include <canopus/drivers/power/ina209.h>
 #include <canopus/board/channels.h>
 
+#include <FreeRTOS.h>
+#include <task.h>
+
 static void test_EPS_BatteryV_in_range(void **s) {
 	uint16_t battery_v_raw;
 	float battery_v;
@@ -19,6 +22,54 @@ static void test_EPS_BatteryV_in_range(void **s) {
 	assert_true(battery_v <= 8.45);
 }
 
+static void test_EPS_ADC_batch(void **s) {
+	eps_adc_sample_t samples[] = {
+		{ .channel = EPS_ADC_BATTERY_v },
+		{ .channel = EPS_ADC_BATTERY_mA },
+		{ .channel = EPS_ADC_BUS_3v3_mA },
+		{ .channel = EPS_ADC_BUS_5v_mA },
+		{ .channel = EPS_ADC_BUS_12v_mA },
+		{ .channel = EPS_ADC_ARRAY_X_v },
+		{ .channel = EPS_ADC_ARRAY_Y_v },
+		{ .channel = EPS_ADC_ARRAY_Z_v },
+		{ .channel = EPS_ADC_BATTERY_C_1 },
+		{ .channel = EPS_ADC_BATTERY_DIRECTION },
+	};
+	eps_adc_sample_t bad = { .channel = EPS_ADC_CHANNEL_COUNT };
+	portTickType before;
+	float battery_v;
+	int i;
+
+	before = xTaskGetTickCount();
+	assert_int_equal(RV_SUCCESS, eps_GetADCRawBatch(samples, ARRAY_COUNT(samples)));
+
+	for (i = 0; i < ARRAY_COUNT(samples); i++) {
+		assert_int_equal(RV_SUCCESS, samples[i].rv);
+		assert_true((portTickType)(samples[i].ticks - before) <= (portTickType)(xTaskGetTickCount() - before));
+		if (i > 0) assert_true((portTickType)(samples[i].ticks - samples[i-1].ticks) < 1000 / portTICK_RATE_MS);
+	}
+
+	battery_v = eps_ADC_convertion(EPS_ADC_BATTERY_v, samples[0].raw);
+	assert_true(battery_v >= 6.35);
+	assert_true(battery_v <= 8.45);
+
+	assert_int_equal(RV_ILLEGAL, eps_GetADCRawBatch(&bad, 1));
+}
+
+static void test_INA_pd3v3_batch(void **s) {
+	ina209_sample_t samples[] = {
+		{ .reg = INA209_CONFIGURATION },
+		{ .reg = INA209_STATUS },
+		{ .reg = INA209_BUS_VOLTAGE },
+		{ .reg = INA209_CURRENT },
+	};
+
+	assert_int_equal(RV_SUCCESS, ina209_init(ch_ina_pd3v3));
+	assert_int_equal(RV_SUCCESS, ina209_readRegisterBatch(ch_ina_pd3v3, samples, ARRAY_COUNT(samples)));
+	assert_int_equal(INA209_CONFIGURATION_DEFAULT, samples[0].value);
+	assert_int_equal(RV_SUCCESS, samples[3].rv);
+}
+
 static void test_EPS_firmwareVersionAsExpected(void **s) {
 	uint16_t firmware_version;
 	retval_t rv;
@@ -64,10 +115,12 @@ static void test_INA_pd12v_id(void **s) {
 
 static const UnitTest tests[] = {
     unit_test(test_EPS_BatteryV_in_range),
+    unit_test(test_EPS_ADC_batch),
     unit_test(test_EPS_firmwareVersionAsExpected),
     unit_test(test_INA_pd3v3_id),
     unit_test(test_INA_pd5v_id),
     unit_test(test_INA_pd12v_id),
+    unit_test(test_INA_pd3v3_batch),
 };
 
 const ss_tests_t power_tests = {
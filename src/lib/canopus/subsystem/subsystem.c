@@ -41,7 +41,7 @@ retval_t ss_command_execute(subsystem_t * self, frame_t * iframe, frame_t * ofra
         log_report_fmt(LOG_ALL, "%s: invalid cmd 0x%02x\n", self->config->name, cmd);
         return RV_ILLEGAL;
     }
-	handler = self->config->command_handlers[cmd];
+	handler = SS_COMMAND_HANDLER(self->config->command_handlers[cmd]);
 	if ((NULL == handler) || (INVALID_PTR == handler)) {
         log_report_fmt(LOG_ALL, "%s: no handler for cmd 0x%02x\n", self->config->name, cmd);
         return RV_ILLEGAL;
@@ -76,6 +76,44 @@ retval_t ss_get_telemetry_beacon(const struct subsystem_t *ss, frame_t *oframe,
 	return ss->api->command_execute(ss, &iframe, oframe, seqnum);
 }
 
+/* From the main task of `ss`, takes a snapshot of its beacon telemetry
+ * every SS_TELEMETRY_PERIOD_ms, once the satellite is up */
+void ss_telemetry_publish(const struct subsystem_t *ss) {
+	ss_telemetry_t *t = &ss->state->telemetry;
+	satellite_mode_e mode;
+	frame_t oframe;
+	uint8_t spare;
+
+	mode = PLATFORM_current_satellite_mode();
+	if ((SM_SURVIVAL != mode) && (SM_MISSION != mode) && (SM_LOW_POWER != mode)) return;
+	if (t->taken && ((xTaskGetTickCount() - t->ticks) < SS_TELEMETRY_PERIOD_ms / portTICK_RATE_MS)) return;
+
+	spare = !t->current;
+	oframe = (frame_t)DECLARE_FRAME(t->data[spare]);
+	if (RV_SUCCESS != ss_get_telemetry_beacon(ss, &oframe, CDH_SEQUENCE_NUMBER_BEACON)) return;
+
+	taskENTER_CRITICAL();
+	t->size[spare] = oframe.position;
+	t->current = spare;
+	t->ticks = xTaskGetTickCount();
+	t->taken = true;
+	taskEXIT_CRITICAL();
+}
+
+/* Puts the latest snapshot of `ss` in `oframe`, RV_NOENT if there's none */
+retval_t ss_telemetry_snapshot(const struct subsystem_t *ss, frame_t *oframe, uint32_t *age_ms) {
+	const ss_telemetry_t *t = &ss->state->telemetry;
+	retval_t rv = RV_NOENT;
+
+	taskENTER_CRITICAL();
+	if (t->taken) {
+		*age_ms = (xTaskGetTickCount() - t->ticks) * portTICK_RATE_MS;
+		rv = frame_put_data(oframe, t->data[t->current], t->size[t->current]);
+	}
+	taskEXIT_CRITICAL();
+	return rv;
+}
+
 retval_t ss_get_telemetry_beacon_short(const struct subsystem_t *ss, frame_t *oframe, uint32_t seqnum) {
 	frame_t iframe = DECLARE_FRAME_BYTES(SS_CMD_GET_TELEMETRY_BEACON_SHORT);
 
@@ -34,6 +34,7 @@ static void TEST_main_task(void *pvParameters) {
 		} else {
 			// No mode change. Tick
 			PLATFORM_ss_is_alive(ss, HEARTBEAT_MAIN_TASK);
+			ss_telemetry_publish(ss);
 
 	    	switch (mode) {
 			case SM_OFF:
@@ -62,7 +63,7 @@ static retval_t cmd_get_telemetry_beacon_ascii(const subsystem_t *self, frame_t
     return RV_SUCCESS;
 }
 
-const static ss_command_handler_t subsystem_commands[] = {
+const static ss_command_t subsystem_commands[] = {
 	DECLARE_BASIC_COMMANDS("", ""),
 	DECLARE_COMMAND(SS_CMD_SS_START, cmd_get_telemetry_beacon, "no_cmd", "", "", ""),
 };
@@ -81,6 +82,7 @@ static subsystem_config_t subsystem_config = {
     .name = "TEST",
     .tests = &test_tests,
     DECLARE_COMMAND_HANDLERS(subsystem_commands),
+    .mode_change_timeout_ms = 1000, /* acknowledges as soon as it's told */
 };
 
 static subsystem_state_t subsystem_state;
@@ -167,6 +167,7 @@ static void THERMAL_main_task(void *pvParameters) {
 			PLATFORM_ss_is_ready(ss);
 		}
 		PLATFORM_ss_is_alive(ss, HEARTBEAT_MAIN_TASK);
+		ss_telemetry_publish(ss);
 	}
 }
 
@@ -240,7 +241,7 @@ static retval_t cmd_get_status(const subsystem_t *self, frame_t * iframe, frame_
 	return frame_put_u32(oframe, nvram.thermal.matrix_disable_key);
 }
 
-const static ss_command_handler_t subsystem_commands[] = {
+const static ss_command_t subsystem_commands[] = {
 	DECLARE_BASIC_COMMANDS("battery_C:s16:[battery_C / 100.0], radio_temp:s16:[radio_temp/100.0]", "battery_temp:u8"),
 	DECLARE_COMMAND(SS_CMD_THERMAL_SET_MATRIX_KEY, cmd_set_matrix_key, "setMatrix", "Set Thermal matrix disable key <secret key>", "key:u32", ""),
 	DECLARE_COMMAND(SS_CMD_THERMAL_GET_STATUS, cmd_get_status, "status", "Return values for all temperature sensors", "", "structure_C:s16:[structure_C/100.0], panel_Ym_Outer_C:s16:[panel_Ym_Outer_C/100.0], camera_board_C:s16:[camera_board_C/100.0], Electronics_C:s16:[Electronics_C/100.0], camera_housing_C:s16:[camera_housing_C/100.0], SVIP_C:s16:[SVIP_C/100.0], panel_Xp_Inner_C:s16:[panel_Xp_Inner_C/100.0], panel_Xp_Outer_C:s16:[panel_Xp_Outer_C/100.0], radio_C:s16:[radio_C/100.0], battery_C:s16:[battery_C/100.0], IMU_C:s16:[IMU_C/100.0], Overo_C:s16:[Overo_C/100.0], TMS_C:s16:[TMS_C/100.0], TMS_Reg_C:s16:[TMS_Reg_C/100.0], matrixKey:u32"),